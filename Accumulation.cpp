@@ -0,0 +1,39 @@
+#include "Accumulation.hpp"
+#include <fstream>
+#include <cstring>
+
+static const char AccumulationMagic[8] = { 'R', 'T', 'A', 'C', 'C', '0', '0', '1' };
+
+bool PartialAccumulation::Save(const std::string& path) const {
+    std::ofstream os(path, std::ios::binary | std::ios::trunc);
+    if (!os)
+        return false;
+    int32_t header[7] = { width, height, sppBegin, sppEnd, yBegin, yEnd, light.empty() ? 0 : 1 };
+    os.write(AccumulationMagic, sizeof(AccumulationMagic));
+    os.write(reinterpret_cast<const char*>(header), sizeof(header));
+    os.write(reinterpret_cast<const char*>(camera.data()), camera.size() * sizeof(AccumPixel));
+    os.write(reinterpret_cast<const char*>(light.data()), light.size() * sizeof(AccumPixel));
+    return (bool)os;
+}
+
+bool PartialAccumulation::Load(const std::string& path) {
+    std::ifstream is(path, std::ios::binary);
+    if (!is)
+        return false;
+    char magic[sizeof(AccumulationMagic)];
+    int32_t header[7];
+    is.read(magic, sizeof(magic));
+    is.read(reinterpret_cast<char*>(header), sizeof(header));
+    if (!is || std::memcmp(magic, AccumulationMagic, sizeof(magic)) != 0)
+        return false;
+    width = header[0]; height = header[1];
+    sppBegin = header[2]; sppEnd = header[3];
+    yBegin = header[4]; yEnd = header[5];
+    if (width <= 0 || height <= 0 || yBegin < 0 || yEnd > height || yBegin > yEnd)
+        return false;
+    camera.resize((size_t)(yEnd - yBegin) * width);
+    light.resize(header[6] ? (size_t)width * height : 0);
+    is.read(reinterpret_cast<char*>(camera.data()), camera.size() * sizeof(AccumPixel));
+    is.read(reinterpret_cast<char*>(light.data()), light.size() * sizeof(AccumPixel));
+    return (bool)is;
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <cstdint>
+#include <cmath>
+#include <string>
+#include <vector>
+#include "Vector.hpp"
+
+/*
+Radiance accumulation in 40.24 fixed point.
+
+Float addition is not associative, so summing the same samples in a different order(another thread count, another process split)
+gives a slightly different image. Integer addition is, so every sample is rounded to fixed point once, and from then on
+any partition of the samples across threads, tiles or processes sums to exactly the same bits.
+
+2^-24 resolution per sample is well below what a float framebuffer keeps for values around 1.0 anyway.
+*/
+#define ACCUMULATION_FRACTION_BITS 24
+#define ACCUMULATION_MAX_SAMPLE 1e9f
+
+struct AccumPixel {
+    int64_t v[3] = { 0, 0, 0 };
+
+    static inline int64_t ToFixed(float f) {
+        if (!std::isfinite(f))      //A nan sample would poison the whole pixel, drop it.
+            return 0;
+        f = std::max(-ACCUMULATION_MAX_SAMPLE, std::min(ACCUMULATION_MAX_SAMPLE, f));
+        return std::llround((double)f * (double)(1ll << ACCUMULATION_FRACTION_BITS));
+    }
+
+    inline void Add(const Vector3f& c) {
+        v[0] += ToFixed(c.x);
+        v[1] += ToFixed(c.y);
+        v[2] += ToFixed(c.z);
+    }
+
+    inline void Set(const Vector3f& c) {
+        v[0] = ToFixed(c.x);
+        v[1] = ToFixed(c.y);
+        v[2] = ToFixed(c.z);
+    }
+
+    inline AccumPixel& operator+=(const AccumPixel& o) {
+        v[0] += o.v[0]; v[1] += o.v[1]; v[2] += o.v[2];
+        return *this;
+    }
+
+    /*Average over sampleCount samples.*/
+    inline Vector3f Resolve(int sampleCount) const {
+        double scale = 1.0 / (double)(1ll << ACCUMULATION_FRACTION_BITS) / std::max(1, sampleCount);
+        return Vector3f((float)(v[0] * scale), (float)(v[1] * scale), (float)(v[2] * scale));
+    }
+};
+
+using AccumBuffer = std::vector<AccumPixel>;
+
+/*
+Partial result of a render job, written by one process and merged by another.
+Camera pass only covers rows [yBegin, yEnd), light pass(BDPT light tracing splats) always covers the whole image.
+*/
+struct PartialAccumulation {
+    int width = 0, height = 0;
+    int sppBegin = 0, sppEnd = 0;
+    int yBegin = 0, yEnd = 0;
+    AccumBuffer camera;
+    AccumBuffer light;      //Empty if the job didn't trace light paths.
+
+    bool Save(const std::string& path) const;
+    bool Load(const std::string& path);
+};
@@ -0,0 +1,48 @@
+#include "AliasTable.hpp"
+#include <algorithm>
+
+void AliasTable::Build(const std::vector<float>& weights) {
+    buckets.clear();
+    pmfs.clear();
+    double sum = 0.0;
+    for (float w : weights)
+        sum += std::max(0.0f, w);
+    if (sum <= 0.0)
+        return;
+
+    int n = (int)weights.size();
+    pmfs.resize(n);
+    buckets.resize(n);
+    std::vector<double> scaled(n);
+    std::vector<int> small, large;
+    for (int i = 0; i < n; i++) {
+        pmfs[i] = (float)(std::max(0.0f, weights[i]) / sum);
+        scaled[i] = std::max(0.0f, weights[i]) / sum * n;
+        (scaled[i] < 1.0 ? small : large).push_back(i);
+    }
+
+    //Fill every under-full bucket from an over-full one.
+    while (!small.empty() && !large.empty()) {
+        int s = small.back(); small.pop_back();
+        int l = large.back(); large.pop_back();
+        buckets[s] = { (float)scaled[s], l };
+        scaled[l] -= 1.0 - scaled[s];
+        (scaled[l] < 1.0 ? small : large).push_back(l);
+    }
+    //Whatever is left is full, up to rounding.
+    for (int i : small)
+        buckets[i] = { 1.0f, i };
+    for (int i : large)
+        buckets[i] = { 1.0f, i };
+}
+
+int AliasTable::Sample(float u, float* pmf) const {
+    int n = (int)buckets.size();
+    float scaled = u * n;
+    int i = std::min(n - 1, (int)scaled);
+    float remainder = scaled - i;
+    int result = remainder < buckets[i].threshold ? i : buckets[i].alias;
+    if (pmf)
+        *pmf = pmfs[result];
+    return result;
+}
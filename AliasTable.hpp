@@ -0,0 +1,28 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+
+/*
+Walker's alias method: O(1) sampling of a discrete distribution, after O(n) build.
+Every bucket holds its own index with probability threshold, and alias otherwise.
+*/
+class AliasTable {
+public:
+    /*Weights needn't be normalized. All zero(or empty) gives an empty table.*/
+    void Build(const std::vector<float>& weights);
+
+    /*u in [0,1). Returns the index, and its probability in pmf if given.*/
+    int Sample(float u, float* pmf = nullptr) const;
+
+    inline float Pmf(int index) const { return pmfs[index]; }
+    inline int Size() const { return (int)pmfs.size(); }
+    inline bool Empty() const { return pmfs.empty(); }
+
+private:
+    struct Bucket {
+        float threshold;
+        int alias;
+    };
+    std::vector<Bucket> buckets;
+    std::vector<float> pmfs;
+};
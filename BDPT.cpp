@@ -3,16 +3,15 @@
 #include "BDPT.hpp"
 #include "SampleHelperFunctions.hpp"
 #include "SceneRenderingHelper.hpp"
+#include "RayStats.hpp"
+#include "Sampler.hpp"
 
+//Area pdf of the camera position. A pinhole is a dirac, light paths never hit it, so strategies ending there weigh nothing.
 #define CAMERA_ZERO_PDF (10000000000.0)    
-#define CAMERA_RAY_PDF (10.0)    
-//Notes here:
-//This is a magic number, indicating the PDF of a single ray coming out of camera.
-//Since there's always only exact 1 ray coming out of camera, this should be a dirac function.
-//But I'm not sure if this is correct. When I make it huge, it's closer to Path Tracing looking, but the caustic effect is not apparent.(Cause the s_n_t_0 path is less important according to MIS formula)  
-//And when it's less, the image is just not correct. I'm confused right now.
+//Directions from the camera take the pinhole's importance and pdf, see CameraWe and CameraPdfWe.
 
-//current value 10.0f is the one that I feel correct and low variance.  
+//Probability of keeping vertex index of a subpath. Sampling(FillPathUsingRussianRoulette, Append) and the MIS weights must agree.
+static inline float RussianRouletteProb(int index) { return index > 4 ? RUSSIAN_ROULETTE : 1.f; }
 
 PTVertex PTVertex::Camera(Vector3f cameraPos) {
     PTVertex v;
@@ -38,7 +37,7 @@ PathVertex BDPTPath::GetVertex(int i) const {
     return PathVertex(this, i);
 }
 
-inline void BDPTPath::GenerateCameraPath(Ray cameraRay) {
+void BDPTPath::GenerateCameraPath(const RayDifferential& cameraRay) {
     verts[0].vertex = PTVertex::Camera(cameraRay.origin);
     verts[0].pdf = CAMERA_ZERO_PDF;
     verts[0].alpha = 1.0f;
@@ -47,7 +46,7 @@ inline void BDPTPath::GenerateCameraPath(Ray cameraRay) {
     verts[1].vertex = scene->Intersect(cameraRay);
     float distSqr;
     Vector3f atob = (verts[0].vertex.x - verts[1].vertex.x).NormlizeAndGetLengthSqr(&distSqr);
-    verts[1].pdf = SrpdfToAreaPdf(CAMERA_RAY_PDF, verts[0].vertex, verts[1].vertex);
+    verts[1].pdf = SrpdfToAreaPdf(CameraPdfWe(scene, cameraRay.direction), verts[0].vertex, verts[1].vertex);
     verts[1].alpha = Vector3f::One();
     verts[1].shadowed = false;
 
@@ -55,30 +54,41 @@ inline void BDPTPath::GenerateCameraPath(Ray cameraRay) {
         count = 2;
         return;
     }
-    FillPathUsingRussianRoulette(1);
+    FillPathUsingRussianRoulette(1, 0);
 }
 
-void BDPTPath::GenerateLightPath(Object* lightObj) {
+void BDPTPath::GenerateLightPath() {
+    //Emitter picked by power, pdf is per area over all emitters.
     Intersection t;
-    lightObj->Sample(t);
+    float pdf0;
+    SetSampleDimension(BounceDimension(MAX_BDPT_PATH_LENGTH, SAMPLE_LIGHT_OFFSET));
+    if (!scene->SampleEmitter(t, &pdf0) || pdf0 == 0.0f) {
+        count = 0;
+        return;
+    }
     verts[0].vertex.x = t.coords;
     verts[0].vertex.type = PTVertex::Type::Light;
     verts[0].vertex.obj = t.obj;
     verts[0].vertex.N = t.normal;
+    verts[0].vertex.Ng = t.normal;
     verts[0].shadowed = false;
-    verts[0].pdf = lightObj->pdf();
+    verts[0].pdf = pdf0;
 
-    verts[0].alpha = lightObj->m->m_emission / verts[0].pdf;
+    verts[0].alpha = t.obj->m->m_emission / verts[0].pdf;
     
     float pdf1;
+    SetSampleDimension(BounceDimension(MAX_BDPT_PATH_LENGTH, SAMPLE_BSDF_OFFSET));
     Vector3f w_i = GetCosineWeightedSample(t.normal, pdf1);
 
     float costheta = DotProduct(verts[0].vertex.N, w_i);
     pdf1 = SafeDivide(pdf1, costheta);
 
-    verts[1].vertex = scene->Intersect(Ray(verts[0].vertex.x, w_i));
+    verts[1].vertex = scene->Intersect(Ray(OffsetRayOrigin(verts[0].vertex.x, t.normal, w_i), w_i));
     verts[1].shadowed = false;
     verts[1].pdf = SrpdfToAreaPdf(pdf1, verts[0].vertex, verts[1].vertex);
+    //From the positions, as FillPathUsingRussianRoulette does.
+    if (verts[1].vertex.type != PTVertex::Type::Background)
+        verts[1].pdf = AreaPdf(scene, nullptr, verts[0].vertex, verts[1].vertex);
 
     if (pdf1 != 0.0f)
         verts[1].alpha = SafeDivide(verts[0].alpha, pdf1);
@@ -86,10 +96,10 @@ void BDPTPath::GenerateLightPath(Object* lightObj) {
         count = 2;
         return;
     }
-    FillPathUsingRussianRoulette(1);
+    FillPathUsingRussianRoulette(1, MAX_BDPT_PATH_LENGTH);
 }
 
-void BDPTPath::FillPathUsingRussianRoulette(int start) {
+void BDPTPath::FillPathUsingRussianRoulette(int start, int firstBounce) {
     count = start + 1;
 
     for (int i = start; i < MAX_BDPT_PATH_LENGTH - 1; i++) {
@@ -100,18 +110,27 @@ void BDPTPath::FillPathUsingRussianRoulette(int start) {
         auto mat = verts[i].vertex.obj->m;
         
         Vector3f bsdf;
+        SetSampleDimension(BounceDimension(firstBounce + i, SAMPLE_BSDF_OFFSET));
         verts[i + 1] = SampleNextVertex(scene, verts[i], w_o);
         
-        float rrProb = i > 4 ? .8f : 1.f;
+        float rrProb = RussianRouletteProb(i + 1);
+        SetSampleDimension(BounceDimension(firstBounce + i, SAMPLE_RR_OFFSET));
         if (GetRandomFloat() > rrProb) {
+            RENDER_COUNT(rouletteTerminated, 1);
             break;
         }
         
         if (verts[i + 1].pdf == 0.0f)
             break;
 
+        //MIS takes the pdf of the vertex positions, the way the other strategies evaluate it(AreaPdf), not of the sampled direction.
+        //The ray starts off an offset origin, which behind a near mirror is enough to change the pdf several times over.
+        if (verts[i + 1].vertex.type != PTVertex::Type::Background)
+            verts[i + 1].pdf = AreaPdf(scene, &verts[i - 1].vertex, verts[i].vertex, verts[i + 1].vertex);
         verts[i + 1].pdf *= rrProb;
         verts[i + 1].alpha = verts[i].alpha * verts[i + 1].alpha / rrProb;
+        if (verts[i + 1].vertex.type != PTVertex::Type::Background)
+            verts[i - 1].pdfRev = AreaPdf(scene, &verts[i + 1].vertex, verts[i].vertex, verts[i - 1].vertex);
 
         count++;
     }
@@ -129,7 +148,7 @@ BDPTPath& BDPTPath::Append(PTVertex vertex, bool dontcheckshadow) {
         assert(vertex.type == PTVertex::Type::Camera || vertex.type == PTVertex::Type::Light);
         verts[0].vertex = vertex;
         verts[0].shadowed = false;
-        verts[0].pdf = vertex.obj->pdf();
+        verts[0].pdf = vertex.type == PTVertex::Type::Light ? scene->EmitterPdf(vertex.obj) : CAMERA_ZERO_PDF;
         if (vertex.type == PTVertex::Type::Light)
             verts[0].alpha = vertex.obj->m->m_emission/ verts[0].pdf;
         else
@@ -138,7 +157,7 @@ BDPTPath& BDPTPath::Append(PTVertex vertex, bool dontcheckshadow) {
         return *this;
     }
 
-    auto& lastVertex = this->operator[](count - 1);
+    auto lastVertex = this->operator[](count - 1);
     assert(lastVertex.Type() != PTVertex::Type::Background);
 
     auto& editVertex = verts[count];
@@ -159,19 +178,21 @@ BDPTPath& BDPTPath::Append(PTVertex vertex, bool dontcheckshadow) {
         Vector3f alpha = SafeDivide(lastVertex.EvalBsdfOnSolidAngle(w_i), srpdf);
         editVertex.alpha = lastVertex.Throughput() * alpha;
 
-        float rrProb = count > 4 ? .8f : 1.f;
-        //rrProb = std::min(rrProb, 1.0f);
+        float rrProb = RussianRouletteProb(count);
         editVertex.pdf *= rrProb;
         editVertex.alpha = SafeDivide(editVertex.alpha, rrProb);
     }
+    if (count >= 2 && vertex.type != PTVertex::Type::Background)
+        verts[count - 2].pdfRev = AreaPdf(scene, &verts[count].vertex, verts[count - 1].vertex, verts[count - 2].vertex);
 
     count++;
 
     return *this;
 }
 
-Vector3f BDPTPath::PathWeight(const BDPTPathView& lightPath, const BDPTPathView& camPath) {
+Vector3f BDPTPath::PathWeight(const BDPTPathView& lightPath, const BDPTPathView& camPath, const MisCounts& counts) {
     auto scene = lightPath.path->scene;
+    RENDER_COUNT(bdptStrategies, 1);
     assert(lightPath.count == 0 || lightPath.path->verts[0].vertex.type == PTVertex::Type::Light);
     assert(camPath.count >= 1 && camPath.path->verts[0].vertex.type == PTVertex::Type::Camera);
     assert(lightPath.count + camPath.count >= 2);
@@ -191,9 +212,10 @@ Vector3f BDPTPath::PathWeight(const BDPTPathView& lightPath, const BDPTPathView&
     if (lightPath.count == 0) {
         auto z2 = camPath.Last().Pre();
         Vector3f w_i = (z2.Position() - z1.Position()).Normalized();
-        c_st = z1.Emission() * DotProduct(z1.Normal(), w_i) ;
-        if (DotProduct(z1.Emission(), z1.Emission()) == 0.0f)
+        //Radiance, the camera throughput has the cosines already. Lights are one sided.
+        if (DotProduct(z1.Emission(), z1.Emission()) == 0.0f || DotProduct(z1.Normal(), w_i) <= 0.0f)
             return 0.0f;
+        c_st = z1.Emission();
     }
     else if (camPath.count == 0) {
         return 0.0f;
@@ -209,53 +231,110 @@ Vector3f BDPTPath::PathWeight(const BDPTPathView& lightPath, const BDPTPathView&
         c_st =
             lightLast.EvalBsdfOnSolidAngle(dir_ltoc)
             * camLast.EvalBsdfOnSolidAngle(-dir_ltoc)
-            * abs(
+            * std::abs(
                 DotProduct(lightLast.Normal(), dir_ltoc)
                * DotProduct(camLast.Normal(), -dir_ltoc)
                 / distSqr
                 );
     }
 
-    //Calculate mis weight.
-    float weightdenominator = 1.0f;
-    
-    //Copy a camera path to append those light verticies.
-    BDPTPath temp = camPath.path->Copy(camPath.count);
-    float cur_pdf = 1.0f;
-
-    for (int i = lightPath.count - 1; i >= 0; i--) {
-        temp.Append(lightPath[i].Vertex(), true);
-        float pdf = temp[temp.count - 1].Pdf();
-        cur_pdf *= SafeDivide(pdf, lightPath[i].Pdf());
-        weightdenominator += cur_pdf * cur_pdf;
+    const int s = lightPath.count, t = camPath.count;
+    float weight = ConnectionWeight(scene, lightPath.path->verts, s, camPath.path->verts, t, counts);
+
+    Vector3f lightThroughput = lightPath.count == 0 ? 1.0f : lightPath.Last().Throughput();
+
+    Vector3f unweightedC = lightThroughput * camPath.Last().Throughput() * c_st;
+    return unweightedC * weight / StrategyCount(counts, s, t);
+}
+
+float BDPTPath::ConnectionWeight(const Scene* scene, const InternalPathVertex* lv, int s, const InternalPathVertex* cv, int t, const MisCounts& counts) {
+    const float count = StrategyCount(counts, s, t);
+    float denominator = 1.0f;
+    LightSideRatios(scene, lv, s, cv, t, 1.0f, counts, count, denominator);
+    CameraSideRatios(scene, lv, s, cv, t, 1.0f, counts, count, denominator);
+    return 1.0f / denominator;
+}
+
+//Calculate mis weight.
+//Walk outward from the connection, turning one vertex at a time into the other subpath. Each step multiplies the pdf ratio
+//of the moved vertex, pdf as the other side would sample it over pdf it was really sampled with.
+//A vertex would get russian roulette on the other side at its index there, see RussianRouletteProb.
+//Each term is also scaled by how many samples its strategy gets, relative to the one being weighted(currentCount).
+//With merging, every vertex passed could also have been merged at: sampled from both sides, found within the merge radius.
+
+float BDPTPath::StrategyCount(const MisCounts& counts, int s, int t) {
+    return s >= 2 && t >= 2 ? counts.connection : 1.0f;
+}
+
+bool BDPTPath::CanMerge(const PTVertex& v) {
+    return v.type == PTVertex::Type::Intermediate && !v.obj->m->IsNearSpecular();
+}
+
+void BDPTPath::LightSideRatios(const Scene* scene, const InternalPathVertex* lv, int s, const InternalPathVertex* cv, int t, float cur_pdf, const MisCounts& counts, float currentCount, float& denominator) {
+    //Light vertices, as if sampled by extending the camera path.
+    for (int i = s - 1; i >= 0; i--) {
+        float pdf;
+        if (i == s - 1)
+            pdf = AreaPdf(scene, t >= 2 ? &cv[t - 2].vertex : nullptr, cv[t - 1].vertex, lv[i].vertex);
+        else if (i == s - 2)
+            pdf = AreaPdf(scene, &cv[t - 1].vertex, lv[s - 1].vertex, lv[i].vertex);
+        else
+            pdf = lv[i].pdfRev;
+        pdf *= RussianRouletteProb(t + (s - 1 - i));
+        cur_pdf *= SafeDivide(pdf, lv[i].pdf);
+        float ratio = cur_pdf * StrategyCount(counts, i, t + (s - i)) / currentCount;
+        denominator += ratio * ratio;
+        if (counts.merge > 0.0f && i >= 1 && CanMerge(lv[i].vertex)) {
+            float mergeRatio = cur_pdf * lv[i].pdf * counts.merge / currentCount;
+            denominator += mergeRatio * mergeRatio;
+        }
         if (cur_pdf == 0.0f)
             break;
     }
+}
 
-    temp = lightPath.path->Copy(lightPath.count);
-    cur_pdf = 1.0f;
-    for (int i = camPath.count - 1; i >= 0; i--) {
-        if (temp.count == 0) {
-            assert(DotProduct(camPath[i].Emission(), camPath[i].Emission()) != 0.0f);
-            auto toAppend = camPath[i].Vertex();
-            toAppend.type = PTVertex::Type::Light;
-            temp.Append(toAppend, true);
+void BDPTPath::CameraSideRatios(const Scene* scene, const InternalPathVertex* lv, int s, const InternalPathVertex* cv, int t, float cur_pdf, const MisCounts& counts, float currentCount, float& denominator) {
+    //Camera vertices, as if sampled by extending the light path.
+    for (int i = t - 1; i >= 0; i--) {
+        float pdf;
+        if (s == 0 && i == t - 1) {
+            //The camera path hit a light, which as a light path would be picked and sampled on its surface.
+            assert(cv[i].vertex.obj->m->hasEmission());
+            pdf = scene->EmitterPdf(cv[i].vertex.obj);
         }
         else {
-            temp.Append(camPath[i].Vertex(), true);
+            if (i == t - 1) {
+                pdf = AreaPdf(scene, s >= 2 ? &lv[s - 2].vertex : nullptr, lv[s - 1].vertex, cv[i].vertex);
+            }
+            else if (i == t - 2) {
+                PTVertex from = cv[t - 1].vertex;
+                if (s == 0)
+                    from.type = PTVertex::Type::Light;
+                pdf = AreaPdf(scene, s >= 1 ? &lv[s - 1].vertex : nullptr, from, cv[i].vertex);
+            }
+            else {
+                pdf = cv[i].pdfRev;
+            }
+            pdf *= RussianRouletteProb(s + (t - 1 - i));
+        }
+        cur_pdf *= SafeDivide(pdf, cv[i].pdf);
+        float ratio = cur_pdf * StrategyCount(counts, s + (t - i), i) / currentCount;
+        denominator += ratio * ratio;
+        if (counts.merge > 0.0f && i >= 1 && i <= s + t - 2 && CanMerge(cv[i].vertex)) {
+            float mergeRatio = cur_pdf * cv[i].pdf * counts.merge / currentCount;
+            denominator += mergeRatio * mergeRatio;
         }
-
-        float pdf = temp[temp.count - 1].Pdf();
-        cur_pdf *= SafeDivide(pdf, camPath[i].Pdf());
-        weightdenominator += cur_pdf * cur_pdf;
         if (cur_pdf == 0.0f)
             break;
     }
+}
 
-    Vector3f lightThroughput = lightPath.count == 0 ? 1.0f : lightPath.Last().Throughput();
-
-    Vector3f unweightedC = lightThroughput * camPath.Last().Throughput() * c_st;
-    return unweightedC / weightdenominator;
+float BDPTPath::MergeWeight(const Scene* scene, const InternalPathVertex* lv, int s, const InternalPathVertex* cv, int t, const MisCounts& counts) {
+    assert(s >= 2 && t >= 2);
+    //The path through the photon lv[s-1], relative to connecting it to cv[t-2]: the merge also samples lv[s-1] from the camera side.
+    float pdf = AreaPdf(scene, t >= 3 ? &cv[t - 3].vertex : nullptr, cv[t - 2].vertex, lv[s - 1].vertex) * RussianRouletteProb(t - 1);
+    float ratio = pdf * counts.merge / StrategyCount(counts, s, t - 1);
+    return ratio * ratio * ConnectionWeight(scene, lv, s, cv, t - 1, counts);
 }
 
 BDPTPath::InternalPathVertex  BDPTPath::SampleNextVertex(const Scene* scene, const InternalPathVertex& vertex, Vector3f w_o) {
@@ -263,11 +342,14 @@ BDPTPath::InternalPathVertex  BDPTPath::SampleNextVertex(const Scene* scene, con
     assert(vertex.vertex.type != PTVertex::Type::Background);
 
     float rawpdf;
-    auto w_i = vertex.vertex.obj->m->sample(w_o, vertex.vertex.N, &rawpdf);
-    float costheta = abs(DotProduct(vertex.vertex.N, w_i));
+    auto w_i = vertex.vertex.obj->m->sample(w_o, vertex.vertex.N, &rawpdf, vertex.vertex.Texels());
+    if (!vertex.vertex.ScattersOnSurface(w_o, w_i))
+        rawpdf = 0.0f;
+    const Vector3f& ng = vertex.vertex.Ng;
+    float costheta = std::abs(DotProduct(ng, w_i));
     float srpdf = SafeDivide(rawpdf, costheta);
-    auto intersection = scene->Intersect(Ray(vertex.vertex.x, w_i), DotProduct(vertex.vertex.N, w_i) > 0.0f ? FaceCulling::CullBack : FaceCulling::CullFront);
-    Vector3f bsdf = vertex.vertex.obj->m->evalGivenSample(w_o, w_i, vertex.vertex.N, false);
+    auto intersection = scene->Intersect(Ray(OffsetRayOrigin(vertex.vertex.x, ng, w_i), w_i), DotProduct(ng, w_i) > 0.0f ? FaceCulling::CullBack : FaceCulling::CullFront);
+    Vector3f bsdf = vertex.vertex.obj->m->evalGivenSample(w_o, w_i, vertex.vertex.N, false, vertex.vertex.Texels());
 
     BDPTPath::InternalPathVertex result;
     result.shadowed = false;
@@ -279,12 +361,12 @@ BDPTPath::InternalPathVertex  BDPTPath::SampleNextVertex(const Scene* scene, con
 }
 
 
-Vector3f BDPT(const Scene* scene, const Ray& ray, int& outBounces, Vector3f* emissionBuffer)
+Vector3f BDPT(const Scene* scene, const RayDifferential& ray, int& outBounces, AccumPixel* emissionBuffer, std::vector<LightSplat>* lightSplats)
 {
     outBounces = 0;
-    auto lightPath = BDPTPath::BDPTPath(scene), camPath = BDPTPath::BDPTPath(scene);
+    BDPTPath lightPath(scene), camPath(scene);
     camPath.GenerateCameraPath(ray);
-    lightPath.GenerateLightPath(scene->m_emissionObjects[0]);
+    lightPath.GenerateLightPath();
     outBounces += camPath.count + lightPath.count;
     Vector3f result;
     for (int iCamPathLength = 1; iCamPathLength <= camPath.count; iCamPathLength++) {
@@ -302,7 +384,10 @@ Vector3f BDPT(const Scene* scene, const Ray& ray, int& outBounces, Vector3f* emi
                 result += pathWeight;
             }
             else {
-                if (emissionBuffer != nullptr) {
+                if (lightSplats != nullptr) {
+                    lightSplats->push_back({ lightSub[iLightPathLength - 1].Position(), pathWeight });
+                }
+                else if (emissionBuffer != nullptr) {
                     auto light = lightSub[iLightPathLength - 1].Position();
                     auto cam = camSub[0].Position();
                     auto lightRayHitCamera = (light - cam).Normalized();
@@ -321,35 +406,64 @@ Vector3f PathVertex::EvalBsdfOnSolidAngle(Vector3f dir) {
         return 1.0f;
     }
     else if (Type() == PTVertex::Type::Camera) {
-        return 1.0f;
+        return CameraWe(path->scene, dir);
     }
     else {
         assert(index >= 1);
-        return Material()->evalGivenSample((Pre().Position() - Position()).Normalized(), dir, Normal(), false);
+        return Material()->evalGivenSample((Pre().Position() - Position()).Normalized(), dir, ShadingNormal(), false, Texels());
     }
 }
 
 float PathVertex::EvalPdfOnSolidAngle(Vector3f dir) {
 	assert(Type() != PTVertex::Type::Background);
-    float cosine = abs(DotProduct(dir, Normal()));
+    float cosine = std::abs(DotProduct(dir, Normal()));
 
 	if (Type() == PTVertex::Type::Light) {
 		return SafeDivide(GetCosineWeightedPdf(Normal(), dir), cosine);
 	}
 	else if (Type() == PTVertex::Type::Camera) {
-        return  CAMERA_RAY_PDF;
+        return CameraPdfWe(path->scene, dir);
 	}
 	else {
 		if (cosine == 0.0f)
 			return 0.0f;
 		Vector3f wo = (Pre().Position() - Position()).Normalized();
+		if (!Vertex().ScattersOnSurface(wo, dir))
+			return 0.0f;
 		return SafeDivide(Material()->pdf(
 			wo,
-			Normal(),
-			dir), cosine);
+			ShadingNormal(),
+			dir, Texels()), cosine);
 	}
 }
 
+float BDPTPath::AreaPdf(const Scene* scene, const PTVertex* pre, const PTVertex& from, const PTVertex& to) {
+    //Mirrors PathVertex::EvalPdfOnSolidAngle, so stored and evaluated pdfs match Append() bit for bit.
+    assert(from.type != PTVertex::Type::Background);
+    float distSqr;
+    Vector3f dir = (to.x - from.x).NormlizeAndGetLengthSqr(&distSqr);
+    Vector3f normal = from.type == PTVertex::Type::Camera ? Vector3f(0.0f, 0.0f, 1.0f) : from.Ng;
+    float cosine = std::abs(DotProduct(dir, normal));
+
+    float srpdf;
+    if (from.type == PTVertex::Type::Light) {
+        srpdf = SafeDivide(GetCosineWeightedPdf(normal, dir), cosine);
+    }
+    else if (from.type == PTVertex::Type::Camera) {
+        srpdf = CameraPdfWe(scene, dir);
+    }
+    else {
+        if (cosine == 0.0f)
+            return SrpdfToAreaPdf(0.0f, from, to);
+        assert(pre != nullptr);
+        Vector3f wo = (pre->x - from.x).Normalized();
+        if (!from.ScattersOnSurface(wo, dir))
+            return SrpdfToAreaPdf(0.0f, from, to);
+        srpdf = SafeDivide(from.obj->m->pdf(wo, from.N, dir, from.Texels()), cosine);
+    }
+    return SrpdfToAreaPdf(srpdf, from, to);
+}
+
 float PathVertex::EvalPdfOnAreaSurface(const Scene* scene, PTVertex v) {
     float distSqr;
     Vector3f w_i = (v.x - Position()).NormlizeAndGetLengthSqr(&distSqr);
@@ -374,6 +488,6 @@ Vector3f PathVertex::Sample(float* pdf) {
 	}
 	else {
 		Vector3f w_o = (Pre().Position() - Position()).Normalized();
-		return Material()->sample(w_o, Normal(), pdf);
+		return Material()->sample(w_o, ShadingNormal(), pdf, Texels());
 	}
 }
@@ -4,6 +4,7 @@
 #include <cassert>
 #include "PTVertex.hpp"
 #include "SampleHelperFunctions.hpp"
+#include "Accumulation.hpp"
 
 #define MAX_BDPT_PATH_LENGTH 16
 #define RUSSIAN_ROULETTE 0.8f
@@ -12,10 +13,17 @@ struct BDPTPath;
 struct PathVertex;
 struct BDPTPathView;
 
+/*Samples per camera path of each kind of strategy, for MIS. Plain BDPT takes every strategy once.*/
+struct MisCounts {
+    float connection = 1.0f;    //Strategies with s >= 2 and t >= 2. Fewer or more with a light vertex cache.
+    float merge = 0.0f;         //Vertex merging(VCM): light paths x pi r^2. 0 without merging.
+};
+
 struct BDPTPath {
     struct InternalPathVertex {
         PTVertex vertex;
-        float pdf;
+        float pdf;          //Area pdf of sampling this vertex from the previous one, what the path was generated with.
+        float pdfRev = 0.0f;    //Area pdf of sampling this vertex from the next one(arriving from the one after), without russian roulette. Set once vertex index+2 exists.
         Vector3f alpha;
         bool shadowed = false;
     };
@@ -35,11 +43,13 @@ struct BDPTPath {
 
     PathVertex GetVertex(int i) const;
 
-    void GenerateCameraPath(Ray cameraRay);
+    void GenerateCameraPath(const RayDifferential& cameraRay);
 
-    void GenerateLightPath(Object* lightObj);
+    /*Starts on any emitter of the scene, picked by power. Empty path if the scene has no light.*/
+    void GenerateLightPath();
 
-    void FillPathUsingRussianRoulette(int start);
+    /*Vertex i takes its sample dimensions from bounce block firstBounce + i(Sampler.hpp).*/
+    void FillPathUsingRussianRoulette(int start, int firstBounce);
 
     inline BDPTPath Copy(int count) const {
         assert(count <= this->count);
@@ -52,10 +62,37 @@ struct BDPTPath {
 
     BDPTPath& Append(PTVertex vertex, bool dontcheckshadow);
 
-    static Vector3f PathWeight(const BDPTPathView& lightPath, const BDPTPathView& camPath);
+    /*
+    Contribution of connecting lightPath and camPath, MIS weighted by power heuristic over all other (s,t) splits of the same path.
+    The pdfs of vertices away from the connection don't depend on it, so they come from pdf/pdfRev stored at generation,
+    only the 2 vertices at each side of the connection are evaluated here. O(s+t) per strategy.
+    counts gives samples per camera path of each kind of strategy. The result is already divided by this strategy's count.
+    */
+    static Vector3f PathWeight(const BDPTPathView& lightPath, const BDPTPathView& camPath, const MisCounts& counts = MisCounts());
+
+    /*MIS weight of connecting lv[0, s) and cv[0, t), not yet divided by the strategy's count. With MergeWeight, all strategies of a path sum to 1.*/
+    static float ConnectionWeight(const Scene* scene, const InternalPathVertex* lv, int s, const InternalPathVertex* cv, int t, const MisCounts& counts);
+
+    /*
+    MIS weight of vertex merging, light subpath lv[0, s) ending at a photon near camera subpath cv[0, t)'s last vertex.
+    Taken for the path through the photon, camera subpath cv[0, t-1) extended to it, so it is the weight every other strategy
+    gives that same path. Mixing the camera vertex and the photon in one path is biased where pdfs change fast within the radius.
+    */
+    static float MergeWeight(const Scene* scene, const InternalPathVertex* lv, int s, const InternalPathVertex* cv, int t, const MisCounts& counts);
+
+    /*Whether vertex merging is done at v: surfaces rough enough for density estimation to make sense.*/
+    static bool CanMerge(const PTVertex& v);
+
+    /*Area pdf of sampling to from from, when from was reached from pre(unused for light and camera vertices). Same as Append() gives, without russian roulette.*/
+    static float AreaPdf(const Scene* scene, const PTVertex* pre, const PTVertex& from, const PTVertex& to);
 
     InternalPathVertex SampleNextVertex(const Scene* scene, const InternalPathVertex& vertex, Vector3f w_o);
 private:
+    static float StrategyCount(const MisCounts& counts, int s, int t);
+    /*Add squared pdf ratios of the strategies with fewer light vertices than (s, t), cur_pdf being p(s, t) over the weighted strategy's pdf.*/
+    static void LightSideRatios(const Scene* scene, const InternalPathVertex* lv, int s, const InternalPathVertex* cv, int t, float cur_pdf, const MisCounts& counts, float currentCount, float& denominator);
+    /*Same, for strategies with fewer camera vertices.*/
+    static void CameraSideRatios(const Scene* scene, const InternalPathVertex* lv, int s, const InternalPathVertex* cv, int t, float cur_pdf, const MisCounts& counts, float currentCount, float& denominator);
 
 };
 
@@ -88,9 +125,14 @@ struct PathVertex {
         return path->verts[index].vertex.x;
     }
 
+    /*Geometric normal, for cosines. The bsdf takes ShadingNormal().*/
     inline Vector3f Normal() const {
         if (path->verts[index].vertex.type == PTVertex::Type::Camera)
             return Vector3f(0.0f, 0.0f, 1.0f);
+        return path->verts[index].vertex.Ng;
+    }
+
+    inline Vector3f ShadingNormal() const {
         return path->verts[index].vertex.N;
     }
 
@@ -110,12 +152,16 @@ struct PathVertex {
         return path->verts[index].vertex.type;
     }
 
-    inline Material* Material() const {
+    inline ::Material* Material() const {
         if (path->verts[index].vertex.obj != nullptr)
             return path->verts[index].vertex.obj->m;
         return nullptr;
     }
 
+    inline const SurfaceTexels* Texels() const {
+        return path->verts[index].vertex.Texels();
+    }
+
     inline Vector3f Emission() const {
         if (Material() == nullptr)
             return 0.0f;
@@ -169,4 +215,14 @@ struct BDPTPathView {
 };
 
 
-Vector3f BDPT(const Scene* scene, const Ray& ray, int& outBounces, Vector3f* emissionBuffer = nullptr);
\ No newline at end of file
+/*A light tracing contribution, landing where the ray from lightPos to the camera crosses the image.*/
+struct LightSplat {
+    Vector3f lightPos;
+    Vector3f value;
+};
+
+/*
+One BDPT sample along ray, returning what the camera side strategies see. Light tracing goes to emissionBuffer,
+or to lightSplats instead if that is given.
+*/
+Vector3f BDPT(const Scene* scene, const RayDifferential& ray, int& outBounces, AccumPixel* emissionBuffer = nullptr, std::vector<LightSplat>* lightSplats = nullptr);
\ No newline at end of file
@@ -1,6 +1,8 @@
 #include <algorithm>
 #include <cassert>
 #include "BVH.hpp"
+#include "RayStats.hpp"
+#include <bitset>
 
 BVHAccel::BVHAccel(std::vector<Object*> p, int maxPrimsInNode,
                    SplitMethod splitMethod)
@@ -117,9 +119,11 @@ Intersection BVHAccel::Intersect(const Ray& ray, FaceCulling culling) const
 #endif
 
 
+    int visited = 0;
     while (stackOffset != 0) {
         auto front = intersectionStack[--stackOffset];
         const BVHBuildNode& node = GN(front);
+        visited++;
 
         if (!node.bounds.IntersectP(ray, ray.direction_inv)){
             continue;
@@ -139,9 +143,67 @@ Intersection BVHAccel::Intersect(const Ray& ray, FaceCulling culling) const
             }
         }
     }
+    RENDER_COUNT(bvhNodes, visited);
     return insect;
 }
 
+/*
+Packet version of Intersect. Every stack entry carries the lanes still interested in that node,
+and lanes skip nodes farther than their closest hit so far.
+*/
+void BVHAccel::IntersectPacket(const RayPacket& packet, uint32_t mask, Intersection* hits) const
+{
+    struct StackEntry {
+        BVHNodeIndex node;
+        uint32_t mask;
+    };
+    StackEntry intersectionStack[intersectionStackSize];
+    int stackOffset = 0;
+
+#ifdef BVH_NODE_ARRAY_LAYOUT
+    if (nodes.size() == 0)
+        return;
+    intersectionStack[stackOffset++] = { 0, mask };
+#else
+    if (root == BVHNodeNull)
+        return;
+    intersectionStack[stackOffset++] = { root, mask };
+#endif
+
+    float tFar[RAY_PACKET_MAX];
+    for (int i = 0; i < RAY_PACKET_MAX; i++) {
+        tFar[i] = (i < packet.count && hits[i].happened) ? hits[i].distance : std::numeric_limits<float>::max();
+    }
+
+    //Counted per lane, so nodes per ray compare with single ray traversal.
+    int visited = 0;
+    while (stackOffset != 0) {
+        auto front = intersectionStack[--stackOffset];
+        const BVHBuildNode& node = GN(front.node);
+        visited += (int)std::bitset<32>(front.mask).count();
+
+        if (!packet.IntervalIntersectP(node.bounds))
+            continue;
+        uint32_t nodeMask = packet.IntersectP(node.bounds, tFar, front.mask);
+        if (nodeMask == 0)
+            continue;
+
+        if (node.object != nullptr) {
+            node.object->IntersectPacket(packet, nodeMask, hits);
+            for (int i = 0; i < packet.count; i++) {
+                if ((nodeMask & (1u << i)) && hits[i].happened)
+                    tFar[i] = hits[i].distance;
+            }
+        } else {
+            if (stackOffset + 2 < intersectionStackSize) {
+                intersectionStack[stackOffset++] = { node.left, nodeMask };
+                intersectionStack[stackOffset++] = { node.right, nodeMask };
+            }
+        }
+    }
+    RENDER_COUNT(bvhNodes, visited);
+}
+
 void BVHAccel::getSample(BVHNodeIndex index, float p, Intersection &pos){
     auto& node = GN(index);
 
@@ -154,7 +216,8 @@ void BVHAccel::getSample(BVHNodeIndex index, float p, Intersection &pos){
 }
 
 void BVHAccel::Sample(Intersection &pos){
-    float p = std::sqrt(GetRandomFloat()) * GN(Root()).area;
+    //Uniform in area, which is what MeshTriangle::pdf() claims.
+    float p = GetRandomFloat() * GN(Root()).area;
     getSample(Root(), p, pos);
 }
 
@@ -14,6 +14,7 @@
 #include "Bounds3.hpp"
 #include "Intersection.hpp"
 #include "Vector.hpp"
+#include "RayPacket.hpp"
 
 struct BVHBuildNode;
 // BVHAccel Forward Declarations
@@ -40,6 +41,7 @@ public:
     ~BVHAccel();
 
     Intersection Intersect(const Ray &ray, FaceCulling cull) const;
+    void IntersectPacket(const RayPacket& packet, uint32_t mask, Intersection* hits) const;
 
     // BVHAccel Private Methods
     BVHNodeIndex recursiveBuild(std::vector<Object*>objects);
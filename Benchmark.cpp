@@ -0,0 +1,656 @@
+#include "Benchmark.hpp"
+#include <chrono>
+#include <functional>
+#include <cstdio>
+#include "SceneRenderingHelper.hpp"
+#include "SampleHelperFunctions.hpp"
+#include "LightSampler.hpp"
+#include "CpuDispatch.hpp"
+#include "WavefrontPathTracer.hpp"
+#include "BDPT.hpp"
+#include "VCM.hpp"
+#include <cstring>
+#include <algorithm>
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define BENCHMARK_REPEAT 3
+
+/*Best of BENCHMARK_REPEAT runs, in seconds.*/
+static double TimeBest(const std::function<void()>& f) {
+    double best = 1e30;
+    for (int i = 0; i < BENCHMARK_REPEAT; i++) {
+        auto start = std::chrono::steady_clock::now();
+        f();
+        auto stop = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double>(stop - start).count());
+    }
+    return best;
+}
+
+static bool SameHit(const PTVertex& a, const PTVertex& b) {
+    return a.type == b.type && a.obj == b.obj;
+}
+
+static void BenchmarkRaySet(const Scene& scene, const char* name, const std::vector<Ray>& rays) {
+    int count = (int)rays.size();
+    std::vector<FaceCulling> culling(count, FaceCulling::CullBack);
+    std::vector<PTVertex> reference(count), hits(count);
+
+    double single = TimeBest([&]() {
+        for (int i = 0; i < count; i++)
+            reference[i] = scene.Intersect(rays[i], culling[i]);
+    });
+    printf("%-8s %9d rays  single  %8.2f Mrays/s\n", name, count, count / single * 1e-6);
+
+    for (int packetSize : { 4, 8, 16 }) {
+        double t = TimeBest([&]() {
+            scene.IntersectStream(rays.data(), culling.data(), count, hits.data(), packetSize);
+        });
+        int mismatch = 0;
+        for (int i = 0; i < count; i++)
+            mismatch += !SameHit(reference[i], hits[i]);
+        printf("%-8s %9d rays  packet%-2d%8.2f Mrays/s  x%.2f  %d mismatches\n", name, count, packetSize, count / t * 1e-6, single / t, mismatch);
+    }
+}
+
+/*Primary, shadow and diffuse bounce rays for the current view.*/
+static void MakeBenchmarkRays(const Scene& scene, std::vector<Ray>& primary, std::vector<Ray>& shadow, std::vector<Ray>& diffuse) {
+    int width = scene.width, height = scene.height;
+    float scale = CalculateScale(scene.fov);
+    ResetRandom(1);
+
+    //Primary rays in 4x4 pixel blocks, the order a tile renderer would produce packets in.
+    for (int by = 0; by < height; by += 4)
+        for (int bx = 0; bx < width; bx += 4)
+            for (int y = by; y < std::min(height, by + 4); y++)
+                for (int x = bx; x < std::min(width, bx + 4); x++)
+                    primary.emplace_back(scene.eyePos, PixelPosToRay(x, y, width, height, scale));
+
+    std::vector<PTVertex> primaryHits(primary.size());
+    for (size_t i = 0; i < primary.size(); i++)
+        primaryHits[i] = scene.Intersect(primary[i]);
+
+    //Shadow rays go from a point on a light toward the hit, as in Scene::ShadowCheck.
+    //Diffuse rays leave the hit with a cosine distribution, as incoherent as secondary rays get.
+    for (auto& v : primaryHits) {
+        if (v.type == PTVertex::Type::Background)
+            continue;
+        if (!scene.m_emissionObjects.empty()) {
+            Intersection l;
+            scene.m_emissionObjects[(int)(GetRandomFloat() * scene.m_emissionObjects.size()) % scene.m_emissionObjects.size()]->Sample(l);
+            shadow.emplace_back(l.coords, (v.x - l.coords).Normalized());
+        }
+        float u = GetRandomFloat(), phi = 2.0f * M_PI * GetRandomFloat();
+        float r = std::sqrt(u);
+        diffuse.emplace_back(v.x, TransformVectorToWorld(Vector3f(r * std::cos(phi), r * std::sin(phi), std::sqrt(1.0f - u)), v.N));
+    }
+}
+
+static void RayBenchmark(const Scene& scene) {
+    std::vector<Ray> primary, shadow, diffuse;
+    MakeBenchmarkRays(scene, primary, shadow, diffuse);
+    BenchmarkRaySet(scene, "primary", primary);
+    BenchmarkRaySet(scene, "shadow", shadow);
+    BenchmarkRaySet(scene, "diffuse", diffuse);
+}
+
+/*
+One light sampled estimate of irradiance at v, luminance only. Light sampling alone, no MIS,
+and no bsdf since the mostly mirror-like materials here would drown the difference between samplers in noise.
+sampler nullptr loops over every emitter instead, one sample each, the way PathTrace used to.
+*/
+static float IrradianceEstimate(const Scene& scene, const LightSampler* sampler, const PTVertex& v, int& shadowRays) {
+    Vector3f result = 0.0f;
+    int count = sampler ? 1 : (int)scene.m_emitters.size();
+    for (int i = 0; i < count; i++) {
+        float pmf = 1.0f;
+        Object* light = sampler ? sampler->Pick(v.x, v.N, GetRandomFloat(), &pmf) : scene.m_emitters[i];
+        if (light == nullptr || pmf <= 0.0f)
+            continue;
+        Intersection pos;
+        light->Sample(pos);
+        float distSqr;
+        Vector3f w_i = (pos.coords - v.x).NormlizeAndGetLengthSqr(&distSqr);
+        float costhetap = DotProduct(pos.normal, -w_i);
+        if (costhetap <= 0.0f)
+            continue;
+        shadowRays++;
+        if (scene.ShadowCheck(pos.coords, v.x))
+            continue;
+        result += light->m->m_emission * (std::abs((float)DotProduct(w_i, v.N)) * light->getArea() * costhetap / (pmf * distSqr));
+    }
+    return 0.2126f * result.x + 0.7152f * result.y + 0.0722f * result.z;
+}
+
+static void LightBenchmark(const Scene& scene) {
+    const int pointCount = 4096, samplesPerPoint = 16;
+    int width = scene.width, height = scene.height;
+    float scale = CalculateScale(scene.fov);
+    ResetRandom(1);
+
+    //Shading points: primary hits at random pixels.
+    std::vector<PTVertex> points;
+    for (int tries = 0; points.size() < pointCount && tries < pointCount * 16; tries++) {
+        Vector3f dir = PixelPosToRay((int)(GetRandomFloat() * width), (int)(GetRandomFloat() * height), width, height, scale);
+        auto v = scene.Intersect(Ray(scene.eyePos, dir));
+        if (v.type == PTVertex::Type::Background || v.obj->m->hasEmission())
+            continue;
+        points.push_back(v);
+    }
+    printf("lights: %d emitters, %d points, %d estimates each\n", (int)scene.m_emitters.size(), (int)points.size(), samplesPerPoint);
+    printf("sampler   us/estimate  shadow rays/estimate  mean      rel. std dev  efficiency\n");
+
+    //Efficiency is 1/(variance x time), relative to looping over every light.
+    double baseEfficiency = 0.0;
+    for (int mode = -1; mode < 3; mode++) {
+        LightSamplerType type = (LightSamplerType)std::max(mode, 0);
+        auto sampler = mode < 0 ? nullptr : LightSampler::Create(type, scene);
+        double mean = 0.0, variance = 0.0;
+        int shadowRays = 0;
+        double t = TimeBest([&]() {
+            ResetRandom(2);
+            mean = variance = 0.0;
+            shadowRays = 0;
+            for (size_t p = 0; p < points.size(); p++) {
+                double sum = 0.0, sumSqr = 0.0;
+                for (int i = 0; i < samplesPerPoint; i++) {
+                    double e = IrradianceEstimate(scene, sampler.get(), points[p], shadowRays);
+                    sum += e;
+                    sumSqr += e * e;
+                }
+                double m = sum / samplesPerPoint;
+                mean += m;
+                variance += (sumSqr / samplesPerPoint - m * m) * samplesPerPoint / (samplesPerPoint - 1);
+            }
+            mean /= points.size();
+            variance /= points.size();
+        });
+        long long estimates = (long long)points.size() * samplesPerPoint;
+        double efficiency = 1.0 / (variance * t + 1e-30);
+        if (mode < 0)
+            baseEfficiency = efficiency;
+        printf("%-9s %10.3f  %12.2f          %-9.4f %-13.3f x%.2f\n", mode < 0 ? "all" : LightSamplerName(type),
+            t / estimates * 1e6, (double)shadowRays / estimates, mean, std::sqrt(variance) / (mean + 1e-30), efficiency / baseEfficiency);
+    }
+}
+
+static bool SameBits(const Vector3f& a, const Vector3f& b) {
+    return std::memcmp(&a.x, &b.x, sizeof(float) * 3) == 0;
+}
+
+/*
+Every kernel of CpuDispatch.hpp at every level this CPU has, timed and compared bit for bit with the generic one.
+Rays go through Scene::IntersectStream(packets of 16), tone mapping gets a row of every 64th float bit pattern
+from 0 to 1 plus out of range values.
+*/
+static void KernelBenchmark(const Scene& scene) {
+    std::vector<Ray> primary, shadow, diffuse;
+    MakeBenchmarkRays(scene, primary, shadow, diffuse);
+    std::vector<Ray> rays = primary;
+    rays.insert(rays.end(), diffuse.begin(), diffuse.end());
+    std::vector<FaceCulling> culling(rays.size(), FaceCulling::CullBack);
+
+    std::vector<Vector3f> colors;
+    for (uint32_t bits = 0; bits <= 0x3f800000u; bits += 64 * 3) {
+        float c[3];
+        for (int i = 0; i < 3; i++) {
+            uint32_t b = bits + 64 * i;
+            std::memcpy(&c[i], &b, sizeof(float));
+        }
+        colors.emplace_back(c[0], c[1], c[2]);
+    }
+    colors.emplace_back(-1.0f, 2.0f, std::numeric_limits<float>::infinity());
+
+    KernelTable selected = s_Kernels;
+    std::vector<PTVertex> referenceHits(rays.size()), hits(rays.size());
+    std::vector<unsigned char> referenceBytes(colors.size() * 3), bytes(colors.size() * 3);
+    double baseTimes[2] = {};
+    printf("isa       rays Mrays/s        tone map Mpixels/s\n");
+    for (int level = 0; level <= (int)DetectCpuIsa(); level++) {
+        s_Kernels = MakeKernelTable((CpuIsa)level);
+        if (level > 0 && s_Kernels.isa == CpuIsa::Generic)
+            break;
+        double times[2];
+        times[0] = TimeBest([&]() {
+            scene.IntersectStream(rays.data(), culling.data(), (int)rays.size(), hits.data(), RAY_PACKET_MAX);
+        });
+        times[1] = TimeBest([&]() {
+            s_Kernels.toneMapRow(colors.data(), bytes.data(), (int)colors.size());
+        });
+        if (level == 0) {
+            referenceHits = hits;
+            referenceBytes = bytes;
+            std::copy(times, times + 2, baseTimes);
+        }
+        int mismatches[2] = {};
+        for (size_t i = 0; i < rays.size(); i++)
+            mismatches[0] += !SameHit(hits[i], referenceHits[i]) || !SameBits(hits[i].x, referenceHits[i].x);
+        for (size_t i = 0; i < bytes.size(); i++)
+            mismatches[1] += bytes[i] != referenceBytes[i];
+        double rates[2] = { rays.size() / times[0] * 1e-6, colors.size() / times[1] * 1e-6 };
+        printf("%-8s", CpuIsaName(s_Kernels.isa));
+        for (int k = 0; k < 2; k++)
+            printf("  %7.2f x%.2f %-7s", rates[k], baseTimes[k] / times[k], mismatches[k] ? "DIFFERS" : "");
+        printf("\n");
+    }
+    s_Kernels = selected;
+}
+
+/*
+What BDPT does per vertex of a path: draw the next direction, evaluate the bsdf for it and the pdf of the reverse direction.
+Random outgoing directions over both sides of a plane, one material at a time, with analytic fresnel and sampling
+and with the tables of -materiallut 1. Then how far the tables are off: largest fresnel error over all cos,
+mean angle between the directions both draw from the same random numbers, and the albedo(mean f cos / pdf) each estimates.
+*/
+static void MaterialBenchmark() {
+    const int vertexCount = 1 << 18;
+    Material plastic(Dieletric), metal(Metal), glass(Transparent);
+    plastic.SetSmoothness(0.7f);
+    metal.SetSmoothness(0.7f);
+    glass.SetSmoothness(0.9f);
+    std::pair<const char*, Material*> materials[] = { { "plastic", &plastic }, { "metal", &metal }, { "glass", &glass } };
+
+    ResetRandom(4);
+    Vector3f n(0.0f, 1.0f, 0.0f);
+    std::vector<Vector3f> wo(vertexCount);
+    for (auto& w : wo)
+        w = Vector3f(GetRandomFloat() - 0.5f, GetRandomFloat() - 0.5f, GetRandomFloat() - 0.5f).Normalized();
+
+    bool selected = s_MaterialLUT;
+    std::vector<Vector3f> wi[2] = { std::vector<Vector3f>(vertexCount), std::vector<Vector3f>(vertexCount) };
+    printf("          ns/vertex(sample + eval + reverse pdf)  M samples/s       fresnel    direction  albedo\n");
+    printf("material  analytic  tables                        analytic  tables  max error  mean error analytic  tables\n");
+    for (auto& m : materials) {
+        double vertexTimes[2], sampleTimes[2], albedo[2];
+        for (int lut = 0; lut < 2; lut++) {
+            s_MaterialLUT = lut;
+            double sum = 0.0;
+            vertexTimes[lut] = TimeBest([&]() {
+                ResetRandom(5);
+                sum = 0.0;
+                for (int i = 0; i < vertexCount; i++) {
+                    float pdf;
+                    Vector3f w = m.second->sample(wo[i], n, &pdf);
+                    Vector3f f = m.second->evalGivenSample(wo[i], w, n, false);
+                    float pdfReverse = m.second->pdf(w, n, wo[i]);
+                    sum += pdf + f.x + pdfReverse;
+                }
+            });
+            sampleTimes[lut] = TimeBest([&]() {
+                ResetRandom(5);
+                for (int i = 0; i < vertexCount; i++) {
+                    float pdf;
+                    wi[lut][i] = m.second->sample(wo[i], n, &pdf);
+                }
+            });
+            albedo[lut] = 0.0;
+            ResetRandom(5);
+            for (int i = 0; i < vertexCount; i++) {
+                float pdf;
+                Vector3f w = m.second->sample(wo[i], n, &pdf);
+                if (pdf > 0.0f)
+                    albedo[lut] += m.second->evalGivenSample(wo[i], w, n).x / pdf;
+            }
+            albedo[lut] /= vertexCount;
+        }
+
+        float fresnelError = 0.0f;
+        for (int i = 0; i <= 4096; i++) {
+            float c = -1.0f + i / 2048.0f;
+            Vector3f I(std::sqrt(std::max(0.0f, 1.0f - c * c)), 0.0f, c), N(0.0f, 0.0f, 1.0f);
+            s_MaterialLUT = false;
+            Vector3f exact = m.second->fresnel(I, N);
+            s_MaterialLUT = true;
+            Vector3f d = m.second->fresnel(I, N) - exact;
+            fresnelError = std::max({ fresnelError, std::abs(d.x), std::abs(d.y), std::abs(d.z) });
+        }
+        double angle = 0.0;
+        for (int i = 0; i < vertexCount; i++)
+            angle += std::acos(std::clamp(DotProduct(wi[0][i], wi[1][i]), -1.0f, 1.0f));
+        angle = angle / vertexCount * 180.0 / M_PI;
+
+        printf("%-9s %8.1f  %6.1f                        %8.2f  %6.2f  %9.2e  %7.4f deg %7.4f  %7.4f\n", m.first,
+            vertexTimes[0] / vertexCount * 1e9, vertexTimes[1] / vertexCount * 1e9,
+            vertexCount / sampleTimes[0] * 1e-6, vertexCount / sampleTimes[1] * 1e-6,
+            fresnelError, angle, albedo[0], albedo[1]);
+    }
+    s_MaterialLUT = selected;
+
+    //Visible normal sampling(-vndf 1): how many samples get lost below the surface, and the same albedo if the pdf matches(up to noise, the ndf one is spiky at grazing angles).
+    bool selectedVisible = s_VisibleNormalSampling;
+    printf("\n          pdf 0 samples          albedo\n");
+    printf("material  ndf       vndf         ndf      vndf\n");
+    for (auto& m : materials) {
+        double zeroFraction[2], albedo[2];
+        for (int visible = 0; visible < 2; visible++) {
+            s_VisibleNormalSampling = visible;
+            long long zero = 0;
+            albedo[visible] = 0.0;
+            ResetRandom(5);
+            for (int i = 0; i < vertexCount; i++) {
+                float pdf;
+                Vector3f w = m.second->sample(wo[i], n, &pdf);
+                if (pdf > 0.0f)
+                    albedo[visible] += m.second->evalGivenSample(wo[i], w, n).x / pdf;
+                else
+                    zero++;
+            }
+            zeroFraction[visible] = (double)zero / vertexCount;
+            albedo[visible] /= vertexCount;
+        }
+        printf("%-9s %6.2f%%   %6.2f%%      %7.4f  %7.4f\n", m.first, zeroFraction[0] * 100.0, zeroFraction[1] * 100.0, albedo[0], albedo[1]);
+    }
+    s_VisibleNormalSampling = selectedVisible;
+}
+
+/*
+Instructions and cycles of this thread over Start()/Stop(), from perf_event_open on Linux.
+Many VMs and containers don't allow it, then Available() is false and IPC is printed as n/a.
+*/
+struct InstructionCounter {
+    int fd[2] = { -1, -1 };
+    long long counts[2] = {};
+
+    InstructionCounter() {
+#if defined(__linux__)
+        uint64_t configs[2] = { PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CPU_CYCLES };
+        for (int k = 0; k < 2; k++) {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.size = sizeof(attr);
+            attr.config = configs[k];
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fd[k] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        }
+#endif
+    }
+    ~InstructionCounter() {
+#if defined(__linux__)
+        for (int k = 0; k < 2; k++)
+            if (fd[k] >= 0)
+                close(fd[k]);
+#endif
+    }
+    bool Available() const { return fd[0] >= 0 && fd[1] >= 0; }
+    void Start() {
+#if defined(__linux__)
+        for (int k = 0; Available() && k < 2; k++) {
+            ioctl(fd[k], PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd[k], PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+    void Stop() {
+#if defined(__linux__)
+        for (int k = 0; Available() && k < 2; k++) {
+            ioctl(fd[k], PERF_EVENT_IOC_DISABLE, 0);
+            if (read(fd[k], &counts[k], sizeof(counts[k])) != sizeof(counts[k]))
+                counts[k] = 0;
+        }
+#endif
+    }
+    void PrintIPC() const {
+        if (Available() && counts[1] > 0)
+            printf("%5.2f", (double)counts[0] / counts[1]);
+        else
+            printf("  n/a");
+    }
+};
+
+/*
+Shading of the hits of primary and diffuse bounce rays the way the wavefront integrator does it per bounce:
+a bsdf sample and its eval, plus pdf and eval toward a light direction. Hit by hit in ray order, as the megakernel
+runs them, against binned by Material and run through the batch functions over SoA arrays, sort and gathers included.
+Both must give the same bits.
+*/
+static void ShadingBenchmark(const Scene& scene) {
+    std::vector<Ray> primary, shadow, diffuse;
+    MakeBenchmarkRays(scene, primary, shadow, diffuse);
+    std::vector<Ray> rays = primary;
+    rays.insert(rays.end(), diffuse.begin(), diffuse.end());
+
+    std::vector<Material*> mats;
+    std::vector<Vector3f> wo, n, wl;
+    std::vector<uint32_t> seeds;
+    ResetRandom(6);
+    for (auto& r : rays) {
+        PTVertex v = scene.Intersect(r);
+        if (v.type == PTVertex::Type::Background)
+            continue;
+        mats.push_back(v.obj->m);
+        wo.push_back(-r.direction);
+        n.push_back(v.N);
+        wl.push_back(Vector3f(GetRandomFloat() - 0.5f, GetRandomFloat() - 0.5f, GetRandomFloat() - 0.5f).Normalized());
+        seeds.push_back(0x9E3779B9u * (uint32_t)seeds.size() | 1u);
+    }
+    int count = (int)mats.size();
+    if (count == 0) {
+        printf("Nothing hit\n");
+        return;
+    }
+
+    struct Outputs {
+        std::vector<Vector3f> wi, f, lightF;
+        std::vector<float> pdf, lightPdf;
+        void Resize(int size) {
+            wi.resize(size); f.resize(size); lightF.resize(size);
+            pdf.resize(size); lightPdf.resize(size);
+        }
+    } single, binned;
+    single.Resize(count);
+    binned.Resize(count);
+
+    InstructionCounter counter[2];
+    std::vector<uint32_t> rng(WAVEFRONT_SHADE_CHUNK);
+    double times[2];
+    times[0] = TimeBest([&]() {
+        counter[0].Start();
+        for (int i = 0; i < count; i++) {
+            s_RndState = seeds[i];
+            single.wi[i] = mats[i]->sample(wo[i], n[i], &single.pdf[i]);
+            single.lightPdf[i] = mats[i]->pdf(wo[i], n[i], wl[i]);
+            single.lightF[i] = mats[i]->evalGivenSample(wo[i], wl[i], n[i]);
+            single.f[i] = mats[i]->evalGivenSample(wo[i], single.wi[i], n[i]);
+        }
+        counter[0].Stop();
+    });
+
+    //Scratch of the binned path, as the wavefront integrator keeps it between bounces.
+    std::vector<Material*> found;
+    std::vector<int> counts, start, cursor, binOf(count), sorted(count);
+    std::vector<Vector3f> bWo(WAVEFRONT_SHADE_CHUNK), bN(WAVEFRONT_SHADE_CHUNK), bWl(WAVEFRONT_SHADE_CHUNK), bWi(WAVEFRONT_SHADE_CHUNK);
+    std::vector<Vector3f> bF(WAVEFRONT_SHADE_CHUNK), bLightF(WAVEFRONT_SHADE_CHUNK);
+    std::vector<float> bPdf(WAVEFRONT_SHADE_CHUNK), bLightPdf(WAVEFRONT_SHADE_CHUNK);
+    times[1] = TimeBest([&]() {
+        counter[1].Start();
+        found.clear();
+        counts.clear();
+        int last = -1;
+        for (int i = 0; i < count; i++) {
+            if (last < 0 || found[last] != mats[i]) {
+                last = (int)(std::find(found.begin(), found.end(), mats[i]) - found.begin());
+                if (last == (int)found.size()) {
+                    found.push_back(mats[i]);
+                    counts.push_back(0);
+                }
+            }
+            binOf[i] = last;
+            counts[last]++;
+        }
+        start.assign(found.size() + 1, 0);
+        for (size_t b = 0; b < found.size(); b++)
+            start[b + 1] = start[b] + counts[b];
+        cursor.assign(start.begin(), start.end() - 1);
+        for (int i = 0; i < count; i++)
+            sorted[cursor[binOf[i]]++] = i;
+
+        //Chunks of a bin at a time, as WavefrontPathTracer does, so the SoA arrays stay in cache.
+        for (size_t b = 0; b < found.size(); b++) {
+            for (int first = start[b]; first < start[b + 1]; first += WAVEFRONT_SHADE_CHUNK) {
+                int size = std::min(WAVEFRONT_SHADE_CHUNK, start[b + 1] - first);
+                for (int k = 0; k < size; k++) {
+                    int i = sorted[first + k];
+                    bWo[k] = wo[i];
+                    bN[k] = n[i];
+                    bWl[k] = wl[i];
+                    rng[k] = seeds[i];
+                }
+                found[b]->SampleBatch(size, bWo.data(), bN.data(), nullptr, rng.data(), bWi.data(), bPdf.data());
+                found[b]->PdfBatch(size, bWo.data(), bN.data(), bWl.data(), nullptr, bLightPdf.data());
+                found[b]->EvalBatch(size, bWo.data(), bWl.data(), bN.data(), nullptr, bLightF.data());
+                found[b]->EvalBatch(size, bWo.data(), bWi.data(), bN.data(), nullptr, bF.data());
+                for (int k = 0; k < size; k++) {
+                    int i = sorted[first + k];
+                    binned.wi[i] = bWi[k];
+                    binned.pdf[i] = bPdf[k];
+                    binned.lightPdf[i] = bLightPdf[k];
+                    binned.lightF[i] = bLightF[k];
+                    binned.f[i] = bF[k];
+                }
+            }
+        }
+        counter[1].Stop();
+    });
+
+    int mismatches = 0;
+    for (int i = 0; i < count; i++) {
+        mismatches += !SameBits(single.wi[i], binned.wi[i]) || !SameBits(single.f[i], binned.f[i]) || !SameBits(single.lightF[i], binned.lightF[i])
+            || std::memcmp(&single.pdf[i], &binned.pdf[i], sizeof(float)) != 0 || std::memcmp(&single.lightPdf[i], &binned.lightPdf[i], sizeof(float)) != 0;
+    }
+    printf("%d hits on %d materials, %s kernels\n", count, (int)found.size(), CpuIsaName(s_Kernels.isa));
+    printf("            ns/hit    IPC\n");
+    const char* names[2] = { "hit by hit", "binned" };
+    for (int k = 0; k < 2; k++) {
+        printf("%-10s  %7.2f  ", names[k], times[k] / count * 1e9);
+        counter[k].PrintIPC();
+        printf("\n");
+    }
+    printf("%s\n", mismatches ? "binned results DIFFER" : "same results");
+}
+
+/*
+The same path of n surface vertices V(V[0] on a light) split into every strategy: s light vertices connected to
+the camera and V[n-1]..V[s], and merges at each V[k] that can merge. Paths are rebuilt with Append() per split.
+*/
+static float MisWeightSum(const Scene& scene, const std::vector<PTVertex>& V, const MisCounts& counts) {
+    int n = (int)V.size();
+    std::vector<BDPTPath> lightPaths(n + 1, BDPTPath(&scene)), camPaths(n + 1, BDPTPath(&scene));
+    std::vector<bool> sampled(n + 1);
+    for (int s = 0; s <= n; s++) {
+        bool nonzero = true;
+        for (int j = 0; j < s; j++) {
+            PTVertex v = V[j];
+            if (j == 0)
+                v.type = PTVertex::Type::Light;
+            lightPaths[s].Append(v, true);
+            nonzero = nonzero && lightPaths[s].verts[j].pdf > 0.0f;
+        }
+        camPaths[s].Append(PTVertex::Camera(scene.eyePos), true);
+        for (int j = n - 1; j >= s; j--) {
+            camPaths[s].Append(V[j], true);
+            nonzero = nonzero && camPaths[s].verts[camPaths[s].count - 1].pdf > 0.0f;
+        }
+        sampled[s] = nonzero;
+    }
+
+    float sum = 0.0f;
+    for (int s = 0; s <= n; s++) {
+        if (sampled[s])
+            sum += BDPTPath::ConnectionWeight(&scene, lightPaths[s].verts, s, camPaths[s].verts, n - s + 1, counts);
+    }
+    for (int k = 1; k <= n - 1; k++) {
+        //Light subpath through V[k], camera subpath down to V[k]: both of split k+1 and of split k.
+        if (BDPTPath::CanMerge(V[k]) && sampled[k + 1] && sampled[k])
+            sum += BDPTPath::MergeWeight(&scene, lightPaths[k + 1].verts, k + 1, camPaths[k].verts, n - k + 1, counts);
+    }
+    return sum;
+}
+
+/*Checks that the MIS weights of every strategy of a path, connections and merges, sum to 1, on paths of BDPT samples.*/
+static void MisWeightBenchmark(const Scene& scene) {
+    const int pathCount = 20000;
+    int width = scene.width, height = scene.height;
+    float scale = CalculateScale(scene.fov);
+    float radius = VCM_DEFAULT_RADIUS * (float)scene.bvh->GN(scene.bvh->Root()).bounds.Diagonal().Magnitude();
+    ResetRandom(1);
+
+    for (float merge : { 0.0f, (float)width * height * (float)M_PI * radius * radius }) {
+        MisCounts counts;
+        counts.merge = merge;
+        int checked = 0, wrong = 0, pdfMismatches = 0;
+        double maxError = 0.0, total = 0.0;
+        for (int tries = 0; checked < pathCount && tries < pathCount * 16; tries++) {
+            Vector3f dir = PixelPosToRay((int)(GetRandomFloat() * width), (int)(GetRandomFloat() * height), width, height, scale);
+            BDPTPath camPath(&scene), lightPath(&scene);
+            camPath.GenerateCameraPath(RayDifferential(scene.eyePos, dir));
+            lightPath.GenerateLightPath();
+
+            //Pdfs stored at generation against the ones Append() and the MIS weights assume.
+            BDPTPath rebuilt(&scene);
+            rebuilt.Append(PTVertex::Camera(scene.eyePos), true);
+            for (int j = 1; j < camPath.count && camPath.verts[j].vertex.type != PTVertex::Type::Background; j++) {
+                rebuilt.Append(camPath.verts[j].vertex, true);
+                pdfMismatches += std::abs(rebuilt.verts[j].pdf - camPath.verts[j].pdf) > 1e-4f * camPath.verts[j].pdf;
+            }
+
+            //A random connection of the two, or the camera path itself if it hit a light.
+            int s = (int)(GetRandomFloat() * (lightPath.count + 1)), t = 2 + (int)(GetRandomFloat() * (camPath.count - 1));
+            if (t > camPath.count || s > lightPath.count || camPath.verts[t - 1].vertex.type == PTVertex::Type::Background)
+                continue;
+            if (s == 0 && !camPath.verts[t - 1].vertex.obj->m->hasEmission())
+                continue;
+            if (s > 0 && (lightPath.verts[s - 1].vertex.type == PTVertex::Type::Background || scene.ShadowCheck(lightPath.verts[s - 1].vertex, camPath.verts[t - 1].vertex)))
+                continue;
+            std::vector<PTVertex> V;
+            for (int j = 0; j < s; j++)
+                V.push_back(lightPath.verts[j].vertex);
+            for (int j = t - 1; j >= 1; j--)
+                V.push_back(camPath.verts[j].vertex);
+
+            float sum = MisWeightSum(scene, V, counts);
+            checked++;
+            total += sum;
+            maxError = std::max(maxError, (double)std::abs(sum - 1.0f));
+            wrong += std::abs(sum - 1.0f) > 1e-3f;
+        }
+        printf("%s: %d paths, mean weight sum %.6f, max error %.2e, %d off by over 1e-3, %d generated pdfs differ\n",
+            merge > 0.0f ? "connections + merges" : "connections", checked, total / std::max(checked, 1), maxError, wrong, pdfMismatches);
+    }
+}
+
+bool RunBenchmark(const std::string& name, const Scene& scene) {
+    if (name == "rays") {
+        RayBenchmark(scene);
+        return true;
+    }
+    if (name == "lights") {
+        LightBenchmark(scene);
+        return true;
+    }
+    if (name == "material") {
+        MaterialBenchmark();
+        return true;
+    }
+    if (name == "shading") {
+        ShadingBenchmark(scene);
+        return true;
+    }
+    if (name == "kernels") {
+        KernelBenchmark(scene);
+        return true;
+    }
+    if (name == "misweights") {
+        MisWeightBenchmark(scene);
+        return true;
+    }
+    printf("Unknown benchmark %s\n", name.c_str());
+    return false;
+}
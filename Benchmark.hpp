@@ -0,0 +1,15 @@
+#pragma once
+#include <string>
+#include "Scene.hpp"
+
+/*
+Micro benchmarks on the current scene, run with -benchmark <name> instead of rendering. Single threaded.
+rays: rays/sec of single ray traversal vs packet/stream traversal(4, 8, 16 lanes), for primary, shadow and diffuse bounce rays.
+material: time per path vertex of bsdf sampling, evaluation and pdf, per material type.
+kernels: each SIMD level of the dispatched kernels(see CpuDispatch.hpp) against the generic ones, speed and bit exactness.
+shading: bsdf work of ray hits shaded one by one vs binned by material into batches(see WavefrontPathTracer.hpp), time and IPC.
+misweights: MIS weights of every connection and merge of the same path summing to 1, on paths BDPT samples.
+lights: cost and variance of one light sample of direct lighting per LightSamplerType, against sampling every light(-lights N for many).
+Returns false for an unknown name.
+*/
+bool RunBenchmark(const std::string& name, const Scene& scene);
@@ -0,0 +1,111 @@
+#include "BlueNoise.hpp"
+#include "global.hpp"
+#include <vector>
+#include <cstdint>
+#include <cmath>
+
+#define BLUE_NOISE_SIGMA 1.5f
+#define BLUE_NOISE_INITIAL_FRACTION 10  //1 in this many pixels set in the initial pattern.
+
+namespace {
+/*Binary pattern on the torus, with the gaussian energy of its set pixels kept up to date at every pixel.*/
+class VoidAndCluster {
+public:
+    static const int N = BLUE_NOISE_SIZE * BLUE_NOISE_SIZE;
+
+    VoidAndCluster() : set(N, 0), energy(N, 0.0f), kernel(N) {
+        for (int y = 0; y < BLUE_NOISE_SIZE; y++) {
+            for (int x = 0; x < BLUE_NOISE_SIZE; x++) {
+                int dx = std::min(x, BLUE_NOISE_SIZE - x), dy = std::min(y, BLUE_NOISE_SIZE - y);
+                kernel[y * BLUE_NOISE_SIZE + x] = std::exp(-(dx * dx + dy * dy) / (2.0f * BLUE_NOISE_SIGMA * BLUE_NOISE_SIGMA));
+            }
+        }
+    }
+
+    void Flip(int p) {
+        set[p] ^= 1;
+        float sign = set[p] ? 1.0f : -1.0f;
+        int px = p % BLUE_NOISE_SIZE, py = p / BLUE_NOISE_SIZE;
+        for (int y = 0; y < BLUE_NOISE_SIZE; y++) {
+            int ky = ((y - py) & (BLUE_NOISE_SIZE - 1)) * BLUE_NOISE_SIZE;
+            for (int x = 0; x < BLUE_NOISE_SIZE; x++)
+                energy[y * BLUE_NOISE_SIZE + x] += sign * kernel[ky + ((x - px) & (BLUE_NOISE_SIZE - 1))];
+        }
+    }
+
+    //Set pixel with the most energy around it.
+    int TightestCluster() const {
+        int best = -1;
+        for (int p = 0; p < N; p++)
+            if (set[p] && (best < 0 || energy[p] > energy[best]))
+                best = p;
+        return best;
+    }
+
+    //Unset pixel with the least energy around it.
+    int LargestVoid() const {
+        int best = -1;
+        for (int p = 0; p < N; p++)
+            if (!set[p] && (best < 0 || energy[p] < energy[best]))
+                best = p;
+        return best;
+    }
+
+    std::vector<uint8_t> set;
+    std::vector<float> energy;
+    std::vector<float> kernel;  //Gaussian of the toroidal offset.
+};
+}
+
+static std::vector<float> BuildBlueNoise() {
+    const int N = VoidAndCluster::N;
+    VoidAndCluster pattern;
+
+    //Initial pattern: random pixels, then moved from clusters to voids until that doesn't change anything.
+    auto savedRndState = s_RndState;
+    ResetRandom(PixelSampleSeed(0, BLUE_NOISE_SIZE));
+    int ones = 0;
+    while (ones < N / BLUE_NOISE_INITIAL_FRACTION) {
+        int p = (int)(XorShift32() % N);
+        if (!pattern.set[p]) {
+            pattern.Flip(p);
+            ones++;
+        }
+    }
+    s_RndState = savedRndState;
+    for (int i = 0; i < N; i++) {
+        int cluster = pattern.TightestCluster();
+        pattern.Flip(cluster);
+        int hole = pattern.LargestVoid();
+        if (hole == cluster) {
+            pattern.Flip(cluster);
+            break;
+        }
+        pattern.Flip(hole);
+    }
+
+    std::vector<int> rank(N);
+    //Ranks below the initial pattern: take out its tightest clusters first.
+    VoidAndCluster removing = pattern;
+    for (int r = ones - 1; r >= 0; r--) {
+        int p = removing.TightestCluster();
+        removing.Flip(p);
+        rank[p] = r;
+    }
+    //Above it: fill the largest voids.
+    for (int r = ones; r < N; r++) {
+        int p = pattern.LargestVoid();
+        pattern.Flip(p);
+        rank[p] = r;
+    }
+
+    std::vector<float> tile(N);
+    for (int p = 0; p < N; p++)
+        tile[p] = (rank[p] + 0.5f) / N;
+    return tile;
+}
+
+const float* BlueNoiseTile() {
+    static const std::vector<float> tile = BuildBlueNoise();
+    return tile.data();
+}
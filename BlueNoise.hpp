@@ -0,0 +1,10 @@
+#pragma once
+
+#define BLUE_NOISE_SIZE 64      //Tile is BLUE_NOISE_SIZE x BLUE_NOISE_SIZE, a power of two so it wraps with a mask.
+
+/*
+Tileable blue noise by void and cluster(Ulichney 1993): every value in (0,1) is used once, and each threshold
+level is spread as evenly as possible, also across the tile's borders. Built on first use, the same every run.
+Row major, BLUE_NOISE_SIZE x BLUE_NOISE_SIZE.
+*/
+const float* BlueNoiseTile();
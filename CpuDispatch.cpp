@@ -0,0 +1,276 @@
+#include "CpuDispatch.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <iostream>
+#include <limits>
+#include "RayPacket.hpp"
+#include "Triangle.hpp"
+#if defined(CPU_DISPATCH)
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#endif
+
+#define TONE_MAP_BLOCK 64   //Pixels converted per batch by the SIMD tone mapping.
+
+bool ParseCpuIsa(const std::string& name, CpuIsa& out) {
+    if (name == "generic") out = CpuIsa::Generic;
+    else if (name == "sse42") out = CpuIsa::SSE42;
+    else if (name == "avx2") out = CpuIsa::AVX2;
+    else if (name == "avx512") out = CpuIsa::AVX512;
+    else return false;
+    return true;
+}
+
+const char* CpuIsaName(CpuIsa isa) {
+    switch (isa) {
+    case CpuIsa::Generic: return "generic";
+    case CpuIsa::SSE42: return "sse42";
+    case CpuIsa::AVX2: return "avx2";
+    case CpuIsa::AVX512: return "avx512";
+    }
+    return "?";
+}
+
+CpuIsa DetectCpuIsa() {
+#if defined(CPU_DISPATCH)
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_SSE4_2))
+        return CpuIsa::Generic;
+    //AVX registers also need the OS to save them on context switches, which xgetbv tells.
+    if (!(ecx & bit_OSXSAVE) || !(ecx & bit_AVX))
+        return CpuIsa::SSE42;
+    unsigned int xcr0Low, xcr0High;
+    __asm__("xgetbv" : "=a"(xcr0Low), "=d"(xcr0High) : "c"(0));
+    const unsigned int ymmState = 0x6, zmmState = 0xe6;
+    if ((xcr0Low & ymmState) != ymmState || !__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) || !(ebx & bit_AVX2))
+        return CpuIsa::SSE42;
+    if ((xcr0Low & zmmState) != zmmState || !(ebx & bit_AVX512F))
+        return CpuIsa::AVX2;
+    return CpuIsa::AVX512;
+#else
+    return CpuIsa::Generic;
+#endif
+}
+
+/*The 8 bit value SaveFloatImageToJpg has always written.*/
+static unsigned char ToneMapByte(float x) {
+    return (unsigned char)(255 * std::pow(std::clamp(x, 0.f, 1.f), 0.6f));
+}
+
+/*
+thresholds[k] is the smallest x in [0, 1] that maps to byte k or more, found by bisecting the float bit patterns.
+ToneMapByte only goes up with x, so these give its exact value with a couple of compares.
+*/
+static const float* ToneMapThresholds() {
+    static const std::vector<float> thresholds = []() {
+        std::vector<float> t(257);
+        t[0] = -std::numeric_limits<float>::infinity();
+        t[256] = std::numeric_limits<float>::infinity();
+        uint32_t oneBits;
+        float oneF = 1.0f;
+        std::memcpy(&oneBits, &oneF, sizeof(float));
+        for (int k = 1; k < 256; k++) {
+            uint32_t low = 0, high = oneBits;
+            while (low < high) {
+                uint32_t mid = low + (high - low) / 2;
+                float x;
+                std::memcpy(&x, &mid, sizeof(float));
+                if (ToneMapByte(x) >= k)
+                    high = mid;
+                else
+                    low = mid + 1;
+            }
+            std::memcpy(&t[k], &low, sizeof(float));
+        }
+        return t;
+    }();
+    return thresholds.data();
+}
+
+/*Exact byte of x(already clamped, not NaN), from a guess that is off by a little.*/
+static inline unsigned char ToneMapFixup(float x, int guess) {
+    static const float* thresholds = ToneMapThresholds();
+    int b = std::clamp(guess, 0, 255);
+    while (x >= thresholds[b + 1])
+        b++;
+    while (x < thresholds[b])
+        b--;
+    return (unsigned char)b;
+}
+
+static uint32_t PacketBoundsHitGeneric(const RayPacket& packet, const Bounds3& b, const float* tFar, uint32_t mask) {
+    //Same math as Bounds3::IntersectP, one lane per iteration.
+    //Run over whole groups of 4 lanes, unused lanes are copies of lane 0 and masked off.
+    //Branch free per lane, and the mask is packed in a second loop, so the first one vectorizes.
+    int lanes = std::min(RAY_PACKET_MAX, (packet.count + 3) & ~3);
+    uint8_t hit[RAY_PACKET_MAX];
+    for (int i = 0; i < lanes; i++) {
+        float t1 = (b.pMin.x - packet.ox[i]) * packet.ix[i], t2 = (b.pMax.x - packet.ox[i]) * packet.ix[i];
+        float nmin = std::max(std::numeric_limits<float>::min(), std::min(t1, t2));
+        float nmax = std::min(std::numeric_limits<float>::max(), std::max(t1, t2));
+        t1 = (b.pMin.y - packet.oy[i]) * packet.iy[i]; t2 = (b.pMax.y - packet.oy[i]) * packet.iy[i];
+        nmin = std::max(nmin, std::min(t1, t2)); nmax = std::min(nmax, std::max(t1, t2));
+        t1 = (b.pMin.z - packet.oz[i]) * packet.iz[i]; t2 = (b.pMax.z - packet.oz[i]) * packet.iz[i];
+        nmin = std::max(nmin, std::min(t1, t2)); nmax = std::min(nmax, std::max(t1, t2));
+        hit[i] = (nmax > 0.0f) & (nmin <= nmax) & (nmin <= tFar[i]);
+    }
+    uint32_t result = 0;
+    for (int i = 0; i < lanes; i++)
+        result |= (uint32_t)hit[i] << i;
+    return result & mask;
+}
+
+static uint32_t PacketTriangleHitGeneric(const RayPacket& packet, const Triangle& tri, uint32_t mask, float* t) {
+    uint32_t result = 0;
+    for (int i = 0; i < packet.count; i++) {
+        if (!(mask & (1u << i)))
+            continue;
+        t[i] = tri.IntersectDistance(*packet.rays[i], packet.culling[i]);
+        if (!(t[i] < 0.0f))
+            result |= 1u << i;
+    }
+    return result;
+}
+
+static void ToneMapRowGeneric(const Vector3f* src, unsigned char* dst, int count) {
+    for (int i = 0; i < count; i++) {
+        dst[i * 3 + 0] = ToneMapByte(src[i].x);
+        dst[i * 3 + 1] = ToneMapByte(src[i].y);
+        dst[i * 3 + 2] = ToneMapByte(src[i].z);
+    }
+}
+
+#if defined(CPU_DISPATCH)
+KERNEL_TARGET_BEGIN("sse4.2,popcnt")
+namespace Sse42Kernels {
+struct Lanes {
+    using F = __m128;
+    using M = __m128;
+    static const int Width = 4;
+    static F Load(const float* p) { return _mm_loadu_ps(p); }
+    static void Store(float* p, F a) { _mm_storeu_ps(p, a); }
+    static void StoreInt(int* p, F a) { _mm_storeu_si128((__m128i*)p, _mm_cvttps_epi32(a)); }
+    static F Set1(float a) { return _mm_set1_ps(a); }
+    static F Add(F a, F b) { return _mm_add_ps(a, b); }
+    static F Sub(F a, F b) { return _mm_sub_ps(a, b); }
+    static F Mul(F a, F b) { return _mm_mul_ps(a, b); }
+    static F Div(F a, F b) { return _mm_div_ps(a, b); }
+    static F Sqrt(F a) { return _mm_sqrt_ps(a); }
+    static F Abs(F a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+    //Operand order picks what std::min(a, b) and std::max(a, b) would, NaN included.
+    static F Min(F a, F b) { return _mm_min_ps(b, a); }
+    static F Max(F a, F b) { return _mm_max_ps(b, a); }
+    static M Lt(F a, F b) { return _mm_cmplt_ps(a, b); }
+    static M Le(F a, F b) { return _mm_cmple_ps(a, b); }
+    static M Gt(F a, F b) { return _mm_cmpgt_ps(a, b); }
+    static M And(M a, M b) { return _mm_and_ps(a, b); }
+    static M Or(M a, M b) { return _mm_or_ps(a, b); }
+    static uint32_t Bits(M m) { return (uint32_t)_mm_movemask_ps(m); }
+};
+#include "KernelsSimd.inl"
+}
+KERNEL_TARGET_END
+
+KERNEL_TARGET_BEGIN("avx2")
+namespace Avx2Kernels {
+struct Lanes {
+    using F = __m256;
+    using M = __m256;
+    static const int Width = 8;
+    static F Load(const float* p) { return _mm256_loadu_ps(p); }
+    static void Store(float* p, F a) { _mm256_storeu_ps(p, a); }
+    static void StoreInt(int* p, F a) { _mm256_storeu_si256((__m256i*)p, _mm256_cvttps_epi32(a)); }
+    static F Set1(float a) { return _mm256_set1_ps(a); }
+    static F Add(F a, F b) { return _mm256_add_ps(a, b); }
+    static F Sub(F a, F b) { return _mm256_sub_ps(a, b); }
+    static F Mul(F a, F b) { return _mm256_mul_ps(a, b); }
+    static F Div(F a, F b) { return _mm256_div_ps(a, b); }
+    static F Sqrt(F a) { return _mm256_sqrt_ps(a); }
+    static F Abs(F a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+    static F Min(F a, F b) { return _mm256_min_ps(b, a); }
+    static F Max(F a, F b) { return _mm256_max_ps(b, a); }
+    static M Lt(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+    static M Le(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+    static M Gt(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+    static M And(M a, M b) { return _mm256_and_ps(a, b); }
+    static M Or(M a, M b) { return _mm256_or_ps(a, b); }
+    static uint32_t Bits(M m) { return (uint32_t)_mm256_movemask_ps(m); }
+};
+#include "KernelsSimd.inl"
+}
+KERNEL_TARGET_END
+
+KERNEL_TARGET_BEGIN("avx512f")
+namespace Avx512Kernels {
+struct Lanes {
+    using F = __m512;
+    using M = __mmask16;    //Compares give mask registers instead of vectors.
+    static const int Width = 16;
+    static F Load(const float* p) { return _mm512_loadu_ps(p); }
+    static void Store(float* p, F a) { _mm512_storeu_ps(p, a); }
+    static void StoreInt(int* p, F a) { _mm512_storeu_si512(p, _mm512_cvttps_epi32(a)); }
+    static F Set1(float a) { return _mm512_set1_ps(a); }
+    static F Add(F a, F b) { return _mm512_add_ps(a, b); }
+    static F Sub(F a, F b) { return _mm512_sub_ps(a, b); }
+    static F Mul(F a, F b) { return _mm512_mul_ps(a, b); }
+    static F Div(F a, F b) { return _mm512_div_ps(a, b); }
+    static F Sqrt(F a) { return _mm512_sqrt_ps(a); }
+    static F Abs(F a) { return _mm512_abs_ps(a); }
+    static F Min(F a, F b) { return _mm512_min_ps(b, a); }
+    static F Max(F a, F b) { return _mm512_max_ps(b, a); }
+    static M Lt(F a, F b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+    static M Le(F a, F b) { return _mm512_cmp_ps_mask(a, b, _CMP_LE_OQ); }
+    static M Gt(F a, F b) { return _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ); }
+    static M And(M a, M b) { return (M)(a & b); }
+    static M Or(M a, M b) { return (M)(a | b); }
+    static uint32_t Bits(M m) { return (uint32_t)m; }
+};
+#include "KernelsSimd.inl"
+}
+KERNEL_TARGET_END
+#endif
+
+KernelTable MakeKernelTable(CpuIsa isa) {
+#if !defined(CPU_DISPATCH)
+    isa = CpuIsa::Generic;
+#endif
+    KernelTable table = { isa, PacketBoundsHitGeneric, PacketTriangleHitGeneric, ToneMapRowGeneric };
+#if defined(CPU_DISPATCH)
+    switch (isa) {
+    case CpuIsa::SSE42:
+        table.packetBoundsHit = Sse42Kernels::PacketBoundsHit;
+        table.packetTriangleHit = Sse42Kernels::PacketTriangleHit;
+        table.toneMapRow = Sse42Kernels::ToneMapRow;
+        break;
+    case CpuIsa::AVX2:
+        table.packetBoundsHit = Avx2Kernels::PacketBoundsHit;
+        table.packetTriangleHit = Avx2Kernels::PacketTriangleHit;
+        table.toneMapRow = Avx2Kernels::ToneMapRow;
+        break;
+    case CpuIsa::AVX512:
+        table.packetBoundsHit = Avx512Kernels::PacketBoundsHit;
+        table.packetTriangleHit = Avx512Kernels::PacketTriangleHit;
+        table.toneMapRow = Avx512Kernels::ToneMapRow;
+        break;
+    default:
+        break;
+    }
+#endif
+    return table;
+}
+
+KernelTable s_Kernels = MakeKernelTable(CpuIsa::Generic);
+
+void SelectKernels(CpuIsa requested) {
+    CpuIsa detected = DetectCpuIsa();
+    s_Kernels = MakeKernelTable(std::min(requested, detected));
+    std::cout << "CPU supports " << CpuIsaName(detected) << ", using " << CpuIsaName(s_Kernels.isa) << " kernels";
+    if (s_Kernels.isa != requested)
+        std::cout << " (asked for " << CpuIsaName(requested) << ")";
+    std::cout << "\n";
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include "Vector.hpp"
+
+/*
+Runtime instruction set dispatch. One binary carries the hot kernels compiled for several x86 levels,
+and SelectKernels() points s_Kernels at the best one cpuid reports(or the one asked for with -isa).
+
+Every path gives bit identical results: the SIMD kernels do the same float operations in the same order as the
+generic code, and no FMA contraction is allowed in them, so a render farm mixing machines still merges cleanly.
+Only GCC/Clang on x86 build the extra paths(CPU_DISPATCH), elsewhere everything runs the generic kernels.
+*/
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define CPU_DISPATCH
+#endif
+
+#if defined(_MSC_VER)
+#define FORCE_INLINE __forceinline
+#else
+#define FORCE_INLINE inline __attribute__((always_inline))
+#endif
+
+/*
+Functions between KERNEL_TARGET_BEGIN(isa) and KERNEL_TARGET_END are compiled for isa, e.g. "avx2".
+Contraction must be off in there, as AVX-512 brings FMA along. GCC turns it off in the macro, clang has no push/pop for it,
+so files using the macros start with #pragma STDC FP_CONTRACT OFF under clang. Only use them under CPU_DISPATCH.
+*/
+#define KERNEL_PRAGMA_STR(x) #x
+#if defined(__clang__)
+#define KERNEL_TARGET_BEGIN(isa) _Pragma(KERNEL_PRAGMA_STR(clang attribute push(__attribute__((target(isa))), apply_to = function)))
+#define KERNEL_TARGET_END _Pragma("clang attribute pop")
+#else
+#define KERNEL_TARGET_BEGIN(isa) _Pragma("GCC push_options") _Pragma(KERNEL_PRAGMA_STR(GCC target(isa))) _Pragma("GCC optimize(\"fp-contract=off\")")
+#define KERNEL_TARGET_END _Pragma("GCC pop_options")
+#endif
+
+enum class CpuIsa {
+    Generic,
+    SSE42,
+    AVX2,
+    AVX512
+};
+
+bool ParseCpuIsa(const std::string& name, CpuIsa& out);
+const char* CpuIsaName(CpuIsa isa);
+
+/*Best level this CPU and OS support, from cpuid(and xgetbv for the AVX register state).*/
+CpuIsa DetectCpuIsa();
+
+struct RayPacket;
+class Bounds3;
+class Triangle;
+
+struct KernelTable {
+    CpuIsa isa = CpuIsa::Generic;
+    /*Lanes of mask whose ray hits b closer than tFar, see RayPacket::IntersectP.*/
+    uint32_t (*packetBoundsHit)(const RayPacket& packet, const Bounds3& b, const float* tFar, uint32_t mask);
+    /*Lanes of mask whose ray hits tri, with the distance in t[lane]. Same test as Triangle::IntersectDistance.*/
+    uint32_t (*packetTriangleHit)(const RayPacket& packet, const Triangle& tri, uint32_t mask, float* t);
+    /*count pixels to 8 bit RGB, clamped and gamma encoded like SaveFloatImageToJpg always did.*/
+    void (*toneMapRow)(const Vector3f* src, unsigned char* dst, int count);
+};
+
+/*Kernels of isa, which must be no higher than DetectCpuIsa(). Without CPU_DISPATCH every table is the generic one.*/
+KernelTable MakeKernelTable(CpuIsa isa);
+
+/*Generic kernels until SelectKernels() runs.*/
+extern KernelTable s_Kernels;
+
+/*
+Use requested if the CPU has it(pass DetectCpuIsa() for the best one), the best supported level below it otherwise, and log the choice.
+Call once at startup, before any thread is started.
+*/
+void SelectKernels(CpuIsa requested);
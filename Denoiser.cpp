@@ -0,0 +1,191 @@
+#include "Denoiser.hpp"
+#include "ImageIO.hpp"
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+
+static const float s_B3Spline[5] = { 1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+
+static inline float Luminance(const Vector3f& c) {
+    return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z;
+}
+
+void AovBuffers::Resize(size_t pixelCount) {
+    albedo.assign(pixelCount, Vector3f());
+    normal.assign(pixelCount, Vector3f());
+    depth.assign(pixelCount, 0.0f);
+}
+
+void AovBuffers::Save(int width, int height, const std::string& path) const {
+    float farthest = 0.0f;
+    for (float d : depth)
+        farthest = std::max(farthest, d);
+    std::vector<Vector3f> normalImage(normal.size()), depthImage(depth.size());
+    for (size_t i = 0; i < normal.size(); i++) {
+        normalImage[i] = depth[i] > 0.0f ? normal[i] * 0.5f + Vector3f(0.5f) : Vector3f();
+        depthImage[i] = Vector3f(farthest > 0.0f ? depth[i] / farthest : 0.0f);
+    }
+    SaveFloatImage(albedo, width, height, PassFileName(path, "albedo"));
+    SaveFloatImage(normalImage, width, height, PassFileName(path, "normal"));
+    SaveFloatImage(depthImage, width, height, PassFileName(path, "depth"));
+}
+
+std::vector<Vector3f> Denoise(const std::vector<Vector3f>& color, const AovBuffers& aov, int width, int height, ThreadPool* pool) {
+    size_t count = (size_t)width * height;
+    std::vector<Vector3f> albedo(count), current(count), next(count);
+    std::vector<float> sigma(count), depthGradient(count), guide(count);
+    const std::vector<float>& depth = aov.depth;
+
+    //Demodulate. Background keeps its color.
+    RunRanges(pool, (int)count, [&](int, int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            albedo[i] = depth[i] > 0.0f ? Vector3f::Max(aov.albedo[i], Vector3f(DENOISE_MIN_ALBEDO)) : Vector3f::One();
+            current[i] = color[i] / albedo[i];
+        }
+    });
+
+    //Noise level around every pixel(over 7x7, so single fireflies don't make it jump), and how much depth changes from one pixel to the next there.
+    RunRanges(pool, height, [&](int, int yBegin, int yEnd) {
+        for (int y = yBegin; y < yEnd; y++) {
+            for (int x = 0; x < width; x++) {
+                size_t i = (size_t)y * width + x;
+                float sum = 0.0f, sumSqr = 0.0f, gradient = 0.0f;
+                int n = 0;
+                for (int dy = -DENOISE_NOISE_RADIUS; dy <= DENOISE_NOISE_RADIUS; dy++) {
+                    for (int dx = -DENOISE_NOISE_RADIUS; dx <= DENOISE_NOISE_RADIUS; dx++) {
+                        int qx = x + dx, qy = y + dy;
+                        if (qx < 0 || qy < 0 || qx >= width || qy >= height)
+                            continue;
+                        size_t j = (size_t)qy * width + qx;
+                        float l = Luminance(current[j]);
+                        sum += l;
+                        sumSqr += l * l;
+                        n++;
+                        if (std::abs(dx) + std::abs(dy) == 1 && depth[j] > 0.0f)
+                            gradient = std::max(gradient, std::fabs(depth[j] - depth[i]));
+                    }
+                }
+                float mean = sum / n;
+                sigma[i] = DENOISE_SIGMA_COLOR * std::sqrt(std::max(sumSqr / n - mean * mean, 0.0f)) + 1e-4f;
+                depthGradient[i] = gradient;
+            }
+        }
+    });
+
+    for (int iteration = 0; iteration < DENOISE_ITERATIONS; iteration++) {
+        int step = 1 << iteration;
+        //Halving the color tolerance every pass keeps the wide late passes from smearing edges the early ones left.
+        float colorScale = 1.0f / step;
+        //Colors are compared blurred a bit, else a firefly differs from every neighbour and stays as it is.
+        RunRanges(pool, height, [&](int, int yBegin, int yEnd) {
+            for (int y = yBegin; y < yEnd; y++) {
+                for (int x = 0; x < width; x++) {
+                    float sum = 0.0f, weightSum = 0.0f;
+                    for (int dy = -1; dy <= 1; dy++) {
+                        for (int dx = -1; dx <= 1; dx++) {
+                            int qx = x + dx, qy = y + dy;
+                            if (qx < 0 || qy < 0 || qx >= width || qy >= height)
+                                continue;
+                            float w = s_B3Spline[dx + 2] * s_B3Spline[dy + 2];
+                            sum += Luminance(current[(size_t)qy * width + qx]) * w;
+                            weightSum += w;
+                        }
+                    }
+                    guide[(size_t)y * width + x] = sum / weightSum;
+                }
+            }
+        });
+        RunRanges(pool, height, [&](int, int yBegin, int yEnd) {
+            for (int y = yBegin; y < yEnd; y++) {
+                for (int x = 0; x < width; x++) {
+                    size_t i = (size_t)y * width + x;
+                    if (depth[i] <= 0.0f) {
+                        next[i] = current[i];
+                        continue;
+                    }
+                    const Vector3f& n = aov.normal[i];
+                    float z = depth[i];
+                    float l = guide[i];
+                    float invSigmaColor = 1.0f / (sigma[i] * colorScale);
+                    float depthScale = DENOISE_SIGMA_DEPTH * depthGradient[i] * step;
+                    Vector3f sum;
+                    float weightSum = 0.0f;
+                    for (int ky = -2; ky <= 2; ky++) {
+                        int qy = y + ky * step;
+                        if (qy < 0 || qy >= height)
+                            continue;
+                        for (int kx = -2; kx <= 2; kx++) {
+                            int qx = x + kx * step;
+                            if (qx < 0 || qx >= width)
+                                continue;
+                            size_t j = (size_t)qy * width + qx;
+                            if (depth[j] <= 0.0f)
+                                continue;
+                            float cosNormal = DotProduct(n, aov.normal[j]);
+                            if (cosNormal <= 0.0f)
+                                continue;
+                            float distance = std::fabs(z - depth[j]) / (depthScale * (std::abs(kx) + std::abs(ky)) + 1e-3f * z)
+                                + std::fabs(l - guide[j]) * invSigmaColor;
+                            float w = s_B3Spline[kx + 2] * s_B3Spline[ky + 2] * std::pow(cosNormal, DENOISE_SIGMA_NORMAL) * std::exp(-distance);
+                            sum += current[j] * w;
+                            weightSum += w;
+                        }
+                    }
+                    next[i] = sum / weightSum;
+                }
+            }
+        });
+        std::swap(current, next);
+    }
+
+    RunRanges(pool, (int)count, [&](int, int begin, int end) {
+        for (int i = begin; i < end; i++)
+            current[i] = current[i] * albedo[i];
+    });
+    return current;
+}
+
+ImageError CompareImages(const std::vector<Vector3f>& image, const std::vector<Vector3f>& reference) {
+    ImageError error;
+    size_t count = std::min(image.size(), reference.size());
+    if (count == 0)
+        return error;
+    double sqrSum = 0.0, relSum = 0.0;
+    for (size_t i = 0; i < count; i++) {
+        for (int c = 0; c < 3; c++) {
+            double r = reference[i][c];
+            double d = image[i][c] - r;
+            sqrSum += d * d;
+            relSum += d * d / (r * r + 0.01);
+        }
+    }
+    error.rmse = std::sqrt(sqrSum / (count * 3));
+    error.relMse = relSum / (count * 3);
+    return error;
+}
+
+bool LoadReferenceImage(const std::string& path, int width, int height, std::vector<Vector3f>& out) {
+    auto reader = ImageRowReader::Open(path);
+    if (!reader) {
+        std::cout << "Can't read reference image " << path << "(ppm, pgm or pfm)\n";
+        return false;
+    }
+    if (reader->Width() != width || reader->Height() != height) {
+        std::cout << "Reference image " << path << " is " << reader->Width() << "x" << reader->Height() << ", the render " << width << "x" << height << "\n";
+        return false;
+    }
+    int channels = reader->Channels();
+    std::vector<float> row((size_t)width * channels);
+    out.resize((size_t)width * height);
+    for (int y = 0; y < height; y++) {
+        if (!reader->ReadRow(y, row.data())) {
+            std::cout << "Reference image " << path << " ends early\n";
+            return false;
+        }
+        for (int x = 0; x < width; x++) {
+            const float* p = &row[(size_t)x * channels];
+            out[(size_t)y * width + x] = channels >= 3 ? Vector3f(p[0], p[1], p[2]) : Vector3f(p[0]);
+        }
+    }
+    return true;
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <vector>
+#include <string>
+#include "Vector.hpp"
+#include "ThreadPool.hpp"
+
+/*
+Edge avoiding A-Trous wavelet denoiser(Dammertz et al. 2010), guided by auxiliary buffers of the first hits.
+
+Color is divided by the albedo first, so textures and material edges aren't blurred along with the noise, and multiplied back at the end.
+What's left is filtered DENOISE_ITERATIONS times with a 5x5 B3 spline kernel whose taps are 1, 2, 4, ... pixels apart,
+every tap weighted down by how far its normal, depth and color are from the center pixel's. The color tolerance follows
+the noise around each pixel(standard deviation of its neighbourhood), and shrinks with every pass, like the paper's.
+Each pass splits rows over the threads of the pool.
+*/
+#define DENOISE_ITERATIONS 5
+#define DENOISE_SIGMA_COLOR 2.0f        //Color differences tolerated, in standard deviations of the noise.
+#define DENOISE_NOISE_RADIUS 3          //The noise is measured over this many pixels around.
+#define DENOISE_SIGMA_NORMAL 64.0f      //Exponent of the cosine between normals.
+#define DENOISE_SIGMA_DEPTH 1.0f        //Depth differences tolerated, relative to what the depth gradient predicts.
+#define DENOISE_MIN_ALBEDO 0.01f        //Albedo is clamped to this when dividing by it.
+#define AOV_SPECULAR_BOUNCES 4          //Mirror like bounces AOV rays follow to the first rough surface.
+
+/*What the camera ray of every pixel hits first, through mirrors and clear glass. Rendered along with color when asked for, see FrameRequest.*/
+struct AovBuffers {
+    std::vector<Vector3f> albedo;   //Diffuse color for plastic, 1 for rough metal, rough glass and lights, 0 on the background.
+    std::vector<Vector3f> normal;   //Shading normal, normal map included.
+    std::vector<float> depth;       //Distance along the camera ray and its mirror bounces, 0 on the background.
+
+    void Resize(size_t pixelCount);
+    /*Albedo, 0.5 + 0.5 normal and depth scaled to 1 at the farthest hit, into PassFileName(path, "albedo"/"normal"/"depth").*/
+    void Save(int width, int height, const std::string& path) const;
+};
+
+/*Denoised color, same size. Background pixels(depth 0) are copied as they are.*/
+std::vector<Vector3f> Denoise(const std::vector<Vector3f>& color, const AovBuffers& aov, int width, int height, ThreadPool* pool);
+
+struct ImageError {
+    double rmse = 0.0;
+    double relMse = 0.0;    //Mean of (x - ref)^2 / (ref^2 + 0.01), so dark and bright areas count alike.
+};
+
+ImageError CompareImages(const std::vector<Vector3f>& image, const std::vector<Vector3f>& reference);
+
+/*Read a ppm, pgm or pfm of width x height, gray ones into all three channels. False with a message if it can't.*/
+bool LoadReferenceImage(const std::string& path, int width, int height, std::vector<Vector3f>& out);
@@ -0,0 +1,304 @@
+#include "Distributed.hpp"
+#include <cstdio>
+#include <filesystem>
+#include <thread>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <condition_variable>
+#include <random>
+#include "ImageIO.hpp"
+
+namespace fs = std::filesystem;
+
+static std::string JobFile(const std::string& directory, int jobIndex, const char* suffix) {
+    return (fs::path(directory) / ("job_" + std::to_string(jobIndex) + suffix)).string();
+}
+
+static std::string MergeClaimFile(const std::string& directory) {
+    return (fs::path(directory) / "merge.claim").string();
+}
+
+static long long NowSeconds() {
+    return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+/*Tells this process' temporary files apart from the other processes' in the same directory.*/
+static const std::string& ProcessToken() {
+    static const std::string token = std::to_string(std::random_device()()) + std::to_string(NowSeconds());
+    return token;
+}
+
+/*Claims hold the time of their last heartbeat. Exclusive creation fails if the claim exists, the heartbeat replaces it atomically.*/
+static bool WriteClaim(const std::string& path, bool exclusive) {
+    auto target = exclusive ? path : path + "." + ProcessToken() + ".tmp";
+    FILE* f = std::fopen(target.c_str(), exclusive ? "wx" : "w");
+    if (f == nullptr)
+        return false;
+    std::fprintf(f, "%lld\n", NowSeconds());
+    std::fclose(f);
+    if (exclusive)
+        return true;
+    std::error_code ec;
+    fs::rename(target, path, ec);
+    return !ec;
+}
+
+/*Seconds since the claim's last heartbeat, -1 if there is no claim.*/
+static long long ClaimAge(const std::string& path) {
+    FILE* f = std::fopen(path.c_str(), "r");
+    if (f == nullptr)
+        return -1;
+    long long time = 0;
+    bool read = std::fscanf(f, "%lld", &time) == 1;
+    std::fclose(f);
+    if (!read) {
+        //Created but not written yet, or its owner died in between. Fall back to the file's age.
+        std::error_code ec;
+        auto written = fs::last_write_time(path, ec);
+        if (ec)
+            return -1;
+        return std::chrono::duration_cast<std::chrono::seconds>(fs::file_time_type::clock::now() - written).count();
+    }
+    return NowSeconds() - time;
+}
+
+/*
+Atomically create the claim at path. Only one process could succeed, even on a shared file system.
+A claim without a heartbeat for timeout seconds belongs to a dead process and is taken over. Two processes taking over the same one
+at once may both render the job, which only costs time: both write the same bits.
+*/
+static bool TryClaim(const std::string& path, int timeout) {
+    if (WriteClaim(path, true))
+        return true;
+    long long age = ClaimAge(path);
+    if (age >= 0 && age < timeout)
+        return false;
+    if (age >= 0) {
+        std::cout << "Taking over " << path << ", no heartbeat for " << age << "s\n";
+        std::error_code ec;
+        fs::remove(path, ec);
+    }
+    return WriteClaim(path, true);
+}
+
+static void ReleaseClaim(const std::string& path) {
+    std::error_code ec;
+    fs::remove(path, ec);
+}
+
+/*Rewrites a claim every DIST_HEARTBEAT_SECONDS from its own thread while alive, so the other processes know its owner is still working.*/
+class ClaimHeartbeat {
+public:
+    explicit ClaimHeartbeat(const std::string& path) :path(path) {
+        thread = std::thread([this]() {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (!wake.wait_for(lock, std::chrono::seconds(DIST_HEARTBEAT_SECONDS), [this]() { return stop; }))
+                WriteClaim(this->path, false);
+        });
+    }
+
+    ~ClaimHeartbeat() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        wake.notify_one();
+        thread.join();
+    }
+
+private:
+    std::string path;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stop = false;
+    std::thread thread;
+};
+
+static std::vector<int> MissingJobs(const std::string& directory, int jobCount) {
+    std::vector<int> missing;
+    for (int i = 0; i < jobCount; i++) {
+        if (!fs::exists(JobFile(directory, i, ".acc")))
+            missing.push_back(i);
+    }
+    return missing;
+}
+
+static void PrintMissingJobs(const std::string& directory, const std::vector<int>& missing) {
+    std::cout << missing.size() << " jobs missing in " << directory << ":\n";
+    for (int i : missing) {
+        long long age = ClaimAge(JobFile(directory, i, ".claim"));
+        std::cout << "  job " << i << ": ";
+        if (age < 0)
+            std::cout << "not claimed\n";
+        else
+            std::cout << "claimed, last heartbeat " << age << "s ago\n";
+    }
+}
+
+RenderJob MakeDistributedJob(int height, int spp, int jobCount, int jobIndex, bool splitTiles) {
+    RenderJob job;
+    job.sppTotal = spp;
+    if (splitTiles) {
+        //Keep job boundaries on tile boundaries.
+        int tileCount = (height + TILE_HEIGHT - 1) / TILE_HEIGHT;
+        job.sppBegin = 0;
+        job.sppEnd = spp;
+        job.yBegin = std::min(height, (int)((long long)tileCount * jobIndex / jobCount) * TILE_HEIGHT);
+        job.yEnd = std::min(height, (int)((long long)tileCount * (jobIndex + 1) / jobCount) * TILE_HEIGHT);
+    }
+    else {
+        job.sppBegin = (int)((long long)spp * jobIndex / jobCount);
+        job.sppEnd = (int)((long long)spp * (jobIndex + 1) / jobCount);
+        job.yBegin = 0;
+        job.yEnd = height;
+    }
+    return job;
+}
+
+static bool RenderAndStoreJob(RenderSession& session, int spp, IntegratorType integrator, const DistributedOptions& options, int jobIndex) {
+    ClaimHeartbeat heartbeat(JobFile(options.directory, jobIndex, ".claim"));
+    const Scene& scene = session.GetScene();
+    RenderJob job = MakeDistributedJob(scene.height, spp, options.jobCount, jobIndex, options.splitTiles);
+    std::cout << "Job " << jobIndex << ": samples [" << job.sppBegin << ", " << job.sppEnd << "), rows [" << job.yBegin << ", " << job.yEnd << ")\n";
+
+    auto partial = session.RenderPartial(job, integrator);
+
+    //Write to a temporary name first, so a merging process never sees a half written file.
+    auto tmp = JobFile(options.directory, jobIndex, ".acc.tmp");
+    if (!partial.Save(tmp)) {
+        std::cout << "Failed to write " << tmp << "\n";
+        return false;
+    }
+    std::error_code ec;
+    fs::rename(tmp, JobFile(options.directory, jobIndex, ".acc"), ec);
+    if (ec)
+        std::cout << "Failed to rename " << tmp << ": " << ec.message() << "\n";
+    return !ec;
+}
+
+void RunDistributedRender(const Scene& scene, int spp, int thread_count, IntegratorType integrator, const DistributedOptions& options, const std::string& outputFileName, bool writePasses) {
+    std::error_code ec;
+    fs::create_directories(options.directory, ec);
+
+    if (options.mergeOnly) {
+        MergePartialAccumulations(options.directory, options.jobCount, outputFileName, writePasses, options.mergeTimeout);
+        return;
+    }
+
+    //One session for every job this process claims, so threads are created once.
+    RenderSession session(scene, thread_count);
+    bool failed = false;
+    for (int i = 0; i < options.jobCount; i++) {
+        if (options.jobIndex >= 0 && i != options.jobIndex)
+            continue;
+        auto claim = JobFile(options.directory, i, ".claim");
+        //A job asked for by -job is rendered even if someone else holds it.
+        if (!TryClaim(claim, options.claimTimeout) && options.jobIndex < 0)
+            continue;
+        if (!RenderAndStoreJob(session, spp, integrator, options, i)) {
+            //Let another process retry it, instead of leaving a claim nobody will finish.
+            std::cout << "Job " << i << " failed, releasing it\n";
+            ReleaseClaim(claim);
+            failed = true;
+        }
+    }
+
+    //The last process to finish merges. The others still rendering will see the missing job and skip this.
+    auto missing = MissingJobs(options.directory, options.jobCount);
+    auto mergeClaim = MergeClaimFile(options.directory);
+    if (!failed && missing.empty() && TryClaim(mergeClaim, options.claimTimeout)) {
+        bool merged;
+        {
+            ClaimHeartbeat heartbeat(mergeClaim);
+            merged = MergePartialAccumulations(options.directory, options.jobCount, outputFileName, writePasses, 0);
+        }
+        if (!merged)
+            ReleaseClaim(mergeClaim);
+    }
+    else if (!missing.empty()) {
+        std::cout << "Jobs still running elsewhere, they will be merged by the last process to finish.\n";
+        PrintMissingJobs(options.directory, missing);
+    }
+}
+
+bool MergePartialAccumulations(const std::string& directory, int jobCount, const std::string& outputFileName, bool writePasses, int waitSeconds) {
+    auto missing = MissingJobs(directory, jobCount);
+    auto lastProgress = std::chrono::steady_clock::now();
+    while (!missing.empty()) {
+        if (std::chrono::steady_clock::now() - lastProgress >= std::chrono::seconds(waitSeconds)) {
+            if (waitSeconds > 0)
+                std::cout << "No job finished in the last " << waitSeconds << "s, giving up\n";
+            PrintMissingJobs(directory, missing);
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        auto stillMissing = MissingJobs(directory, jobCount);
+        if (stillMissing.size() < missing.size())
+            lastProgress = std::chrono::steady_clock::now();
+        missing = stillMissing;
+    }
+
+    int width = 0, height = 0;
+    AccumBuffer camera, light;
+    std::vector<int> rowSpp;
+    bool hasLight = false;
+    for (int i = 0; i < jobCount; i++) {
+        PartialAccumulation partial;
+        auto path = JobFile(directory, i, ".acc");
+        if (!partial.Load(path)) {
+            std::cout << "Failed to read " << path << "\n";
+            return false;
+        }
+        if (i == 0) {
+            width = partial.width;
+            height = partial.height;
+            camera.resize((size_t)width * height);
+            light.resize((size_t)width * height);
+            rowSpp.resize(height, 0);
+        }
+        else if (partial.width != width || partial.height != height) {
+            std::cout << path << " has a different resolution\n";
+            return false;
+        }
+        for (int y = partial.yBegin; y < partial.yEnd; y++) {
+            rowSpp[y] += partial.sppEnd - partial.sppBegin;
+            for (int x = 0; x < width; x++) {
+                camera[(size_t)y * width + x] += partial.camera[(size_t)(y - partial.yBegin) * width + x];
+            }
+        }
+        if (!partial.light.empty()) {
+            hasLight = true;
+            for (size_t j = 0; j < light.size(); j++) {
+                light[j] += partial.light[j];
+            }
+        }
+    }
+
+    int spp = rowSpp.empty() ? 0 : rowSpp[0];
+    for (int y = 0; y < height; y++) {
+        if (rowSpp[y] != spp) {
+            std::cout << "Row " << y << " has " << rowSpp[y] << " samples, expected " << spp << ". Jobs don't cover the frame evenly.\n";
+            return false;
+        }
+    }
+
+    std::vector<Vector3f> cameraPass(camera.size()), lightPass(light.size()), framebuffer(camera.size());
+    for (size_t j = 0; j < camera.size(); j++) {
+        cameraPass[j] = camera[j].Resolve(spp);
+        lightPass[j] = light[j].Resolve(spp);
+        //Same order of float adds as Renderer::Render, camera first then light.
+        framebuffer[j] = cameraPass[j];
+        if (hasLight)
+            framebuffer[j] += lightPass[j];
+    }
+
+    std::cout << "Merged " << jobCount << " jobs, " << spp << " spp\n";
+    if (writePasses) {
+        SaveFloatImage(cameraPass, width, height, PassFileName(outputFileName, "camera"));
+        if (hasLight)
+            SaveFloatImage(lightPass, width, height, PassFileName(outputFileName, "light"));
+    }
+    SaveFloatImage(framebuffer, width, height, outputFileName);
+    return true;
+}
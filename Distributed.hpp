@@ -0,0 +1,41 @@
+#pragma once
+#include <string>
+#include "Scene.hpp"
+#include "Renderer.hpp"
+
+#define DIST_HEARTBEAT_SECONDS 5
+#define DIST_CLAIM_TIMEOUT 60          //Seconds without a heartbeat before a claim is taken over.
+#define DIST_MERGE_TIMEOUT 600         //Seconds -merge waits without any job finishing.
+
+/*
+Splitting one frame across several processes or machines.
+
+All processes are started with the same scene and arguments, plus a shared directory. The frame is cut into jobCount jobs,
+either by sample range(every process renders the whole image with fewer samples) or by tile rows.
+Processes claim jobs by exclusively creating job_<k>.claim in the directory, and write the fixed point result to job_<k>.acc.
+A claim holds a heartbeat timestamp, refreshed while its job renders. One without a heartbeat for claimTimeout seconds
+was left by a dead process, and is taken over by the next process to look.
+Whoever finishes the last job merges all of them into the final image, which is bit-identical to a single process render
+with the same spp, since every sample has its own seed and sums are fixed point.
+
+No network service is needed, only a directory every process could see.
+*/
+struct DistributedOptions {
+    std::string directory;
+    int jobCount = 1;
+    bool splitTiles = false;    //Split by tile rows instead of sample ranges.
+    int jobIndex = -1;          //Render only this job. -1 claims jobs from the directory until none is left.
+    bool mergeOnly = false;     //Don't render, wait for all jobs and merge.
+    int claimTimeout = DIST_CLAIM_TIMEOUT;
+    int mergeTimeout = DIST_MERGE_TIMEOUT;
+};
+
+RenderJob MakeDistributedJob(int height, int spp, int jobCount, int jobIndex, bool splitTiles);
+
+void RunDistributedRender(const Scene& scene, int spp, int thread_count, IntegratorType integrator, const DistributedOptions& options, const std::string& outputFileName, bool writePasses);
+
+/*
+Merge job_0.acc ... job_<jobCount-1>.acc in directory. Waits for missing ones until waitSeconds pass without any job finishing,
+then lists them and fails.
+*/
+bool MergePartialAccumulations(const std::string& directory, int jobCount, const std::string& outputFileName, bool writePasses, int waitSeconds);
@@ -13,14 +13,17 @@ inline float Visibility(float vn, float vh, float roughness) {
 	return 2.0f / (1 + std::sqrt(1.0f + roughness * roughness * tan2));
 }
 
-/*GGX D term. Indicate given N, H, roughness, how much */
-inline float GGXTerm(float ndoth, float roughness) {
+/*GGX D term. Indicate given N, H, roughness, how much
+tan^2 comes from |N x H|^2 instead of 1 - cos^2: near the peak of a smooth lobe 1 - cos^2 is about roughness^2,
+which float dot products can't resolve, and D would be off by several percent.*/
+inline float GGXTerm(const Vector3f& n, const Vector3f& h, float roughness) {
 	float a2 = roughness * roughness;
-	float costheta = ndoth;
+	float costheta = DotProduct(n, h);
 	float costheta2 = costheta * costheta;
 	float cosehta4 = costheta2 * costheta2;
 
-	float tangenttheta2 = (1.0f - costheta2) / costheta2;
+	//A ratio, so it doesn't depend on |h|. cos^4 below does, h still has to be unit length.
+	float tangenttheta2 = CrossProduct(n, h).SqrMagnitude() / costheta2;
 	float denominator_partb = a2 + tangenttheta2;
 	denominator_partb = denominator_partb * denominator_partb;
 
@@ -31,7 +34,7 @@ inline float GGXTerm(float ndoth, float roughness) {
 
 /*Given normal and microsurface normal(half direction), calculate probablity of the microsurface.*/
 inline float GGXHalfPDF(Vector3f n, Vector3f h, float roughness) {
-	return GGXTerm(abs(DotProduct(n, h)), roughness) * abs(DotProduct(n, h));
+	return GGXTerm(n, h, roughness) * std::abs(DotProduct(n, h));
 }
 
 /*Convert smoothness to roughness*/
@@ -40,11 +43,10 @@ inline float SmoothnessToRoughenss(float smoothness) {
 }
 
 /*
-Given normal and roughness, generate a half dir sample.
+Given normal and roughness, the half dir for uniform numbers d1, d2.
 GGX paper(35)(36)
 */
-inline Vector3f SampleGGXSpecularH(Vector3f N, float roughness) {
-	float d1 = GetRandomFloat(), d2 = GetRandomFloat();
+inline Vector3f GGXSpecularH(Vector3f N, float roughness, float d1, float d2) {
 	float theta = std::atan2(roughness * std::sqrt(d1), std::sqrt(1.0f - d1));
 	float phi = 2.0f * M_PI * d2;
 	Vector3f microNLocal(
@@ -57,3 +59,58 @@ inline Vector3f SampleGGXSpecularH(Vector3f N, float roughness) {
 
 	return microNWorld;
 }
+
+/*Given normal and roughness, generate a half dir sample.*/
+inline Vector3f SampleGGXSpecularH(Vector3f N, float roughness) {
+	float d1 = GetRandomFloat(), d2 = GetRandomFloat();
+	return GGXSpecularH(N, roughness, d1, d2);
+}
+
+/*Smith masking of the whole microsurface seen from a direction at cos nv to the normal.*/
+inline float SmithG1(float nv, float roughness) {
+	float nv2 = nv * nv;
+	float tan2 = (1.0f - nv2) / nv2;
+	return 2.0f / (1 + std::sqrt(1.0f + roughness * roughness * tan2));
+}
+
+/*
+Given normal, view direction and roughness, the half dir for uniform numbers d1, d2, drawn from the normals wo can see
+(Heitz 2018, Sampling the GGX Distribution of Visible Normals). Facets turned away from wo, which reflect below the surface, are never picked.
+Works from whichever side of N wo is on.
+*/
+inline Vector3f GGXVisibleH(Vector3f N, const Vector3f& wo, float roughness, float d1, float d2) {
+	if (DotProduct(N, wo) < 0.0f)
+		N = -N;
+	Vector3f tangent = AnyPerpendicular(N), bitangent = CrossProduct(N, tangent);
+	//wo in the frame TransformVectorToWorld uses, stretched to roughness 1.
+	Vector3f v = Vector3f(roughness * DotProduct(wo, tangent), roughness * DotProduct(wo, bitangent), DotProduct(wo, N)).Normalized();
+	float lenSqr = v.x * v.x + v.y * v.y;
+	Vector3f t1 = lenSqr > 0.0f ? Vector3f(-v.y, v.x, 0.0f) / std::sqrt(lenSqr) : Vector3f(1.0f, 0.0f, 0.0f);
+	Vector3f t2 = CrossProduct(v, t1);
+	//Point on the disk, squeezed onto the part of the hemisphere v sees.
+	float r = std::sqrt(d1), phi = 2.0f * M_PI * d2;
+	float p1 = r * std::cos(phi), p2 = r * std::sin(phi);
+	float s = 0.5f * (1.0f + v.z);
+	p2 = (1.0f - s) * std::sqrt(std::max(0.0f, 1.0f - p1 * p1)) + s * p2;
+	Vector3f h = p1 * t1 + p2 * t2 + std::sqrt(std::max(0.0f, 1.0f - p1 * p1 - p2 * p2)) * v;
+	//Unstretch.
+	return TransformVectorToWorld(Vector3f(roughness * h.x, roughness * h.y, std::max(0.0f, h.z)), N).Normalized();
+}
+
+inline Vector3f SampleGGXVisibleH(Vector3f N, const Vector3f& wo, float roughness) {
+	float d1 = GetRandomFloat(), d2 = GetRandomFloat();
+	return GGXVisibleH(N, wo, roughness, d1, d2);
+}
+
+/*Probablity of GGXVisibleH drawing h for wo: G1(wo) max(0, wo.h) D(h) / |wo.n|, h taken on wo's side.*/
+inline float GGXVisibleHalfPDF(Vector3f n, const Vector3f& wo, const Vector3f& h, float roughness) {
+	float nv = DotProduct(n, wo);
+	float vh = DotProduct(wo, h);
+	if (nv == 0.0f)
+		return 0.0f;
+	if (DotProduct(n, h) * nv < 0.0f)
+		vh = -vh;
+	if (vh <= 0.0f)
+		return 0.0f;
+	return SmithG1(std::abs(nv), roughness) * vh * GGXTerm(n, h, roughness) / std::abs(nv);
+}
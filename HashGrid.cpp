@@ -0,0 +1,69 @@
+#include "HashGrid.hpp"
+#include "ThreadPool.hpp"
+#include <atomic>
+#include <algorithm>
+#include <limits>
+
+void HashGrid::Build(const Vector3f* points, int count, float radius, ThreadPool* pool) {
+    this->radius = radius;
+    radiusSqr = radius * radius;
+    invCellSize = 1.0f / (2.0f * radius);
+    sortedX.resize(count);
+    sortedY.resize(count);
+    sortedZ.resize(count);
+    sortedIndices.resize(count);
+    if (count == 0)
+        return;
+
+    uint32_t tableSize = 1;
+    while (tableSize < (uint32_t)count)
+        tableSize <<= 1;
+    tableMask = tableSize - 1;
+
+    //Grid origin, so cell coordinates stay small and positive.
+    int threadCount = pool ? pool->ThreadCount() : 1;
+    std::vector<Vector3f> threadMin(threadCount, Vector3f(std::numeric_limits<float>::max()));
+    RunRanges(pool, count, [&](int threadIndex, int begin, int end) {
+        for (int i = begin; i < end; i++)
+            threadMin[threadIndex] = Vector3f::Min(threadMin[threadIndex], points[i]);
+    });
+    origin = threadMin[0];
+    for (auto& m : threadMin)
+        origin = Vector3f::Min(origin, m);
+
+    //Count points per bucket.
+    pointBuckets.resize(count);
+    std::vector<std::atomic<int>> counts(tableSize);
+    RunRanges(pool, count, [&](int /*threadIndex*/, int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            Vector3f local = (points[i] - origin) * invCellSize;
+            uint32_t bucket = Hash((int)std::floor(local.x), (int)std::floor(local.y), (int)std::floor(local.z));
+            pointBuckets[i] = bucket;
+            counts[bucket].fetch_add(1, std::memory_order_relaxed);
+        }
+    });
+
+    bucketStart.resize(tableSize + 1);
+    bucketStart[0] = 0;
+    for (uint32_t b = 0; b < tableSize; b++)
+        bucketStart[b + 1] = bucketStart[b] + counts[b].load(std::memory_order_relaxed);
+
+    //Scatter. Slots within a bucket are handed out in any order, so sort each bucket by index afterwards.
+    for (uint32_t b = 0; b < tableSize; b++)
+        counts[b].store(bucketStart[b], std::memory_order_relaxed);
+    RunRanges(pool, count, [&](int /*threadIndex*/, int begin, int end) {
+        for (int i = begin; i < end; i++)
+            sortedIndices[counts[pointBuckets[i]].fetch_add(1, std::memory_order_relaxed)] = i;
+    });
+    RunRanges(pool, (int)tableSize, [&](int /*threadIndex*/, int begin, int end) {
+        for (int b = begin; b < end; b++) {
+            std::sort(sortedIndices.begin() + bucketStart[b], sortedIndices.begin() + bucketStart[b + 1]);
+            for (int k = bucketStart[b]; k < bucketStart[b + 1]; k++) {
+                const Vector3f& p = points[sortedIndices[k]];
+                sortedX[k] = p.x;
+                sortedY[k] = p.y;
+                sortedZ[k] = p.z;
+            }
+        }
+    });
+}
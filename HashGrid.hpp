@@ -0,0 +1,65 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include "Vector.hpp"
+
+class ThreadPool;
+
+/*
+Fixed radius range queries over a point set, rebuilt from scratch whenever the points change(every VCM iteration).
+
+Cells are 2 x radius wide and hashed into a table about as large as the point count. Build is a parallel counting sort:
+hash every point, count per bucket, prefix sum, scatter, so the points of one bucket end up next to each other in memory,
+with their coordinates copied alongside as separate x, y, z arrays. A query then looks at the 2x2x2 cells around the point,
+each one contiguous run of floats the distance test streams through.
+Within a bucket points are kept in input order, so results don't depend on the thread count.
+*/
+class HashGrid {
+public:
+    /*pool may be nullptr to build on the calling thread.*/
+    void Build(const Vector3f* points, int count, float radius, ThreadPool* pool);
+
+    /*Calls f(index) for every point within radius of x, index being its position in the array given to Build().*/
+    template<typename F>
+    void Query(const Vector3f& x, F&& f) const {
+        if (sortedIndices.empty())
+            return;
+        Vector3f local = (x - origin) * invCellSize;
+        //The 8 cells nearest to x cover the whole ball, as cells are twice the radius.
+        int cx = (int)std::floor(local.x - 0.5f), cy = (int)std::floor(local.y - 0.5f), cz = (int)std::floor(local.z - 0.5f);
+        uint32_t visited[8];
+        int visitedCount = 0;
+        for (int i = 0; i < 8; i++) {
+            uint32_t bucket = Hash(cx + (i & 1), cy + ((i >> 1) & 1), cz + (i >> 2));
+            //Different cells can share a bucket, don't count its points twice.
+            bool seen = false;
+            for (int j = 0; j < visitedCount; j++)
+                seen |= visited[j] == bucket;
+            if (seen)
+                continue;
+            visited[visitedCount++] = bucket;
+            for (int k = bucketStart[bucket]; k < bucketStart[bucket + 1]; k++) {
+                float dx = sortedX[k] - x.x, dy = sortedY[k] - x.y, dz = sortedZ[k] - x.z;
+                if (dx * dx + dy * dy + dz * dz <= radiusSqr)
+                    f(sortedIndices[k]);
+            }
+        }
+    }
+
+    inline int Size() const { return (int)sortedIndices.size(); }
+    inline float Radius() const { return radius; }
+
+private:
+    inline uint32_t Hash(int x, int y, int z) const {
+        return ((uint32_t)x * 73856093u ^ (uint32_t)y * 19349663u ^ (uint32_t)z * 83492791u) & tableMask;
+    }
+
+    Vector3f origin;
+    float radius = 0.0f, radiusSqr = 0.0f, invCellSize = 0.0f;
+    uint32_t tableMask = 0;
+    std::vector<int> bucketStart;       //Table size + 1 entries, points of bucket b are [bucketStart[b], bucketStart[b + 1]).
+    std::vector<float> sortedX, sortedY, sortedZ;
+    std::vector<int> sortedIndices;
+    std::vector<uint32_t> pointBuckets; //Build scratch.
+};
@@ -0,0 +1,367 @@
+#include "ImageIO.hpp"
+#include "CpuDispatch.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <cctype>
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+/*
+Both formats are written little endian, which is what every platform we build for uses.
+Pfm marks it with a negative scale, exr is little endian by spec.
+*/
+
+static std::string ToLower(std::string s) {
+    std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+    return s;
+}
+
+ImageFormat ImageFormatFromPath(const std::string& path) {
+    auto dot = path.find_last_of('.');
+    if (dot == std::string::npos)
+        return ImageFormat::Jpg;
+    auto ext = ToLower(path.substr(dot + 1));
+    if (ext == "pfm")
+        return ImageFormat::Pfm;
+    if (ext == "exr")
+        return ImageFormat::Exr;
+    return ImageFormat::Jpg;
+}
+
+std::string PassFileName(const std::string& path, const std::string& passName) {
+    auto dot = path.find_last_of('.');
+    auto slash = path.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        return path + "." + passName;
+    return path.substr(0, dot) + "." + passName + path.substr(dot);
+}
+
+void SaveFloatImageToJpg(const std::vector<Vector3f>& framebuffer, int width, int height, const std::string& path) {
+    std::vector<unsigned char> normalizedBuffer((size_t)width * height * 3);
+    for (int y = 0; y < height; y++)
+        s_Kernels.toneMapRow(&framebuffer[(size_t)y * width], &normalizedBuffer[(size_t)y * width * 3], width);
+
+    stbi_write_jpg(path.c_str(), width, height, 3, &normalizedBuffer[0], 100);
+}
+
+/*Exr header bits.*/
+namespace {
+    const int ExrBlockHeaderSize = 8;  //int32 y + int32 data size.
+
+    template<typename T>
+    void Put(std::ostream& os, T v) {
+        os.write(reinterpret_cast<const char*>(&v), sizeof(T));
+    }
+
+    void PutString(std::ostream& os, const char* s) {
+        os.write(s, std::strlen(s) + 1);
+    }
+
+    void PutAttribute(std::ostream& os, const char* name, const char* type, int32_t size) {
+        PutString(os, name);
+        PutString(os, type);
+        Put<int32_t>(os, size);
+    }
+
+    /*Write header up to the start of the pixel data(for exr, up to the first scanline block).*/
+    void WriteImageHeader(std::ostream& os, ImageFormat format, int width, int height) {
+        if (format == ImageFormat::Pfm) {
+            os << "PF\n" << width << " " << height << "\n-1.0\n";
+            return;
+        }
+        Put<uint32_t>(os, 20000630);    //Magic number 0x762f3101.
+        Put<uint32_t>(os, 2);           //Version 2, single part scanline.
+
+        //Channels are stored in alphabetical order.
+        PutAttribute(os, "channels", "chlist", 3 * 18 + 1);
+        for (auto channel : { "B", "G", "R" }) {
+            PutString(os, channel);
+            Put<int32_t>(os, 2);        //FLOAT
+            Put<uint8_t>(os, 0);        //pLinear
+            Put<uint8_t>(os, 0); Put<uint8_t>(os, 0); Put<uint8_t>(os, 0);
+            Put<int32_t>(os, 1);        //xSampling
+            Put<int32_t>(os, 1);        //ySampling
+        }
+        Put<uint8_t>(os, 0);
+
+        PutAttribute(os, "compression", "compression", 1);
+        Put<uint8_t>(os, 0);            //NO_COMPRESSION, one scanline per block.
+
+        for (auto window : { "dataWindow", "displayWindow" }) {
+            PutAttribute(os, window, "box2i", 16);
+            Put<int32_t>(os, 0); Put<int32_t>(os, 0);
+            Put<int32_t>(os, width - 1); Put<int32_t>(os, height - 1);
+        }
+
+        PutAttribute(os, "lineOrder", "lineOrder", 1);
+        Put<uint8_t>(os, 0);            //INCREASING_Y
+
+        PutAttribute(os, "pixelAspectRatio", "float", 4);
+        Put<float>(os, 1.0f);
+
+        PutAttribute(os, "screenWindowCenter", "v2f", 8);
+        Put<float>(os, 0.0f); Put<float>(os, 0.0f);
+
+        PutAttribute(os, "screenWindowWidth", "float", 4);
+        Put<float>(os, 1.0f);
+
+        Put<uint8_t>(os, 0);            //End of header.
+
+        //Offset table, blocks have a fixed size so they are all known up front.
+        uint64_t blockSize = ExrBlockHeaderSize + (uint64_t)width * 3 * sizeof(float);
+        uint64_t firstBlock = (uint64_t)os.tellp() + (uint64_t)height * sizeof(uint64_t);
+        for (int y = 0; y < height; y++) {
+            Put<uint64_t>(os, firstBlock + y * blockSize);
+        }
+    }
+}
+
+StreamingImageWriter::StreamingImageWriter(ImageFormat format, int width, int height)
+    : format(format), width(width), height(height)
+{}
+
+std::unique_ptr<StreamingImageWriter> StreamingImageWriter::Open(const std::string& path, int width, int height) {
+    auto format = ImageFormatFromPath(path);
+    if (format == ImageFormat::Jpg)
+        return nullptr;
+
+    std::unique_ptr<StreamingImageWriter> writer(new StreamingImageWriter(format, width, height));
+    {
+        //Lay out the whole file with black pixels, so rows could be written back in any order later.
+        std::ofstream os(path, std::ios::binary | std::ios::trunc);
+        if (!os)
+            return nullptr;
+        WriteImageHeader(os, format, width, height);
+        writer->dataStart = os.tellp();
+        std::vector<float> zeros((size_t)width * 3, 0.0f);
+        for (int y = 0; y < height; y++) {
+            if (format == ImageFormat::Exr) {
+                Put<int32_t>(os, y);
+                Put<int32_t>(os, (int32_t)(zeros.size() * sizeof(float)));
+            }
+            os.write(reinterpret_cast<const char*>(zeros.data()), zeros.size() * sizeof(float));
+        }
+        if (!os)
+            return nullptr;
+    }
+    writer->file.open(path, std::ios::binary | std::ios::in | std::ios::out);
+    if (!writer->file)
+        return nullptr;
+    return writer;
+}
+
+std::streamoff StreamingImageWriter::RowOffset(int y) const {
+    std::streamoff rowBytes = (std::streamoff)width * 3 * sizeof(float);
+    if (format == ImageFormat::Pfm) {
+        //Pfm stores rows bottom to top.
+        return dataStart + (std::streamoff)(height - 1 - y) * rowBytes;
+    }
+    return dataStart + (std::streamoff)y * (rowBytes + ExrBlockHeaderSize) + ExrBlockHeaderSize;
+}
+
+void StreamingImageWriter::EncodeRow(const Vector3f* row, std::vector<float>& out) const {
+    out.resize((size_t)width * 3);
+    if (format == ImageFormat::Pfm) {
+        for (int x = 0; x < width; x++) {
+            out[x * 3 + 0] = row[x].x;
+            out[x * 3 + 1] = row[x].y;
+            out[x * 3 + 2] = row[x].z;
+        }
+    }
+    else {
+        //Exr scanline is planar, B then G then R.
+        for (int x = 0; x < width; x++) {
+            out[x] = row[x].z;
+            out[width + x] = row[x].y;
+            out[width * 2 + x] = row[x].x;
+        }
+    }
+}
+
+void StreamingImageWriter::DecodeRow(const std::vector<float>& in, Vector3f* row) const {
+    if (format == ImageFormat::Pfm) {
+        for (int x = 0; x < width; x++) {
+            row[x] = Vector3f(in[x * 3 + 0], in[x * 3 + 1], in[x * 3 + 2]);
+        }
+    }
+    else {
+        for (int x = 0; x < width; x++) {
+            row[x] = Vector3f(in[width * 2 + x], in[width + x], in[x]);
+        }
+    }
+}
+
+bool StreamingImageWriter::WriteRows(int y, int rowCount, const Vector3f* rows) {
+    std::vector<float> encoded;
+    std::lock_guard<std::mutex> lock(fileMutex);
+    for (int i = 0; i < rowCount; i++) {
+        EncodeRow(rows + (size_t)i * width, encoded);
+        file.seekp(RowOffset(y + i));
+        file.write(reinterpret_cast<const char*>(encoded.data()), encoded.size() * sizeof(float));
+    }
+    file.flush();
+    return (bool)file;
+}
+
+bool StreamingImageWriter::AccumulateRows(int y, int rowCount, const Vector3f* rows) {
+    std::vector<float> encoded((size_t)width * 3);
+    std::vector<Vector3f> row(width);
+    std::lock_guard<std::mutex> lock(fileMutex);
+    for (int i = 0; i < rowCount; i++) {
+        file.seekg(RowOffset(y + i));
+        file.read(reinterpret_cast<char*>(encoded.data()), encoded.size() * sizeof(float));
+        DecodeRow(encoded, row.data());
+        for (int x = 0; x < width; x++) {
+            row[x] += rows[(size_t)i * width + x];
+        }
+        EncodeRow(row.data(), encoded);
+        file.seekp(RowOffset(y + i));
+        file.write(reinterpret_cast<const char*>(encoded.data()), encoded.size() * sizeof(float));
+    }
+    file.flush();
+    return (bool)file;
+}
+
+static void SaveFloatImageLinear(const std::vector<Vector3f>& framebuffer, int width, int height, const std::string& path, ImageFormat format) {
+    std::ofstream os(path, std::ios::binary | std::ios::trunc);
+    if (!os) {
+        std::cout << "Failed to open " << path << " for writing\n";
+        return;
+    }
+    WriteImageHeader(os, format, width, height);
+    std::vector<float> row((size_t)width * 3);
+    for (int i = 0; i < height; i++) {
+        //Pfm is bottom to top, exr top to bottom.
+        int y = format == ImageFormat::Pfm ? height - 1 - i : i;
+        const Vector3f* src = &framebuffer[(size_t)y * width];
+        if (format == ImageFormat::Pfm) {
+            for (int x = 0; x < width; x++) {
+                row[x * 3 + 0] = src[x].x;
+                row[x * 3 + 1] = src[x].y;
+                row[x * 3 + 2] = src[x].z;
+            }
+        }
+        else {
+            Put<int32_t>(os, y);
+            Put<int32_t>(os, (int32_t)(row.size() * sizeof(float)));
+            for (int x = 0; x < width; x++) {
+                row[x] = src[x].z;
+                row[width + x] = src[x].y;
+                row[width * 2 + x] = src[x].x;
+            }
+        }
+        os.write(reinterpret_cast<const char*>(row.data()), row.size() * sizeof(float));
+    }
+}
+
+void SaveFloatImageToPfm(const std::vector<Vector3f>& framebuffer, int width, int height, const std::string& path) {
+    SaveFloatImageLinear(framebuffer, width, height, path, ImageFormat::Pfm);
+}
+
+void SaveFloatImageToExr(const std::vector<Vector3f>& framebuffer, int width, int height, const std::string& path) {
+    SaveFloatImageLinear(framebuffer, width, height, path, ImageFormat::Exr);
+}
+
+void SaveFloatImage(const std::vector<Vector3f>& framebuffer, int width, int height, const std::string& path) {
+    switch (ImageFormatFromPath(path)) {
+    case ImageFormat::Pfm:
+        SaveFloatImageToPfm(framebuffer, width, height, path);
+        break;
+    case ImageFormat::Exr:
+        SaveFloatImageToExr(framebuffer, width, height, path);
+        break;
+    default:
+        SaveFloatImageToJpg(framebuffer, width, height, path);
+        break;
+    }
+}
+
+//Next whitespace separated token of a ppm/pgm header, skipping # comments.
+static std::string HeaderToken(std::istream& is) {
+    std::string token;
+    int c;
+    while ((c = is.get()) != EOF) {
+        if (c == '#') {
+            while ((c = is.get()) != EOF && c != '\n');
+            continue;
+        }
+        if (std::isspace(c)) {
+            if (!token.empty())
+                break;
+            continue;
+        }
+        token += (char)c;
+    }
+    return token;
+}
+
+std::unique_ptr<ImageRowReader> ImageRowReader::Open(const std::string& path) {
+    std::unique_ptr<ImageRowReader> reader(new ImageRowReader());
+    auto& file = reader->file;
+    file.open(path, std::ios::binary);
+    if (!file)
+        return nullptr;
+    std::string magic = HeaderToken(file);
+    if (magic == "P6" || magic == "P5" || magic == "PF" || magic == "Pf") {
+        reader->pfm = magic[0] == 'P' && (magic[1] == 'F' || magic[1] == 'f');
+        reader->channels = (magic == "P6" || magic == "PF") ? 3 : 1;
+    }
+    else {
+        return nullptr;
+    }
+    try {
+        reader->width = std::stoi(HeaderToken(file));
+        reader->height = std::stoi(HeaderToken(file));
+        //The single whitespace after the last header value is eaten by HeaderToken.
+        float scale = std::stof(HeaderToken(file));
+        if (reader->pfm) {
+            reader->bits = 32;
+            reader->bigEndian = scale > 0.0f;
+        }
+        else {
+            reader->maxValue = scale;
+            reader->bits = scale > 255.0f ? 16 : 8;
+        }
+    }
+    catch (const std::exception&) {
+        return nullptr;
+    }
+    if (reader->width <= 0 || reader->height <= 0 || reader->maxValue <= 0.0f || reader->maxValue > 65535.0f)
+        return nullptr;
+    reader->dataStart = file.tellg();
+    reader->raw.resize((size_t)reader->width * reader->channels * (reader->bits / 8));
+    return reader;
+}
+
+bool ImageRowReader::ReadRow(int y, float* row) {
+    if (y < 0 || y >= height)
+        return false;
+    std::streamoff rowBytes = (std::streamoff)raw.size();
+    //Pfm stores rows bottom to top, like we write it.
+    file.seekg(dataStart + (std::streamoff)(pfm ? height - 1 - y : y) * rowBytes);
+    file.read(reinterpret_cast<char*>(raw.data()), rowBytes);
+    if (!file)
+        return false;
+    size_t count = (size_t)width * channels;
+    if (bits == 8) {
+        for (size_t i = 0; i < count; i++)
+            row[i] = raw[i] / maxValue;
+    }
+    else if (bits == 16) {
+        //Always big endian.
+        for (size_t i = 0; i < count; i++)
+            row[i] = ((raw[i * 2] << 8) | raw[i * 2 + 1]) / maxValue;
+    }
+    else {
+        for (size_t i = 0; i < count; i++) {
+            uint32_t b;
+            std::memcpy(&b, &raw[i * 4], 4);
+            if (bigEndian)
+                b = (b >> 24) | ((b >> 8) & 0xff00u) | ((b << 8) & 0xff0000u) | (b << 24);
+            std::memcpy(&row[i], &b, 4);
+        }
+    }
+    return true;
+}
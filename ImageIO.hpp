@@ -0,0 +1,90 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <fstream>
+#include <mutex>
+#include <memory>
+#include "Vector.hpp"
+
+enum class ImageFormat {
+    Jpg,
+    Pfm,    //Portable float map, linear RGB float32.
+    Exr     //OpenEXR, uncompressed scanline RGB float32.
+};
+
+/*Pick output format from file extension. Unknown extensions fall back to jpg.*/
+ImageFormat ImageFormatFromPath(const std::string& path);
+
+/*Insert a pass name before the extension, "out.exr" + "light" -> "out.light.exr"*/
+std::string PassFileName(const std::string& path, const std::string& passName);
+
+/*8-bit output, clamped and gamma-encoded for display. All HDR information is lost.*/
+void SaveFloatImageToJpg(const std::vector<Vector3f>& framebuffer, int width, int height, const std::string& path);
+
+void SaveFloatImageToPfm(const std::vector<Vector3f>& framebuffer, int width, int height, const std::string& path);
+
+void SaveFloatImageToExr(const std::vector<Vector3f>& framebuffer, int width, int height, const std::string& path);
+
+/*Save linear float buffer, format is decided by file extension.*/
+void SaveFloatImage(const std::vector<Vector3f>& framebuffer, int width, int height, const std::string& path);
+
+/*
+Writes a float image to disk a few rows at a time, so the whole image never needs to be resident.
+Both pfm and uncompressed exr have a fixed size per scanline, so the file is laid out completely on Open(),
+and every row has a known offset. Rows could then be written in any order, from any thread.
+
+Jpg can't be streamed, Open() returns nullptr for it and the caller should keep a full framebuffer instead.
+*/
+class StreamingImageWriter {
+public:
+    static std::unique_ptr<StreamingImageWriter> Open(const std::string& path, int width, int height);
+
+    /*Overwrite rows [y, y + rowCount). rows is rowCount * width pixels, top to bottom.*/
+    bool WriteRows(int y, int rowCount, const Vector3f* rows);
+
+    /*Read back rows [y, y + rowCount), add rows to them and write them again. Used to merge passes into a streamed image.*/
+    bool AccumulateRows(int y, int rowCount, const Vector3f* rows);
+
+    int Width() const { return width; }
+    int Height() const { return height; }
+
+private:
+    StreamingImageWriter(ImageFormat format, int width, int height);
+    std::streamoff RowOffset(int y) const;
+    void EncodeRow(const Vector3f* row, std::vector<float>& out) const;
+    void DecodeRow(const std::vector<float>& in, Vector3f* row) const;
+
+    ImageFormat format;
+    int width, height;
+    std::streamoff dataStart = 0;
+    std::fstream file;
+    std::mutex fileMutex;
+};
+
+/*
+Reads an image a row at a time, top to bottom, so a big texture never needs to be resident.
+Binary ppm(P6) and pgm(P5) at 8 or 16 bits per channel, and pfm(color or gray, rows come back flipped to top to bottom).
+*/
+class ImageRowReader {
+public:
+    /*nullptr if path can't be opened or isn't one of the formats above.*/
+    static std::unique_ptr<ImageRowReader> Open(const std::string& path);
+
+    /*Row y as Channels() floats per pixel, integer formats scaled to [0, 1]. Rows can be read in any order.*/
+    bool ReadRow(int y, float* row);
+
+    int Width() const { return width; }
+    int Height() const { return height; }
+    int Channels() const { return channels; }
+    int BitsPerChannel() const { return bits; }
+
+private:
+    ImageRowReader() = default;
+
+    std::ifstream file;
+    int width = 0, height = 0, channels = 0, bits = 0;
+    bool pfm = false, bigEndian = false;
+    float maxValue = 1.0f;
+    std::streamoff dataStart = 0;
+    std::vector<unsigned char> raw;
+};
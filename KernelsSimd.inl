@@ -0,0 +1,115 @@
+/*
+Kernel bodies shared by every SIMD level. CpuDispatch.cpp includes this once per level, inside a namespace that
+defines Lanes(the vector type and its operations) and under KERNEL_TARGET_BEGIN for that level.
+Each kernel mirrors the generic code operation for operation, so the results are the same bits.
+*/
+
+static uint32_t PacketBoundsHit(const RayPacket& packet, const Bounds3& b, const float* tFar, uint32_t mask) {
+    using F = Lanes::F;
+    using M = Lanes::M;
+    const F zero = Lanes::Set1(0.0f);
+    const F lowest = Lanes::Set1(std::numeric_limits<float>::min()), highest = Lanes::Set1(std::numeric_limits<float>::max());
+    const F minX = Lanes::Set1(b.pMin.x), minY = Lanes::Set1(b.pMin.y), minZ = Lanes::Set1(b.pMin.z);
+    const F maxX = Lanes::Set1(b.pMax.x), maxY = Lanes::Set1(b.pMax.y), maxZ = Lanes::Set1(b.pMax.z);
+    //Unused lanes are copies of lane 0, masked off at the end.
+    int lanes = std::min(RAY_PACKET_MAX, (packet.count + Lanes::Width - 1) & ~(Lanes::Width - 1));
+    uint32_t result = 0;
+    for (int i = 0; i < lanes; i += Lanes::Width) {
+        F o = Lanes::Load(packet.ox + i), inv = Lanes::Load(packet.ix + i);
+        F t1 = Lanes::Mul(Lanes::Sub(minX, o), inv), t2 = Lanes::Mul(Lanes::Sub(maxX, o), inv);
+        F nmin = Lanes::Max(lowest, Lanes::Min(t1, t2));
+        F nmax = Lanes::Min(highest, Lanes::Max(t1, t2));
+        o = Lanes::Load(packet.oy + i); inv = Lanes::Load(packet.iy + i);
+        t1 = Lanes::Mul(Lanes::Sub(minY, o), inv); t2 = Lanes::Mul(Lanes::Sub(maxY, o), inv);
+        nmin = Lanes::Max(nmin, Lanes::Min(t1, t2)); nmax = Lanes::Min(nmax, Lanes::Max(t1, t2));
+        o = Lanes::Load(packet.oz + i); inv = Lanes::Load(packet.iz + i);
+        t1 = Lanes::Mul(Lanes::Sub(minZ, o), inv); t2 = Lanes::Mul(Lanes::Sub(maxZ, o), inv);
+        nmin = Lanes::Max(nmin, Lanes::Min(t1, t2)); nmax = Lanes::Min(nmax, Lanes::Max(t1, t2));
+        M hit = Lanes::And(Lanes::And(Lanes::Gt(nmax, zero), Lanes::Le(nmin, nmax)), Lanes::Le(nmin, Lanes::Load(tFar + i)));
+        result |= Lanes::Bits(hit) << i;
+    }
+    return result & mask;
+}
+
+//a.b as DotProduct adds it up: (x + y) + z.
+static FORCE_INLINE Lanes::F Dot(Lanes::F ax, Lanes::F ay, Lanes::F az, Lanes::F bx, Lanes::F by, Lanes::F bz) {
+    return Lanes::Add(Lanes::Add(Lanes::Mul(ax, bx), Lanes::Mul(ay, by)), Lanes::Mul(az, bz));
+}
+
+static uint32_t PacketTriangleHit(const RayPacket& packet, const Triangle& tri, uint32_t mask, float* tOut) {
+    using F = Lanes::F;
+    using M = Lanes::M;
+    const F zero = Lanes::Set1(0.0f), one = Lanes::Set1(1.0f), epsilon = Lanes::Set1(EPSILON);
+    const F e1x = Lanes::Set1(tri.e1.x), e1y = Lanes::Set1(tri.e1.y), e1z = Lanes::Set1(tri.e1.z);
+    const F e2x = Lanes::Set1(tri.e2.x), e2y = Lanes::Set1(tri.e2.y), e2z = Lanes::Set1(tri.e2.z);
+    const F v0x = Lanes::Set1(tri.v0.x), v0y = Lanes::Set1(tri.v0.y), v0z = Lanes::Set1(tri.v0.z);
+    const F nx = Lanes::Set1(tri.normal.x), ny = Lanes::Set1(tri.normal.y), nz = Lanes::Set1(tri.normal.z);
+    const uint32_t widthMask = (uint32_t)((1ull << Lanes::Width) - 1);
+    int lanes = std::min(RAY_PACKET_MAX, (packet.count + Lanes::Width - 1) & ~(Lanes::Width - 1));
+    uint32_t result = 0;
+    for (int i = 0; i < lanes; i += Lanes::Width) {
+        F dx = Lanes::Load(packet.dx + i), dy = Lanes::Load(packet.dy + i), dz = Lanes::Load(packet.dz + i);
+        M miss = Lanes::Gt(Lanes::Mul(Dot(dx, dy, dz, nx, ny, nz), Lanes::Load(packet.cullSign + i)), zero);
+
+        //Triangle::IntersectDistance, all lanes to the end.
+        F px = Lanes::Sub(Lanes::Mul(dy, e2z), Lanes::Mul(dz, e2y));
+        F py = Lanes::Sub(Lanes::Mul(dz, e2x), Lanes::Mul(dx, e2z));
+        F pz = Lanes::Sub(Lanes::Mul(dx, e2y), Lanes::Mul(dy, e2x));
+        F det = Dot(e1x, e1y, e1z, px, py, pz);
+        miss = Lanes::Or(miss, Lanes::Lt(Lanes::Abs(det), epsilon));
+        F detInv = Lanes::Div(one, det);
+
+        F tx = Lanes::Sub(Lanes::Load(packet.ox + i), v0x);
+        F ty = Lanes::Sub(Lanes::Load(packet.oy + i), v0y);
+        F tz = Lanes::Sub(Lanes::Load(packet.oz + i), v0z);
+        F u = Lanes::Mul(Dot(tx, ty, tz, px, py, pz), detInv);
+        miss = Lanes::Or(miss, Lanes::Or(Lanes::Lt(u, zero), Lanes::Gt(u, one)));
+
+        F qx = Lanes::Sub(Lanes::Mul(ty, e1z), Lanes::Mul(tz, e1y));
+        F qy = Lanes::Sub(Lanes::Mul(tz, e1x), Lanes::Mul(tx, e1z));
+        F qz = Lanes::Sub(Lanes::Mul(tx, e1y), Lanes::Mul(ty, e1x));
+        F v = Lanes::Mul(Dot(dx, dy, dz, qx, qy, qz), detInv);
+        miss = Lanes::Or(miss, Lanes::Or(Lanes::Lt(v, zero), Lanes::Gt(Lanes::Add(u, v), one)));
+
+        F t = Lanes::Mul(Dot(e2x, e2y, e2z, qx, qy, qz), detInv);
+        miss = Lanes::Or(miss, Lanes::Lt(t, zero));
+        Lanes::Store(tOut + i, t);
+        result |= (~Lanes::Bits(miss) & widthMask) << i;
+    }
+    return result & mask;
+}
+
+/*
+255 * x^0.6 from square roots: 0.6 ~ 1/2 + 1/16 + 1/32 + 1/256 + 1/512. Within a byte of std::pow,
+ToneMapFixup() then moves it onto the exact value.
+*/
+static void ToneMapRow(const Vector3f* src, unsigned char* dst, int count) {
+    using F = Lanes::F;
+    const F zero = Lanes::Set1(0.0f), one = Lanes::Set1(1.0f), scale = Lanes::Set1(255.0f);
+    float values[TONE_MAP_BLOCK * 3];
+    int approx[TONE_MAP_BLOCK * 3];
+    for (int begin = 0; begin < count; begin += TONE_MAP_BLOCK) {
+        int pixels = std::min(TONE_MAP_BLOCK, count - begin);
+        //Interleaved like the output, padded with zeros to whole vectors.
+        for (int i = 0; i < pixels; i++) {
+            values[i * 3 + 0] = src[begin + i].x;
+            values[i * 3 + 1] = src[begin + i].y;
+            values[i * 3 + 2] = src[begin + i].z;
+        }
+        int n = pixels * 3, padded = (n + Lanes::Width - 1) & ~(Lanes::Width - 1);
+        for (int i = n; i < padded; i++)
+            values[i] = 0.0f;
+        for (int i = 0; i < padded; i += Lanes::Width) {
+            //Max first so NaN ends up as 0.
+            F x = Lanes::Min(Lanes::Max(zero, Lanes::Load(values + i)), one);
+            F s1 = Lanes::Sqrt(x);
+            F s2 = Lanes::Sqrt(s1), s3 = Lanes::Sqrt(s2), s4 = Lanes::Sqrt(s3), s5 = Lanes::Sqrt(s4);
+            F s6 = Lanes::Sqrt(s5), s7 = Lanes::Sqrt(s6), s8 = Lanes::Sqrt(s7), s9 = Lanes::Sqrt(s8);
+            F y = Lanes::Mul(Lanes::Mul(Lanes::Mul(s1, s4), Lanes::Mul(s5, s8)), s9);
+            Lanes::Store(values + i, x);
+            Lanes::StoreInt(approx + i, Lanes::Mul(y, scale));
+        }
+        for (int i = 0; i < n; i++)
+            dst[(size_t)begin * 3 + i] = ToneMapFixup(values[i], approx[i]);
+    }
+}
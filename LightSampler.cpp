@@ -0,0 +1,258 @@
+#include "LightSampler.hpp"
+#include "Scene.hpp"
+#include "Triangle.hpp"
+#include <algorithm>
+#include <cmath>
+
+bool ParseLightSamplerType(const std::string& name, LightSamplerType& out) {
+    if (name == "uniform") out = LightSamplerType::Uniform;
+    else if (name == "power") out = LightSamplerType::Power;
+    else if (name == "bvh") out = LightSamplerType::BVH;
+    else return false;
+    return true;
+}
+
+const char* LightSamplerName(LightSamplerType type) {
+    switch (type) {
+    case LightSamplerType::Uniform: return "uniform";
+    case LightSamplerType::Power: return "power";
+    case LightSamplerType::BVH: return "bvh";
+    }
+    return "?";
+}
+
+std::shared_ptr<LightSampler> LightSampler::Create(LightSamplerType type, const Scene& scene) {
+    switch (type) {
+    case LightSamplerType::Uniform: return std::make_shared<UniformLightSampler>(scene.m_emitters);
+    case LightSamplerType::Power: return std::make_shared<PowerLightSampler>(scene.m_emitters, scene.m_emitterTable);
+    case LightSamplerType::BVH: return std::make_shared<LightBVHSampler>(scene.m_emitters);
+    }
+    return nullptr;
+}
+
+//Whether primitive is emitters[primitive->emitterIndex], i.e. a light the sampler can return.
+static inline bool IsEmitterOf(const std::vector<Object*>& emitters, const Object* primitive) {
+    return primitive != nullptr && primitive->emitterIndex >= 0 && (size_t)primitive->emitterIndex < emitters.size()
+        && emitters[primitive->emitterIndex] == primitive;
+}
+
+Object* UniformLightSampler::Pick(const Vector3f&, const Vector3f&, float u, float* pmf) const {
+    if (emitters.empty()) {
+        *pmf = 0.0f;
+        return nullptr;
+    }
+    int i = std::min((int)emitters.size() - 1, (int)(u * emitters.size()));
+    *pmf = 1.0f / emitters.size();
+    return emitters[i];
+}
+
+float UniformLightSampler::Pmf(const Vector3f&, const Vector3f&, const Object* primitive) const {
+    return IsEmitterOf(emitters, primitive) ? 1.0f / emitters.size() : 0.0f;
+}
+
+Object* PowerLightSampler::Pick(const Vector3f&, const Vector3f&, float u, float* pmf) const {
+    if (table.Empty()) {
+        *pmf = 0.0f;
+        return nullptr;
+    }
+    return emitters[table.Sample(u, pmf)];
+}
+
+float PowerLightSampler::Pmf(const Vector3f&, const Vector3f&, const Object* primitive) const {
+    if (table.Empty() || !IsEmitterOf(emitters, primitive))
+        return 0.0f;
+    return table.Pmf(primitive->emitterIndex);
+}
+
+/* Light BVH */
+
+static inline float SafeSqrt(float v) { return std::sqrt(std::max(0.0f, v)); }
+static inline float SafeAcos(float v) { return std::acos(std::clamp(v, -1.0f, 1.0f)); }
+
+//cos(max(0, a - b)) and sin of the same, from sin and cos of a and b.
+static inline float CosSubClamped(float sinA, float cosA, float sinB, float cosB) {
+    return cosA > cosB ? 1.0f : cosA * cosB + sinA * sinB;
+}
+static inline float SinSubClamped(float sinA, float cosA, float sinB, float cosB) {
+    return cosA > cosB ? 0.0f : sinA * cosB - cosA * sinB;
+}
+
+//Rodrigues rotation of v by angle around unit axis k.
+static Vector3f Rotate(const Vector3f& v, const Vector3f& k, float angle) {
+    float c = std::cos(angle), s = std::sin(angle);
+    return v * c + CrossProduct(k, v) * s + k * (float)(DotProduct(k, v) * (1.0f - c));
+}
+
+float LightBounds::Importance(const Vector3f& x, const Vector3f& n) const {
+    if (power <= 0.0f)
+        return 0.0f;
+    Vector3f center = 0.5f * bounds.pMin + 0.5f * bounds.pMax;
+    Vector3f toPoint = x - center;
+    float radiusSqr = 0.25f * bounds.Diagonal().SqrMagnitude();
+    float distSqr = toPoint.SqrMagnitude();
+    float clampedDistSqr = std::max(distSqr, radiusSqr);
+    float dist = std::sqrt(distSqr);
+
+    //Angle the box takes up seen from x. Inside its bounding sphere, anything is possible.
+    float cosBound = -1.0f;
+    if (distSqr > radiusSqr)
+        cosBound = SafeSqrt(1.0f - radiusSqr / distSqr);
+    float sinBound = SafeSqrt(1.0f - cosBound * cosBound);
+
+    //Smallest angle between an emitter normal and the direction to x.
+    float cosW = dist > 0.0f ? (float)DotProduct(toPoint, axis) / dist : 1.0f;
+    float sinW = SafeSqrt(1.0f - cosW * cosW);
+    float sinN = SafeSqrt(1.0f - cosNormalAngle * cosNormalAngle);
+    float cosX = CosSubClamped(sinW, cosW, sinN, cosNormalAngle);
+    float sinX = SinSubClamped(sinW, cosW, sinN, cosNormalAngle);
+    float cosTheta = CosSubClamped(sinX, cosX, sinBound, cosBound);
+    if (cosTheta <= cosEmitAngle)
+        return 0.0f;
+
+    float importance = power * cosTheta / clampedDistSqr;
+
+    //Cosine at the receiver, either side since transmissive materials take light from behind.
+    if (dist > 0.0f) {
+        float cosI = std::abs((float)DotProduct(toPoint, n)) / dist;
+        float sinI = SafeSqrt(1.0f - cosI * cosI);
+        importance *= CosSubClamped(sinI, cosI, sinBound, cosBound);
+    }
+    return std::max(0.0f, importance);
+}
+
+LightBounds LightBounds::Union(const LightBounds& a, const LightBounds& b) {
+    if (a.power <= 0.0f)
+        return b;
+    if (b.power <= 0.0f)
+        return a;
+    LightBounds r;
+    r.bounds = ::Union(a.bounds, b.bounds);
+    r.power = a.power + b.power;
+    r.cosEmitAngle = std::min(a.cosEmitAngle, b.cosEmitAngle);
+
+    //Smallest cone holding both normal cones.
+    float thetaA = SafeAcos(a.cosNormalAngle), thetaB = SafeAcos(b.cosNormalAngle);
+    float thetaD = SafeAcos((float)DotProduct(a.axis, b.axis));
+    if (std::min(thetaD + thetaB, (float)M_PI) <= thetaA) {
+        r.axis = a.axis;
+        r.cosNormalAngle = a.cosNormalAngle;
+        return r;
+    }
+    if (std::min(thetaD + thetaA, (float)M_PI) <= thetaB) {
+        r.axis = b.axis;
+        r.cosNormalAngle = b.cosNormalAngle;
+        return r;
+    }
+    float thetaO = (thetaA + thetaD + thetaB) * 0.5f;
+    Vector3f rotationAxis = CrossProduct(a.axis, b.axis);
+    if (thetaO >= M_PI || rotationAxis.SqrMagnitude() == 0.0f) {
+        r.axis = a.axis;
+        r.cosNormalAngle = -1.0f;
+        return r;
+    }
+    r.axis = Rotate(a.axis, rotationAxis.Normalized(), thetaO - thetaA).Normalized();
+    r.cosNormalAngle = std::cos(thetaO);
+    return r;
+}
+
+LightBVHSampler::LightBVHSampler(const std::vector<Object*>& emitters) : emitters(emitters) {
+    emitterBounds.resize(emitters.size());
+    trails.resize(emitters.size());
+    std::vector<int> indices;
+    for (int i = 0; i < (int)emitters.size(); i++) {
+        auto e = emitters[i]->m->GetEmission();
+        LightBounds& lb = emitterBounds[i];
+        lb.bounds = emitters[i]->GetBounds();
+        lb.power = (0.2126f * e.x + 0.7152f * e.y + 0.0722f * e.z) * emitters[i]->getArea();
+        lb.cosEmitAngle = 0.0f;
+        if (auto tri = dynamic_cast<Triangle*>(emitters[i])) {
+            lb.axis = tri->normal;
+            lb.cosNormalAngle = 1.0f;
+        }
+        else {
+            //Spheres and such, lit in every direction.
+            lb.axis = Vector3f(0.0f, 0.0f, 1.0f);
+            lb.cosNormalAngle = -1.0f;
+        }
+        if (lb.power > 0.0f)
+            indices.push_back(i);
+    }
+    if (!indices.empty())
+        Build(indices, 0, (int)indices.size(), 0, 0);
+}
+
+int LightBVHSampler::Build(std::vector<int>& indices, int begin, int end, uint64_t trail, int depth) {
+    int index = (int)nodes.size();
+    nodes.emplace_back();
+    if (end - begin == 1) {
+        nodes[index].lb = emitterBounds[indices[begin]];
+        nodes[index].emitter = indices[begin];
+        trails[indices[begin]] = trail;
+        return index;
+    }
+
+    Bounds3 centroidBounds;
+    for (int i = begin; i < end; i++)
+        centroidBounds = Union(centroidBounds, emitterBounds[indices[i]].bounds.Centroid());
+    int axis = centroidBounds.maxExtent();
+    int mid = (begin + end) / 2;
+    std::nth_element(indices.begin() + begin, indices.begin() + mid, indices.begin() + end, [&](int a, int b) {
+        const Vector3f ca = emitterBounds[a].bounds.Centroid(), cb = emitterBounds[b].bounds.Centroid();
+        return ca[axis] < cb[axis];
+    });
+
+    //Median split halves every level, so depth stays way below 64 bits.
+    int left = Build(indices, begin, mid, trail, depth + 1);
+    int right = Build(indices, mid, end, trail | (1ull << depth), depth + 1);
+    nodes[index].child[0] = left;
+    nodes[index].child[1] = right;
+    nodes[index].lb = LightBounds::Union(nodes[left].lb, nodes[right].lb);
+    return index;
+}
+
+Object* LightBVHSampler::Pick(const Vector3f& x, const Vector3f& n, float u, float* pmf) const {
+    *pmf = 0.0f;
+    if (nodes.empty() || nodes[0].lb.Importance(x, n) <= 0.0f)
+        return nullptr;
+    int node = 0;
+    float p = 1.0f;
+    while (nodes[node].emitter < 0) {
+        float i0 = nodes[nodes[node].child[0]].lb.Importance(x, n);
+        float i1 = nodes[nodes[node].child[1]].lb.Importance(x, n);
+        if (i0 <= 0.0f && i1 <= 0.0f)
+            return nullptr;
+        float p0 = i0 / (i0 + i1);
+        if (u < p0) {
+            node = nodes[node].child[0];
+            u = std::min(u / p0, 0.99999994f);
+            p *= p0;
+        }
+        else {
+            node = nodes[node].child[1];
+            u = std::min((u - p0) / (1.0f - p0), 0.99999994f);
+            p *= 1.0f - p0;
+        }
+    }
+    *pmf = p;
+    return emitters[nodes[node].emitter];
+}
+
+float LightBVHSampler::Pmf(const Vector3f& x, const Vector3f& n, const Object* primitive) const {
+    if (nodes.empty() || !IsEmitterOf(emitters, primitive) || nodes[0].lb.Importance(x, n) <= 0.0f)
+        return 0.0f;
+    uint64_t trail = trails[primitive->emitterIndex];
+    int node = 0;
+    float p = 1.0f;
+    while (nodes[node].emitter < 0) {
+        float i0 = nodes[nodes[node].child[0]].lb.Importance(x, n);
+        float i1 = nodes[nodes[node].child[1]].lb.Importance(x, n);
+        if (i0 <= 0.0f && i1 <= 0.0f)
+            return 0.0f;
+        float p0 = i0 / (i0 + i1);
+        int side = trail & 1;
+        p *= side ? 1.0f - p0 : p0;
+        node = nodes[node].child[side];
+        trail >>= 1;
+    }
+    return nodes[node].emitter == primitive->emitterIndex ? p : 0.0f;
+}
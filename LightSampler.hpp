@@ -0,0 +1,96 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <string>
+#include "Vector.hpp"
+#include "Bounds3.hpp"
+#include "AliasTable.hpp"
+
+class Object;
+class Scene;
+
+enum class LightSamplerType {
+    Uniform,    //Every emissive primitive equally likely.
+    Power,      //Proportional to emitted power(Scene::m_emitterTable), O(1).
+    BVH         //Light BVH, by estimated contribution at the shading point, O(log n).
+};
+
+bool ParseLightSamplerType(const std::string& name, LightSamplerType& out);
+const char* LightSamplerName(LightSamplerType type);
+
+/*
+Picks one emissive primitive(Scene::m_emitters) for next event estimation at a shading point,
+so a vertex pays one shadow ray no matter how many lights the scene has.
+Pick and Pmf must agree: Pmf is also needed for MIS, when a bsdf sample hits a light.
+*/
+class LightSampler {
+public:
+    virtual ~LightSampler() {}
+
+    /*Emitter for shading point x with normal n, u in [0,1). nullptr(pmf 0) if no light can contribute.*/
+    virtual Object* Pick(const Vector3f& x, const Vector3f& n, float u, float* pmf) const = 0;
+    /*Probability Pick(x, n, ...) returns primitive.*/
+    virtual float Pmf(const Vector3f& x, const Vector3f& n, const Object* primitive) const = 0;
+
+    /*Built over scene.m_emitters, which must be filled already.*/
+    static std::shared_ptr<LightSampler> Create(LightSamplerType type, const Scene& scene);
+};
+
+class UniformLightSampler : public LightSampler {
+public:
+    UniformLightSampler(const std::vector<Object*>& emitters) : emitters(emitters) {}
+    Object* Pick(const Vector3f& x, const Vector3f& n, float u, float* pmf) const override;
+    float Pmf(const Vector3f& x, const Vector3f& n, const Object* primitive) const override;
+private:
+    std::vector<Object*> emitters;
+};
+
+class PowerLightSampler : public LightSampler {
+public:
+    PowerLightSampler(const std::vector<Object*>& emitters, const AliasTable& table) : emitters(emitters), table(table) {}
+    Object* Pick(const Vector3f& x, const Vector3f& n, float u, float* pmf) const override;
+    float Pmf(const Vector3f& x, const Vector3f& n, const Object* primitive) const override;
+private:
+    std::vector<Object*> emitters;
+    AliasTable table;
+};
+
+/*
+Bounds of a set of emitters, as seen from a shading point: box, total power, and a cone of normals.
+Emission of every emitter is within emitAngle of its own normal(pi/2 for one sided triangles).
+*/
+struct LightBounds {
+    Bounds3 bounds;
+    float power = 0.0f;
+    Vector3f axis;
+    float cosNormalAngle = 1.0f;    //All normals are within this of axis, -1 for any direction.
+    float cosEmitAngle = 0.0f;
+
+    /*Conservative estimate of the contribution to point x with normal n, 0 only if nothing inside can reach it.*/
+    float Importance(const Vector3f& x, const Vector3f& n) const;
+    static LightBounds Union(const LightBounds& a, const LightBounds& b);
+};
+
+/*
+Binary BVH over emitters, split at the median centroid of the longest axis like BVHAccel.
+Picking walks down choosing children by Importance(), so nearby, facing, bright lights are favoured.
+Each emitter stores its path from the root as bits, to get its pmf back by walking the same nodes.
+*/
+class LightBVHSampler : public LightSampler {
+public:
+    LightBVHSampler(const std::vector<Object*>& emitters);
+    Object* Pick(const Vector3f& x, const Vector3f& n, float u, float* pmf) const override;
+    float Pmf(const Vector3f& x, const Vector3f& n, const Object* primitive) const override;
+private:
+    struct Node {
+        LightBounds lb;
+        int child[2] = { -1, -1 };  //Both -1 for a leaf.
+        int emitter = -1;
+    };
+    int Build(std::vector<int>& indices, int begin, int end, uint64_t trail, int depth);
+
+    std::vector<Object*> emitters;
+    std::vector<LightBounds> emitterBounds;
+    std::vector<Node> nodes;
+    std::vector<uint64_t> trails;   //Per emitter, bit i is the child taken at depth i.
+};
@@ -0,0 +1,117 @@
+#include "LightVertexCache.hpp"
+#include "SceneRenderingHelper.hpp"
+#include <algorithm>
+
+int LightVertexCache::Build(const Scene* scene, const uint32_t* seeds, int pathCount, int connectionsPerVertex, AccumPixel* emissionBuffer) {
+    vertices.clear();
+    paths.clear();
+    entries.clear();
+    int bounces = 0;
+    BDPTPath lightPath(scene);
+    for (int i = 0; i < pathCount; i++) {
+        ResetRandom(seeds[i]);
+        lightPath.GenerateLightPath();
+        bounces += lightPath.count;
+        int first = (int)vertices.size();
+        int count = 0;
+        while (count < lightPath.count && lightPath.verts[count].vertex.type != PTVertex::Type::Background) {
+            vertices.push_back(lightPath.verts[count]);
+            count++;
+            if (count >= 2)
+                entries.push_back({ first, count });
+        }
+        paths.push_back({ first, count });
+    }
+    connectionCount = entries.empty() ? 0.0f : (float)connectionsPerVertex * pathCount / entries.size();
+
+    //Light tracing, once connectionCount is known for the MIS weights.
+    if (emissionBuffer == nullptr)
+        return bounces;
+    MisCounts counts;
+    counts.connection = connectionCount;
+    BDPTPath camera(scene);
+    camera.Append(PTVertex::Camera(scene->eyePos), true);
+    for (auto& p : paths) {
+        GetSubpath(p, lightPath);
+        for (int s = 1; s <= p.count; s++) {
+            auto pathWeight = Vector3f::Max(BDPTPath::PathWeight(lightPath.Sub(s), camera.Sub(1), counts), 0.0f);
+            auto light = lightPath[s - 1].Position();
+            auto lightRayHitCamera = (light - scene->eyePos).Normalized();
+            DrawToImage(Ray(light, lightRayHitCamera), emissionBuffer, pathWeight, scene->fov, scene->width, scene->height);
+        }
+    }
+    return bounces;
+}
+
+void LightVertexCache::GetSubpath(int index, BDPTPath& path) const {
+    GetSubpath(entries[index], path);
+}
+
+void LightVertexCache::GetSubpath(const Subpath& subpath, BDPTPath& path) const {
+    std::copy(vertices.begin() + subpath.first, vertices.begin() + subpath.first + subpath.count, path.verts);
+    path.count = subpath.count;
+}
+
+Vector3f BDPTLightCache(const Scene* scene, const RayDifferential& ray, const LightVertexCache& cache, int& outBounces)
+{
+    BDPTPath camPath(scene), noLight(scene), lightPoint(scene), cached(scene);
+    camPath.GenerateCameraPath(ray);
+    outBounces = camPath.count;
+
+    Intersection l;
+    float pdf;
+    if (scene->SampleEmitter(l, &pdf)) {
+        PTVertex v;
+        v.type = PTVertex::Type::Light;
+        v.x = l.coords;
+        v.N = l.normal;
+        v.Ng = l.normal;
+        v.obj = l.obj;
+        lightPoint.Append(v, true);
+    }
+
+    MisCounts counts;
+    counts.connection = cache.ConnectionCount();
+    Vector3f result;
+    for (int t = 2; t <= camPath.count; t++) {
+        auto camSub = camPath.Sub(t);
+        result += Vector3f::Max(BDPTPath::PathWeight(noLight.Sub(0), camSub, counts), 0.0f);
+        if (camSub.Last().Type() == PTVertex::Type::Background)
+            break;
+        if (lightPoint.count != 0)
+            result += Vector3f::Max(BDPTPath::PathWeight(lightPoint.Sub(1), camSub, counts), 0.0f);
+        if (cache.Size() == 0)
+            continue;
+        for (int i = 0; i < scene->lightCacheConnections; i++) {
+            int index = std::min(cache.Size() - 1, (int)(GetRandomFloat() * cache.Size()));
+            cache.GetSubpath(index, cached);
+            result += Vector3f::Max(BDPTPath::PathWeight(cached.Sub(cached.count), camSub, counts), 0.0f);
+        }
+    }
+    return result;
+}
+
+void LightCacheRenderTile(const Scene* scene, int yStart, int rowCount, int sppBegin, int sppEnd, AccumPixel* tile, AccumPixel* emissionBuffer, int& outBounces) {
+    outBounces = 0;
+    int width = scene->width;
+    int pixelCount = scene->width * scene->height;
+    int tilePixelCount = width * rowCount;
+    float scale = CalculateScale(scene->fov);
+    LightVertexCache cache;
+    std::vector<uint32_t> seeds(tilePixelCount);
+
+    for (int ispp = sppBegin; ispp < sppEnd; ispp++) {
+        //Light paths get seeds of their own, past the last pixel, so they don't repeat a camera sample's random numbers.
+        for (int j = 0; j < tilePixelCount; j++)
+            seeds[j] = PixelSampleSeed(pixelCount + yStart * width + j, ispp);
+        outBounces += cache.Build(scene, seeds.data(), tilePixelCount, scene->lightCacheConnections, emissionBuffer);
+
+        for (int j = 0; j < tilePixelCount; j++) {
+            int i = yStart * width + j;
+            ResetRandom(PixelSampleSeed(i, ispp));
+            int bounces;
+            tile[j].Add(BDPTLightCache(scene, CameraRay(scene->eyePos, i % width, i / width, scene->width, scene->height, scale), cache, bounces));
+            outBounces += bounces;
+        }
+    }
+}
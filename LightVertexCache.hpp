@@ -0,0 +1,53 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include "BDPT.hpp"
+
+/*
+Light vertex cache BDPT(Davidovic et al. 2014, "Progressive Light Transport Simulation on the GPU").
+
+BDPT() traces a fresh light path per camera sample, and connects every camera vertex to every vertex of it.
+Here light paths are traced up front into a pool, as many as there are camera samples, which then stays read only.
+Each camera vertex connects to Scene::lightCacheConnections vertices picked uniformly from the whole pool,
+so connection cost no longer grows with light path length, and light paths that die early cost nothing at connection time.
+- Light tracing(t = 1) is done once per cached path, when building.
+- s = 1(a point on a light) still takes a fresh light sample per camera path, light points are too few in the pool.
+- Connections with s >= 2 are taken ConnectionCount() times per camera path on average, which PathWeight weighs in.
+*/
+class LightVertexCache {
+public:
+    /*
+    Trace pathCount light paths into the cache, replacing what was there. Light path i starts from random state seeds[i].
+    Light tracing splats go to emissionBuffer, if given. Returns the number of extension rays traced.
+    */
+    int Build(const Scene* scene, const uint32_t* seeds, int pathCount, int connectionsPerVertex, AccumPixel* emissionBuffer);
+
+    /*Connections per camera vertex into the light subpaths of one light path: connectionsPerVertex x paths / cached vertices.*/
+    inline float ConnectionCount() const { return connectionCount; }
+    /*Vertices that could be picked, those after the light point.*/
+    inline int Size() const { return (int)entries.size(); }
+
+    /*Copies the light subpath ending at cached vertex index into path.*/
+    void GetSubpath(int index, BDPTPath& path) const;
+
+private:
+    struct Subpath {
+        int first;      //Index of its light point in vertices.
+        int count;
+    };
+    void GetSubpath(const Subpath& subpath, BDPTPath& path) const;
+
+    std::vector<BDPTPath::InternalPathVertex> vertices;     //Light paths back to back, background vertices left out.
+    std::vector<Subpath> paths;
+    std::vector<Subpath> entries;
+    float connectionCount = 0.0f;
+};
+
+/*One camera sample connecting into cache. Same as BDPT(), except light tracing which LightVertexCache::Build() does.*/
+Vector3f BDPTLightCache(const Scene* scene, const RayDifferential& ray, const LightVertexCache& cache, int& outBounces);
+
+/*
+Render samples [sppBegin, sppEnd) of rows [yStart, yStart + rowCount) into tile, one light vertex cache per sample index
+built from as many light paths as the tile has pixels. outBounces is the number of extension rays traced.
+*/
+void LightCacheRenderTile(const Scene* scene, int yStart, int rowCount, int sppBegin, int sppEnd, AccumPixel* tile, AccumPixel* emissionBuffer, int& outBounces);
@@ -0,0 +1,212 @@
+#include "MLT.hpp"
+#include "Scene.hpp"
+#include "BDPT.hpp"
+#include "ThreadPool.hpp"
+#include "AliasTable.hpp"
+#include "SceneRenderingHelper.hpp"
+#include "Sampler.hpp"
+#include <algorithm>
+#include <cmath>
+
+//Inverse error function(Giles 2010), turns a uniform number into a normally distributed small step.
+static float ErfInv(float x) {
+    x = std::clamp(x, -.99999f, .99999f);
+    float w = -std::log((1.0f - x) * (1.0f + x));
+    float p;
+    if (w < 5.0f) {
+        w = w - 2.5f;
+        p = 2.81022636e-08f;
+        p = 3.43273939e-07f + p * w;
+        p = -3.5233877e-06f + p * w;
+        p = -4.39150654e-06f + p * w;
+        p = 0.00021858087f + p * w;
+        p = -0.00125372503f + p * w;
+        p = -0.00417768164f + p * w;
+        p = 0.246640727f + p * w;
+        p = 1.50140941f + p * w;
+    }
+    else {
+        w = std::sqrt(w) - 3.0f;
+        p = -0.000200214257f;
+        p = 0.000100950558f + p * w;
+        p = 0.00134934322f + p * w;
+        p = -0.00367342844f + p * w;
+        p = 0.00573950773f + p * w;
+        p = -0.0076224613f + p * w;
+        p = 0.00943887047f + p * w;
+        p = 1.00167406f + p * w;
+        p = 2.83297682f + p * w;
+    }
+    return p * x;
+}
+
+PrimarySampleSource::PrimarySampleSource(uint32_t seed) : rndState(seed == 0 ? 1 : seed) {
+}
+
+float PrimarySampleSource::Uniform() {
+    //XorShift32, on the chain's own state.
+    rndState ^= rndState << 13;
+    rndState ^= rndState >> 17;
+    rndState ^= rndState << 15;
+    return std::min(rndState * (1.0f / 4294967296.0f), 0.99999994f);
+}
+
+float PrimarySampleSource::Next() {
+    EnsureReady(index);
+    return samples[index++].value;
+}
+
+void PrimarySampleSource::StartIteration() {
+    iteration++;
+    largeStep = Uniform() < MLT_LARGE_STEP_PROB;
+    index = 0;
+}
+
+void PrimarySampleSource::Accept() {
+    if (largeStep)
+        lastLargeStepIteration = iteration;
+}
+
+void PrimarySampleSource::Reject() {
+    for (auto& x : samples) {
+        if (x.lastModification == iteration) {
+            x.value = x.valueBackup;
+            x.lastModification = x.modificationBackup;
+        }
+    }
+    iteration--;
+}
+
+void PrimarySampleSource::EnsureReady(int i) {
+    if (i >= (int)samples.size())
+        samples.resize(i + 1);
+    PrimarySample& x = samples[i];
+    //Not asked for since the last accepted large step, which would have made it fresh.
+    if (x.lastModification < lastLargeStepIteration) {
+        x.value = Uniform();
+        x.lastModification = lastLargeStepIteration;
+    }
+    x.valueBackup = x.value;
+    x.modificationBackup = x.lastModification;
+    if (largeStep) {
+        x.value = Uniform();
+    }
+    else {
+        //Normal steps add up: n skipped small steps of sigma are one of sigma x sqrt(n).
+        long long smallSteps = iteration - x.lastModification;
+        float normal = std::sqrt(2.0f) * ErfInv(2.0f * Uniform() - 1.0f);
+        x.value += normal * MLT_SIGMA * std::sqrt((float)smallSteps);
+        x.value = std::min(x.value - std::floor(x.value), 0.99999994f);
+    }
+    x.lastModification = iteration;
+}
+
+namespace {
+/*One evaluation of the chain's state: the pixel its camera path went through, and everything BDPT found.*/
+struct MLTSample {
+    int pixel = 0;
+    Vector3f camera;
+    std::vector<LightSplat> splats;
+    float importance = 0.0f;    //Luminance of camera plus all splats.
+};
+}
+
+static inline float Luminance(const Vector3f& c) {
+    return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z;
+}
+
+//Random numbers come from s_SampleSource. Returns the number of extension rays traced.
+static int Evaluate(const Scene* scene, float scale, MLTSample& out) {
+    SetSampleDimension(SAMPLE_DIMENSION_PIXEL);
+    int width = scene->width, height = scene->height;
+    int x = std::min(width - 1, (int)(GetRandomFloat() * width));
+    int y = std::min(height - 1, (int)(GetRandomFloat() * height));
+    out.pixel = y * width + x;
+    out.splats.clear();
+    int bounces;
+    out.camera = Vector3f::Max(BDPT(scene, CameraRay(scene->eyePos, x, y, width, height, scale), bounces, nullptr, &out.splats), 0.0f);
+    out.importance = Luminance(out.camera);
+    for (auto& s : out.splats) {
+        s.value = Vector3f::Max(s.value, 0.0f);
+        out.importance += Luminance(s.value);
+    }
+    if (!std::isfinite(out.importance))
+        out.importance = 0.0f;
+    return bounces;
+}
+
+static void Deposit(const Scene* scene, const MLTSample& sample, float weight, AccumPixel* buffer) {
+    buffer[sample.pixel].Add(sample.camera * weight);
+    for (auto& s : sample.splats) {
+        auto lightRayHitCamera = (s.lightPos - scene->eyePos).Normalized();
+        DrawToImage(Ray(s.lightPos, lightRayHitCamera), buffer, s.value * weight, scene->fov, scene->width, scene->height);
+    }
+}
+
+long long MLTRender(const Scene* scene, ThreadPool& pool, int firstPixel, int pixelCount, int sppBegin, int sppEnd, std::vector<AccumBuffer>& threadBuffers) {
+    float scale = CalculateScale(scene->fov);
+    int threadCount = pool.ThreadCount();
+    int jobSeed = (int)PixelSampleSeed(firstPixel, MLT_BOOTSTRAP_SAMPLE - sppBegin);
+    std::vector<long long> threadBounces(threadCount, 0);
+
+    //Bootstrap. The mean importance of independent samples is the normalization b, and chains start at one of them picked by importance.
+    std::vector<float> bootstrap(MLT_BOOTSTRAP_SAMPLES);
+    RunRanges(&pool, MLT_BOOTSTRAP_SAMPLES, [&](int threadIndex, int begin, int end) {
+        MLTSample sample;
+        for (int i = begin; i < end; i++) {
+            PrimarySampleSource source(PixelSampleSeed(i, jobSeed));
+            s_SampleSource = &source;
+            threadBounces[threadIndex] += Evaluate(scene, scale, sample);
+            bootstrap[i] = sample.importance;
+        }
+        s_SampleSource = nullptr;
+    });
+    double importanceSum = 0.0;
+    for (float f : bootstrap)
+        importanceSum += f;
+    float b = (float)(importanceSum / MLT_BOOTSTRAP_SAMPLES);
+    AliasTable starts;
+    starts.Build(bootstrap);
+
+    long long mutations = (long long)(sppEnd - sppBegin) * pixelCount;
+    if (b > 0.0f) pool.Run([&](int threadIndex) {
+        AccumPixel* buffer = &threadBuffers[threadIndex][0];
+        MLTSample current, proposed;
+        long long done = 0, threadMutations = mutations / MLT_CHAINS * ((MLT_CHAINS - threadIndex + threadCount - 1) / threadCount);
+        for (int chain = threadIndex; chain < MLT_CHAINS; chain += threadCount) {
+            long long chainMutations = mutations * (chain + 1) / MLT_CHAINS - mutations * chain / MLT_CHAINS;
+            ResetRandom(PixelSampleSeed(MLT_BOOTSTRAP_SAMPLES + chain, jobSeed));
+            int start = starts.Sample(std::min(GetRandomFloat(), 0.99999994f));
+
+            //Same seed as the bootstrap sample, so this evaluates to the same path.
+            PrimarySampleSource source(PixelSampleSeed(start, jobSeed));
+            s_SampleSource = &source;
+            threadBounces[threadIndex] += Evaluate(scene, scale, current);
+            for (long long m = 0; m < chainMutations; m++) {
+                source.StartIteration();
+                threadBounces[threadIndex] += Evaluate(scene, scale, proposed);
+                float accept = current.importance > 0.0f ? std::min(1.0f, proposed.importance / current.importance) : 1.0f;
+                //Expected values: both states are splatted, weighted by the chance of each being the next one.
+                if (accept > 0.0f)
+                    Deposit(scene, proposed, accept * b / proposed.importance, buffer);
+                if (accept < 1.0f)
+                    Deposit(scene, current, (1.0f - accept) * b / current.importance, buffer);
+                if (source.Uniform() < accept) {
+                    std::swap(current, proposed);
+                    source.Accept();
+                }
+                else {
+                    source.Reject();
+                }
+                if (threadIndex == 0 && (++done & 0xffff) == 0)
+                    UpdateProgress((float)done / std::max(1ll, threadMutations));
+            }
+            s_SampleSource = nullptr;
+        }
+    });
+
+    long long bounces = 0;
+    for (auto b : threadBounces)
+        bounces += b;
+    return bounces;
+}
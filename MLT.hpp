@@ -0,0 +1,61 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include "global.hpp"
+#include "Accumulation.hpp"
+
+class Scene;
+class ThreadPool;
+
+#define MLT_BOOTSTRAP_SAMPLES 100000    //Independent samples estimating the normalization, and picking where chains start.
+#define MLT_CHAINS 64                   //Fixed, so the image doesn't depend on the thread count.
+#define MLT_LARGE_STEP_PROB 0.3f
+#define MLT_SIGMA 0.01f                 //Standard deviation of a small step, in primary sample space.
+#define MLT_BOOTSTRAP_SAMPLE -2         //Sample index bootstrap and chain seeds are made with, no camera or light path uses it.
+
+/*
+Primary sample vector of one Markov chain(Kelemen et al. 2002). Installed as s_SampleSource, it hands out its
+coordinates in order to whatever the integrator asks for, following SetSampleDimension. Coordinates are mutated lazily, when first asked for in an
+iteration: small steps that were skipped meanwhile add up to one normal step of larger sigma.
+Uses its own random state, so the integrator's calls don't disturb mutation decisions.
+*/
+class PrimarySampleSource : public SampleSource {
+public:
+    explicit PrimarySampleSource(uint32_t seed);
+
+    float Next() override;
+    void SetDimension(int d) override { index = d; }
+
+    /*Start a new proposal: a large step(all coordinates fresh) or a small one. Coordinates are handed out from the first again.*/
+    void StartIteration();
+    void Accept();
+    void Reject();
+
+    float Uniform();    //From the chain's own random state, not the sample vector.
+
+private:
+    struct PrimarySample {
+        float value = 0.0f;
+        long long lastModification = 0;
+        float valueBackup = 0.0f;
+        long long modificationBackup = 0;
+    };
+    void EnsureReady(int i);
+
+    uint32_t rndState;
+    std::vector<PrimarySample> samples;
+    long long iteration = 0;
+    long long lastLargeStepIteration = 0;
+    bool largeStep = true;
+    int index = 0;
+};
+
+/*
+Primary sample space Metropolis light transport over BDPT(). Every sample of the chain picks its pixel from its first
+two coordinates, and its whole contribution(camera side and light tracing splats) is what the chain's importance follows.
+Renders (sppEnd - sppBegin) x pixelCount mutations, split between MLT_CHAINS chains, each chain run by a single thread
+from start to end. Splats go to threadBuffers[threadIndex], full frame, already scaled so resolving by spp gives the image.
+Seeds depend on firstPixel and sppBegin, so render jobs covering other rows or samples run other chains.
+Returns the number of extension rays traced.
+*/
+long long MLTRender(const Scene* scene, ThreadPool& pool, int firstPixel, int pixelCount, int sppBegin, int sppEnd, std::vector<AccumBuffer>& threadBuffers);
@@ -2,63 +2,73 @@
 #include "SampleHelperFunctions.hpp"
 #include "GGX.hpp"
 
+bool s_VisibleNormalSampling = false;
+#ifdef RENDER_COUNTERS
+thread_local BsdfSampleStats s_BsdfSampleStats;
+#endif
+
 /*
 Given w_i, w_o, N, calculate how much light would be passed per unit solid angle.
 Note that return value is not BSDF, since we combine the cosine-term( dot(normal, light) ) calculation here.
 
 The code is just an plain implementation of Walter07. See the paper for why and how.
 */
-Vector3f Material::evalGivenSample(const Vector3f& wo, const Vector3f& wi, const Vector3f& N, bool combineCosineTerm) {
+template<MaterialType T>
+FORCE_INLINE Vector3f Material::EvalGivenSampleT(const Vector3f& wo, const Vector3f& wi, const Vector3f& N, bool combineCosineTerm, const SurfaceTexels* texels) const {
 	float nl = DotProduct(N, wi);
 	float nv = DotProduct(N, wo);
 	if (nl == 0.0f || nv == 0.0f)
 		return 0.0f;
+	//Only glass passes light through, the others are done before anything is computed.
+	if (T != Transparent && !(nl * nv > 0.0f))
+		return 0.0f;
 	Vector3f h = GetHalfDir(N, wi, wo, ior_d);
 
-	float nh = DotProduct(N, h);
-	float lv = DotProduct(wi, wo);
 	float lh = DotProduct(wi, h);
 	float vh = DotProduct(wo, h);
-	float D = GGXTerm(nh, rough);
-	float G = Visibility(nv, vh, rough) * Visibility(nl, lh, rough);
-	Vector3f f = fresnel(wi, h);
+	float r = RoughAt(texels);
+	float D = GGXTerm(N, h, r);
+	float G = Visibility(nv, vh, r) * Visibility(nl, lh, r);
+	Vector3f f = FresnelT<T>(wi, h);
 
 	if (nl * nv > 0.0f)      //Reflection.
 	{
 		Vector3f specular = 0;
 		if (G != 0.0f)
 		{
-			specular = (D * f * G) / (4.0 * abs(nv));       //Original formula is DFG/(4*nv*nl), we combine the cosine term here, so nl canceld out with it.
+			specular = (D * f * G) / (4.0f * std::abs(nv));       //Original formula is DFG/(4*nv*nl), we combine the cosine term here, so nl canceld out with it.
+			if constexpr (T == Metal) {
+				if (s_EnergyCompensation && TablesAt(texels)) {
+					//Turquin 2019: what single scattering misses comes back after more bounces, tinted by the fresnel at normal incidence.
+					float E = lut.Albedo(std::abs(nv));
+					specular = specular * (Vector3f::One() + lut.fresnel[FRESNEL_LUT_SIZE] * ((1.0f - E) / E));
+				}
+			}
 			if (!combineCosineTerm) {
-				specular = specular / abs(nl);
+				specular = specular / std::abs(nl);
 			}
 		}
 
-		Vector3f diffuse = 0;
-		if (this->m_type == Dieletric) {
-			diffuse = this->Kd * (Vector3f::One() - f) / M_PI;
+		if constexpr (T == Dieletric) {
+			Vector3f diffuse = (texels ? texels->Kd : this->Kd) * (Vector3f::One() - f) / M_PI;
 			if (combineCosineTerm) {
 				diffuse = diffuse * saturate(nl);
 			}
+			return diffuse + specular;
 		}
-
-		return diffuse + specular;
+		return specular;
 	}
 	else {      //Refraction
-		//Calculate half dir.
-		if (m_type != Transparent)
-			return 0.0f;
 		float ior_i, ior_o;
-		GetInsideOutsideIOR(N, wi, wo, ior_d, ior_i, ior_o);
 		if (nv < 0.0f) {
 			ior_i = 1.0f; ior_o = ior_d;
 		}
 		else {
 			ior_i = ior_d; ior_o = 1.0f;
 		}
-		auto partA = abs(vh) * abs(lh) / (abs(nv) /* abs(nl)*/);	//Cancelled out with cosine term.
+		auto partA = std::abs(vh) * std::abs(lh) / (std::abs(nv) /* abs(nl)*/);	//Cancelled out with cosine term.
 		if (!combineCosineTerm) {
-			partA /= abs(nl);
+			partA /= std::abs(nl);
 		}
 
 		auto partB = ior_o * ior_o * (1.0f - f.x) * G * D;
@@ -71,6 +81,37 @@ Vector3f Material::evalGivenSample(const Vector3f& wo, const Vector3f& wi, const
 	}
 }
 
+FORCE_INLINE Vector3f Material::EvalGivenSampleImpl(const Vector3f& wo, const Vector3f& wi, const Vector3f& N, bool combineCosineTerm, const SurfaceTexels* texels) {
+	switch (m_type) {
+	case Metal: return EvalGivenSampleT<Metal>(wo, wi, N, combineCosineTerm, texels);
+	case Transparent: return EvalGivenSampleT<Transparent>(wo, wi, N, combineCosineTerm, texels);
+	default: return EvalGivenSampleT<Dieletric>(wo, wi, N, combineCosineTerm, texels);
+	}
+}
+
+Vector3f Material::evalGivenSample(const Vector3f& wo, const Vector3f& wi, const Vector3f& N, bool combineCosineTerm, const SurfaceTexels* texels) {
+	//Not dispatched: a call through a pointer per hit costs more than wider instructions gain on one hit.
+	return EvalGivenSampleImpl(wo, wi, N, combineCosineTerm, texels);
+}
+
+template<MaterialType T>
+FORCE_INLINE void Material::EvalBatchT(int count, const Vector3f* wo, const Vector3f* wi, const Vector3f* N, const SurfaceTexels* texels, Vector3f* f) const {
+	for (int i = 0; i < count; i++)
+		f[i] = EvalGivenSampleT<T>(wo[i], wi[i], N[i], true, texels ? &texels[i] : nullptr);
+}
+
+FORCE_INLINE void Material::EvalBatchImpl(int count, const Vector3f* wo, const Vector3f* wi, const Vector3f* N, const SurfaceTexels* texels, Vector3f* f) {
+	switch (m_type) {
+	case Metal: EvalBatchT<Metal>(count, wo, wi, N, texels, f); break;
+	case Transparent: EvalBatchT<Transparent>(count, wo, wi, N, texels, f); break;
+	default: EvalBatchT<Dieletric>(count, wo, wi, N, texels, f); break;
+	}
+}
+
+void Material::EvalBatch(int count, const Vector3f* wo, const Vector3f* wi, const Vector3f* N, const SurfaceTexels* texels, Vector3f* f) {
+	EvalBatchImpl(count, wo, wi, N, texels, f);
+}
+
 /*
 The GGX microfacet model doesn't include diffuse surface calculation.
 It's possible to create another material dedicated for diffuse, using Lambert.
@@ -102,69 +143,84 @@ So in bsdf sampling, we chose to reflect the ray or refract the ray, based on fr
 */
 
 /*Given sample represented as w_o, n, w_i, calculate probablity of it.*/
-float Material::pdf(Vector3f w_o, Vector3f n, Vector3f w_i) {
+template<MaterialType T>
+float Material::PdfT(const Vector3f& w_o, const Vector3f& n, const Vector3f& w_i, const SurfaceTexels* texels) const {
 
 	float nv = DotProduct(n, w_o), nl = DotProduct(n, w_i);
 	if (nv == 0.0f || nl == 0.0f)
 		return 0.0f;
-	//Get the fresnel.
+	if (T != Transparent && !(nv * nl > 0.0f))
+		return 0.0f;
 	Vector3f h = GetHalfDir(n, w_i, w_o, ior_d);
-	Vector3f f = fresnel(w_o, h);
 	//Calculate probablity of h.
-	float pdf_h = GGXHalfPDF(n, h, rough);
+	float pdf_h = HalfDirPdf(w_o, n, h, RoughAt(texels));
 
 	float vh = DotProduct(w_o, h);
-	float abs_vh = abs(vh);
-	float lh = DotProduct(w_i, h);
-	float ior_i, ior_o;
-	GetInsideOutsideIOR(n, w_i, w_o, ior_d, ior_i, ior_o);
-	if (nv * nl < 0.0f) {
-		//Refraction.
-		float den = (ior_i * lh + ior_o * vh);
-		float jaco = SafeDivide(ior_o * ior_o * abs_vh, (den * den));
-		if (m_type != Transparent)
-			return 0.0f;
-
-		return pdf_h * (1.0f - f.x) * jaco;
+	float abs_vh = std::abs(vh);
+	if constexpr (T == Metal) {
+		return pdf_h * SafeDivide(1.0f, (4.0f * abs_vh));
 	}
-	else if (nv * nl > 0.0f) {
-		//Reflection
-		float jaco = SafeDivide(1.0f, (4.0f * abs_vh));
-		auto diffuse = GetCosineWeightedPdf( n, w_i);
-		if (m_type == Metal) {
-			return pdf_h * jaco;
-		}
-		else if (m_type == Dieletric) {
-			return (diffuse + pdf_h * jaco) * 0.5f;
-		}
-		else {
-			return pdf_h * f.x * jaco;
-		}
+	else if constexpr (T == Dieletric) {
+		return (GetCosineWeightedPdf(n, w_i) + pdf_h * SafeDivide(1.0f, (4.0f * abs_vh))) * 0.5f;
 	}
 	else {
+		//Glass picks reflection or refraction by the fresnel.
+		Vector3f f = FresnelT<T>(w_o, h);
+		if (nv * nl < 0.0f) {
+			//Refraction.
+			float ior_i, ior_o;
+			GetInsideOutsideIOR(n, w_i, w_o, ior_d, ior_i, ior_o);
+			float lh = DotProduct(w_i, h);
+			float den = (ior_i * lh + ior_o * vh);
+			float jaco = SafeDivide(ior_o * ior_o * abs_vh, (den * den));
+			return pdf_h * (1.0f - f.x) * jaco;
+		}
+		else if (nv * nl > 0.0f) {
+			//Reflection
+			return pdf_h * f.x * SafeDivide(1.0f, (4.0f * abs_vh));
+		}
 		return 0.0f;
 	}
 }
 
+float Material::pdf(Vector3f w_o, Vector3f n, Vector3f w_i, const SurfaceTexels* texels) {
+	switch (m_type) {
+	case Metal: return PdfT<Metal>(w_o, n, w_i, texels);
+	case Transparent: return PdfT<Transparent>(w_o, n, w_i, texels);
+	default: return PdfT<Dieletric>(w_o, n, w_i, texels);
+	}
+}
+
+FORCE_INLINE Vector3f Material::SampleHalfDir(const Vector3f& w_o, const Vector3f& n, float r) const {
+	//Visible normals come first, the tables only hold the whole distribution.
+	if (s_VisibleNormalSampling)
+		return SampleGGXVisibleH(n, w_o, r);
+	return s_MaterialLUT && r == rough ? lut.SampleH(n) : SampleGGXSpecularH(n, r);
+}
+
+FORCE_INLINE float Material::HalfDirPdf(const Vector3f& w_o, const Vector3f& n, const Vector3f& h, float r) const {
+	return s_VisibleNormalSampling ? GGXVisibleHalfPDF(n, w_o, h, r) : GGXHalfPDF(n, h, r);
+}
+
 /*Given w_o, n, draw a w_i sample, return it and its pdf*/
-Vector3f Material::sample(Vector3f w_o, Vector3f n, float* pdf) {
-	Vector3f H = SampleGGXSpecularH(n, rough);
+template<MaterialType T>
+Vector3f Material::SampleT(const Vector3f& w_o, const Vector3f& n, float* pdf, const SurfaceTexels* texels) const {
+	float r = RoughAt(texels);
+	Vector3f H = SampleHalfDir(w_o, n, r);
 	Vector3f w_i_s = Reflect(w_o, H);
-	float pdf_h = GGXHalfPDF(n, H, rough);
+	float pdf_h = HalfDirPdf(w_o, n, H, r);
 
 	float vn = DotProduct(w_o, n);
-	float nh = DotProduct(n, H);
 	float vh = DotProduct(w_o, H);
-	float abs_vh = abs(vh);
-	float ior_i, ior_o;
+	float abs_vh = std::abs(vh);
 	float jaco_reflect = SafeDivide(1.0f, (4.0f * abs_vh));
-	if (m_type == Metal) {
+	if constexpr (T == Metal) {
 		*pdf = pdf_h * jaco_reflect;
 		if (vn * DotProduct(w_i_s, n) < 0.0f)
 			*pdf = 0.0f;
 		return w_i_s;
 	}
-	else if (m_type == Dieletric) {
+	else if constexpr (T == Dieletric) {
 		if (GetRandomFloat() < 0.5f) {
 			//Specular.
 			float pdf_d = GetCosineWeightedPdf(n, w_i_s);
@@ -179,8 +235,8 @@ Vector3f Material::sample(Vector3f w_o, Vector3f n, float* pdf) {
 			Vector3f w_i_d = GetCosineWeightedSample(n, pdf_d);
 			H = (w_i_d + w_o).Normalized();
 			vh = DotProduct(w_o, H);
-			abs_vh = abs(vh);
-			pdf_h = GGXHalfPDF(n, H, rough);
+			abs_vh = std::abs(vh);
+			pdf_h = HalfDirPdf(w_o, n, H, r);
 			jaco_reflect = SafeDivide(1.0f, (4.0f * abs_vh));
 			*pdf = (pdf_h * jaco_reflect + pdf_d) * 0.5f;
 			if (vn * DotProduct(w_i_d, n) < 0.0f)
@@ -189,7 +245,7 @@ Vector3f Material::sample(Vector3f w_o, Vector3f n, float* pdf) {
 		}
 	}
 	else {  //Transmittance dieletric.
-		Vector3f f = fresnel(w_o, H);
+		Vector3f f = FresnelT<T>(w_o, H);
 
 		if (GetRandomFloat() < f.x) {
 			//Go reflection.
@@ -199,6 +255,7 @@ Vector3f Material::sample(Vector3f w_o, Vector3f n, float* pdf) {
 			return w_i_s;
 		}
 		else {
+			float ior_i, ior_o;
 			Vector3f w_i_refract = Refract(w_o, H, ior_d);
 			GetInsideOutsideIOR(n, w_i_refract, w_o, ior_d, ior_i, ior_o);
 			float lh = DotProduct(w_i_refract, H);
@@ -213,30 +270,117 @@ Vector3f Material::sample(Vector3f w_o, Vector3f n, float* pdf) {
 	}
 }
 
+Vector3f Material::sample(Vector3f w_o, Vector3f n, float* pdf, const SurfaceTexels* texels) {
+	Vector3f w_i;
+	switch (m_type) {
+	case Metal: w_i = SampleT<Metal>(w_o, n, pdf, texels); break;
+	case Transparent: w_i = SampleT<Transparent>(w_o, n, pdf, texels); break;
+	default: w_i = SampleT<Dieletric>(w_o, n, pdf, texels); break;
+	}
+#ifdef RENDER_COUNTERS
+	s_BsdfSampleStats.samples[m_type]++;
+	if (*pdf == 0.0f)
+		s_BsdfSampleStats.zeroPdf[m_type]++;
+#endif
+	return w_i;
+}
+
+template<MaterialType T>
+void Material::SampleBatchT(int count, const Vector3f* wo, const Vector3f* n, const SurfaceTexels* texels, uint32_t* rng, Vector3f* wi, float* pdf) const {
+	uint32_t savedRndState = s_RndState;
+	for (int i = 0; i < count; i++) {
+		s_RndState = rng[i];
+		wi[i] = SampleT<T>(wo[i], n[i], &pdf[i], texels ? &texels[i] : nullptr);
+		rng[i] = s_RndState;
+	}
+	s_RndState = savedRndState;
+#ifdef RENDER_COUNTERS
+	long long zeroPdf = 0;
+	for (int i = 0; i < count; i++)
+		zeroPdf += pdf[i] == 0.0f;
+	s_BsdfSampleStats.samples[T] += count;
+	s_BsdfSampleStats.zeroPdf[T] += zeroPdf;
+#endif
+}
+
+void Material::SampleBatch(int count, const Vector3f* wo, const Vector3f* n, const SurfaceTexels* texels, uint32_t* rng, Vector3f* wi, float* pdf) {
+	switch (m_type) {
+	case Metal: SampleBatchT<Metal>(count, wo, n, texels, rng, wi, pdf); break;
+	case Transparent: SampleBatchT<Transparent>(count, wo, n, texels, rng, wi, pdf); break;
+	default: SampleBatchT<Dieletric>(count, wo, n, texels, rng, wi, pdf); break;
+	}
+}
+
+template<MaterialType T>
+void Material::PdfBatchT(int count, const Vector3f* wo, const Vector3f* n, const Vector3f* wi, const SurfaceTexels* texels, float* pdf) const {
+	for (int i = 0; i < count; i++)
+		pdf[i] = PdfT<T>(wo[i], n[i], wi[i], texels ? &texels[i] : nullptr);
+}
+
+void Material::PdfBatch(int count, const Vector3f* wo, const Vector3f* n, const Vector3f* wi, const SurfaceTexels* texels, float* pdf) {
+	switch (m_type) {
+	case Metal: PdfBatchT<Metal>(count, wo, n, wi, texels, pdf); break;
+	case Transparent: PdfBatchT<Transparent>(count, wo, n, wi, texels, pdf); break;
+	default: PdfBatchT<Dieletric>(count, wo, n, wi, texels, pdf); break;
+	}
+}
+
 
 void Material::SetSmoothness(float smooth) {
 	this->rough = SmoothnessToRoughenss(smooth);
+	lut.BuildGGX(rough);
 }
 
-Vector3f Material::fresnel(Vector3f I, const Vector3f& N) const {
-	if (this->m_type == Metal) {
+void Material::SetMetalIOR(const Vector3f& eta, const Vector3f& k) {
+	ior_m = eta;
+	ior_m_k = k;
+	UpdateCachedTerms();
+}
+
+void Material::SetIOR(float ior) {
+	ior_d = ior;
+	UpdateCachedTerms();
+}
+
+void Material::UpdateCachedTerms() {
+	twoEta = 2.0f * ior_m;
+	etaSqrPlusKSqr = ior_m * ior_m + ior_m_k * ior_m_k;
+	invIor = 1.0f / ior_d;
+
+	Vector3f n(0.0f, 0.0f, 1.0f);
+	lut.BuildFresnel([&](float c) { return FresnelAnalyticT<Metal>(Vector3f(std::sqrt(1.0f - c * c), 0.0f, c), n); });
+	lut.BuildGGX(rough);
+}
+
+template<MaterialType T>
+FORCE_INLINE Vector3f Material::FresnelT(Vector3f I, const Vector3f& N) const {
+	//Dieletric fresnel is cheaper, and has a kink at total internal reflection linear interpolation can't follow.
+	if (T == Metal && s_MaterialLUT)
+		return lut.Fresnel(DotProduct(I, N));
+	return FresnelAnalyticT<T>(I, N);
+}
+
+template<MaterialType T>
+FORCE_INLINE Vector3f Material::FresnelAnalyticT(Vector3f I, const Vector3f& N) const {
+	if constexpr (T == Metal) {
 		float cosTheta = DotProduct(I, N);
 		float cosTheta2 = cosTheta * cosTheta;
-		float sinTheta2 = 1.0 - cosTheta2;
-		Vector3f TwoEtaCosTheta = 2.0 * ior_m * cosTheta;
-		Vector3f t0 = ior_m * ior_m + ior_m_k * ior_m_k;
+		Vector3f TwoEtaCosTheta = twoEta * cosTheta;
+		const Vector3f& t0 = etaSqrPlusKSqr;
 		Vector3f t1 = t0 * cosTheta2;
 		Vector3f Rs = (t0 - TwoEtaCosTheta + cosTheta2) / (t0 + TwoEtaCosTheta + cosTheta2);
-		Vector3f Rp = (t1 - TwoEtaCosTheta + 1.0) / (t1 + TwoEtaCosTheta + 1);
+		Vector3f Rp = (t1 - TwoEtaCosTheta + 1.0f) / (t1 + TwoEtaCosTheta + 1.0f);
 		return 0.5f * (Rp + Rs);
 	}
 	else {
 		I = -I;
-		float cosi = std::clamp(DotProduct(I, N), -1., 1.);
+		float cosi = std::clamp(DotProduct(I, N), -1.0f, 1.0f);
 		float etai = 1, etat = this->ior_d;
-		if (cosi > 0) { std::swap(etai, etat); }
+		//etai / etat, either ior or the cached 1 / ior.
+		float eta = invIor;
+		if (cosi > 0) { std::swap(etai, etat); eta = ior_d; }
 		// Compute sini using Snell's law
-		float sint = etai / etat * sqrtf(std::max(0.f, 1 - cosi * cosi));
+		float sint = eta * sqrtf(std::max(0.f, 1 - cosi * cosi));
 		// Total internal reflection
 		if (sint >= 1) {
 			return 1;
@@ -250,3 +394,9 @@ Vector3f Material::fresnel(Vector3f I, const Vector3f& N) const {
 		}
 	}
 }
+
+Vector3f Material::fresnel(Vector3f I, const Vector3f& N) const {
+	if (m_type == Metal)
+		return FresnelT<Metal>(I, N);
+	return FresnelT<Dieletric>(I, N);
+}
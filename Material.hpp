@@ -7,11 +7,33 @@
 
 #include "Vector.hpp"
 #include "global.hpp"
+#include "CpuDispatch.hpp"
+#include "MaterialLUT.hpp"
+#include "RayStats.hpp"
+
+#define NEAR_SPECULAR_ROUGHNESS 0.05f    //Metal and glass smoother than this are treated as mirrors by caustic photons and vertex merging.
 
 enum MaterialType {
     Dieletric, Metal, Transparent
 };
 
+/*Draw GGX half vectors from the normals visible from w_o(-vndf 1) instead of the whole distribution.*/
+extern bool s_VisibleNormalSampling;
+#ifdef RENDER_COUNTERS
+extern thread_local BsdfSampleStats s_BsdfSampleStats;
+#endif
+
+class Texture;
+
+/*
+Kd and roughness at one hit on a textured material, from its maps(see Scene::ApplyTextures). Passed to the bsdf functions,
+which use the material's own values without it. A roughness other than the material's skips the -materiallut tables.
+*/
+struct SurfaceTexels {
+    Vector3f Kd;
+    float rough = 0.0f;
+};
+
 class Material{
 public:
 
@@ -19,28 +41,81 @@ public:
     MaterialType m_type;
     //Vector3f m_color;
     Vector3f m_emission;
+    //Set these two through SetIOR() and SetMetalIOR(), so the cached terms below follow.
     float ior_d = 1.5f; //Only for dieletric.
     Vector3f ior_m = Vector3f(0.13100, 0.55758, 1.4561)  ,ior_m_k = Vector3f(4.0624, 2.2039, 1.9541); /*Only for metal. The default value is silver.*/;
     Vector3f Kd;
     float rough = 0.2f;
+    //Optional maps over Kd, roughness(perceptual, squared like SetSmoothness does) and the normal(tangent space). Not owned.
+    Texture* albedoMap = nullptr;
+    Texture* roughnessMap = nullptr;
+    Texture* normalMap = nullptr;
 
     inline Material(MaterialType t = Dieletric, Vector3f e = Vector3f(0, 0, 0)) {
         m_type = t;
         //m_color = c;
         m_emission = e;
         Kd = Vector3f(0.5f, 0.5f, 0.5f);
+        UpdateCachedTerms();
     }
     void SetSmoothness(float smooth);
+    void SetMetalIOR(const Vector3f& eta, const Vector3f& k);
+    void SetIOR(float ior);
     inline MaterialType getType() { return m_type; }
     inline Vector3f GetEmission() { return m_emission; }
     inline bool hasEmission() {
         if (m_emission.x > 0.0f || m_emission.y > 0.0f || m_emission.z > 0.0f) return true;
         else return false;
     }
+    /*Metal or glass nearly as sharp as a mirror. Density estimation(photons, vertex merging) is pointless on such surfaces.*/
+    inline bool IsNearSpecular() const { return m_type != Dieletric && rough < NEAR_SPECULAR_ROUGHNESS; }
+    inline bool HasTextures() const { return albedoMap || roughnessMap || normalMap; }
     Vector3f fresnel(Vector3f I, const Vector3f& N) const;
-    float pdf(Vector3f w_o, Vector3f n, Vector3f w_i);
-    Vector3f sample(Vector3f w_o, Vector3f n, float* pdf);
-    Vector3f evalGivenSample(const Vector3f& wo, const Vector3f& wi, const Vector3f& N, bool combineCosineTerm = true);
+    /*texels of the hit for textured materials, see PTVertex::Texels().*/
+    float pdf(Vector3f w_o, Vector3f n, Vector3f w_i, const SurfaceTexels* texels = nullptr);
+    Vector3f sample(Vector3f w_o, Vector3f n, float* pdf, const SurfaceTexels* texels = nullptr);
+    Vector3f evalGivenSample(const Vector3f& wo, const Vector3f& wi, const Vector3f& N, bool combineCosineTerm = true, const SurfaceTexels* texels = nullptr);
+    /*Body of evalGivenSample.*/
+    Vector3f EvalGivenSampleImpl(const Vector3f& wo, const Vector3f& wi, const Vector3f& N, bool combineCosineTerm, const SurfaceTexels* texels);
+
+    /*
+    sample(), pdf() and evalGivenSample() over count hits on this material, with inputs and outputs in SoA arrays:
+    one switch on the type, then that type's code in a tight loop. Same results as calling them hit by hit.
+    rng[i] is the random state of hit i, drawn from and updated as if it was s_RndState around sample().
+    texels is per hit too, nullptr for untextured materials.
+    */
+    void SampleBatch(int count, const Vector3f* wo, const Vector3f* n, const SurfaceTexels* texels, uint32_t* rng, Vector3f* wi, float* pdf);
+    void PdfBatch(int count, const Vector3f* wo, const Vector3f* n, const Vector3f* wi, const SurfaceTexels* texels, float* pdf);
+    void EvalBatch(int count, const Vector3f* wo, const Vector3f* wi, const Vector3f* N, const SurfaceTexels* texels, Vector3f* f);
+    /*Body of EvalBatch.*/
+    void EvalBatchImpl(int count, const Vector3f* wo, const Vector3f* wi, const Vector3f* N, const SurfaceTexels* texels, Vector3f* f);
+
+private:
+    /*
+    The bsdf of one material type. The public functions switch on m_type once and call these,
+    so each type only runs its own terms: no fresnel in metal and plastic pdfs, no refraction outside glass.
+    */
+    template<MaterialType T> Vector3f FresnelT(Vector3f I, const Vector3f& N) const;
+    template<MaterialType T> Vector3f FresnelAnalyticT(Vector3f I, const Vector3f& N) const;
+    template<MaterialType T> Vector3f EvalGivenSampleT(const Vector3f& wo, const Vector3f& wi, const Vector3f& N, bool combineCosineTerm, const SurfaceTexels* texels) const;
+    template<MaterialType T> float PdfT(const Vector3f& w_o, const Vector3f& n, const Vector3f& w_i, const SurfaceTexels* texels) const;
+    template<MaterialType T> Vector3f SampleT(const Vector3f& w_o, const Vector3f& n, float* pdf, const SurfaceTexels* texels) const;
+    template<MaterialType T> void SampleBatchT(int count, const Vector3f* wo, const Vector3f* n, const SurfaceTexels* texels, uint32_t* rng, Vector3f* wi, float* pdf) const;
+    template<MaterialType T> void PdfBatchT(int count, const Vector3f* wo, const Vector3f* n, const Vector3f* wi, const SurfaceTexels* texels, float* pdf) const;
+    template<MaterialType T> void EvalBatchT(int count, const Vector3f* wo, const Vector3f* wi, const Vector3f* N, const SurfaceTexels* texels, Vector3f* f) const;
+    //GGX half vector for w_o by whichever sampling is on, and its probablity, for roughness r.
+    Vector3f SampleHalfDir(const Vector3f& w_o, const Vector3f& n, float r) const;
+    float HalfDirPdf(const Vector3f& w_o, const Vector3f& n, const Vector3f& h, float r) const;
+    inline float RoughAt(const SurfaceTexels* texels) const { return texels ? texels->rough : rough; }
+    //The GGX tables are built for rough only.
+    inline bool TablesAt(const SurfaceTexels* texels) const { return !texels || texels->rough == rough; }
+
+    void UpdateCachedTerms();
+    //Metal fresnel terms that only depend on the ior, and 1 / ior_d.
+    Vector3f twoEta, etaSqrPlusKSqr;
+    float invIor;
+    //Used with -materiallut 1 and -energycomp 1, see MaterialLUT.hpp.
+    MaterialLUT lut;
 };
 
 
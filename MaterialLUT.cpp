@@ -0,0 +1,66 @@
+#include "MaterialLUT.hpp"
+#include "GGX.hpp"
+#include <cmath>
+
+bool s_MaterialLUT = false;
+bool s_EnergyCompensation = false;
+
+//cos and sin of 2 pi u for u = i / PHI_LUT_SIZE.
+static float s_CosPhiTable[PHI_LUT_SIZE + 1], s_SinPhiTable[PHI_LUT_SIZE + 1];
+
+static bool s_PhiTablesBuilt = []() {
+    for (int i = 0; i <= PHI_LUT_SIZE; i++) {
+        double phi = 2.0 * M_PI * i / PHI_LUT_SIZE;
+        s_CosPhiTable[i] = (float)std::cos(phi);
+        s_SinPhiTable[i] = (float)std::sin(phi);
+    }
+    return true;
+}();
+
+void MaterialLUT::BuildGGX(float roughness) {
+    //cos(atan2(roughness * sqrt(u), sqrt(1 - u))), as GGXSpecularH computes theta.
+    double a2 = (double)roughness * roughness;
+    roughnessSqr = (float)a2;
+    for (int i = 0; i <= GGX_SAMPLE_LUT_SIZE; i++) {
+        double u = (double)i / GGX_SAMPLE_LUT_SIZE;
+        cosThetaH[i] = (float)std::sqrt((1.0 - u) / (1.0 - u + a2 * u));
+    }
+
+    /*
+    E(v) = integral of D G / (4 nv nl) nl over the hemisphere, with half vectors drawn from D nh on a stratified grid:
+    each weighs G vh / (nh nv). Fixed numbers, so building tables leaves the random state alone.
+    */
+    Vector3f n(0.0f, 0.0f, 1.0f);
+    for (int k = 0; k <= GGX_ALBEDO_LUT_SIZE; k++) {
+        float nv = std::max(1e-3f, (float)k / GGX_ALBEDO_LUT_SIZE);
+        Vector3f wo(std::sqrt(1.0f - nv * nv), 0.0f, nv);
+        double sum = 0.0;
+        for (int y = 0; y < GGX_ALBEDO_GRID; y++) {
+            for (int x = 0; x < GGX_ALBEDO_GRID; x++) {
+                Vector3f h = GGXSpecularH(n, roughness, (x + 0.5f) / GGX_ALBEDO_GRID, (y + 0.5f) / GGX_ALBEDO_GRID);
+                Vector3f wi = Reflect(wo, h);
+                float nl = DotProduct(n, wi), vh = DotProduct(wo, h), nh = DotProduct(n, h);
+                if (nl <= 0.0f || vh <= 0.0f || nh <= 0.0f)
+                    continue;
+                float G = Visibility(nv, vh, roughness) * Visibility(nl, DotProduct(wi, h), roughness);
+                sum += G * vh / (nh * nv);
+            }
+        }
+        albedo[k] = (float)std::min(1.0, sum / (GGX_ALBEDO_GRID * GGX_ALBEDO_GRID));
+    }
+}
+
+Vector3f MaterialLUT::SampleH(const Vector3f& N) const {
+    float d1 = GetRandomFloat(), d2 = GetRandomFloat();
+    float t;
+    int i = LUTCell(d1, GGX_SAMPLE_LUT_SIZE, t);
+    float cosTheta = cosThetaH[i] + (cosThetaH[i + 1] - cosThetaH[i]) * t;
+    if (i == GGX_SAMPLE_LUT_SIZE - 1)
+        cosTheta = std::sqrt((1.0f - d1) / (1.0f - d1 + roughnessSqr * d1));
+    float sinTheta = std::sqrt(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+    i = LUTCell(d2, PHI_LUT_SIZE, t);
+    float cosPhi = s_CosPhiTable[i] + (s_CosPhiTable[i + 1] - s_CosPhiTable[i]) * t;
+    float sinPhi = s_SinPhiTable[i] + (s_SinPhiTable[i + 1] - s_SinPhiTable[i]) * t;
+    //Interpolated cos/sin are a bit short of unit length, normalizing takes care of it.
+    return TransformVectorToWorld(Vector3f(sinTheta * cosPhi, sinTheta * sinPhi, cosTheta), N).Normalized();
+}
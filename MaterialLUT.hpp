@@ -0,0 +1,60 @@
+#pragma once
+#include <algorithm>
+#include "Vector.hpp"
+
+/*
+Per material tables in place of the analytic conductor fresnel and GGX half vector sampling(-materiallut 1), so sampling
+needs no atan2/sin/cos and metal fresnel no divisions. Material rebuilds them whenever the roughness or an ior changes.
+Lookups interpolate linearly between entries: close to the analytic values but not the same,
+-benchmark material prints the speed and the error of both.
+*/
+#define FRESNEL_LUT_SIZE 256        //Cells over cos in [-1, 1].
+#define GGX_SAMPLE_LUT_SIZE 1024    //Cells over the first uniform number in [0, 1].
+#define GGX_ALBEDO_LUT_SIZE 32      //Cells over cos in [0, 1].
+#define GGX_ALBEDO_GRID 32          //Half vectors per side of the grid that integrates each albedo entry.
+#define PHI_LUT_SIZE 1024           //Cells over the second uniform number, shared by every material.
+
+extern bool s_MaterialLUT;
+/*Scale metal reflection up by the energy single scattering GGX loses(-energycomp 1), from the albedo table.*/
+extern bool s_EnergyCompensation;
+
+//Cell of u in [0, 1] in a table of size cells, and the position inside it.
+inline int LUTCell(float u, int size, float& t) {
+    float x = std::clamp(u, 0.0f, 1.0f) * size;
+    int i = std::min((int)x, size - 1);
+    t = x - i;
+    return i;
+}
+
+struct MaterialLUT {
+    //Conductor fresnel by the cos Material::fresnel computes, DotProduct(I, N).
+    Vector3f fresnel[FRESNEL_LUT_SIZE + 1];
+    //Inverse CDF of the GGX half vector: cos theta for the first uniform number.
+    float cosThetaH[GGX_SAMPLE_LUT_SIZE + 1];
+    //The last cell goes from near the peak to grazing and is computed, so this is kept for it.
+    float roughnessSqr;
+    //Directional albedo of the GGX lobe with fresnel 1, by cos of the view direction.
+    float albedo[GGX_ALBEDO_LUT_SIZE + 1];
+
+    template<class F>
+    void BuildFresnel(F fresnelOfCos) {
+        for (int i = 0; i <= FRESNEL_LUT_SIZE; i++)
+            fresnel[i] = fresnelOfCos(-1.0f + 2.0f * i / FRESNEL_LUT_SIZE);
+    }
+    void BuildGGX(float roughness);
+
+    inline Vector3f Fresnel(float cosTheta) const {
+        float t;
+        int i = LUTCell((cosTheta + 1.0f) * 0.5f, FRESNEL_LUT_SIZE, t);
+        return Vector3f::Lerp(fresnel[i], fresnel[i + 1], t);
+    }
+
+    inline float Albedo(float cosTheta) const {
+        float t;
+        int i = LUTCell(cosTheta, GGX_ALBEDO_LUT_SIZE, t);
+        return albedo[i] + (albedo[i + 1] - albedo[i]) * t;
+    }
+
+    /*SampleGGXSpecularH from the tables, drawing the same two numbers.*/
+    Vector3f SampleH(const Vector3f& N) const;
+};
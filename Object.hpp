@@ -10,6 +10,7 @@
 #include "Bounds3.hpp"
 #include "Ray.hpp"
 #include "Intersection.hpp"
+#include <vector>
 
 enum FaceCulling {
     CullBack,
@@ -17,12 +18,22 @@ enum FaceCulling {
     NoCull
 };
 
+struct RayPacket;
+
+/*Texture coordinates at a point of a surface, and how the point moves as they change.*/
+struct SurfaceUV {
+    float u, v;
+    Vector3f dpdu, dpdv;
+};
+
 class Object
 {
 public:
     Object(Material* m_) : m(m_) {}
     virtual ~Object() {}
     virtual Intersection GetIntersection(Ray _ray, FaceCulling culling) = 0;
+    /*Closest hits for the lanes of packet in mask, hits[i] is only replaced by a closer one. Default traces lane by lane.*/
+    virtual void IntersectPacket(const RayPacket& packet, uint32_t mask, Intersection* hits);
     virtual Bounds3 GetBounds()=0;
     virtual float getArea()=0;
     virtual void Sample(Intersection &pos)=0;
@@ -30,7 +41,14 @@ public:
         return m->hasEmission();
     }
     virtual float pdf() = 0;
+    /*Primitives this object is made of, each intersectable and sampleable on its own. Most objects are a single one.*/
+    virtual void GetPrimitives(std::vector<Object*>& out) { out.push_back(this); }
+    /*Texture coordinates at p, a point on this primitive. False for objects without any.*/
+    virtual bool SurfaceCoords(const Vector3f& /*p*/, SurfaceUV& /*out*/) const { return false; }
+    /*How much the normal turns moving by dp along the surface, for ray differentials. Flat surfaces don't turn.*/
+    virtual Vector3f NormalDerivative(const Vector3f& /*dp*/) const { return Vector3f(0.0f); }
     Material* m;
+    int emitterIndex = -1;      //Index in Scene::m_emitters, if this is an emissive primitive.
 };
 
 
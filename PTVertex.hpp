@@ -12,8 +12,23 @@ struct PTVertex {
     };
     Type type;
     Vector3f x;
-    Vector3f N;
+    Vector3f N;     //Shading normal, a normal map can tilt it(Scene::ApplyTextures). Only for the bsdf.
+    Vector3f Ng;    //Geometric normal, for ray offsets, culling, visibility and the cosines of the geometry term.
     Object* obj = nullptr;
+    //Kd and roughness from the maps of a textured material, filled in by Scene::Intersect.
+    SurfaceTexels texels;
+    bool textured = false;
+
+    /*What to pass to the bsdf functions of obj->m.*/
+    inline const SurfaceTexels* Texels() const { return textured ? &texels : nullptr; }
+
+    /*
+    Whether light can scatter from w_i to w_o here. With a tilted N a bsdf sample can be above N but below the real surface,
+    opaque surfaces don't let that through. Always true without a normal map, the bsdf is 0 below N anyway.
+    */
+    inline bool ScattersOnSurface(const Vector3f& w_o, const Vector3f& w_i) const {
+        return obj->m->getType() == MaterialType::Transparent || DotProduct(w_o, Ng) * DotProduct(w_i, Ng) > 0.0f;
+    }
 
     static PTVertex Camera(Vector3f cameraPos);
 
@@ -1,59 +1,81 @@
 #include "PathTracer.hpp"
 #include "Object.hpp"
+#include "Sampler.hpp"
 
 #define RussianRoulette 0.8f
 
-class DirectLightSampler {
-public:
-    DirectLightSampler(Object* emissionObject)
-    {
-        this->obj = emissionObject;
-    }
-    Object* obj;
-
-    float pdf(Vector3f x, Vector3f w_o, Vector3f n, Vector3f w_i) {
-        auto intersection = obj->GetIntersection(Ray(x, w_i), FaceCulling::NoCull);
-        if (!intersection.happened)
-            return 0.0f;
-        float lightDistanceSqr = DotProduct(intersection.coords - x, intersection.coords - x);
-        float rawpdf = obj->pdf();
-        float costhetap = DotProduct(intersection.normal, -w_i);
-        if (costhetap == 0.0f)
-            return 0.0f;
-        return (double)rawpdf * lightDistanceSqr / abs(costhetap);   //When we generate sample, even back-facing lights are considered. So shouldn't cull those lights here(using a abs).
-    }
-
-    Vector3f sample(Vector3f x, Vector3f w_o, Vector3f n, float* pdf) {
-        Intersection pos;
-        obj->Sample(pos);
-        pos.m = obj->m;
-        pos.happened = true;
-        Vector3f w_i = (pos.coords - x);
-        float lightDistanceSqr = DotProduct(w_i, w_i);
-        w_i = w_i.Normalized();
-        float rawpdf = obj->pdf();
-        float costhetap = DotProduct(pos.normal, -w_i);
-        if (costhetap == 0.0f)
-            *pdf = 0.0f;
-        *pdf = (double)rawpdf * lightDistanceSqr / abs(costhetap);   //When we generate sample, even back-facing lights are considered. So shouldn't cull those lights here.
-        return w_i;
-    }
-};
+bool SampleLightPoint(const Scene* scene, const Vector3f& x, const Vector3f& n, LightPoint& out)
+{
+    float pmf;
+    Object* light = scene->lightSampler->Pick(x, n, GetRandomFloat(), &pmf);
+    if (light == nullptr || pmf <= 0.0f)
+        return false;
+    Intersection pos;
+    light->Sample(pos);
+    float lightDistanceSqr;
+    Vector3f w_i = (pos.coords - x).NormlizeAndGetLengthSqr(&lightDistanceSqr);
+    float costhetap = DotProduct(pos.normal, -w_i);
+    if (costhetap <= 0.0f)      //Back of a one sided light.
+        return false;
+    out.pos = pos.coords;
+    out.w_i = w_i;
+    out.emission = light->m->m_emission;
+    out.pdf = pmf / light->getArea() * lightDistanceSqr / costhetap;
+    return true;
+}
+
+bool SampleLightConnection(const Scene* scene, Material* mat, const Vector3f& x, const Vector3f& w_o, const Vector3f& n, const SurfaceTexels* texels, LightConnection& out)
+{
+    LightPoint light;
+    if (!SampleLightPoint(scene, x, n, light))
+        return false;
+    float pdf_bsdf = mat->pdf(w_o, n, light.w_i, texels);
+    out.lightPos = light.pos;
+    out.contribution = mat->evalGivenSample(w_o, light.w_i, n, true, texels) * light.emission / (EPSILON + light.pdf + pdf_bsdf);
+    return true;
+}
+
+float LightPdf(const Scene* scene, const Vector3f& from, const Vector3f& fromNormal, const PTVertex& hit)
+{
+    float pmf = scene->lightSampler->Pmf(from, fromNormal, hit.obj);
+    if (pmf <= 0.0f)
+        return 0.0f;
+    float lightDistanceSqr;
+    Vector3f w_i = (hit.x - from).NormlizeAndGetLengthSqr(&lightDistanceSqr);
+    float costhetap = DotProduct(hit.Ng, -w_i);
+    if (costhetap <= 0.0f)
+        return 0.0f;
+    return pmf / hit.obj->getArea() * lightDistanceSqr / costhetap;
+}
 
 // Implementation of Path Tracing
-Vector3f PathTrace(const Scene* scene, const Ray& ray, int& outBounces)
+// Next event estimation on every vertex: one light picked by the scene's light sampler, one shadow ray.
+// The bsdf sample is the next bounce, emission it hits is added weighted against the light sample by balance heuristic.
+// So the last vertex still traces its bsdf ray, only to pick up emission.
+Vector3f PathTrace(const Scene* scene, const RayDifferential& ray, int& outBounces, DepthRayStats* depthStats, const CausticPhotonMap* caustics)
 {
     outBounces = 0;
-    Ray currentRay = ray;
+#ifndef RENDER_COUNTERS
+    (void)depthStats;
+#endif
+    RayDifferential currentRay = ray;
     Vector3f alpha = 1.0f;
     Vector3f resultRadiance = 0.0f;
-    bool lastBounceExplicitSampledLight = false;
     bool lastBounceFlipCulling = false;
+    //Previous vertex, for MIS of emission hit by its bsdf sample.
+    Vector3f lastX, lastN;
+    float lastPdfBsdf = 0.0f;
+    CausticChain chain = CausticChain::None;   //Stays None without caustics.
 
-    while (true) {
+    for (int depth = 0; depth <= scene->maxDepth; depth++) {
         if (alpha.x == 0.0f && alpha.y == 0.0f && alpha.z == 0.0f)
             break;
         auto intersection = scene->Intersect(currentRay, lastBounceFlipCulling ? FaceCulling::CullFront : FaceCulling::CullBack);
+        outBounces += 1;
+#ifdef RENDER_COUNTERS
+        if (depthStats)
+            depthStats->AddExtension(depth);
+#endif
 
         if (intersection.type == PTVertex::Type::Background) {
             // std::cout << throughput<<std::endl;
@@ -61,74 +83,74 @@ Vector3f PathTrace(const Scene* scene, const Ray& ray, int& outBounces)
             break;
         }
 
-        if (intersection.obj->m->hasEmission()) {
-            if (!lastBounceExplicitSampledLight) {
+        //Light reached through a caustic chain is in the photon map already.
+        if (intersection.obj->m->hasEmission() && chain != CausticChain::Covered) {
+            if (depth == 0) {
                 resultRadiance += alpha * intersection.obj->m->GetEmission();
             }
+            else if (DotProduct(intersection.Ng, currentRay.direction) < 0.0f) {
+                float pdf_light = LightPdf(scene, lastX, lastN, intersection);
+                resultRadiance += alpha * intersection.obj->m->GetEmission() * (lastPdfBsdf / (lastPdfBsdf + pdf_light));
+            }
         }
+        if (depth == scene->maxDepth)
+            break;
 
         Vector3f x = intersection.x;
         Vector3f w_o = -currentRay.direction;
-        Vector3f n = intersection.N;
+        Vector3f n = intersection.N, ng = intersection.Ng;
         auto mat = intersection.obj->m;
+        const SurfaceTexels* texels = intersection.Texels();
 
-        float pdf_bsdf;
-        Vector3f w_i_bsdf = mat->sample(w_o, n, &pdf_bsdf);
-        //return w_i_bsdf;
-#if 1
-        {
-            lastBounceExplicitSampledLight = true;
-
-            for (int iLight = 0; iLight < scene->m_emissionObjects.size(); iLight++) {
-                auto& light = scene->m_emissionObjects[iLight];
-                auto lightSampler = DirectLightSampler(light);
-                float pdf_light_light, pdf_bsdf_light, pdf_light_bsdf;
-                Vector3f w_i_light = lightSampler.sample(x, w_o, n, &pdf_light_light);
-                pdf_light_bsdf = mat->pdf(w_o, n, w_i_light);
-                pdf_bsdf_light = lightSampler.pdf(x, w_o, n, w_i_bsdf);
-
-                Vector3f eval_result = 0;
-
-                if (pdf_bsdf + pdf_bsdf_light > 0.0f) {
-                    auto inte = light->GetIntersection(Ray(x, w_i_bsdf), FaceCulling::CullBack);
-
-                    if (inte.happened && !scene->ShadowCheck(inte.coords, x)) {
-                        eval_result += mat->evalGivenSample(w_o, w_i_bsdf, n) / (EPSILON + pdf_bsdf + pdf_bsdf_light);
-                    }
-                }
-                if (pdf_light_light + pdf_light_bsdf > 0.0f) {
-                    auto inte = light->GetIntersection(Ray(x, w_i_light), FaceCulling::CullBack);
-                    if (!scene->ShadowCheck(inte.coords, x))
-                        eval_result += mat->evalGivenSample(w_o, w_i_light, n) / (EPSILON + pdf_light_light + pdf_light_bsdf);
-                }
-
-                resultRadiance += alpha * eval_result * light->m->m_emission;
-            }
+        if (caustics) {
+            chain = NextCausticChain(chain, mat);
+            if (chain == CausticChain::AfterRough)
+                resultRadiance += alpha * caustics->Estimate(mat, x, w_o, n, texels);
         }
-#endif
-        break;
 
-        Vector3f weight = 0;
-        if (pdf_bsdf > 0.0f) {
-            weight = mat->evalGivenSample(w_o, w_i_bsdf, n) / (EPSILON + pdf_bsdf);
+        float pdf_bsdf;
+        SetSampleDimension(BounceDimension(depth, SAMPLE_BSDF_OFFSET));
+        Vector3f w_i_bsdf = mat->sample(w_o, n, &pdf_bsdf, texels);
+
+        LightConnection connection;
+        SetSampleDimension(BounceDimension(depth, SAMPLE_LIGHT_OFFSET));
+        if (chain != CausticChain::Covered && SampleLightConnection(scene, mat, x, w_o, n, texels, connection)
+            && intersection.ScattersOnSurface(w_o, connection.lightPos - x)) {
+#ifdef RENDER_COUNTERS
+            if (depthStats)
+                depthStats->AddShadow(depth);
+#endif
+            if (!scene->ShadowCheck(connection.lightPos, x))
+                resultRadiance += alpha * connection.contribution;
         }
 
-        currentRay = Ray(x, w_i_bsdf);
-        if (DotProduct(n, w_i_bsdf) < 0.0f)
+        if (pdf_bsdf <= 0.0f || !intersection.ScattersOnSurface(w_o, w_i_bsdf))
+            break;
+
+        Vector3f weight = mat->evalGivenSample(w_o, w_i_bsdf, n, true, texels) / (EPSILON + pdf_bsdf);
+
+        RayDifferential nextRay(OffsetRayOrigin(x, ng, w_i_bsdf), w_i_bsdf);
+        if (currentRay.hasDifferentials)
+            scene->SpawnDifferentials(currentRay, intersection, nextRay);
+        currentRay = nextRay;
+        if (DotProduct(ng, w_i_bsdf) < 0.0f)
             lastBounceFlipCulling = true;
         else
             lastBounceFlipCulling = false;
+        lastX = x;
+        lastN = n;
+        lastPdfBsdf = pdf_bsdf;
 
-        bool doRussianRoulette = outBounces > 4;
+        bool doRussianRoulette = depth > 4;
+        SetSampleDimension(BounceDimension(depth, SAMPLE_RR_OFFSET));
         if (!doRussianRoulette || GetRandomFloat() < RussianRoulette) {
             alpha = alpha * weight
                 / (doRussianRoulette ? RussianRoulette : 1.0f);
-            outBounces += 1;
-            continue;
         }
         else {
+            RENDER_COUNT(rouletteTerminated, 1);
             break;
         }
     }
     return resultRadiance;
-}
\ No newline at end of file
+}
@@ -1,4 +1,38 @@
+#pragma once
 #include "Vector.hpp"
 #include "Scene.hpp"
+#include "RayStats.hpp"
+#include "PhotonMap.hpp"
 
-Vector3f PathTrace(const Scene* scene, const Ray& ray, int& outBounces);
\ No newline at end of file
+/*A light sample for next event estimation, not yet shadow tested.*/
+struct LightConnection {
+    Vector3f lightPos;
+    Vector3f contribution;      //Radiance toward w_o if lightPos is visible from x, MIS weighted, not multiplied by throughput.
+};
+
+/*A point on an emitter picked for x, before the bsdf is involved.*/
+struct LightPoint {
+    Vector3f pos;
+    Vector3f w_i;               //From x toward pos.
+    Vector3f emission;
+    float pdf;                  //Solid angle at x.
+};
+
+/*First half of SampleLightConnection: pick an emitter with scene->lightSampler and a point on it. False if it faces away from x.*/
+bool SampleLightPoint(const Scene* scene, const Vector3f& x, const Vector3f& n, LightPoint& out);
+
+/*
+Next event estimation at x: one emitter picked by scene->lightSampler, one point on it.
+Weighted by balance heuristic against the bsdf sample, whose hit is weighted by LightPdf().
+False if there's nothing to shadow test.
+*/
+bool SampleLightConnection(const Scene* scene, Material* mat, const Vector3f& x, const Vector3f& w_o, const Vector3f& n, const SurfaceTexels* texels, LightConnection& out);
+
+/*Solid angle pdf(at from) of SampleLightConnection giving hit, a point on an emitter primitive.*/
+float LightPdf(const Scene* scene, const Vector3f& from, const Vector3f& fromNormal, const PTVertex& hit);
+
+/*
+Unidirectional path tracing with up to scene->maxDepth vertices. outBounces is the number of extension rays traced.
+With caustics, photons are gathered at rough vertices, and the paths they stand for are left out(see CausticChain).
+*/
+Vector3f PathTrace(const Scene* scene, const RayDifferential& ray, int& outBounces, DepthRayStats* depthStats = nullptr, const CausticPhotonMap* caustics = nullptr);
\ No newline at end of file
@@ -0,0 +1,97 @@
+#include "PhotonMap.hpp"
+#include "Scene.hpp"
+#include "Material.hpp"
+#include "BVH.hpp"
+#include "ThreadPool.hpp"
+#include "SampleHelperFunctions.hpp"
+#include <algorithm>
+
+long long CausticPhotonMap::Build(const Scene* scene, int photonCount, ThreadPool* pool) {
+    struct ThreadPhotons {
+        std::vector<Vector3f> positions, directions, normals, power;
+        long long rays = 0;
+    };
+    int threadCount = pool ? pool->ThreadCount() : 1;
+    std::vector<ThreadPhotons> threads(threadCount);
+    float scale = photonCount > 0 ? 1.0f / photonCount : 0.0f;
+
+    //Same depth limit as path tracing: a photon bounces at most maxDepth - 1 times before it lands.
+    RunRanges(pool, photonCount, [&](int threadIndex, int begin, int end) {
+        ThreadPhotons& out = threads[threadIndex];
+        for (int i = begin; i < end; i++) {
+            ResetRandom(PixelSampleSeed(i, PHOTON_SEED_SAMPLE));
+            Intersection l;
+            float pdf;
+            if (!scene->SampleEmitter(l, &pdf) || pdf == 0.0f)
+                continue;
+            float pdfDirection;
+            Vector3f w = GetCosineWeightedSample(l.normal, pdfDirection);
+            //Cosine weighted, so emitted cosine over direction pdf is pi.
+            Vector3f alpha = l.obj->m->m_emission * (float)M_PI / pdf * scale;
+            Ray ray(l.coords, w);
+            bool flipCulling = false;
+            for (int depth = 0; depth < scene->maxDepth; depth++) {
+                PTVertex hit = scene->Intersect(ray, flipCulling ? FaceCulling::CullFront : FaceCulling::CullBack);
+                out.rays++;
+                if (hit.type == PTVertex::Type::Background)
+                    break;
+                auto mat = hit.obj->m;
+                Vector3f w_o = -ray.direction;
+                if (!mat->IsNearSpecular()) {
+                    //Straight from the light is direct lighting, path tracing does that.
+                    if (depth > 0) {
+                        out.positions.push_back(hit.x);
+                        out.directions.push_back(w_o);
+                        out.normals.push_back(hit.Ng);
+                        out.power.push_back(alpha);
+                    }
+                    break;
+                }
+                float pdfBsdf;
+                Vector3f w_i = mat->sample(w_o, hit.N, &pdfBsdf, hit.Texels());
+                if (pdfBsdf <= 0.0f || !hit.ScattersOnSurface(w_o, w_i))
+                    break;
+                alpha = alpha * mat->evalGivenSample(w_o, w_i, hit.N, true, hit.Texels()) / (EPSILON + pdfBsdf);
+                flipCulling = DotProduct(hit.Ng, w_i) < 0.0f;
+                ray = Ray(OffsetRayOrigin(hit.x, hit.Ng, w_i), w_i);
+            }
+        }
+    });
+
+    //Thread ranges are in photon order, so appending them in thread order gives the same map for any thread count.
+    positions.clear();
+    directions.clear();
+    normals.clear();
+    power.clear();
+    long long rays = 0;
+    for (auto& t : threads) {
+        positions.insert(positions.end(), t.positions.begin(), t.positions.end());
+        directions.insert(directions.end(), t.directions.begin(), t.directions.end());
+        normals.insert(normals.end(), t.normals.begin(), t.normals.end());
+        power.insert(power.end(), t.power.begin(), t.power.end());
+        rays += t.rays;
+    }
+
+    float radius = scene->photonRadius;
+    if (radius <= 0.0f)
+        radius = PHOTON_DEFAULT_RADIUS * (float)scene->bvh->GN(scene->bvh->Root()).bounds.Diagonal().Magnitude();
+    invArea = 1.0f / ((float)M_PI * radius * radius);
+    grid.Build(positions.data(), (int)positions.size(), radius, pool);
+    return rays;
+}
+
+Vector3f CausticPhotonMap::Estimate(Material* mat, const Vector3f& x, const Vector3f& w_o, const Vector3f& n, const SurfaceTexels* texels) const {
+    Vector3f sum;
+    grid.Query(x, [&](int i) {
+        if (DotProduct(normals[i], n) <= 0.0f)
+            return;
+        sum += mat->evalGivenSample(w_o, directions[i], n, false, texels) * power[i];
+    });
+    return sum * invArea;
+}
+
+CausticChain NextCausticChain(CausticChain chain, const Material* mat) {
+    if (!mat->IsNearSpecular())
+        return CausticChain::AfterRough;
+    return chain == CausticChain::None ? CausticChain::None : CausticChain::Covered;
+}
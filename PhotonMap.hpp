@@ -0,0 +1,54 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include "Vector.hpp"
+#include "HashGrid.hpp"
+
+class Scene;
+class Material;
+struct SurfaceTexels;
+class ThreadPool;
+
+#define PHOTON_DEFAULT_RADIUS 0.002f    //Gather radius relative to the scene's bounding box diagonal, when Scene::photonRadius is 0.
+#define PHOTON_SEED_SAMPLE -1           //Sample index photon paths are seeded with, no camera or light path uses it.
+
+/*
+Caustic photon map(Jensen 1996): photons shot from the emitters that bounced only off near specular surfaces(Material::IsNearSpecular),
+stored where they first land on a rough one. Path tracing gathers them at its rough vertices instead of finding
+light -> specular -> rough paths by chance, which it rarely does with small lights.
+
+Photons are kept as flat arrays, indexed the same as the HashGrid built over their positions.
+Built once per scene, the same photons serve every frame and sample.
+*/
+class CausticPhotonMap {
+public:
+    /*Shoots photonCount photon paths(only caustic ones get stored) on pool. Returns the number of rays traced.*/
+    long long Build(const Scene* scene, int photonCount, ThreadPool* pool);
+
+    /*Radiance reflected toward w_o at x(on a rough surface of mat, normal n) by caustic photons within the radius.*/
+    Vector3f Estimate(Material* mat, const Vector3f& x, const Vector3f& w_o, const Vector3f& n, const SurfaceTexels* texels = nullptr) const;
+
+    inline int Size() const { return (int)power.size(); }
+    inline float Radius() const { return grid.Radius(); }
+
+private:
+    std::vector<Vector3f> positions;
+    std::vector<Vector3f> directions;   //Toward where the photon came from.
+    std::vector<Vector3f> normals;
+    std::vector<Vector3f> power;        //Already divided by the number of photon paths shot.
+    float invArea = 0.0f;               //1 / (pi r^2)
+    HashGrid grid;
+};
+
+/*
+Where a camera path stands relative to the caustic photon map. Paths light -> near specular... -> rough vertex are the photons' job,
+so once a camera path gathered at a rough vertex, light it reaches through only near specular vertices after it is dropped.
+*/
+enum class CausticChain : uint8_t {
+    None,           //No rough vertex yet.
+    AfterRough,     //Last vertex was rough, photons were gathered there.
+    Covered         //Only near specular vertices since the last rough one. Emission and light samples from here are in the photon map.
+};
+
+/*Chain state after a vertex of material mat.*/
+CausticChain NextCausticChain(CausticChain chain, const Material* mat);
@@ -1,5 +1,7 @@
 #include <cstdlib>
 #include <cstdint>
+#include "global.hpp"
 
 
-thread_local uint32_t s_RndState = 1;
\ No newline at end of file
+thread_local uint32_t s_RndState = 1;
+thread_local SampleSource* s_SampleSource = nullptr;
\ No newline at end of file
@@ -8,7 +8,7 @@
 struct Ray{
     Vector3f origin;
     Vector3f direction, direction_inv;
-    
+
     Ray(const Vector3f& ori, const Vector3f& dir, const double _t = 0.0): origin(ori), direction(dir) {
         direction_inv = Vector3f(1./direction.x, 1./direction.y, 1./direction.z);
 
@@ -21,4 +21,32 @@ struct Ray{
         return os;
     }
 };
+
+/*
+A ray with optional differentials(pbrt 10.1): the rays through the pixels one to the right and one below, kept next to this one
+through mirror like bounces. Where they cut the surface is the footprint texture lookups filter over, see Scene::ApplyTextures.
+Only camera rays and the specular chains after them carry these, every other ray is a plain Ray.
+*/
+struct RayDifferential : Ray {
+    bool hasDifferentials = false;
+    Vector3f rxOrigin, rxDirection, ryOrigin, ryDirection;
+
+    RayDifferential(const Vector3f& ori, const Vector3f& dir) : Ray(ori, dir) {}
+};
+
+/*
+Tolerance for a ray hitting the surface it starts on. Float error of a hit point grows with its magnitude,
+so a fixed one is too small far from the origin and needlessly large close to it.
+*/
+#define RAY_EPSILON_SCALE 1e-5f
+
+inline float RayEpsilon(const Vector3f& p) {
+    return (std::max(std::fabs(p.x), std::max(std::fabs(p.y), std::fabs(p.z))) + 1.0f) * RAY_EPSILON_SCALE;
+}
+
+/*p pushed off its surface(normal n) to the side w leaves towards, to start a ray from.*/
+inline Vector3f OffsetRayOrigin(const Vector3f& p, const Vector3f& n, const Vector3f& w) {
+    float offset = RayEpsilon(p);
+    return p + n * (DotProduct(n, w) < 0.0f ? -offset : offset);
+}
 #endif //RAYTRACING_RAY_H
@@ -0,0 +1,73 @@
+#include "RayPacket.hpp"
+#include "CpuDispatch.hpp"
+#include <algorithm>
+
+void RayPacket::Prepare() {
+    coherent = count > 0;
+    for (int i = 0; i < count; i++) {
+        const Ray& r = *rays[i];
+        ox[i] = r.origin.x; oy[i] = r.origin.y; oz[i] = r.origin.z;
+        ix[i] = r.direction_inv.x; iy[i] = r.direction_inv.y; iz[i] = r.direction_inv.z;
+        dx[i] = r.direction.x; dy[i] = r.direction.y; dz[i] = r.direction.z;
+        cullSign[i] = culling[i] == CullBack ? 1.0f : culling[i] == CullFront ? -1.0f : 0.0f;
+    }
+    //Unused lanes copy lane 0, so the SoA loops could always run full width.
+    for (int i = count; i < RAY_PACKET_MAX && count > 0; i++) {
+        ox[i] = ox[0]; oy[i] = oy[0]; oz[i] = oz[0];
+        ix[i] = ix[0]; iy[i] = iy[0]; iz[i] = iz[0];
+        dx[i] = dx[0]; dy[i] = dy[0]; dz[i] = dz[0];
+        cullSign[i] = cullSign[0];
+    }
+
+    const float* o[3] = { ox, oy, oz };
+    const float* inv[3] = { ix, iy, iz };
+    for (int iAxis = 0; iAxis < 3 && coherent; iAxis++) {
+        originMin[iAxis] = originMax[iAxis] = o[iAxis][0];
+        invDirMin[iAxis] = invDirMax[iAxis] = inv[iAxis][0];
+        for (int i = 0; i < count; i++) {
+            float d = inv[iAxis][i];
+            //Mixed signs or axis parallel lanes, the interval would span infinity. Fall back to per lane tests only.
+            if (!std::isfinite(d) || (d > 0.0f) != (inv[iAxis][0] > 0.0f)) {
+                coherent = false;
+                break;
+            }
+            originMin[iAxis] = std::min(originMin[iAxis], o[iAxis][i]);
+            originMax[iAxis] = std::max(originMax[iAxis], o[iAxis][i]);
+            invDirMin[iAxis] = std::min(invDirMin[iAxis], d);
+            invDirMax[iAxis] = std::max(invDirMax[iAxis], d);
+        }
+    }
+}
+
+bool RayPacket::IntervalIntersectP(const Bounds3& b) const {
+    if (!coherent)
+        return true;
+    float entryLow = std::numeric_limits<float>::lowest(), exitHigh = std::numeric_limits<float>::max();
+    for (int iAxis = 0; iAxis < 3; iAxis++) {
+        bool positive = invDirMin[iAxis] > 0.0f;
+        float nearPlane = positive ? b.pMin[iAxis] : b.pMax[iAxis];
+        float farPlane = positive ? b.pMax[iAxis] : b.pMin[iAxis];
+        //(plane - origin) * invDir over the intervals, min of the entry and max of the exit.
+        float n0 = (nearPlane - originMax[iAxis]), n1 = (nearPlane - originMin[iAxis]);
+        float f0 = (farPlane - originMax[iAxis]), f1 = (farPlane - originMin[iAxis]);
+        float entry = std::min(std::min(n0 * invDirMin[iAxis], n0 * invDirMax[iAxis]), std::min(n1 * invDirMin[iAxis], n1 * invDirMax[iAxis]));
+        float exit = std::max(std::max(f0 * invDirMin[iAxis], f0 * invDirMax[iAxis]), std::max(f1 * invDirMin[iAxis], f1 * invDirMax[iAxis]));
+        entryLow = std::max(entryLow, entry);
+        exitHigh = std::min(exitHigh, exit);
+    }
+    return exitHigh > 0.0f && entryLow <= exitHigh;
+}
+
+uint32_t RayPacket::IntersectP(const Bounds3& b, const float* tFar, uint32_t mask) const {
+    return s_Kernels.packetBoundsHit(*this, b, tFar, mask);
+}
+
+void Object::IntersectPacket(const RayPacket& packet, uint32_t mask, Intersection* hits) {
+    for (int i = 0; i < packet.count; i++) {
+        if (!(mask & (1u << i)))
+            continue;
+        auto t = GetIntersection(*packet.rays[i], packet.culling[i]);
+        if (t.happened && (!hits[i].happened || hits[i].distance > t.distance))
+            hits[i] = t;
+    }
+}
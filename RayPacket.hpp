@@ -0,0 +1,56 @@
+#pragma once
+#include <cstdint>
+#include <limits>
+#include "Ray.hpp"
+#include "Bounds3.hpp"
+#include "Object.hpp"
+
+/*
+A packet of up to RAY_PACKET_MAX rays traced through the BVH together.
+
+Nodes are tested against all lanes of the packet at once(SoA, so the slab test runs 4 to 16 lanes per instruction, see CpuDispatch.hpp),
+and a node is only entered by the lanes that hit it. Each lane keeps its own closest hit distance, nodes farther than that are skipped.
+
+If all lanes point into the same octant, the packet also gets an interval bound over origins and inverse directions.
+A node missed by that bound is missed by every lane, so it's rejected with one test instead of count.
+For primary rays of a tile(shared origin, close directions) that's a frustum test.
+*/
+#define RAY_PACKET_MAX 16
+
+struct RayPacket {
+    int count = 0;
+    const Ray* rays[RAY_PACKET_MAX];
+    FaceCulling culling[RAY_PACKET_MAX];
+
+    float ox[RAY_PACKET_MAX], oy[RAY_PACKET_MAX], oz[RAY_PACKET_MAX];
+    float ix[RAY_PACKET_MAX], iy[RAY_PACKET_MAX], iz[RAY_PACKET_MAX];
+    float dx[RAY_PACKET_MAX], dy[RAY_PACKET_MAX], dz[RAY_PACKET_MAX];
+    //Triangles facing this way are culled: dot(direction, normal) * cullSign > 0. 1 for CullBack, -1 for CullFront, 0 for NoCull.
+    float cullSign[RAY_PACKET_MAX];
+
+    //Interval bound, valid if coherent.
+    bool coherent = false;
+    float originMin[3], originMax[3];
+    float invDirMin[3], invDirMax[3];
+
+    inline void Clear() { count = 0; }
+
+    inline void Push(const Ray* ray, FaceCulling c) {
+        rays[count] = ray;
+        culling[count] = c;
+        count++;
+    }
+
+    inline uint32_t FullMask() const {
+        return (1u << count) - 1u;
+    }
+
+    /*Fill SoA lanes and the interval bound. Call after all rays are pushed.*/
+    void Prepare();
+
+    /*Conservative test for the whole packet. False means no lane could hit b.*/
+    bool IntervalIntersectP(const Bounds3& b) const;
+
+    /*Lanes of mask which hit b closer than tFar. Runs the kernel picked for this CPU(see CpuDispatch.hpp).*/
+    uint32_t IntersectP(const Bounds3& b, const float* tFar, uint32_t mask) const;
+};
@@ -0,0 +1,135 @@
+#pragma once
+#include <iostream>
+
+#define RAY_STATS_MAX_DEPTH 32
+
+/*
+Rays traced per path depth(0 is the camera ray), counted by the path tracers when built with RENDER_COUNTERS. Depths past the end share the last slot.
+Each thread fills its own and they are summed after the frame.
+*/
+struct DepthRayStats {
+    long long extension[RAY_STATS_MAX_DEPTH] = {};
+    long long shadow[RAY_STATS_MAX_DEPTH] = {};
+
+    static inline int Slot(int depth) { return depth < RAY_STATS_MAX_DEPTH ? depth : RAY_STATS_MAX_DEPTH - 1; }
+
+    inline void AddExtension(int depth, long long n = 1) { extension[Slot(depth)] += n; }
+    inline void AddShadow(int depth, long long n = 1) { shadow[Slot(depth)] += n; }
+
+    inline DepthRayStats& operator+=(const DepthRayStats& o) {
+        for (int i = 0; i < RAY_STATS_MAX_DEPTH; i++) {
+            extension[i] += o.extension[i];
+            shadow[i] += o.shadow[i];
+        }
+        return *this;
+    }
+
+    inline bool Empty() const {
+        for (int i = 0; i < RAY_STATS_MAX_DEPTH; i++) {
+            if (extension[i] != 0 || shadow[i] != 0)
+                return false;
+        }
+        return true;
+    }
+
+    inline void Print(std::ostream& os) const {
+        os << "Depth   Extension rays   Shadow rays\n";
+        for (int i = 0; i < RAY_STATS_MAX_DEPTH; i++) {
+            if (extension[i] == 0 && shadow[i] == 0)
+                continue;
+            os << (i == RAY_STATS_MAX_DEPTH - 1 ? ">=" : "  ") << i << "\t" << extension[i] << "\t\t " << shadow[i] << "\n";
+        }
+    }
+};
+
+/*
+Material::sample calls per material type(MaterialType order), and how many came back with pdf 0: w_i on the wrong side of the surface,
+so the path ends there and the ray to get to it was wasted. Counted per thread in s_BsdfSampleStats, when built with RENDER_COUNTERS.
+*/
+struct BsdfSampleStats {
+    long long samples[3] = {};
+    long long zeroPdf[3] = {};
+
+    inline BsdfSampleStats& operator+=(const BsdfSampleStats& o) {
+        for (int i = 0; i < 3; i++) {
+            samples[i] += o.samples[i];
+            zeroPdf[i] += o.zeroPdf[i];
+        }
+        return *this;
+    }
+
+    inline bool Empty() const { return samples[0] == 0 && samples[1] == 0 && samples[2] == 0; }
+
+    inline void Print(std::ostream& os) const {
+        static const char* names[3] = { "plastic", "metal", "glass" };
+        os << "Bsdf samples with pdf 0:";
+        for (int i = 0; i < 3; i++) {
+            if (samples[i] > 0)
+                os << "  " << names[i] << " " << 100.0 * zeroPdf[i] / samples[i] << "% of " << samples[i];
+        }
+        os << "\n";
+    }
+};
+
+/*
+Hot path counters, summed per thread into s_RenderCounters and gathered after the frame like BsdfSampleStats.
+Only there when built with the RENDER_COUNTERS cmake option. Otherwise RENDER_COUNT is nothing and the struct stays 0.
+*/
+struct RenderCounters {
+    long long cameraRays = 0;
+    long long rays = 0;                 //Every ray traced through the scene BVH, shadow rays included.
+    long long shadowRays = 0;
+    long long bvhNodes = 0;             //Nodes visited, mesh BVHs included.
+    long long triangleTests = 0;
+    long long rouletteTerminated = 0;   //Paths ended by russian roulette.
+    long long bdptStrategies = 0;       //(s, t) connections evaluated, BDPTPath::PathWeight calls.
+
+    inline RenderCounters& operator+=(const RenderCounters& o) {
+        cameraRays += o.cameraRays;
+        rays += o.rays;
+        shadowRays += o.shadowRays;
+        bvhNodes += o.bvhNodes;
+        triangleTests += o.triangleTests;
+        rouletteTerminated += o.rouletteTerminated;
+        bdptStrategies += o.bdptStrategies;
+        return *this;
+    }
+
+    inline bool Empty() const { return rays == 0 && cameraRays == 0 && bdptStrategies == 0; }
+
+    inline void Print(std::ostream& os) const {
+        os << "Rays: " << rays << "(camera " << cameraRays << ", shadow " << shadowRays << ")";
+        if (rays > 0)
+            os << ", " << (double)bvhNodes / rays << " BVH nodes and " << (double)triangleTests / rays << " triangle tests per ray";
+        os << "\n";
+        if (rouletteTerminated > 0 || bdptStrategies > 0)
+            os << "Paths ended by russian roulette: " << rouletteTerminated << ", BDPT strategies: " << bdptStrategies << "\n";
+    }
+};
+
+#ifdef RENDER_COUNTERS
+extern thread_local RenderCounters s_RenderCounters;
+#define RENDER_COUNT(counter, n) (s_RenderCounters.counter += (n))
+#else
+#define RENDER_COUNT(counter, n) ((void)0)
+#endif
+
+/*Wall clock seconds spent per phase. Load and BVH build are the scene's, timed in main.*/
+struct PhaseTimes {
+    double load = 0.0;
+    double bvhBuild = 0.0;
+    double render = 0.0;    //Tracing, caustic photons and AOVs included.
+    double merge = 0.0;     //Light tracing splats summed and added to the image.
+    double denoise = 0.0;
+    double output = 0.0;    //Image files written.
+
+    inline PhaseTimes& operator+=(const PhaseTimes& o) {
+        load += o.load;
+        bvhBuild += o.bvhBuild;
+        render += o.render;
+        merge += o.merge;
+        denoise += o.denoise;
+        output += o.output;
+        return *this;
+    }
+};
@@ -8,15 +8,29 @@
 #include <chrono>
 #include <atomic>
 #include <queue>
-#include <future>
+#include <functional>
 #include "Scene.hpp"
 #include "Renderer.hpp"
 #include "PathTracer.hpp"
 #include "SceneRenderingHelper.hpp"
 #include "BDPT.hpp"
+#include "ImageIO.hpp"
+#include "WavefrontPathTracer.hpp"
+#include "LightVertexCache.hpp"
+#include "VCM.hpp"
+#include "MLT.hpp"
+#include "Sampler.hpp"
+#include "Texture.hpp"
 
-using Buffer = std::vector<Vector3f>;
 const float EPSILON = 1e-4;
+#ifdef RENDER_COUNTERS
+thread_local RenderCounters s_RenderCounters;
+#endif
+
+static double SecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
 struct ThreadTask {
     ThreadTask(Vector3f* target, int x, int y) :
         target(target),
@@ -26,102 +40,494 @@ struct ThreadTask {
     Vector3f* target;
 };
 
-const Scene* curScene;
-std::atomic<int> totalRays;
+bool ParseIntegratorType(const std::string& name, IntegratorType& type) {
+    if (name == "pt")
+        type = IntegratorType::PathTracing;
+    else if (name == "bdpt")
+        type = IntegratorType::BDPT;
+    else if (name == "wavefront")
+        type = IntegratorType::Wavefront;
+    else if (name == "lvc")
+        type = IntegratorType::LightCacheBDPT;
+    else if (name == "vcm")
+        type = IntegratorType::VCM;
+    else if (name == "mlt")
+        type = IntegratorType::MLT;
+    else
+        return false;
+    return true;
+}
+
+const char* IntegratorName(IntegratorType type) {
+    switch (type) {
+    case IntegratorType::BDPT: return "Bidirectional Path Tracing";
+    case IntegratorType::Wavefront: return "Wavefront path tracing";
+    case IntegratorType::LightCacheBDPT: return "Bidirectional Path Tracing with light vertex cache";
+    case IntegratorType::VCM: return "Vertex connection and merging";
+    case IntegratorType::MLT: return "Primary sample space Metropolis light transport";
+    default: return "Path tracing";
+    }
+}
+
+RenderSession::RenderSession(const Scene& scene, int threadCount, bool pinThreads) :
+    scene(scene),
+    pool(threadCount, pinThreads),
+    threadLightBuffers(pool.ThreadCount()),
+    threadTiles(pool.ThreadCount()),
+    threadDepthStats(pool.ThreadCount()),
+    threadBsdfStats(pool.ThreadCount()),
+    threadCounters(pool.ThreadCount()),
+    frameVertices(0)
+{
+}
 
-Buffer FillBufferThread(int threadCount, int threadOffset, int spp, Vector3f* buffer, bool bdpt) {
+/*
+Image is split into tiles of TILE_HEIGHT rows. Thread threadIndex renders tiles threadIndex, threadIndex + threadCount, ... of the job.
+A finished tile is handed to onTile, so only one tile per thread needs to be resident.
+Light tracing splats(HasLightPass) go to threadLightBuffers[threadIndex].
+*/
+void RenderSession::FillBufferThread(int threadIndex, const Scene& frameScene, const RenderJob& job, IntegratorType integrator, const CausticPhotonMap* caustics, const TileCallback& onTile) {
+    const Scene* curScene = &frameScene;
+    int threadCount = pool.ThreadCount();
+    bool bdpt = integrator == IntegratorType::BDPT;
+    bool lightPass = HasLightPass(integrator);
     float scale = CalculateScale(curScene->fov);
-    float imageAspectRatio = curScene->width / (float)curScene->height;
+    int width = curScene->width;
     int pixelCount = curScene->width * curScene->height;
-    int threadRayCounter = 0;
-    Buffer emissionBuffer(curScene->width * curScene->height);
-    for (size_t i = threadOffset; i < pixelCount; i+= threadCount)
+    int tileCount = (job.yEnd - job.yBegin + TILE_HEIGHT - 1) / TILE_HEIGHT;
+    long long threadVertexCounter = 0;
+    AccumBuffer& emissionBuffer = threadLightBuffers[threadIndex];
+    emissionBuffer.assign(lightPass ? pixelCount : 0, AccumPixel());
+    AccumBuffer& tile = threadTiles[threadIndex];
+    DepthRayStats& depthStats = threadDepthStats[threadIndex];
+    depthStats = DepthRayStats();
+    tile.resize((size_t)width * TILE_HEIGHT);
+    auto sampler = Sampler::Create(curScene->samplerType, job.sppTotal > 0 ? job.sppTotal : job.sppEnd, width);
+    //The random sampler keeps to pixel centers, so default renders stay what they were.
+    bool jitterPixels = curScene->samplerType != SamplerType::Random;
+    for (int iTile = threadIndex; iTile < tileCount; iTile += threadCount)
     {
-        int xPixel = i % curScene->width;
-        int yPixel = i / curScene->width;
-        ResetRandom((int)i + 1);
-        for (int ispp = 0; ispp < spp; ispp++)
-        {
-            // generate primary ray direction
-            Vector3f dir = PixelPosToRay(xPixel, yPixel, curScene->width, curScene->height, scale);
+        int yStart = job.yBegin + iTile * TILE_HEIGHT;
+        int rowCount = std::min(TILE_HEIGHT, job.yEnd - yStart);
+        std::fill(tile.begin(), tile.end(), AccumPixel());
+        if (integrator == IntegratorType::Wavefront) {
+            int bounces;
+            WavefrontRenderTile(curScene, yStart, rowCount, job.sppBegin, job.sppEnd, &tile[0], bounces, &depthStats, caustics);
+            threadVertexCounter += bounces;
+        }
+        else if (integrator == IntegratorType::LightCacheBDPT) {
             int bounces;
-            if (bdpt)
-                *(buffer + i) += (1.0f / spp) * BDPT(curScene, Ray(curScene->eyePos, dir), bounces, &emissionBuffer[0]);
-            else
-                *(buffer + i) += (1.0f / spp) * PathTrace(curScene, Ray(curScene->eyePos, dir), bounces);
-            threadRayCounter += bounces;
+            LightCacheRenderTile(curScene, yStart, rowCount, job.sppBegin, job.sppEnd, &tile[0], &emissionBuffer[0], bounces);
+            threadVertexCounter += bounces;
+        }
+        else for (int i = yStart * width; i < (yStart + rowCount) * width; i++)
+        {
+            int xPixel = i % width;
+            int yPixel = i / width;
+            AccumPixel& target = tile[i - yStart * width];
+            s_SampleSource = sampler.get();
+            for (int ispp = job.sppBegin; ispp < job.sppEnd; ispp++)
+            {
+                sampler->StartPixelSample(i, ispp);
+                float jitterX = 0.5f, jitterY = 0.5f;
+                if (jitterPixels) {
+                    SetSampleDimension(SAMPLE_DIMENSION_PIXEL);
+                    jitterX = GetRandomFloat();
+                    jitterY = GetRandomFloat();
+                }
+                // generate primary ray direction
+                RayDifferential cameraRay = CameraRay(curScene->eyePos, xPixel, yPixel, curScene->width, curScene->height, scale, jitterX, jitterY);
+                int bounces;
+                if (bdpt)
+                    target.Add(BDPT(curScene, cameraRay, bounces, &emissionBuffer[0]));
+                else
+                    target.Add(PathTrace(curScene, cameraRay, bounces, &depthStats, caustics));
+                threadVertexCounter += bounces;
+            }
+            s_SampleSource = nullptr;
+        }
+        if (frameAov)
+            FillAovRows(*curScene, yStart, rowCount);
+        onTile(yStart, rowCount, &tile[0]);
+        if (threadIndex == 0) {  //Logging IS performance issue, don't do too much.
+            UpdateProgress((float)iTile / tileCount);
         }
-        if (threadOffset == 0 && i % 10000 == 0){  //Logging IS performance issue, don't do too much.
-            UpdateProgress((float)i / pixelCount);
+    }
+    frameVertices += threadVertexCounter;
+}
+
+/*
+Camera rays go through pixel centers, so every sample of a pixel hits the same point first, and one ray per pixel gives its AOVs.
+Mirror like metal and glass(Material::IsNearSpecular) only show what's behind them, so the ray follows its reflection or refraction
+up to AOV_SPECULAR_BOUNCES times, and the AOVs are of the first rough hit(depth along the whole way). Lights get albedo 1.
+*/
+void RenderSession::FillAovRows(const Scene& frameScene, int yStart, int rowCount) {
+    float scale = CalculateScale(frameScene.fov);
+    int width = frameScene.width;
+    for (int y = yStart; y < yStart + rowCount; y++) {
+        for (int x = 0; x < width; x++) {
+            size_t i = (size_t)y * width + x;
+            RayDifferential ray = CameraRay(frameScene.eyePos, x, y, width, frameScene.height, scale);
+            FaceCulling culling = FaceCulling::CullBack;
+            float distance = 0.0f;
+            PTVertex hit = frameScene.Intersect(ray, culling);
+            for (int bounce = 0; bounce < AOV_SPECULAR_BOUNCES && hit.type != PTVertex::Type::Background; bounce++) {
+                Material* m = hit.obj->m;
+                if (!m->IsNearSpecular() || m->hasEmission())
+                    break;
+                Vector3f w_o = -ray.direction;
+                Vector3f w_i = m->getType() == MaterialType::Transparent ? Refract(w_o, hit.N, m->ior_d) : Vector3f(0.0f);
+                if (w_i.SqrMagnitude() == 0.0f)     //Metal, or total internal reflection.
+                    w_i = Reflect(w_o, hit.N);
+                distance += (hit.x - ray.origin).Magnitude();
+                RayDifferential next(OffsetRayOrigin(hit.x, hit.Ng, w_i), w_i);
+                frameScene.SpawnDifferentials(ray, hit, next);
+                ray = next;
+                culling = DotProduct(hit.Ng, w_i) < 0.0f ? FaceCulling::CullFront : FaceCulling::CullBack;
+                hit = frameScene.Intersect(ray, culling);
+            }
+            if (hit.type == PTVertex::Type::Background) {
+                frameAov->albedo[i] = Vector3f();
+                frameAov->normal[i] = Vector3f();
+                frameAov->depth[i] = 0.0f;
+                continue;
+            }
+            Material* m = hit.obj->m;
+            bool diffuse = m->getType() == MaterialType::Dieletric && !m->hasEmission();
+            frameAov->albedo[i] = diffuse ? (hit.Texels() ? hit.texels.Kd : m->Kd) : Vector3f::One();
+            frameAov->normal[i] = hit.N;
+            frameAov->depth[i] = distance + (hit.x - ray.origin).Magnitude();
         }
     }
-    for (int i = 0; i < curScene->width * curScene->height; i++) {
-        emissionBuffer[i] = emissionBuffer[i] * 1.0f / spp;
+}
+
+/*Photons only depend on the scene, so one map serves every frame of the session.*/
+const CausticPhotonMap* RenderSession::PrepareCausticMap(IntegratorType integrator) {
+    if (scene.causticPhotons <= 0 || (integrator != IntegratorType::PathTracing && integrator != IntegratorType::Wavefront))
+        return nullptr;
+    if (!causticMapBuilt) {
+        auto start = std::chrono::steady_clock::now();
+        frameVertices += causticMap.Build(&scene, scene.causticPhotons, &pool);
+        causticMapBuilt = true;
+        std::cout << "Caustic photons: " << causticMap.Size() << " stored of " << scene.causticPhotons << " shot, radius " << causticMap.Radius()
+            << ", " << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << "s\n";
+    }
+    return &causticMap;
+}
+
+/*
+VCM needs every light path of an iteration before any camera path, so it can't go tile by tile.
+The whole job is accumulated at once, iteration after iteration, and handed to onTile at the end.
+*/
+void RenderSession::RenderVCM(const Scene& frameScene, const RenderJob& job, const TileCallback& onTile) {
+    int width = frameScene.width;
+    for (auto& emissionBuffer : threadLightBuffers)
+        emissionBuffer.assign((size_t)width * frameScene.height, AccumPixel());
+    for (auto& d : threadDepthStats)
+        d = DepthRayStats();
+    AccumBuffer camera((size_t)(job.yEnd - job.yBegin) * width);
+    VCMIntegrator vcm(&frameScene, pool, job.yBegin, job.yEnd);
+    for (int ispp = job.sppBegin; ispp < job.sppEnd; ispp++) {
+        frameVertices += vcm.Iteration(ispp, &camera[0], threadLightBuffers);
+        UpdateProgress((float)(ispp + 1 - job.sppBegin) / (job.sppEnd - job.sppBegin));
     }
-    totalRays += threadRayCounter;
-    return emissionBuffer;
+    for (int y = job.yBegin; y < job.yEnd; y += TILE_HEIGHT)
+        onTile(y, std::min(TILE_HEIGHT, job.yEnd - y), &camera[(size_t)(y - job.yBegin) * width]);
+}
+
+/*
+MLT chains wander over the whole frame, so everything they find is splatted like light tracing,
+and the job's camera pass stays black. The job only sets how many mutations are made.
+*/
+void RenderSession::RenderMLT(const Scene& frameScene, const RenderJob& job, const TileCallback& onTile) {
+    int width = frameScene.width;
+    for (auto& emissionBuffer : threadLightBuffers)
+        emissionBuffer.assign((size_t)width * frameScene.height, AccumPixel());
+    for (auto& d : threadDepthStats)
+        d = DepthRayStats();
+    int pixelCount = (job.yEnd - job.yBegin) * width;
+    frameVertices += MLTRender(&frameScene, pool, job.yBegin * width, pixelCount, job.sppBegin, job.sppEnd, threadLightBuffers);
+    AccumBuffer camera((size_t)TILE_HEIGHT * width);
+    for (int y = job.yBegin; y < job.yEnd; y += TILE_HEIGHT)
+        onTile(y, std::min(TILE_HEIGHT, job.yEnd - y), &camera[0]);
+}
+
+/*Run FillBufferThread on every pool thread(or RenderVCM, RenderMLT), and sum up their light tracing splats.*/
+AccumBuffer RenderSession::RenderTiles(const Scene& frameScene, const RenderJob& job, IntegratorType integrator, const TileCallback& onTile) {
+    auto start = std::chrono::steady_clock::now();
+    frameVertices = 0;
+    //Bsdf sample counters are thread_local(every integrator samples materials), each pool thread clears its own.
+#ifdef RENDER_COUNTERS
+    pool.Run([](int) {
+        s_BsdfSampleStats = BsdfSampleStats();
+        s_RenderCounters = RenderCounters();
+    });
+#endif
+
+    if (integrator == IntegratorType::VCM || integrator == IntegratorType::MLT) {
+        if (integrator == IntegratorType::VCM)
+            RenderVCM(frameScene, job, onTile);
+        else
+            RenderMLT(frameScene, job, onTile);
+        if (frameAov) {
+            RunRanges(&pool, job.yEnd - job.yBegin, [&](int, int begin, int end) {
+                FillAovRows(frameScene, job.yBegin + begin, end - begin);
+            });
+        }
+    }
+    else {
+        const CausticPhotonMap* caustics = PrepareCausticMap(integrator);
+        pool.Run([&](int threadIndex) {
+            FillBufferThread(threadIndex, frameScene, job, integrator, caustics, onTile);
+        });
+    }
+
+    auto traced = std::chrono::steady_clock::now();
+    AccumBuffer lightPass;
+    if (HasLightPass(integrator)) {
+        lightPass.resize((size_t)frameScene.width * frameScene.height);
+        for (auto& emissionBuffer : threadLightBuffers)
+        {
+            //Fixed point, so the order threads are merged in doesn't matter.
+            for (size_t j = 0; j < emissionBuffer.size(); j++)
+            {
+                lightPass[j] += emissionBuffer[j];
+            }
+        }
+    }
+    std::cout << std::endl;
+
+    frameDepthStats = DepthRayStats();
+    for (auto& d : threadDepthStats)
+        frameDepthStats += d;
+    stats.depth += frameDepthStats;
+#ifdef RENDER_COUNTERS
+    pool.Run([&](int threadIndex) {
+        threadBsdfStats[threadIndex] = s_BsdfSampleStats;
+        threadCounters[threadIndex] = s_RenderCounters;
+    });
+#endif
+    frameBsdfStats = BsdfSampleStats();
+    for (auto& b : threadBsdfStats)
+        frameBsdfStats += b;
+    stats.bsdf += frameBsdfStats;
+    frameCounters = RenderCounters();
+    for (auto& c : threadCounters)
+        frameCounters += c;
+    stats.counters += frameCounters;
+    stats.vertices += frameVertices;
+    stats.frames++;
+    stats.phases.render += std::chrono::duration<double>(traced - start).count();
+    stats.phases.merge += SecondsSince(traced);
+    return lightPass;
+}
+
+PartialAccumulation RenderSession::RenderPartial(const RenderJob& job, IntegratorType integrator)
+{
+    PartialAccumulation result;
+    result.width = scene.width;
+    result.height = scene.height;
+    result.sppBegin = job.sppBegin;
+    result.sppEnd = job.sppEnd;
+    result.yBegin = job.yBegin;
+    result.yEnd = job.yEnd;
+    result.camera.resize((size_t)(job.yEnd - job.yBegin) * scene.width);
+
+    //Tiles don't overlap, so each thread writes its own part of result.camera.
+    TileCallback onTile = [&](int yStart, int rowCount, const AccumPixel* tile) {
+        std::copy(tile, tile + (size_t)rowCount * scene.width, &result.camera[(size_t)(yStart - job.yBegin) * scene.width]);
+    };
+    result.light = RenderTiles(scene, job, integrator, onTile);
+    return result;
 }
 
 // The main render function. This where we iterate over all pixels in the image,
 // generate primary rays and cast these rays into the scene. The content of the
 // framebuffer is saved to a file.
-void Renderer::Render(std::string outputFileName, const Scene& scene, int spp, int thread_count, bool bdpt)
+void RenderSession::Render(const FrameRequest& frame)
 {
-    if (bdpt) {
-        std::cout << "Tracing mode: Bidirectional Ptah Tracing" << std::endl;
+    const std::string& outputFileName = frame.outputFileName;
+    int spp = frame.spp;
+    bool writePasses = frame.writePasses;
+    std::cout << "Tracing mode: " << IntegratorName(frame.integrator) << std::endl;
+    bool bdpt = HasLightPass(frame.integrator);
+    auto start = std::chrono::system_clock::now();
+    long long verticesBefore = stats.vertices;
+    PhaseTimes phasesBefore = stats.phases;
+    //Images written count as output. Streamed pfm/exr tiles are written while rendering, so those count as render.
+    auto save = [&](const std::vector<Vector3f>& image, const std::string& path) {
+        auto saveStart = std::chrono::steady_clock::now();
+        SaveFloatImage(image, scene.width, scene.height, path);
+        stats.phases.output += SecondsSince(saveStart);
+    };
+
+    //Shallow copy, objects and BVH are shared. Only the camera differs.
+    Scene frameScene = scene;
+    if (frame.eyePos)
+        frameScene.eyePos = *frame.eyePos;
+    if (frame.fov)
+        frameScene.fov = *frame.fov;
+
+    //For pfm/exr, tiles go to disk as soon as they are done. Otherwise keep a full framebuffer.
+    bool wholeFrame = frame.denoise || !frame.reference.empty();
+    auto writer = wholeFrame ? nullptr : StreamingImageWriter::Open(outputFileName, scene.width, scene.height);
+    std::unique_ptr<StreamingImageWriter> cameraPassWriter;
+    std::vector<Vector3f> framebuffer;
+    if (writer) {
+        std::cout << "Streaming tiles to " << outputFileName << "\n";
+        if (writePasses)
+            cameraPassWriter = StreamingImageWriter::Open(PassFileName(outputFileName, "camera"), scene.width, scene.height);
     }
     else {
-        std::cout << "Tracing mode: Path tracing" << std::endl;
+        framebuffer.resize(scene.width * scene.height);
     }
-    auto start = std::chrono::system_clock::now();
-    std::vector<Vector3f> framebuffer(scene.width * scene.height);
-
-    curScene = &scene;
 
     // change the spp value to change sample ammount
     std::cout << "SPP: " << spp << "\n";
 
-    std::vector<std::future<Buffer>> threads;
-    std::vector<Buffer> emissionBuffers;
-    for (int iThread = 1; iThread < thread_count; iThread++)
-    {
-        auto future = std::async(std::launch::async, FillBufferThread, thread_count, iThread, spp, &framebuffer[0], bdpt);
-        threads.push_back(std::move(future));
+    RenderJob job;
+    job.sppBegin = 0; job.sppEnd = spp;
+    job.sppTotal = spp;
+    job.yBegin = 0; job.yEnd = scene.height;
+
+    TileCallback onTile = [&](int yStart, int rowCount, const AccumPixel* tile) {
+        std::vector<Vector3f> resolved((size_t)rowCount * scene.width);
+        for (size_t i = 0; i < resolved.size(); i++) {
+            resolved[i] = tile[i].Resolve(spp);
+        }
+        if (writer) {
+            writer->WriteRows(yStart, rowCount, &resolved[0]);
+            if (cameraPassWriter)
+                cameraPassWriter->WriteRows(yStart, rowCount, &resolved[0]);
+        }
+        else {
+            std::copy(resolved.begin(), resolved.end(), &framebuffer[(size_t)yStart * scene.width]);
+        }
+    };
+    AovBuffers aov;
+    if (frame.writeAovs || frame.denoise) {
+        aov.Resize((size_t)scene.width * scene.height);
+        frameAov = &aov;
     }
-    emissionBuffers.push_back(FillBufferThread(thread_count, 0, spp, &framebuffer[0], bdpt));
+    AccumBuffer lightAccum = RenderTiles(frameScene, job, frame.integrator, onTile);
+    frameAov = nullptr;
 
-    for (size_t i = 0; i < threads.size(); i++)
-    {
-        threads[i].wait();
+    if (writePasses && !writer) {
+        save(framebuffer, PassFileName(outputFileName, "camera"));
     }
 
     if (bdpt) {
-        //Merge emission buffer.
-        for (size_t i = 0; i < threads.size(); i++)
-        {
-            emissionBuffers.push_back(threads[i].get());
-        }
-
         std::cout << "Tracing finished, merge emission buffer\n";
-        for (size_t j = 0; j < scene.width * scene.height; j++)
+        auto mergeStart = std::chrono::steady_clock::now();
+        std::vector<Vector3f> lightPass(lightAccum.size());
+        for (size_t j = 0; j < lightAccum.size(); j++)
         {
-            //framebuffer[j] = 0.0f;
-            for (size_t i = 0; i < emissionBuffers.size(); i++)
+            lightPass[j] = lightAccum[j].Resolve(spp);
+        }
+        if (writer) {
+            for (int y = 0; y < scene.height; y += TILE_HEIGHT) {
+                writer->AccumulateRows(y, std::min(TILE_HEIGHT, scene.height - y), &lightPass[(size_t)y * scene.width]);
+            }
+        }
+        else {
+            size_t pixelCount = (size_t)scene.width * scene.height;
+            for (size_t j = 0; j < pixelCount; j++)
             {
-                framebuffer[j] += emissionBuffers[i][j];
+                framebuffer[j] += lightPass[j];
             }
         }
+        stats.phases.merge += SecondsSince(mergeStart);
+        if (writePasses) {
+            save(lightPass, PassFileName(outputFileName, "light"));
+        }
     }
 
-    std::cout << std::endl;
     auto stop = std::chrono::system_clock::now();
 
     std::cout << "Render complete: \n";
     std::cout << "Time taken: " << std::chrono::duration_cast<std::chrono::hours>(stop - start).count() << " hours\n";
     std::cout << "          : " << std::chrono::duration_cast<std::chrono::minutes>(stop - start).count() << " minutes\n";
     std::cout << "          : " << std::chrono::duration_cast<std::chrono::seconds>(stop - start).count() << " seconds\n";
-    std::cout << "Rays: " << totalRays << std::endl;
-    std::cout << "Rays Per Second: " << (float)totalRays / 1e3f / std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count() << "MRays" << std::endl;
-    
-    SaveFloatImageToJpg(framebuffer, scene.width, scene.height, outputFileName.c_str());
+    //Rates are over the render phase only, merging and writing files take time too but trace nothing.
+    double renderSeconds = stats.phases.render - phasesBefore.render;
+    long long frameVertexCount = stats.vertices - verticesBefore;
+    std::cout << "Path vertices: " << frameVertexCount << ", " << frameVertexCount / 1e6 / renderSeconds << "M per second of rendering\n";
+    if (!frameCounters.Empty()) {
+        frameCounters.Print(std::cout);
+        std::cout << "Rays Per Second: " << frameCounters.rays / 1e6 / renderSeconds << "MRays\n";
+    }
+    if (!frameDepthStats.Empty())
+        frameDepthStats.Print(std::cout);
+    if (!frameBsdfStats.Empty())
+        frameBsdfStats.Print(std::cout);
+    //Since the session started, tiles stay cached from frame to frame.
+    auto textureStats = s_TextureCache.Stats();
+    if (textureStats.tileReads > 0)
+        textureStats.Print(std::cout);
+
+    if (frame.writeAovs) {
+        auto saveStart = std::chrono::steady_clock::now();
+        aov.Save(scene.width, scene.height, outputFileName);
+        stats.phases.output += SecondsSince(saveStart);
+    }
+    std::vector<Vector3f> reference;
+    bool compare = !frame.reference.empty() && LoadReferenceImage(frame.reference, scene.width, scene.height, reference);
+    if (frame.denoise) {
+        if (compare) {
+            auto error = CompareImages(framebuffer, reference);
+            std::cout << "Noisy    RMSE " << error.rmse << ", relMSE " << error.relMse << "\n";
+        }
+        if (frame.writeAovs)
+            save(framebuffer, PassFileName(outputFileName, "noisy"));
+        auto denoiseStart = std::chrono::steady_clock::now();
+        framebuffer = Denoise(framebuffer, aov, scene.width, scene.height, &pool);
+        double denoiseSeconds = SecondsSince(denoiseStart);
+        stats.phases.denoise += denoiseSeconds;
+        std::cout << "Denoised in " << denoiseSeconds << "s\n";
+    }
+    if (compare) {
+        auto error = CompareImages(framebuffer, reference);
+        std::cout << (frame.denoise ? "Denoised" : "Image   ") << " RMSE " << error.rmse << ", relMSE " << error.relMse << "\n";
+    }
+
+    if (!writer)
+        save(framebuffer, outputFileName);
+    std::cout << "Phases: render " << renderSeconds << "s, merge " << stats.phases.merge - phasesBefore.merge << "s, denoise "
+        << stats.phases.denoise - phasesBefore.denoise << "s, output " << stats.phases.output - phasesBefore.output << "s\n";
+}
+
+bool SaveStatsJson(const RenderStats& stats, int threadCount, const std::string& path) {
+    std::ofstream os(path, std::ios::trunc);
+    if (!os) {
+        std::cout << "Can't write stats to " << path << "\n";
+        return false;
+    }
+    const PhaseTimes& p = stats.phases;
+    const RenderCounters& c = stats.counters;
+    //Rates per second of the render phase, 0 if nothing was rendered.
+    auto rate = [&](long long n) { return p.render > 0.0 ? n / p.render : 0.0; };
+    os << "{\n";
+    os << "  \"frames\": " << stats.frames << ",\n";
+    os << "  \"threads\": " << threadCount << ",\n";
+    os << "  \"seconds\": { \"load\": " << p.load << ", \"bvhBuild\": " << p.bvhBuild << ", \"render\": " << p.render
+        << ", \"merge\": " << p.merge << ", \"denoise\": " << p.denoise << ", \"output\": " << p.output << " },\n";
+    os << "  \"pathVertices\": " << stats.vertices << ",\n";
+    os << "  \"pathVerticesPerSecond\": " << rate(stats.vertices) << ",\n";
+#ifdef RENDER_COUNTERS
+    os << "  \"counters\": {\n";
+    os << "    \"cameraRays\": " << c.cameraRays << ",\n";
+    os << "    \"rays\": " << c.rays << ",\n";
+    os << "    \"shadowRays\": " << c.shadowRays << ",\n";
+    os << "    \"bvhNodesVisited\": " << c.bvhNodes << ",\n";
+    os << "    \"triangleTests\": " << c.triangleTests << ",\n";
+    os << "    \"rouletteTerminated\": " << c.rouletteTerminated << ",\n";
+    os << "    \"bdptStrategies\": " << c.bdptStrategies << ",\n";
+    os << "    \"raysPerSecond\": " << rate(c.rays) << "\n";
+    os << "  }\n";
+#else
+    (void)c;
+    os << "  \"counters\": null\n";
+#endif
+    os << "}\n";
+    return (bool)os;
 }
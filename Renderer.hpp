@@ -3,12 +3,127 @@
 //
 #pragma once
 
+#include <atomic>
+#include <functional>
+#include <optional>
+#include <string>
 #include "Scene.hpp"
+#include "Accumulation.hpp"
+#include "ThreadPool.hpp"
+#include "RayStats.hpp"
+#include "PhotonMap.hpp"
+#include "Denoiser.hpp"
 
-class Renderer
+#define TILE_HEIGHT 16
+
+enum class IntegratorType {
+    PathTracing,
+    BDPT,
+    Wavefront,      //Path tracing, processed in batches of paths stage by stage. See WavefrontPathTracer.hpp
+    LightCacheBDPT, //BDPT connecting to a shared pool of light paths. See LightVertexCache.hpp
+    VCM,            //BDPT plus vertex merging, rendered in whole frame iterations. See VCM.hpp
+    MLT             //Primary sample space Metropolis over BDPT, one Markov chain at a time per thread. See MLT.hpp
+};
+
+/*"pt", "bdpt", "wavefront", "lvc", "vcm", "mlt". Returns false if name is unknown.*/
+bool ParseIntegratorType(const std::string& name, IntegratorType& type);
+
+/*Whether the integrator splats light tracing into a separate light pass.*/
+inline bool HasLightPass(IntegratorType type) {
+    return type == IntegratorType::BDPT || type == IntegratorType::LightCacheBDPT || type == IntegratorType::VCM
+        || type == IntegratorType::MLT;
+}
+
+const char* IntegratorName(IntegratorType type);
+
+/*A piece of a frame: samples [sppBegin, sppEnd) of every pixel in rows [yBegin, yEnd).*/
+struct RenderJob {
+    int sppBegin = 0, sppEnd = 0;
+    int yBegin = 0, yEnd = 0;
+    int sppTotal = 0;   //Samples of the whole frame, which the sampler spreads its strata over. 0 for sppEnd.
+};
+
+/*Statistics of a RenderSession, summed over every frame it rendered.*/
+struct RenderStats {
+    long long vertices = 0;     //Path vertices the integrators made(bounces, light path vertices), not rays. RenderCounters has those.
+    int frames = 0;
+    PhaseTimes phases;          //Load and BVH build are left to the caller.
+    DepthRayStats depth;        //Path tracing and wavefront only.
+    BsdfSampleStats bsdf;
+    RenderCounters counters;    //Empty unless built with RENDER_COUNTERS.
+};
+
+/*
+stats as JSON into path: seconds per phase, path vertices, and with RENDER_COUNTERS rays per kind, BVH nodes, triangle tests,
+russian roulette and BDPT strategies, with rates over the render phase. False if path can't be written.
+*/
+bool SaveStatsJson(const RenderStats& stats, int threadCount, const std::string& path);
+
+/*
+One frame to render. eyePos and fov override the scene's camera for this frame only,
+so camera variants of the same scene could be submitted back to back.
+*/
+struct FrameRequest {
+    std::string outputFileName = "output.jpg";
+    int spp = 1;
+    IntegratorType integrator = IntegratorType::BDPT;
+    bool writePasses = false;
+    bool writeAovs = false;     //Albedo, normal and depth of the first hits into <name>.albedo/.normal/.depth.<ext>, and the noisy color into <name>.noisy.<ext> when denoising.
+    bool denoise = false;       //Run the A-Trous denoiser(Denoiser.hpp) on the frame before saving it.
+    std::string reference;      //Image to print the error of the frame against, before and after denoising.
+    std::optional<Vector3f> eyePos;
+    std::optional<double> fov;
+};
+
+/*
+A long lived renderer for one scene. Owns a pool of worker threads(pinned if asked, see ThreadPool) and the per thread buffers, both reused for every frame,
+and keeps statistics of its own. No render state is global, so several sessions could live in one process.
+The scene must outlive the session and not change while a frame renders.
+*/
+class RenderSession
 {
 public:
-    void Render(std::string outputFileName, const Scene& scene, int spp, int thread_count, bool bdpt);
+    RenderSession(const Scene& scene, int threadCount, bool pinThreads = false);
+
+    /*
+    Output format is picked by outputFileName's extension. pfm and exr are linear float, and written tile by tile while rendering.
+    If writePasses is set, camera pass(paths ending at the camera side) and light pass(light tracing splats of BDPT) are also written to their own files.
+    Denoising and comparing to a reference need the whole frame, so pfm and exr aren't streamed then.
+    */
+    void Render(const FrameRequest& frame);
+
+    /*Render only part of the frame, keeping the raw fixed point sums so it could be merged with other parts later.*/
+    PartialAccumulation RenderPartial(const RenderJob& job, IntegratorType integrator);
+
+    inline const RenderStats& Stats() const { return stats; }
+    inline const Scene& GetScene() const { return scene; }
+    inline int ThreadCount() const { return pool.ThreadCount(); }
 
 private:
+    using TileCallback = std::function<void(int yStart, int rowCount, const AccumPixel* tile)>;
+
+    AccumBuffer RenderTiles(const Scene& frameScene, const RenderJob& job, IntegratorType integrator, const TileCallback& onTile);
+    void FillBufferThread(int threadIndex, const Scene& frameScene, const RenderJob& job, IntegratorType integrator, const CausticPhotonMap* caustics, const TileCallback& onTile);
+    /*First hits of the camera rays of rows [yStart, yStart + rowCount) into frameAov.*/
+    void FillAovRows(const Scene& frameScene, int yStart, int rowCount);
+    /*Caustic photon map for integrator, built on first use. nullptr if it doesn't use one.*/
+    const CausticPhotonMap* PrepareCausticMap(IntegratorType integrator);
+    void RenderVCM(const Scene& frameScene, const RenderJob& job, const TileCallback& onTile);
+    void RenderMLT(const Scene& frameScene, const RenderJob& job, const TileCallback& onTile);
+
+    const Scene& scene;
+    ThreadPool pool;
+    std::vector<AccumBuffer> threadLightBuffers;   //Light tracing splats of each thread, BDPT only(HasLightPass).
+    std::vector<AccumBuffer> threadTiles;
+    std::vector<DepthRayStats> threadDepthStats;
+    DepthRayStats frameDepthStats;
+    std::vector<BsdfSampleStats> threadBsdfStats;
+    BsdfSampleStats frameBsdfStats;
+    std::vector<RenderCounters> threadCounters;
+    RenderCounters frameCounters;
+    AovBuffers* frameAov = nullptr;     //Set while a frame wants them.
+    std::atomic<long long> frameVertices;
+    RenderStats stats;
+    CausticPhotonMap causticMap;
+    bool causticMapBuilt = false;
 };
@@ -38,7 +38,7 @@ Vector3f Reflect(Vector3f I, const Vector3f& N)
 Vector3f Refract(Vector3f I, const Vector3f& N, const float& ior)
 {
 	I = -I;
-	float cosi = std::clamp(DotProduct(I, N), -1.0, 1.0);
+	float cosi = std::clamp(DotProduct(I, N), -1.0f, 1.0f);
 	float etai = 1, etat = ior;
 	Vector3f n = N;
 	if (cosi < 0) { cosi = -cosi; }
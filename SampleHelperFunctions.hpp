@@ -123,9 +123,9 @@ inline float SrpdfToAreaPdf(float srpdf, const PTVertex& v1, const PTVertex& v2)
 	assert(v1.type != PTVertex::Type::Background);
 	float distSqr;
 	Vector3f w = (v2.x - v1.x).NormlizeAndGetLengthSqr(&distSqr);
-	float cos1 = v1.type == PTVertex::Type::Camera ? 1.0f : abs(DotProduct(w, v1.N));
-	float cos2 = v2.type == PTVertex::Type::Camera ? 1.0f : abs(DotProduct(-w, v2.N));
+	float cos1 = v1.type == PTVertex::Type::Camera ? 1.0f : std::abs(DotProduct(w, v1.Ng));
+	float cos2 = v2.type == PTVertex::Type::Camera ? 1.0f : std::abs(DotProduct(-w, v2.Ng));
 
-	return srpdf * abs(cos1 * cos2 / distSqr);
+	return srpdf * std::abs(cos1 * cos2 / distSqr);
 
 }
@@ -0,0 +1,165 @@
+#include "Sampler.hpp"
+#include "BlueNoise.hpp"
+#include <algorithm>
+#include <cmath>
+
+#define ONE_MINUS_EPSILON 0.99999994f
+
+bool ParseSamplerType(const std::string& name, SamplerType& out) {
+    if (name == "random") out = SamplerType::Random;
+    else if (name == "stratified") out = SamplerType::Stratified;
+    else if (name == "sobol") out = SamplerType::Sobol;
+    else if (name == "bluenoise") out = SamplerType::BlueNoise;
+    else return false;
+    return true;
+}
+
+const char* SamplerName(SamplerType type) {
+    switch (type) {
+    case SamplerType::Random: return "random";
+    case SamplerType::Stratified: return "stratified";
+    case SamplerType::Sobol: return "sobol";
+    case SamplerType::BlueNoise: return "bluenoise";
+    }
+    return "?";
+}
+
+std::unique_ptr<Sampler> Sampler::Create(SamplerType type, int sppTotal, int width) {
+    switch (type) {
+    case SamplerType::Random: return std::make_unique<RandomSampler>();
+    case SamplerType::Stratified: return std::make_unique<StratifiedSampler>(sppTotal);
+    case SamplerType::Sobol: return std::make_unique<SobolSampler>();
+    case SamplerType::BlueNoise: return std::make_unique<BlueNoiseSampler>(width);
+    }
+    return nullptr;
+}
+
+static inline float ToUnitFloat(uint32_t x) {
+    return std::min(x * (1.0f / 4294967296.0f), ONE_MINUS_EPSILON);
+}
+
+void RandomSampler::StartPixelSample(int pixel, int sampleIndex) {
+    state = PixelSampleSeed(pixel, sampleIndex);
+}
+
+float RandomSampler::Next() {
+    //Same as GetRandomFloat() on the global state.
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 15;
+    return (double)state / 0xffffffff;
+}
+
+//Element i of a random permutation of [0, l), picked by p(Kensler 2013, Correlated multi-jittered sampling).
+static uint32_t PermutationElement(uint32_t i, uint32_t l, uint32_t p) {
+    uint32_t w = l - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    do {
+        i ^= p;
+        i *= 0xe170893d;
+        i ^= p >> 16;
+        i ^= (i & w) >> 4;
+        i ^= p >> 8;
+        i *= 0x0929eb3f;
+        i ^= p >> 23;
+        i ^= (i & w) >> 1;
+        i *= 1 | p >> 27;
+        i *= 0x6935fa69;
+        i ^= (i & w) >> 11;
+        i *= 0x74dcb303;
+        i ^= (i & w) >> 2;
+        i *= 0x9e501cc3;
+        i ^= (i & w) >> 2;
+        i *= 0xc860a3df;
+        i &= w;
+        i ^= i >> 5;
+    } while (i >= l);
+    return (i + p) % l;
+}
+
+void StratifiedSampler::StartPixelSample(int pixel, int sampleIndex) {
+    this->pixel = pixel;
+    this->sampleIndex = sampleIndex;
+    dimension = 0;
+}
+
+float StratifiedSampler::Next() {
+    int d = dimension++;
+    uint32_t seed = PixelSampleSeed(pixel, d);
+    uint32_t stratum = PermutationElement((uint32_t)(sampleIndex % sppTotal), (uint32_t)sppTotal, seed);
+    float jitter = ToUnitFloat(PixelSampleSeed((int)seed, sampleIndex));
+    return std::min((stratum + jitter) / sppTotal, ONE_MINUS_EPSILON);
+}
+
+static inline uint32_t ReverseBits(uint32_t x) {
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ff) << 8) | ((x & 0xff00ff00) >> 8);
+    x = ((x & 0x0f0f0f0f) << 4) | ((x & 0xf0f0f0f0) >> 4);
+    x = ((x & 0x33333333) << 2) | ((x & 0xcccccccc) >> 2);
+    x = ((x & 0x55555555) << 1) | ((x & 0xaaaaaaaa) >> 1);
+    return x;
+}
+
+//Owen scrambling of the bits of x from the highest down, by hashing(Laine-Karras permutation on reversed bits).
+static inline uint32_t NestedUniformScramble(uint32_t x, uint32_t seed) {
+    x = ReverseBits(x);
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return ReverseBits(x);
+}
+
+//Second Sobol dimension, the first is the bit reversed index.
+static inline uint32_t SobolDimension1(uint32_t index) {
+    uint32_t x = 0, v = 0x80000000u;
+    for (; index; index >>= 1, v ^= v >> 1)
+        if (index & 1)
+            x ^= v;
+    return x;
+}
+
+//Dimension d of sample sampleIndex, from the sequence scrambled by key.
+static float ScrambledSobol(int sampleIndex, int d, int key) {
+    //Both dimensions of a pair shuffle the index the same way, so they stay a 2D sequence.
+    uint32_t pairSeed = PixelSampleSeed(key, d >> 1);
+    uint32_t index = NestedUniformScramble((uint32_t)sampleIndex, pairSeed);
+    uint32_t x = (d & 1) ? SobolDimension1(index) : ReverseBits(index);
+    return ToUnitFloat(NestedUniformScramble(x, PixelSampleSeed((int)pairSeed, d)));
+}
+
+void SobolSampler::StartPixelSample(int pixel, int sampleIndex) {
+    this->pixel = pixel;
+    this->sampleIndex = sampleIndex;
+    dimension = 0;
+}
+
+float SobolSampler::Next() {
+    return ScrambledSobol(sampleIndex, dimension++, pixel);
+}
+
+BlueNoiseSampler::BlueNoiseSampler(int width) : tile(BlueNoiseTile()), width(width) {
+}
+
+void BlueNoiseSampler::StartPixelSample(int pixel, int sampleIndex) {
+    x = pixel % width;
+    y = pixel / width;
+    this->sampleIndex = sampleIndex;
+    dimension = 0;
+}
+
+float BlueNoiseSampler::Next() {
+    int d = dimension++;
+    //Tile offsets of dimension d from the R2 sequence, far apart for consecutive dimensions.
+    int ox = (int)(BLUE_NOISE_SIZE * std::fmod(d * 0.7548776662f, 1.0f));
+    int oy = (int)(BLUE_NOISE_SIZE * std::fmod(d * 0.5698402910f, 1.0f));
+    float shift = tile[((y + oy) & (BLUE_NOISE_SIZE - 1)) * BLUE_NOISE_SIZE + ((x + ox) & (BLUE_NOISE_SIZE - 1))];
+    //Key -1 isn't a pixel, so the shared sequence is none of SobolSampler's.
+    float u = ScrambledSobol(sampleIndex, d, -1) + shift;
+    return std::min(u - std::floor(u), ONE_MINUS_EPSILON);
+}
@@ -0,0 +1,95 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <cstdint>
+#include "global.hpp"
+
+enum class SamplerType {
+    Random,     //XorShift seeded by PixelSampleSeed, every dimension independent. Same numbers as without a sampler.
+    Stratified, //Every dimension jittered over spp strata, strata shuffled per pixel and dimension.
+    Sobol,      //Owen scrambled Sobol, padded from 2D pairs.
+    BlueNoise   //One Sobol sequence for the whole image, rotated per pixel by blue noise, so low spp error is blue noise.
+};
+
+bool ParseSamplerType(const std::string& name, SamplerType& out);
+const char* SamplerName(SamplerType type);
+
+/*
+Dimension layout, passed to SetSampleDimension. Every bounce owns a fixed block, so the same decision of the same bounce
+always gets the same dimension, no matter how many numbers earlier bounces took.
+*/
+#define SAMPLE_DIMENSION_PIXEL 0        //2 dimensions, image plane. Jitter within the pixel, except with the random sampler which shoots through centers.
+#define SAMPLE_DIMENSION_PATH 2         //Block of bounce 0.
+#define SAMPLE_BOUNCE_DIMENSIONS 12
+#define SAMPLE_BSDF_OFFSET 0            //Material::sample: GGX half vector, lobe, cosine sample. At most 5.
+#define SAMPLE_LIGHT_OFFSET 6           //Light pick, primitive pick, point on primitive. At most 4, even so a mesh light's point is one Sobol pair.
+#define SAMPLE_RR_OFFSET 10             //Russian roulette.
+
+inline int BounceDimension(int bounce, int offset) {
+    return SAMPLE_DIMENSION_PATH + bounce * SAMPLE_BOUNCE_DIMENSIONS + offset;
+}
+
+/*
+Sample vector of one (pixel, sample) pair, installed as s_SampleSource so GetRandomFloat() takes its numbers from it.
+Next() hands out dimensions in order from the last SetDimension().
+Samples are a pure function of (pixel, sample index, dimension), so any sample range renders alone the same as part of a whole frame.
+*/
+class Sampler : public SampleSource {
+public:
+    /*Start sample sampleIndex of pixel, at dimension 0.*/
+    virtual void StartPixelSample(int pixel, int sampleIndex) = 0;
+
+    /*sppTotal is the frame's sample count, which stratified sampling spreads its strata over. width is the image's.*/
+    static std::unique_ptr<Sampler> Create(SamplerType type, int sppTotal, int width);
+};
+
+class RandomSampler : public Sampler {
+public:
+    void StartPixelSample(int pixel, int sampleIndex) override;
+    float Next() override;
+private:
+    uint32_t state = 1;
+};
+
+class StratifiedSampler : public Sampler {
+public:
+    explicit StratifiedSampler(int sppTotal) : sppTotal(sppTotal < 1 ? 1 : sppTotal) {}
+    void StartPixelSample(int pixel, int sampleIndex) override;
+    void SetDimension(int d) override { dimension = d; }
+    float Next() override;
+private:
+    int sppTotal;
+    int pixel = 0, sampleIndex = 0, dimension = 0;
+};
+
+/*
+Owen scrambled Sobol(Burley 2020, Practical hash-based Owen scrambling). Dimensions come in pairs, each pair the first two
+Sobol dimensions with its own shuffle of the sample index and its own scrambles, so any pair is a (0,2) sequence.
+Best at power of two spp.
+*/
+class SobolSampler : public Sampler {
+public:
+    void StartPixelSample(int pixel, int sampleIndex) override;
+    void SetDimension(int d) override { dimension = d; }
+    float Next() override;
+private:
+    int pixel = 0, sampleIndex = 0, dimension = 0;
+};
+
+/*
+Blue noise dithered sampling(Georgiev and Fajardo 2016). Every pixel takes the same Owen scrambled Sobol points, shifted
+modulo 1(Cranley-Patterson rotation) by a value from the blue noise tile at the pixel. Neighbouring pixels get far apart
+shifts, so at 1-4 spp their errors cancel out locally instead of forming white noise. Each dimension reads the tile at
+another offset, so dimensions aren't rotated alike.
+*/
+class BlueNoiseSampler : public Sampler {
+public:
+    explicit BlueNoiseSampler(int width);
+    void StartPixelSample(int pixel, int sampleIndex) override;
+    void SetDimension(int d) override { dimension = d; }
+    float Next() override;
+private:
+    const float* tile;
+    int width;
+    int x = 0, y = 0, sampleIndex = 0, dimension = 0;
+};
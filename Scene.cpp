@@ -3,10 +3,14 @@
 //
 
 #include "Scene.hpp"
+#include "RayStats.hpp"
 #include <cmath>
 #include <cassert>
 #include "BDPT.hpp"
 #include "Renderer.hpp"
+#include "Texture.hpp"
+#include "GGX.hpp"
+#include "SampleHelperFunctions.hpp"
 
 void Scene::BuildBVH() {
     printf(" - Generating BVH...\n\n");
@@ -16,15 +20,53 @@ void Scene::BuildBVH() {
             m_emissionObjects.push_back(t);
         }
     }
+    BuildEmitterTable();
 }
 
-PTVertex Scene::Intersect(const Ray &ray, FaceCulling culling) const
+void Scene::BuildEmitterTable() {
+    m_emitters.clear();
+    for (auto& t : m_emissionObjects)
+        t->GetPrimitives(m_emitters);
+    std::vector<float> power;
+    for (int i = 0; i < (int)m_emitters.size(); i++) {
+        auto e = m_emitters[i]->m->GetEmission();
+        m_emitters[i]->emitterIndex = i;
+        power.push_back((0.2126f * e.x + 0.7152f * e.y + 0.0722f * e.z) * m_emitters[i]->getArea());
+    }
+    m_emitterTable.Build(power);
+    lightSampler = LightSampler::Create(lightSamplerType, *this);
+}
+
+bool Scene::SampleEmitter(Intersection& pos, float* pdf) const {
+    if (m_emitterTable.Empty()) {
+        *pdf = 0.0f;
+        return false;
+    }
+    float pmf;
+    Object* emitter = m_emitters[m_emitterTable.Sample(GetRandomFloat(), &pmf)];
+    emitter->Sample(pos);
+    pos.obj = emitter;
+    pos.m = emitter->m;
+    pos.emit = emitter->m->GetEmission();
+    pos.happened = true;
+    *pdf = pmf / emitter->getArea();
+    return true;
+}
+
+float Scene::EmitterPdf(const Object* primitive) const {
+    if (primitive == nullptr || primitive->emitterIndex < 0 || primitive->emitterIndex >= m_emitterTable.Size()
+        || m_emitters[primitive->emitterIndex] != primitive)
+        return 0.0f;
+    return m_emitterTable.Pmf(primitive->emitterIndex) / m_emitters[primitive->emitterIndex]->getArea();
+}
+
+static PTVertex ToPTVertex(const Intersection& t)
 {
-    auto t = this->bvh->Intersect(ray, culling);
     PTVertex r;
     if (t.happened) {
         r.obj = t.obj;
         r.N = t.normal;
+        r.Ng = t.normal;
         r.type = PTVertex::Type::Intermediate;
         r.x = t.coords;
     }
@@ -34,13 +76,214 @@ PTVertex Scene::Intersect(const Ray &ray, FaceCulling culling) const
     return r;
 }
 
+PTVertex Scene::Intersect(const Ray &ray, FaceCulling culling, bool withTextures) const
+{
+    RENDER_COUNT(rays, 1);
+    PTVertex v = ToPTVertex(this->bvh->Intersect(ray, culling));
+    if (withTextures && v.obj && v.obj->m->HasTextures())
+        ApplyTextures(ray, v);
+    return v;
+}
+
+PTVertex Scene::Intersect(const RayDifferential& ray, FaceCulling culling, bool withTextures) const
+{
+    RENDER_COUNT(rays, 1);
+    PTVertex v = ToPTVertex(this->bvh->Intersect(ray, culling));
+    if (withTextures && v.obj && v.obj->m->HasTextures())
+        ApplyTextures(ray, v, &ray);
+    return v;
+}
+
+/*
+Offsets from p to where the differentials of ray cut the plane through p with normal n. False if ray is null or has none.
+At grazing angles the footprint gets long, stretching it more than 20 times only blurs.
+*/
+static bool DifferentialFootprint(const RayDifferential* ray, const Vector3f& p, const Vector3f& n, Vector3f& dpdx, Vector3f& dpdy)
+{
+    if (!ray || !ray->hasDifferentials)
+        return false;
+    auto cut = [&](const Vector3f& o, const Vector3f& d) {
+        float dn = DotProduct(d, n);
+        float minDn = 0.05f * d.Magnitude();
+        dn = std::copysign(std::max(std::fabs(dn), minDn), dn);
+        return o + d * (DotProduct(p - o, n) / dn) - p;
+    };
+    dpdx = cut(ray->rxOrigin, ray->rxDirection);
+    dpdy = cut(ray->ryOrigin, ray->ryDirection);
+    return true;
+}
+
+void Scene::ApplyTextures(const Ray& ray, PTVertex& v, const RayDifferential* differentials) const
+{
+    Material* m = v.obj->m;
+    SurfaceUV s;
+    if (!v.obj->SurfaceCoords(v.x, s))
+        return;
+    TextureCoords st;
+    st.u = s.u;
+    st.v = s.v;
+
+    //Where rays one pixel off in x and y meet the tangent plane, then the same offsets in u and v(least squares, pbrt 10.1).
+    const Vector3f& d = ray.direction;
+    Vector3f dpdx, dpdy;
+    if (!DifferentialFootprint(differentials, v.x, v.N, dpdx, dpdy)) {
+        float width = 2.0f * std::tan(deg2rad(fov * 0.5)) / height * (v.x - eyePos).Magnitude();
+        Vector3f ax = CrossProduct(d, std::fabs(d.y) < 0.9f ? Vector3f(0.0f, 1.0f, 0.0f) : Vector3f(1.0f, 0.0f, 0.0f)).Normalized();
+        Vector3f ay = CrossProduct(d, ax);
+        float dn = DotProduct(d, v.N);
+        dn = std::copysign(std::max(std::fabs(dn), 0.05f), dn);
+        dpdx = (ax - d * (DotProduct(ax, v.N) / dn)) * width;
+        dpdy = (ay - d * (DotProduct(ay, v.N) / dn)) * width;
+    }
+    float a11 = DotProduct(s.dpdu, s.dpdu), a12 = DotProduct(s.dpdu, s.dpdv), a22 = DotProduct(s.dpdv, s.dpdv);
+    float det = a11 * a22 - a12 * a12;
+    if (det != 0.0f) {
+        float invDet = 1.0f / det;
+        auto toUV = [&](const Vector3f& dp, float& du, float& dv) {
+            float b1 = DotProduct(s.dpdu, dp), b2 = DotProduct(s.dpdv, dp);
+            du = (a22 * b1 - a12 * b2) * invDet;
+            dv = (a11 * b2 - a12 * b1) * invDet;
+        };
+        toUV(dpdx, st.dudx, st.dvdx);
+        toUV(dpdy, st.dudy, st.dvdy);
+    }
+
+    if (m->albedoMap || m->roughnessMap) {
+        v.textured = true;
+        v.texels.Kd = m->albedoMap ? m->albedoMap->Lookup(st) : m->Kd;
+        v.texels.rough = m->roughnessMap ? SmoothnessToRoughenss(1.0f - saturate(m->roughnessMap->Lookup(st).x)) : m->rough;
+    }
+    if (m->normalMap) {
+        Vector3f t = s.dpdu - v.N * DotProduct(v.N, s.dpdu);
+        if (t.SqrMagnitude() == 0.0f)
+            return;
+        t = t.Normalized();
+        Vector3f b = CrossProduct(v.N, t);
+        if (DotProduct(b, s.dpdv) < 0.0f)
+            b = -b;
+        Vector3f c = m->normalMap->Lookup(st) * 2.0f - Vector3f::One();
+        Vector3f shading = (t * c.x + b * c.y + v.N * c.z).Normalized();
+        //A map tilting the normal past the ray would have it see the back side, keep the flat one then.
+        if (DotProduct(shading, d) * DotProduct(v.N, d) > 0.0f)
+            v.N = shading;
+    }
+}
+
+void Scene::SpawnDifferentials(const RayDifferential& in, const PTVertex& hit, RayDifferential& out) const
+{
+    out.hasDifferentials = false;
+    Material* m = hit.obj->m;
+    Vector3f dpdx, dpdy;
+    if (!m->IsNearSpecular() || !DifferentialFootprint(&in, hit.x, hit.Ng, dpdx, dpdy))
+        return;
+    Vector3f n = hit.N;
+    Vector3f dndx = hit.obj->NormalDerivative(dpdx), dndy = hit.obj->NormalDerivative(dpdy);
+    Vector3f wo = -in.direction, wi = out.direction;
+    Vector3f dwodx = -in.rxDirection - wo, dwody = -in.ryDirection - wo;
+    float cosO = DotProduct(wo, n);
+    out.rxOrigin = out.origin + dpdx;
+    out.ryOrigin = out.origin + dpdy;
+    if (DotProduct(wi, n) * cosO > 0.0f) {
+        //wi = -wo + 2(wo.n)n, differentiated.
+        float dDNdx = DotProduct(dwodx, n) + DotProduct(wo, dndx);
+        float dDNdy = DotProduct(dwody, n) + DotProduct(wo, dndy);
+        out.rxDirection = wi - dwodx + (dndx * cosO + n * dDNdx) * 2.0f;
+        out.ryDirection = wi - dwody + (dndy * cosO + n * dDNdy) * 2.0f;
+    }
+    else {
+        //wi = -eta wo + mu n, eta the ior on wo's side over the other one and n turned to wo.
+        float eta = 1.0f / m->ior_d;
+        if (cosO < 0.0f) {
+            eta = m->ior_d;
+            n = -n;
+            dndx = -dndx;
+            dndy = -dndy;
+            cosO = -cosO;
+        }
+        float cosI = std::fabs(DotProduct(wi, n));
+        if (cosI == 0.0f)
+            return;
+        float mu = eta * cosO - cosI;
+        float dmu = eta - eta * eta * cosO / cosI;
+        float dDNdx = DotProduct(dwodx, n) + DotProduct(wo, dndx);
+        float dDNdy = DotProduct(dwody, n) + DotProduct(wo, dndy);
+        out.rxDirection = wi - dwodx * eta + dndx * mu + n * (dmu * dDNdx);
+        out.ryDirection = wi - dwody * eta + dndy * mu + n * (dmu * dDNdy);
+    }
+    out.hasDifferentials = true;
+}
+
+/*Counting sort of ray indices by the sign bits of their direction, so packets mostly get a valid interval bound.*/
+static void SortByOctant(const Ray* rays, int count, std::vector<int>& order)
+{
+    int octantStart[9] = { 0 };
+    for (int i = 0; i < count; i++) {
+        auto& d = rays[i].direction;
+        octantStart[1 + ((d.x < 0.0f) | ((d.y < 0.0f) << 1) | ((d.z < 0.0f) << 2))]++;
+    }
+    for (int i = 0; i < 8; i++)
+        octantStart[i + 1] += octantStart[i];
+    order.resize(count);
+    for (int i = 0; i < count; i++) {
+        auto& d = rays[i].direction;
+        order[octantStart[(d.x < 0.0f) | ((d.y < 0.0f) << 1) | ((d.z < 0.0f) << 2)]++] = i;
+    }
+}
+
+/*Whether hit, found by the shadow ray from lightCoords to x, is in between rather than x's own surface.*/
+static inline bool OccludedBefore(const Vector3f& lightCoords, const Vector3f& x, const Vector3f& hit)
+{
+    return (hit - lightCoords).Magnitude() < (x - lightCoords).Magnitude() - RayEpsilon(x);
+}
+
+void Scene::IntersectStream(const Ray* rays, const FaceCulling* culling, int count, PTVertex* out, int packetSize, bool withTextures) const
+{
+    packetSize = std::max(1, std::min(RAY_PACKET_MAX, packetSize));
+    RENDER_COUNT(rays, count);
+    std::vector<int> order;
+    SortByOctant(rays, count, order);
+
+    RayPacket packet;
+    Intersection hits[RAY_PACKET_MAX];
+    for (int begin = 0; begin < count; begin += packetSize) {
+        packet.Clear();
+        for (int i = begin; i < std::min(count, begin + packetSize); i++)
+            packet.Push(&rays[order[i]], culling[order[i]]);
+        packet.Prepare();
+        for (int i = 0; i < packet.count; i++)
+            hits[i] = Intersection();
+        bvh->IntersectPacket(packet, packet.FullMask(), hits);
+        for (int i = 0; i < packet.count; i++) {
+            PTVertex& v = out[order[begin + i]];
+            v = ToPTVertex(hits[i]);
+            if (withTextures && v.obj && v.obj->m->HasTextures())
+                ApplyTextures(*packet.rays[i], v);
+        }
+    }
+}
+
+void Scene::ShadowCheckStream(const Vector3f* lightCoords, const Vector3f* x, int count, uint8_t* shadowed, int packetSize) const
+{
+    RENDER_COUNT(shadowRays, count);
+    std::vector<Ray> rays;
+    rays.reserve(count);
+    for (int i = 0; i < count; i++)
+        rays.emplace_back(lightCoords[i], (x[i] - lightCoords[i]).Normalized());
+    std::vector<FaceCulling> culling(count, FaceCulling::CullBack);
+    std::vector<PTVertex> hits(count);
+    //Only where they hit matters, so no texture lookups churning the tile cache.
+    IntersectStream(rays.data(), culling.data(), count, hits.data(), packetSize, false);
+    //Same test as ShadowCheck.
+    for (int i = 0; i < count; i++)
+        shadowed[i] = hits[i].type != PTVertex::Type::Background && OccludedBefore(lightCoords[i], x[i], hits[i].x);
+}
+
 bool Scene::ShadowCheck(Vector3f lightCoords, Vector3f x, FaceCulling culling) const
 {
-    auto lightDistanceSqr = DotProduct(lightCoords - x, lightCoords - x);
     //Shadow check.
-    auto shadowInter = Intersect(Ray(lightCoords, (x - lightCoords).Normalized()), culling);
-    auto shadowDistanceSqr = DotProduct(shadowInter.x - lightCoords, shadowInter.x - lightCoords);
-    if (shadowInter.type != PTVertex::Type::Background && shadowDistanceSqr < lightDistanceSqr - 1.0f) {
+    RENDER_COUNT(shadowRays, 1);
+    auto shadowInter = Intersect(Ray(lightCoords, (x - lightCoords).Normalized()), culling, false);
+    if (shadowInter.type != PTVertex::Type::Background && OccludedBefore(lightCoords, x, shadowInter.x)) {
         //Shadowed.
         return true;
     }
@@ -57,7 +300,7 @@ bool Scene::ShadowCheck(const PTVertex& v1, const PTVertex& v2) const {
 
 	if (v1.obj != nullptr && v2.obj != v1.obj && v1.obj->m->getType() == MaterialType::Transparent) {    //v1 and v2 on the same transmittance object.
 																													//Transmittance material.
-		if (DotProduct(atob, v1.N) < 0.0f) {
+		if (DotProduct(atob, v1.Ng) < 0.0f) {
 			//v2 is on backside of v1 surface. flip culling.
 			return ShadowCheck(v1.x, v2.x, FaceCulling::CullFront);
 		}
@@ -68,13 +311,14 @@ bool Scene::ShadowCheck(const PTVertex& v1, const PTVertex& v2) const {
 	}
 	else {
 
-		if (v1.obj != nullptr && DotProduct(atob, v1.N) < 0.0f) {
-			//Fast path, if v1 is object, use its normal facing to quick detect occlusion.
-			return false;
+		//Fast path, if v1 is object, use its normal facing to quick detect occlusion.
+		//Going into an opaque surface it's blocked by itself, a normal map could tilt N so the bsdf isn't 0 there.
+		if (v1.obj != nullptr && DotProduct(atob, v1.Ng) < 0.0f) {
+			return v1.obj->m->getType() != MaterialType::Transparent;
 		}
-		if (v2.obj != nullptr && DotProduct(-atob, v2.N) < 0.0f) {
+		if (v2.obj != nullptr && DotProduct(-atob, v2.Ng) < 0.0f) {
 			//Same as above.
-			return false;
+			return v2.obj->m->getType() != MaterialType::Transparent;
 		}
 
 		//Slowest detection.
@@ -11,6 +11,9 @@
 #include "BVH.hpp"
 #include "Ray.hpp"
 #include "PTVertex.hpp"
+#include "AliasTable.hpp"
+#include "LightSampler.hpp"
+#include "Sampler.hpp"
 
 class Scene
 {
@@ -21,20 +24,58 @@ public:
     double fov = 40;
     Vector3f eyePos;
     Vector3f backgroundColor = Vector3f(0.235294f, 0.67451f, 0.843137f);
-    int maxDepth = 1;
+    int maxDepth = 16;     //Path vertices after the camera for path tracing, 1 is direct lighting only. BDPT only uses russian roulette.
     float RussianRoulette = 0.8;
+    int lightCacheConnections = 1;     //Cached light vertices each camera vertex connects to, light vertex cache BDPT only.
+    float vcmRadius = 0.0f;     //Initial merge radius of VCM, 0 picks one from the scene size.
+    int causticPhotons = 0;     //Photon paths shot for the caustic photon map of path tracing, 0 for none.
+    float photonRadius = 0.0f;  //Caustic photon gather radius, 0 picks one from the scene size.
     BVHAccel* bvh;
     std::vector<Object*> objects;
     std::vector<Object*> m_emissionObjects;
+    //Every emissive primitive(mesh triangle, sphere), picked with probability proportional to emitted power x area.
+    std::vector<Object*> m_emitters;
+    AliasTable m_emitterTable;
+    //Picks the emitter for next event estimation in path tracing, built with the emitter table.
+    LightSamplerType lightSamplerType = LightSamplerType::Power;
+    std::shared_ptr<LightSampler> lightSampler;
+    SamplerType samplerType = SamplerType::Random;     //Where path tracing and BDPT take their random numbers from.
 
     Scene(int w, int h) : width(w), height(h)
     {}
 
     Scene& Add(Object* object) { objects.push_back(object);  return *this; }
     const std::vector<Object*>& GetObjects() const { return objects; }
-    PTVertex Intersect(const Ray& ray, FaceCulling culling = FaceCulling::CullBack) const;
+    /*withTextures false skips the texture lookups(v.texels and the normal map), for rays that only test occlusion.*/
+    PTVertex Intersect(const Ray& ray, FaceCulling culling = FaceCulling::CullBack, bool withTextures = true) const;
+    /*Same, with the texture lookups filtered over the ray's differentials if it has any.*/
+    PTVertex Intersect(const RayDifferential& ray, FaceCulling culling = FaceCulling::CullBack, bool withTextures = true) const;
+    /*
+    Look up the maps of v's material, hit by ray: Kd and roughness go to v.texels, the normal map tilts v.N(v.Ng stays).
+    The mip level is for where the differentials of ray(if given) cut the surface, or without them for a cone of one pixel's angle
+    from the eye, as if the camera saw v directly. Intersect() does this for textured materials.
+    */
+    void ApplyTextures(const Ray& ray, PTVertex& v, const RayDifferential* differentials = nullptr) const;
+    /*
+    Differentials of out, the ray leaving hit after in got there, through mirror like reflection or refraction(pbrt 10.1).
+    Rougher bounces spread a footprint much more than that, so out goes on without any then.
+    */
+    void SpawnDifferentials(const RayDifferential& in, const PTVertex& hit, RayDifferential& out) const;
     void BuildBVH();
+    void BuildEmitterTable();
     bool ShadowCheck(Vector3f lightCoords, Vector3f x, FaceCulling culling = CullBack) const;
     bool ShadowCheck(const PTVertex& v1, const PTVertex& v2) const;
 
+    /*Sample a point on any emitter. pdf is per area over all emitters, selection probability included. False if the scene has no light.*/
+    bool SampleEmitter(Intersection& pos, float* pdf) const;
+    /*The area pdf SampleEmitter would give for a point on primitive.*/
+    float EmitterPdf(const Object* primitive) const;
+
+    /*
+    Stream versions of Intersect and ShadowCheck(lightCoords, x), for batches of unrelated rays.
+    Rays are grouped by direction octant and traced in packets of packetSize, results come back in input order.
+    */
+    void IntersectStream(const Ray* rays, const FaceCulling* culling, int count, PTVertex* out, int packetSize = RAY_PACKET_MAX, bool withTextures = true) const;
+    void ShadowCheckStream(const Vector3f* lightCoords, const Vector3f* x, int count, uint8_t* shadowed, int packetSize = RAY_PACKET_MAX) const;
+
 };
\ No newline at end of file
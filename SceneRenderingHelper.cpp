@@ -6,65 +6,62 @@
 #include "Vector.hpp"
 #include "Scene.hpp"
 #include "SampleHelperFunctions.hpp"
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "stb_image_write.h"
+#include "RayStats.hpp"
 
 float CalculateScale(float fov) {
     return tan(deg2rad(fov * 0.5));
 }
 
-Vector3f PixelPosToRay(int xPixel, int yPixel, int width, int height, float scale) {
+Vector3f PixelPosToRay(int xPixel, int yPixel, int width, int height, float scale, float jitterX, float jitterY) {
     float imageAspectRatio = width / height;
-    float x = (2 * (xPixel + 0.5) / (float)width - 1) *
+    float x = (2 * (xPixel + (double)jitterX) / (float)width - 1) *
         imageAspectRatio * scale;
-    float y = (1 - 2 * (yPixel + 0.5) / (float)height) * scale;
+    float y = (1 - 2 * (yPixel + (double)jitterY) / (float)height) * scale;
     return Vector3f(-x, y, 1).Normalized();
 }
 
-Vector3f RayToUV(Ray ray, int width, int height, float scale) {
-    float imageAspectRatio = width / height;
-    auto t = Vector3f(-ray.direction.x / scale / imageAspectRatio, -ray.direction.y / scale, 0.0f);
-    return (t + 1.0f) * 0.5f;
+RayDifferential CameraRay(const Vector3f& eye, int xPixel, int yPixel, int width, int height, float scale, float jitterX, float jitterY) {
+    RENDER_COUNT(cameraRays, 1);
+    RayDifferential ray(eye, PixelPosToRay(xPixel, yPixel, width, height, scale, jitterX, jitterY));
+    ray.hasDifferentials = true;
+    ray.rxOrigin = ray.ryOrigin = eye;
+    ray.rxDirection = PixelPosToRay(xPixel + 1, yPixel, width, height, scale, jitterX, jitterY);
+    ray.ryDirection = PixelPosToRay(xPixel, yPixel + 1, width, height, scale, jitterX, jitterY);
+    return ray;
 }
 
-void DrawToImage(Ray lightRay, Vector3f* buffer, Vector3f value, float fov, int width, int height, BlendMode mode) {
-    lightRay.direction = lightRay.direction / lightRay.direction.z;
-    Vector3f uv = RayToUV(lightRay, width, height, CalculateScale(fov));
-    Vector3f coordScreenSpace = Vector3f(uv.x * width, uv.y * height, 0.0f);
-
-    int centerPixelX = coordScreenSpace.x;
-    int centerPixelY = coordScreenSpace.y;
-
-    for (int ix = centerPixelX - 1; ix <= centerPixelX + 1; ix++) {
-        for (int iy = centerPixelY - 1; iy <= centerPixelY + 1; iy++) {
-            if (ix < 0 || iy < 0 || ix >= width || iy >= height)
-                continue;
-            Vector3f curPixelUV = Vector3f(ix + 0.5f, iy + 0.5f, 0.0f);
-            float distanceX = std::abs(coordScreenSpace.x - curPixelUV.x);
-            float distanceY = std::abs(coordScreenSpace.y - curPixelUV.y);
-
-            float weight =
-                std::max(0.0f, 1.0f - distanceX)
-                * std::max(0.0f, 1.0f - distanceY);
-            if (mode == BlendMode::Additive)
-                buffer[ix + height * iy] += weight * value;
-            else
-                buffer[ix + height * iy] = weight * value;
-        }
-    }
+//cos of dir to the view direction, 0 if dir misses the image. Area of the image plane in area.
+static float CameraCosine(const Scene* scene, const Vector3f& dir, float& area) {
+    float imageAspectRatio = scene->width / scene->height;     //Same as PixelPosToRay.
+    float scale = CalculateScale(scene->fov);
+    area = 4.0f * imageAspectRatio * scale * scale;
+    float cosTheta = dir.z;
+    if (cosTheta <= 0.0f)
+        return 0.0f;
+    if (std::abs(dir.x / cosTheta) > imageAspectRatio * scale || std::abs(dir.y / cosTheta) > scale)
+        return 0.0f;
+    return cosTheta;
 }
 
-void SaveFloatImageToJpg(std::vector<Vector3f> framebuffer, int width, int height, std::string path) {
-    std::vector<unsigned char> normalizedBuffer;
-    normalizedBuffer.reserve(framebuffer.size() * 3);
-    for (auto i = 0; i < height * width; ++i) {
-        static unsigned char color[3];
-        color[0] = (unsigned char)(255 * std::pow(std::clamp(framebuffer[i].x, 0.f, 1.f), 0.6f));
-        color[1] = (unsigned char)(255 * std::pow(std::clamp(framebuffer[i].y, 0.f, 1.f), 0.6f));
-        color[2] = (unsigned char)(255 * std::pow(std::clamp(framebuffer[i].z, 0.f, 1.f), 0.6f));
-        normalizedBuffer.insert(normalizedBuffer.end(), color, color + 3);
-    }
+float CameraWe(const Scene* scene, const Vector3f& dir) {
+    float area;
+    float cosTheta = CameraCosine(scene, dir, area);
+    if (cosTheta == 0.0f)
+        return 0.0f;
+    float cos2 = cosTheta * cosTheta;
+    return 1.0f / (area * cos2 * cos2);
+}
 
-    stbi_write_jpg(path.c_str(), width, height, 3, &normalizedBuffer[0], 100);
+float CameraPdfWe(const Scene* scene, const Vector3f& dir) {
+    float area;
+    float cosTheta = CameraCosine(scene, dir, area);
+    if (cosTheta == 0.0f)
+        return 0.0f;
+    return 1.0f / (area * cosTheta * cosTheta * cosTheta);
+}
 
+Vector3f RayToUV(Ray ray, int width, int height, float scale) {
+    float imageAspectRatio = width / height;
+    auto t = Vector3f(-ray.direction.x / scale / imageAspectRatio, -ray.direction.y / scale, 0.0f);
+    return (t + 1.0f) * 0.5f;
 }
@@ -4,6 +4,8 @@
 #include "Vector.hpp"
 #include "Scene.hpp"
 #include "SampleHelperFunctions.hpp"
+#include "ImageIO.hpp"
+#include "Accumulation.hpp"
 
 enum BlendMode {
     Replace,
@@ -12,10 +14,58 @@ enum BlendMode {
 
 float CalculateScale(float fov);
 
-Vector3f PixelPosToRay(int xPixel, int yPixel, int width, int height, float scale);
+/*Direction through the point of the pixel at jitter, [0,1) across it. The center by default.*/
+Vector3f PixelPosToRay(int xPixel, int yPixel, int width, int height, float scale, float jitterX = 0.5f, float jitterY = 0.5f);
+
+/*Ray from eye through the pixel(at jitter, see PixelPosToRay), with differentials towards the next pixel in x and y.*/
+RayDifferential CameraRay(const Vector3f& eye, int xPixel, int yPixel, int width, int height, float scale, float jitterX = 0.5f, float jitterY = 0.5f);
+
+/*
+The pinhole camera CameraRay shoots from, looking down +z onto an image plane at distance 1(pbrt's PerspectiveCamera).
+CameraWe is the importance of direction dir from the eye, 1/(A cos^4), A the image plane's area. CameraPdfWe is the solid angle pdf
+of CameraRay picking dir for a uniformly chosen point of the image, 1/(A cos^3). Both are 0 outside the image.
+*/
+float CameraWe(const Scene* scene, const Vector3f& dir);
+float CameraPdfWe(const Scene* scene, const Vector3f& dir);
 
 Vector3f RayToUV(Ray ray, int width, int height, float scale);
 
-void DrawToImage(Ray lightRay, Vector3f* buffer, Vector3f value, float fov, int width, int height, BlendMode mode = BlendMode::Additive);
+inline void BlendPixel(Vector3f& pixel, const Vector3f& value, BlendMode mode) {
+    if (mode == BlendMode::Additive)
+        pixel += value;
+    else
+        pixel = value;
+}
+
+inline void BlendPixel(AccumPixel& pixel, const Vector3f& value, BlendMode mode) {
+    if (mode == BlendMode::Additive)
+        pixel.Add(value);
+    else
+        pixel.Set(value);
+}
+
+/*Splat value onto the image where lightRay hits the camera, bilinear over the nearby pixels. TPixel is Vector3f or AccumPixel.*/
+template<typename TPixel>
+void DrawToImage(Ray lightRay, TPixel* buffer, Vector3f value, float fov, int width, int height, BlendMode mode = BlendMode::Additive) {
+    lightRay.direction = lightRay.direction / lightRay.direction.z;
+    Vector3f uv = RayToUV(lightRay, width, height, CalculateScale(fov));
+    Vector3f coordScreenSpace = Vector3f(uv.x * width, uv.y * height, 0.0f);
+
+    int centerPixelX = coordScreenSpace.x;
+    int centerPixelY = coordScreenSpace.y;
+
+    for (int ix = centerPixelX - 1; ix <= centerPixelX + 1; ix++) {
+        for (int iy = centerPixelY - 1; iy <= centerPixelY + 1; iy++) {
+            if (ix < 0 || iy < 0 || ix >= width || iy >= height)
+                continue;
+            Vector3f curPixelUV = Vector3f(ix + 0.5f, iy + 0.5f, 0.0f);
+            float distanceX = std::abs(coordScreenSpace.x - curPixelUV.x);
+            float distanceY = std::abs(coordScreenSpace.y - curPixelUV.y);
 
-void SaveFloatImageToJpg(std::vector<Vector3f> framebuffer, int width, int height, std::string path);
\ No newline at end of file
+            float weight =
+                std::max(0.0f, 1.0f - distanceX)
+                * std::max(0.0f, 1.0f - distanceY);
+            BlendPixel(buffer[ix + width * iy], weight * value, mode);
+        }
+    }
+}
\ No newline at end of file
@@ -53,3 +53,17 @@ void Sphere::Sample(Intersection& pos) {
 	pos.emit = m->GetEmission();
 	pos.obj = this;
 }
+
+bool Sphere::SurfaceCoords(const Vector3f& p, SurfaceUV& out) const {
+	Vector3f d = (p - center) / radius;
+	float phi = std::atan2(d.z, d.x);
+	float theta = std::acos(std::clamp(d.y, -1.0f, 1.0f));
+	out.u = phi / (2.0f * M_PI) + 0.5f;
+	out.v = 1.0f - theta / M_PI;
+	float sinTheta = std::sin(theta), cosTheta = d.y;
+	float cosPhi = std::cos(phi), sinPhi = std::sin(phi);
+	//p = center + radius(sin theta cos phi, cos theta, sin theta sin phi), phi = 2 pi(u - 0.5), theta = pi(1 - v).
+	out.dpdu = Vector3f(-sinTheta * sinPhi, 0.0f, sinTheta * cosPhi) * (2.0f * M_PI * radius);
+	out.dpdv = Vector3f(cosTheta * cosPhi, -sinTheta, cosTheta * sinPhi) * (-M_PI * radius);
+	return true;
+}
@@ -18,6 +18,9 @@ public:
     Sphere(const Vector3f &c, const float &r, Material* mt = new Material()) : center(c), radius(r), radius2(r * r), Object(mt), area(4 * M_PI *r *r) {}
 
     Intersection GetIntersection(Ray ray, FaceCulling culling);
+    /*u around the y axis, v from the bottom pole to the top.*/
+    bool SurfaceCoords(const Vector3f& p, SurfaceUV& out) const override;
+    Vector3f NormalDerivative(const Vector3f& dp) const override { return dp / radius; }
 
     Bounds3 GetBounds();
     
@@ -0,0 +1,323 @@
+#include "Texture.hpp"
+#include "ImageIO.hpp"
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <algorithm>
+#include <functional>
+#include <filesystem>
+
+TextureCache s_TextureCache;
+std::string s_TextureCacheDir;
+
+static std::atomic<uint32_t> s_NextTextureId{ 1 };
+
+static float SrgbToLinear(float c) {
+    return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+static float LinearToSrgb(float c) {
+    return c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+}
+
+static float s_SrgbTable[256];
+static bool s_SrgbTableBuilt = []() {
+    for (int i = 0; i < 256; i++)
+        s_SrgbTable[i] = SrgbToLinear(i / 255.0f);
+    return true;
+}();
+
+/*
+Builds one mip level from rows of the level above, as they stream in. Keeps a strip of TEXTURE_TILE_SIZE rows,
+written out as tiles once full, and the last odd row, averaged with the next one into a row of the level below.
+So tiling a texture only needs about two strips of its full width in memory.
+*/
+struct MipLevelBuilder {
+    MipLevelBuilder(int w, int h, int c) : width(w), height(h), channels(c) {}
+    int width, height, channels;
+    int rowsIn = 0;
+    std::vector<float> strip, pending;
+    bool hasPending = false;
+};
+
+static void WriteStrip(const MipLevelBuilder& b, int stripIndex, int rows, size_t firstTile, int tilesX, bool floatTexels, bool srgb,
+    std::ofstream& file, std::vector<uint64_t>& offsets) {
+    const int TS = TEXTURE_TILE_SIZE;
+    std::vector<unsigned char> bytes;
+    std::vector<float> floats;
+    for (int tx = 0; tx < tilesX; tx++) {
+        //Edge tiles are padded with the last texel, lookups never read the padding.
+        floats.assign((size_t)TS * TS * b.channels, 0.0f);
+        for (int y = 0; y < TS; y++) {
+            const float* row = &b.strip[(size_t)std::min(y, rows - 1) * b.width * b.channels];
+            for (int x = 0; x < TS; x++) {
+                int sx = std::min(tx * TS + x, b.width - 1);
+                for (int c = 0; c < b.channels; c++)
+                    floats[((size_t)y * TS + x) * b.channels + c] = row[(size_t)sx * b.channels + c];
+            }
+        }
+        offsets[firstTile + (size_t)stripIndex * tilesX + tx] = (uint64_t)file.tellp();
+        if (floatTexels) {
+            file.write(reinterpret_cast<const char*>(floats.data()), floats.size() * sizeof(float));
+            continue;
+        }
+        bytes.resize(floats.size());
+        for (size_t i = 0; i < floats.size(); i++) {
+            float v = std::clamp(floats[i], 0.0f, 1.0f);
+            bytes[i] = (unsigned char)std::lround((srgb ? LinearToSrgb(v) : v) * 255.0f);
+        }
+        file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+    }
+}
+
+std::unique_ptr<Texture> Texture::Load(const std::string& path, bool srgb) {
+    auto reader = ImageRowReader::Open(path);
+    if (!reader) {
+        std::cout << "Can't read texture " << path << ", only binary ppm, pgm and pfm are supported\n";
+        return nullptr;
+    }
+    std::unique_ptr<Texture> texture(new Texture());
+    texture->id = s_NextTextureId++;
+    texture->channels = reader->Channels();
+    texture->floatTexels = reader->BitsPerChannel() != 8;
+    texture->srgb = srgb;
+
+    //Mip chain down to 1x1, odd sizes round up and repeat their last row or column.
+    const int TS = TEXTURE_TILE_SIZE;
+    size_t tileCount = 0;
+    for (int w = reader->Width(), h = reader->Height();; w = (w + 1) / 2, h = (h + 1) / 2) {
+        Level l{ w, h, (w + TS - 1) / TS, (h + TS - 1) / TS, tileCount };
+        texture->levels.push_back(l);
+        tileCount += (size_t)l.tilesX * l.tilesY;
+        if (w == 1 && h == 1)
+            break;
+    }
+    texture->tileOffsets.resize(tileCount);
+
+    //Unique per process and texture, so several renders can share the directory.
+    static const uint32_t session = std::random_device()();
+    std::filesystem::path dir = s_TextureCacheDir.empty() ? std::filesystem::temp_directory_path() : std::filesystem::path(s_TextureCacheDir);
+    char name[64];
+    snprintf(name, sizeof(name), "texture_%08x_%u.tiles", session, texture->id);
+    texture->tiledPath = (dir / name).string();
+    std::ofstream file(texture->tiledPath, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        std::cout << "Can't write tiles of " << path << " to " << texture->tiledPath << "\n";
+        return nullptr;
+    }
+
+    std::vector<MipLevelBuilder> builders;
+    for (auto& l : texture->levels) {
+        MipLevelBuilder b(l.width, l.height, texture->channels);
+        b.strip.resize((size_t)TS * l.width * b.channels);
+        b.pending.resize((size_t)l.width * b.channels);
+        builders.push_back(std::move(b));
+    }
+    //Rows of level i go into its strip, and pairs of them down to level i + 1.
+    std::function<void(int, const float*)> addRow = [&](int i, const float* row) {
+        MipLevelBuilder& b = builders[i];
+        const Level& l = texture->levels[i];
+        size_t rowSize = (size_t)b.width * b.channels;
+        std::copy(row, row + rowSize, &b.strip[(size_t)(b.rowsIn % TS) * rowSize]);
+        b.rowsIn++;
+        if (b.rowsIn % TS == 0 || b.rowsIn == b.height)
+            WriteStrip(b, (b.rowsIn - 1) / TS, (b.rowsIn - 1) % TS + 1, l.firstTile, l.tilesX, texture->floatTexels, srgb, file, texture->tileOffsets);
+        if (i + 1 == (int)builders.size())
+            return;
+        if (!b.hasPending && b.rowsIn < b.height) {
+            std::copy(row, row + rowSize, b.pending.begin());
+            b.hasPending = true;
+            return;
+        }
+        const float* above = b.hasPending ? b.pending.data() : row;
+        MipLevelBuilder& next = builders[i + 1];
+        std::vector<float> half((size_t)next.width * b.channels);
+        for (int x = 0; x < next.width; x++) {
+            int x0 = 2 * x, x1 = std::min(2 * x + 1, b.width - 1);
+            for (int c = 0; c < b.channels; c++) {
+                half[(size_t)x * b.channels + c] = 0.25f * (above[(size_t)x0 * b.channels + c] + above[(size_t)x1 * b.channels + c]
+                    + row[(size_t)x0 * b.channels + c] + row[(size_t)x1 * b.channels + c]);
+            }
+        }
+        b.hasPending = false;
+        addRow(i + 1, half.data());
+    };
+
+    std::vector<float> row((size_t)reader->Width() * texture->channels);
+    //Averaging is done on linear values, 8 bit ones are encoded again when written. Pfm is linear already.
+    bool decode = srgb && reader->BitsPerChannel() != 32;
+    for (int y = 0; y < reader->Height(); y++) {
+        if (!reader->ReadRow(y, row.data())) {
+            std::cout << "Texture " << path << " ends early\n";
+            return nullptr;
+        }
+        if (decode) {
+            for (auto& c : row)
+                c = SrgbToLinear(c);
+        }
+        addRow(0, row.data());
+    }
+    file.close();
+    if (!file) {
+        std::cout << "Can't write tiles of " << path << " to " << texture->tiledPath << "\n";
+        return nullptr;
+    }
+    texture->tiledFile.open(texture->tiledPath, std::ios::binary);
+    std::cout << " - Texture " << path << ": " << texture->Width() << "x" << texture->Height() << ", " << texture->Levels() << " levels, " << tileCount << " tiles\n";
+    return texture;
+}
+
+Texture::~Texture() {
+    tiledFile.close();
+    if (!tiledPath.empty())
+        std::remove(tiledPath.c_str());
+}
+
+bool Texture::ReadTile(size_t tile, TextureTile& out) const {
+    size_t count = (size_t)TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE * channels;
+    std::lock_guard<std::mutex> lock(fileMutex);
+    tiledFile.seekg((std::streamoff)tileOffsets[tile]);
+    if (floatTexels) {
+        out.floats.resize(count);
+        tiledFile.read(reinterpret_cast<char*>(out.floats.data()), count * sizeof(float));
+    }
+    else {
+        out.bytes.resize(count);
+        tiledFile.read(reinterpret_cast<char*>(out.bytes.data()), count);
+    }
+    bool ok = (bool)tiledFile;
+    tiledFile.clear();
+    return ok;
+}
+
+Vector3f Texture::Texel(int level, int x, int y) const {
+    const Level& l = levels[level];
+    const int TS = TEXTURE_TILE_SIZE;
+    const TextureTile* tile = s_TextureCache.Get(*this, l.firstTile + (size_t)(y / TS) * l.tilesX + x / TS);
+    size_t i = ((size_t)(y % TS) * TS + x % TS) * channels;
+    if (floatTexels) {
+        const float* t = &tile->floats[i];
+        return channels == 1 ? Vector3f(t[0]) : Vector3f(t[0], t[1], t[2]);
+    }
+    const unsigned char* t = &tile->bytes[i];
+    if (channels == 1)
+        return Vector3f(srgb ? s_SrgbTable[t[0]] : t[0] / 255.0f);
+    if (srgb)
+        return Vector3f(s_SrgbTable[t[0]], s_SrgbTable[t[1]], s_SrgbTable[t[2]]);
+    return Vector3f(t[0], t[1], t[2]) / 255.0f;
+}
+
+Vector3f Texture::LookupLevel(float u, float v, int level) const {
+    const Level& l = levels[level];
+    //Texel centers at half integers, image rows go down while v goes up.
+    float x = u * l.width - 0.5f, y = (1.0f - v) * l.height - 0.5f;
+    float fx = std::floor(x), fy = std::floor(y);
+    float tx = x - fx, ty = y - fy;
+    auto wrap = [](float c, int size) {
+        int i = (int)std::fmod(c, (float)size);
+        return i < 0 ? i + size : i;
+    };
+    int x0 = wrap(fx, l.width), y0 = wrap(fy, l.height);
+    int x1 = x0 + 1 == l.width ? 0 : x0 + 1, y1 = y0 + 1 == l.height ? 0 : y0 + 1;
+    Vector3f top = Vector3f::Lerp(Texel(level, x0, y0), Texel(level, x1, y0), tx);
+    Vector3f bottom = Vector3f::Lerp(Texel(level, x0, y1), Texel(level, x1, y1), tx);
+    return Vector3f::Lerp(top, bottom, ty);
+}
+
+Vector3f Texture::Lookup(const TextureCoords& st) const {
+    //Texels the footprint covers along its longer axis, the level where that is one texel.
+    float w = (float)Width(), h = (float)Height();
+    float lx = std::sqrt(st.dudx * st.dudx * w * w + st.dvdx * st.dvdx * h * h);
+    float ly = std::sqrt(st.dudy * st.dudy * w * w + st.dvdy * st.dvdy * h * h);
+    float lod = std::clamp(std::log2(std::max(std::max(lx, ly), 1e-8f)), 0.0f, (float)(Levels() - 1));
+    int level = std::min((int)lod, Levels() - 1);
+    float t = lod - level;
+    Vector3f c = LookupLevel(st.u, st.v, level);
+    if (t > 0.0f && level + 1 < Levels())
+        c = Vector3f::Lerp(c, LookupLevel(st.u, st.v, level + 1), t);
+    return c;
+}
+
+/*Tiles this thread used last, by key. A shared_ptr keeps each alive if the cache evicts it meanwhile.*/
+struct RecentTile {
+    uint64_t key = ~0ull;
+    std::shared_ptr<const TextureTile> tile;
+};
+static thread_local RecentTile s_RecentTiles[TEXTURE_THREAD_TILES];
+
+static inline uint64_t MixTileKey(uint64_t key) {
+    key ^= key >> 29;
+    key *= 0xbf58476d1ce4e5b9ull;
+    return key ^ (key >> 32);
+}
+
+const TextureTile* TextureCache::Get(const Texture& tex, size_t tile) {
+    uint64_t key = ((uint64_t)tex.id << 40) | tile;
+    uint64_t hash = MixTileKey(key);
+    RecentTile& recent = s_RecentTiles[hash % TEXTURE_THREAD_TILES];
+    if (recent.key == key)
+        return recent.tile.get();
+
+    Shard& shard = shards[(hash >> 8) % TEXTURE_CACHE_SHARDS];
+    std::shared_ptr<const TextureTile> found;
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.tiles.find(key);
+        if (it != shard.tiles.end()) {
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second.lru);
+            found = it->second.tile;
+        }
+    }
+    if (!found) {
+        //Read without the lock, another thread may get the same tile in meanwhile, then the first one in is kept.
+        auto loaded = std::make_shared<TextureTile>();
+        if (!tex.ReadTile(tile, *loaded)) {
+            loaded->bytes.assign(loaded->bytes.size(), 0);
+            loaded->floats.assign(loaded->floats.size(), 0.0f);
+        }
+        tileReads++;
+        size_t bytes = tex.TileBytes();
+        size_t shardBudget = std::max(bytes, budget / TEXTURE_CACHE_SHARDS);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.tiles.find(key);
+        if (it != shard.tiles.end()) {
+            found = it->second.tile;
+        }
+        else {
+            shard.lru.push_front(key);
+            shard.tiles[key] = Entry{ loaded, shard.lru.begin(), bytes };
+            shard.bytes += bytes;
+            size_t total = resident += bytes;
+            size_t seen = peak;
+            while (total > seen && !peak.compare_exchange_weak(seen, total));
+            found = loaded;
+            while (shard.bytes > shardBudget && shard.lru.size() > 1) {
+                auto last = shard.tiles.find(shard.lru.back());
+                shard.bytes -= last->second.bytes;
+                resident -= last->second.bytes;
+                shard.tiles.erase(last);
+                shard.lru.pop_back();
+                evictions++;
+            }
+        }
+    }
+    recent.key = key;
+    recent.tile = std::move(found);
+    return recent.tile.get();
+}
+
+TextureCacheStats TextureCache::Stats() const {
+    TextureCacheStats s;
+    s.tileReads = tileReads;
+    s.evictions = evictions;
+    s.residentBytes = resident;
+    s.peakBytes = peak;
+    s.budgetBytes = budget;
+    return s;
+}
+
+void TextureCacheStats::Print(std::ostream& os) const {
+    os << "Texture cache: " << tileReads << " tile reads, " << evictions << " evictions, peak " << (peakBytes >> 20)
+        << " MB of " << (budgetBytes >> 20) << " MB\n";
+}
@@ -0,0 +1,116 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <list>
+#include <atomic>
+#include <fstream>
+#include <unordered_map>
+#include "Vector.hpp"
+
+/*
+Image textures, tiled and mip-mapped, paged in through one cache of fixed size shared by every texture.
+
+Loading streams the image once and writes its whole mip chain as square tiles to a file in s_TextureCacheDir, like maketx does.
+Lookups then read only the tiles they touch, and the least recently used tiles are dropped when the cache goes over its budget
+(-texturecache MB), so any amount of texture data renders in about the same memory. Mip levels are picked by the footprint
+of the lookup, so distant and minified surfaces only pull in small tiles of the coarse levels.
+*/
+#define TEXTURE_TILE_SIZE 64            //Texels per side of a tile.
+#define TEXTURE_CACHE_SHARDS 16         //Independently locked parts of the cache, picked by tile.
+#define TEXTURE_THREAD_TILES 16         //Tiles each thread keeps a hold of to skip locking. These come on top of the budget.
+
+/*Where a lookup lands, and how far the coordinates move to the next pixel in x and y: the footprint the mip level is picked for.*/
+struct TextureCoords {
+    float u = 0.0f, v = 0.0f;
+    float dudx = 0.0f, dvdx = 0.0f, dudy = 0.0f, dvdy = 0.0f;
+};
+
+/*Texels of one tile, row by row, bytes for 8 bit images and floats for the others.*/
+struct TextureTile {
+    std::vector<unsigned char> bytes;
+    std::vector<float> floats;
+};
+
+struct TextureCacheStats {
+    long long tileReads = 0;        //Read from the tiled files: once on first use and again after each eviction.
+    long long evictions = 0;
+    size_t residentBytes = 0, peakBytes = 0, budgetBytes = 0;
+
+    void Print(std::ostream& os) const;
+};
+
+class Texture {
+public:
+    /*
+    Tile the image at path(ppm, pgm or pfm) into the cache directory. srgb for color maps stored gamma encoded,
+    ppm/pgm albedo usually is. Texels come back linear either way. nullptr with a message if it can't be read or written.
+    */
+    static std::unique_ptr<Texture> Load(const std::string& path, bool srgb);
+    ~Texture();
+
+    /*Trilinear between the two mip levels closest to the footprint, repeating outside [0, 1]. v goes up the image.*/
+    Vector3f Lookup(const TextureCoords& st) const;
+    /*Bilinear in one mip level, 0 is the full size image.*/
+    Vector3f LookupLevel(float u, float v, int level) const;
+
+    int Width() const { return levels[0].width; }
+    int Height() const { return levels[0].height; }
+    int Levels() const { return (int)levels.size(); }
+    int Channels() const { return channels; }
+    size_t TileBytes() const { return (size_t)TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE * channels * (floatTexels ? sizeof(float) : 1); }
+
+private:
+    friend class TextureCache;
+    struct Level {
+        int width, height, tilesX, tilesY;
+        size_t firstTile;       //Index of its first tile in tileOffsets.
+    };
+
+    Texture() = default;
+    Vector3f Texel(int level, int x, int y) const;
+    bool ReadTile(size_t tile, TextureTile& out) const;
+
+    uint32_t id = 0;
+    int channels = 3;
+    bool floatTexels = false, srgb = false;
+    std::vector<Level> levels;
+    std::vector<uint64_t> tileOffsets;
+    std::string tiledPath;
+    mutable std::ifstream tiledFile;
+    mutable std::mutex fileMutex;
+};
+
+class TextureCache {
+public:
+    void SetBudget(size_t bytes) { budget = bytes; }
+    size_t Budget() const { return budget; }
+
+    /*Tile of tex, read in if it isn't resident. The pointer stays valid until this thread's next Get().*/
+    const TextureTile* Get(const Texture& tex, size_t tile);
+
+    TextureCacheStats Stats() const;
+
+private:
+    struct Entry {
+        std::shared_ptr<const TextureTile> tile;
+        std::list<uint64_t>::iterator lru;
+        size_t bytes;
+    };
+    struct Shard {
+        std::mutex mutex;
+        std::list<uint64_t> lru;        //Most recently used first.
+        std::unordered_map<uint64_t, Entry> tiles;
+        size_t bytes = 0;
+    };
+
+    Shard shards[TEXTURE_CACHE_SHARDS];
+    std::atomic<size_t> budget{ (size_t)256 << 20 };
+    std::atomic<size_t> resident{ 0 }, peak{ 0 };
+    std::atomic<long long> tileReads{ 0 }, evictions{ 0 };
+};
+
+extern TextureCache s_TextureCache;
+/*Where the tiled files go(-texturedir), the system temp directory by default. They are deleted with their Texture.*/
+extern std::string s_TextureCacheDir;
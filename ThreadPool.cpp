@@ -0,0 +1,101 @@
+#include "ThreadPool.hpp"
+#include <algorithm>
+#include <atomic>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+//Pinned pools of the process take cores one after another, so two sessions don't share them.
+static std::atomic<int> s_NextPinnedCore(0);
+
+/*Cores the process may run on(its affinity mask, e.g. from taskset), in order. Empty if the platform can't tell.*/
+static std::vector<int> AllowedCores() {
+    std::vector<int> cores;
+#ifdef _WIN32
+    DWORD_PTR processMask, systemMask;
+    if (GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask)) {
+        for (int i = 0; i < (int)sizeof(DWORD_PTR) * 8; i++) {
+            if (processMask & ((DWORD_PTR)1 << i))
+                cores.push_back(i);
+        }
+    }
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int i = 0; i < CPU_SETSIZE; i++) {
+            if (CPU_ISSET(i, &set))
+                cores.push_back(i);
+        }
+    }
+#endif
+    return cores;
+}
+
+/*Best effort, a failed pin only costs cache locality.*/
+static void PinThread(std::thread& thread, int core) {
+#ifdef _WIN32
+    SetThreadAffinityMask(thread.native_handle(), (DWORD_PTR)1 << core);
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core, &set);
+    pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#endif
+}
+
+ThreadPool::ThreadPool(int threadCount, bool pinThreads) {
+    threadCount = std::max(1, threadCount);
+    std::vector<int> cores = pinThreads ? AllowedCores() : std::vector<int>();
+    int firstCore = cores.empty() ? 0 : s_NextPinnedCore.fetch_add(threadCount);
+    for (int i = 0; i < threadCount; i++) {
+        workers.emplace_back(&ThreadPool::WorkerLoop, this, i);
+        if (!cores.empty())
+            PinThread(workers.back(), cores[(firstCore + i) % cores.size()]);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& t : workers)
+        t.join();
+}
+
+void ThreadPool::Run(const std::function<void(int threadIndex)>& task) {
+    std::unique_lock<std::mutex> lock(mutex);
+    currentTask = &task;
+    running = (int)workers.size();
+    generation++;
+    wake.notify_all();
+    done.wait(lock, [this]() { return running == 0; });
+    currentTask = nullptr;
+}
+
+void ThreadPool::WorkerLoop(int threadIndex) {
+    unsigned long long seenGeneration = 0;
+    while (true) {
+        const std::function<void(int)>* task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&]() { return stopping || generation != seenGeneration; });
+            if (stopping)
+                return;
+            seenGeneration = generation;
+            task = currentTask;
+        }
+        (*task)(threadIndex);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--running == 0)
+                done.notify_one();
+        }
+    }
+}
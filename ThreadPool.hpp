@@ -0,0 +1,51 @@
+#pragma once
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+/*
+Fixed set of worker threads, created once and reused for every frame.
+Run() hands the same task to all workers(each gets its own index, like the old per frame std::async threads did) and waits for all of them.
+With pinThreads, workers are pinned to one logical core each where the platform supports it, so per thread buffers stay in that core's caches
+between frames. Only cores in the process' affinity mask are used, and each pinned pool of the process starts after the last one's cores.
+Off by default: other processes on the machine don't know about it, and would pile up on the same cores.
+*/
+class ThreadPool {
+public:
+    explicit ThreadPool(int threadCount, bool pinThreads = false);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /*Run task(threadIndex) on every worker, return when all are done. Not reentrant.*/
+    void Run(const std::function<void(int threadIndex)>& task);
+
+    inline int ThreadCount() const { return (int)workers.size(); }
+
+private:
+    void WorkerLoop(int threadIndex);
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    const std::function<void(int)>* currentTask = nullptr;
+    unsigned long long generation = 0;     //Bumped for every Run(), workers wait for it to change.
+    int running = 0;
+    bool stopping = false;
+};
+
+/*f(threadIndex, begin, end) over [0, count), split into one contiguous range per thread. Runs on the calling thread if pool is nullptr.*/
+template<typename F>
+void RunRanges(ThreadPool* pool, int count, F&& f) {
+    if (pool == nullptr) {
+        f(0, 0, count);
+        return;
+    }
+    int threadCount = pool->ThreadCount();
+    pool->Run([&](int threadIndex) {
+        f(threadIndex, (int)((long long)count * threadIndex / threadCount), (int)((long long)count * (threadIndex + 1) / threadCount));
+    });
+}
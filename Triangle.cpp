@@ -1,5 +1,8 @@
 #include "Triangle.hpp"
 #include "OBJ_Loader.hpp"
+#include "CpuDispatch.hpp"
+#include "RayStats.hpp"
+#include <bitset>
 
 bool rayTriangleIntersect(const Vector3f& v0, const Vector3f& v1, const Vector3f& v2, const Vector3f& orig, const Vector3f& dir, float& tnear, float& u, float& v)
 {
@@ -43,6 +46,9 @@ MeshTriangle::MeshTriangle(const std::string& filename, Material* m_) : Object(m
     Vector3f max_vert = Vector3f{ -std::numeric_limits<float>::max(),
         -std::numeric_limits<float>::max(),
         -std::numeric_limits<float>::max() };
+    bool hasUV = false;
+    for (auto& vert : mesh.Vertices)
+        hasUV |= vert.TextureCoordinate.X != 0.0f || vert.TextureCoordinate.Y != 0.0f;
     for (int i = 0; i < mesh.Vertices.size(); i += 3) {
         std::array<Vector3f, 3> face_vertices;
 
@@ -62,6 +68,25 @@ MeshTriangle::MeshTriangle(const std::string& filename, Material* m_) : Object(m
 
         triangles.emplace_back(face_vertices[0], face_vertices[1],
             face_vertices[2], m);
+        Triangle& tri = triangles.back();
+        Vector3f* uv[3] = { &tri.t0, &tri.t1, &tri.t2 };
+        if (hasUV) {
+            for (int j = 0; j < 3; j++)
+                *uv[j] = Vector3f(mesh.Vertices[i + j].TextureCoordinate.X, mesh.Vertices[i + j].TextureCoordinate.Y, 0.0f);
+        }
+        else {
+            //Drop the axis the normal is closest to.
+            float ax = std::fabs(tri.normal.x), ay = std::fabs(tri.normal.y), az = std::fabs(tri.normal.z);
+            for (int j = 0; j < 3; j++) {
+                const Vector3f& p = face_vertices[j];
+                if (ax >= ay && ax >= az)
+                    *uv[j] = Vector3f(p.z, p.y, 0.0f) / PLANAR_UV_SCALE;
+                else if (ay >= az)
+                    *uv[j] = Vector3f(p.x, p.z, 0.0f) / PLANAR_UV_SCALE;
+                else
+                    *uv[j] = Vector3f(p.x, p.y, 0.0f) / PLANAR_UV_SCALE;
+            }
+        }
     }
 
     bounding_box = Bounds3(min_vert, max_vert);
@@ -74,45 +99,95 @@ MeshTriangle::MeshTriangle(const std::string& filename, Material* m_) : Object(m
     bvh = new BVHAccel(ptrs);
 }
 
-Intersection Triangle::GetIntersection(Ray ray, FaceCulling culling)
+/*Distance along the ray to the triangle, or a negative value if missed.*/
+float Triangle::IntersectDistance(const Ray& ray, FaceCulling culling) const
 {
-    Intersection inter;
-
     if (culling == FaceCulling::CullBack) {
         if (DotProduct(ray.direction, normal) > 0)
-            return inter;
+            return -1.0;
     }
     else if (culling == FaceCulling::CullFront) {
         if (DotProduct(ray.direction, normal) < 0)
-            return inter;
+            return -1.0;
     }
 
-    double u, v, t_tmp = 0;
+    float u, v, t_tmp = 0;
     Vector3f pvec = CrossProduct(ray.direction, e2);
-    double det = DotProduct(e1, pvec);
-    if (fabs(det) < EPSILON)
-        return inter;
+    float det = DotProduct(e1, pvec);
+    if (std::fabs(det) < EPSILON)
+        return -1.0f;
 
-    double det_inv = 1. / det;
+    float det_inv = 1.0f / det;
     Vector3f tvec = ray.origin - v0;
     u = DotProduct(tvec, pvec) * det_inv;
     if (u < 0 || u > 1)
-        return inter;
+        return -1.0;
     Vector3f qvec = CrossProduct(tvec, e1);
     v = DotProduct(ray.direction, qvec) * det_inv;
     if (v < 0 || u + v > 1)
-        return inter;
+        return -1.0;
     t_tmp = DotProduct(e2, qvec) * det_inv;
+    return t_tmp;
+}
 
-
-    if (t_tmp < 0.0f)
-        return inter;
-    inter.distance = t_tmp;
-    inter.coords = ray.origin + t_tmp * ray.direction;
+void Triangle::FillIntersection(const Ray& ray, float t, Intersection& inter)
+{
+    inter.distance = t;
+    inter.coords = ray.origin + t * ray.direction;
     inter.obj = this;
     inter.normal = this->normal;
     inter.m = this->m;
-
     inter.happened = true;
+}
+
+bool Triangle::SurfaceCoords(const Vector3f& p, SurfaceUV& out) const
+{
+    //Barycentrics of p, which is in the plane of the triangle.
+    Vector3f ep = p - v0;
+    float d00 = DotProduct(e1, e1), d01 = DotProduct(e1, e2), d11 = DotProduct(e2, e2);
+    float d20 = DotProduct(ep, e1), d21 = DotProduct(ep, e2);
+    float den = d00 * d11 - d01 * d01;
+    if (den == 0.0f)
+        return false;
+    float b1 = (d11 * d20 - d01 * d21) / den, b2 = (d00 * d21 - d01 * d20) / den;
+    Vector3f duv1 = t1 - t0, duv2 = t2 - t0;
+    Vector3f uv = t0 + duv1 * b1 + duv2 * b2;
+    out.u = uv.x;
+    out.v = uv.y;
+    float det = duv1.x * duv2.y - duv1.y * duv2.x;
+    if (std::fabs(det) < 1e-12f) {
+        //Degenerate mapping, any frame in the plane will do.
+        out.dpdu = e1.Normalized();
+        out.dpdv = CrossProduct(normal, out.dpdu);
+        return true;
+    }
+    float invDet = 1.0f / det;
+    out.dpdu = (e1 * duv2.y - e2 * duv1.y) * invDet;
+    out.dpdv = (e2 * duv1.x - e1 * duv2.x) * invDet;
+    return true;
+}
+
+Intersection Triangle::GetIntersection(Ray ray, FaceCulling culling)
+{
+    Intersection inter;
+    RENDER_COUNT(triangleTests, 1);
+    float t = IntersectDistance(ray, culling);
+    if (t < 0.0f)
+        return inter;
+    FillIntersection(ray, t, inter);
     return inter;
 }
+
+void Triangle::IntersectPacket(const RayPacket& packet, uint32_t mask, Intersection* hits)
+{
+    //No virtual call and no Intersection per lane, only hits closer than the current one are written.
+    float t[RAY_PACKET_MAX];
+    RENDER_COUNT(triangleTests, std::bitset<32>(mask).count());
+    uint32_t hitMask = s_Kernels.packetTriangleHit(packet, *this, mask, t);
+    for (int i = 0; i < packet.count; i++) {
+        if (!(hitMask & (1u << i)))
+            continue;
+        if (!hits[i].happened || hits[i].distance > t[i])
+            FillIntersection(*packet.rays[i], t[i], hits[i]);
+    }
+}
@@ -8,6 +8,8 @@
 #include <cassert>
 #include <array>
 
+#define PLANAR_UV_SCALE 100.0f     //Scene units per texture repeat, for meshes without texture coordinates.
+
 bool rayTriangleIntersect(const Vector3f& v0, const Vector3f& v1,
     const Vector3f& v2, const Vector3f& orig,
     const Vector3f& dir, float& tnear, float& u, float& v);
@@ -25,6 +27,10 @@ public:
     }
 
     Intersection GetIntersection(Ray ray, FaceCulling culling) override;
+    void IntersectPacket(const RayPacket& packet, uint32_t mask, Intersection* hits) override;
+    float IntersectDistance(const Ray& ray, FaceCulling culling) const;
+    void FillIntersection(const Ray& ray, float t, Intersection& inter);
+    bool SurfaceCoords(const Vector3f& p, SurfaceUV& out) const override;
 
     inline Bounds3 GetBounds() override { return Union(Bounds3(v0, v1), v2); }
 
@@ -45,7 +51,7 @@ public:
 
     Vector3f v0, v1, v2; // vertices A, B ,C , counter-clockwise order
     Vector3f e1, e2;     // 2 edges v1-v0, v2-v0;
-    Vector3f t0, t1, t2; // texture coords
+    Vector3f t0, t1, t2; // texture coords, from the obj or projected(see MeshTriangle)
     Vector3f normal;
     float area;
 };
@@ -53,6 +59,7 @@ public:
 class MeshTriangle : public Object
 {
 public:
+    /*Texture coordinates come from the obj. Without any, each triangle is projected along its main axis, one repeat per PLANAR_UV_SCALE.*/
     MeshTriangle(const std::string& filename, Material* m_ = new Material());
 
     float pdf() override {
@@ -71,7 +78,20 @@ public:
 
         return intersec;
     }
+
+    inline void IntersectPacket(const RayPacket& packet, uint32_t mask, Intersection* hits) override
+    {
+        if (bvh) {
+            bvh->IntersectPacket(packet, mask, hits);
+        }
+    }
     
+    inline void GetPrimitives(std::vector<Object*>& out) override
+    {
+        for (auto& t : triangles)
+            out.push_back(&t);
+    }
+
     inline void Sample(Intersection &pos){
         bvh->Sample(pos);
         pos.emit = m->GetEmission();
@@ -0,0 +1,143 @@
+#include "VCM.hpp"
+#include "ThreadPool.hpp"
+#include "BVH.hpp"
+#include "SceneRenderingHelper.hpp"
+#include <algorithm>
+#include <cmath>
+
+VCMIntegrator::VCMIntegrator(const Scene* scene, ThreadPool& pool, int yBegin, int yEnd) :
+    scene(scene),
+    pool(pool),
+    yBegin(yBegin),
+    pathCount((yEnd - yBegin) * scene->width),
+    threads(pool.ThreadCount()),
+    paths(pathCount)
+{
+    initialRadius = scene->vcmRadius;
+    if (initialRadius <= 0.0f)
+        initialRadius = VCM_DEFAULT_RADIUS * (float)scene->bvh->GN(scene->bvh->Root()).bounds.Diagonal().Magnitude();
+}
+
+float VCMIntegrator::Radius(int ispp) const {
+    return initialRadius * std::pow((float)(ispp + 1), 0.5f * (VCM_RADIUS_ALPHA - 1.0f));
+}
+
+long long VCMIntegrator::Iteration(int ispp, AccumPixel* camera, std::vector<AccumBuffer>& lightBuffers) {
+    int width = scene->width;
+    int pixelCount = scene->width * scene->height;
+    float radius = Radius(ispp);
+    MisCounts counts;
+    counts.merge = (float)pathCount * (float)M_PI * radius * radius;
+    std::vector<long long> threadBounces(threads.size(), 0);
+
+    //Light paths, each thread keeping the vertices of its own range.
+    RunRanges(&pool, pathCount, [&](int threadIndex, int begin, int end) {
+        ThreadData& data = threads[threadIndex];
+        data.vertices.clear();
+        data.photons.clear();
+        data.photonPositions.clear();
+        BDPTPath lightPath(scene), cameraPoint(scene);
+        cameraPoint.Append(PTVertex::Camera(scene->eyePos), true);
+        AccumPixel* emissionBuffer = &lightBuffers[threadIndex][0];
+        for (int i = begin; i < end; i++) {
+            //Seeded past the last pixel, same as the light vertex cache, so they don't repeat a camera sample's random numbers.
+            ResetRandom(PixelSampleSeed(pixelCount + yBegin * width + i, ispp));
+            lightPath.GenerateLightPath();
+            threadBounces[threadIndex] += lightPath.count;
+            int count = 0;
+            while (count < lightPath.count && lightPath.verts[count].vertex.type != PTVertex::Type::Background)
+                count++;
+            paths[i] = { threadIndex, (int)data.vertices.size(), count };
+            data.vertices.insert(data.vertices.end(), lightPath.verts, lightPath.verts + count);
+
+            for (int s = 1; s <= count; s++) {
+                if (s >= 2 && BDPTPath::CanMerge(lightPath.verts[s - 1].vertex)) {
+                    data.photons.push_back({ i, s });
+                    data.photonPositions.push_back(lightPath.verts[s - 1].vertex.x);
+                }
+                auto pathWeight = Vector3f::Max(BDPTPath::PathWeight(lightPath.Sub(s), cameraPoint.Sub(1), counts), 0.0f);
+                auto light = lightPath[s - 1].Position();
+                auto lightRayHitCamera = (light - scene->eyePos).Normalized();
+                DrawToImage(Ray(light, lightRayHitCamera), emissionBuffer, pathWeight, scene->fov, scene->width, scene->height);
+            }
+        }
+    });
+
+    //Gather photons in path order, so the grid doesn't depend on the thread count.
+    std::vector<int> photonStart(threads.size() + 1, 0);
+    for (size_t t = 0; t < threads.size(); t++)
+        photonStart[t + 1] = photonStart[t] + (int)threads[t].photons.size();
+    photons.resize(photonStart.back());
+    photonPositions.resize(photonStart.back());
+    pool.Run([&](int threadIndex) {
+        const ThreadData& data = threads[threadIndex];
+        std::copy(data.photons.begin(), data.photons.end(), photons.begin() + photonStart[threadIndex]);
+        std::copy(data.photonPositions.begin(), data.photonPositions.end(), photonPositions.begin() + photonStart[threadIndex]);
+    });
+    grid.Build(photonPositions.data(), (int)photonPositions.size(), radius, &pool);
+
+    RunRanges(&pool, pathCount, [&](int threadIndex, int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            int bounces;
+            camera[i].Add(CameraSample(i, ispp, counts, bounces));
+            threadBounces[threadIndex] += bounces;
+        }
+    });
+
+    long long bounces = 0;
+    for (auto b : threadBounces)
+        bounces += b;
+    return bounces;
+}
+
+Vector3f VCMIntegrator::CameraSample(int pixel, int ispp, const MisCounts& counts, int& outBounces) const {
+    int width = scene->width;
+    int i = yBegin * width + pixel;
+    ResetRandom(PixelSampleSeed(i, ispp));
+    BDPTPath camPath(scene), lightPath(scene);
+    camPath.GenerateCameraPath(CameraRay(scene->eyePos, i % width, i / width, scene->width, scene->height, CalculateScale(scene->fov)));
+    outBounces = camPath.count;
+
+    //Connections, with the light path traced for this pixel.
+    const LightPath& own = paths[pixel];
+    const auto* ownVertices = &threads[own.thread].vertices[own.first];
+    std::copy(ownVertices, ownVertices + own.count, lightPath.verts);
+    lightPath.count = own.count;
+    Vector3f result;
+    for (int t = 2; t <= camPath.count; t++) {
+        auto camSub = camPath.Sub(t);
+        result += Vector3f::Max(BDPTPath::PathWeight(lightPath.Sub(0), camSub, counts), 0.0f);
+        if (camSub.Last().Type() == PTVertex::Type::Background)
+            break;
+        for (int s = 1; s <= lightPath.count; s++)
+            result += Vector3f::Max(BDPTPath::PathWeight(lightPath.Sub(s), camSub, counts), 0.0f);
+    }
+
+    //Merges, with light vertices of every light path near each camera vertex.
+    const auto* cv = camPath.verts;
+    Vector3f merged;
+    for (int t = 2; t <= camPath.count; t++) {
+        const PTVertex& x = cv[t - 1].vertex;
+        if (x.type == PTVertex::Type::Background)
+            break;
+        if (!BDPTPath::CanMerge(x))
+            continue;
+        Vector3f w_o = (cv[t - 2].vertex.x - x.x).Normalized();
+        Vector3f vertexSum;
+        grid.Query(x.x, [&](int index) {
+            const Photon& photon = photons[index];
+            const LightPath& path = paths[photon.path];
+            const auto* lv = &threads[path.thread].vertices[path.first];
+            const PTVertex& y = lv[photon.s - 1].vertex;
+            if (DotProduct(x.Ng, y.Ng) <= 0.0f)
+                return;
+            Vector3f w_i = (lv[photon.s - 2].vertex.x - y.x).Normalized();
+            Vector3f bsdf = x.obj->m->evalGivenSample(w_o, w_i, x.N, false, x.Texels());
+            float weight = BDPTPath::MergeWeight(scene, lv, photon.s, cv, t, counts);
+            vertexSum += bsdf * lv[photon.s - 1].alpha * weight;
+        });
+        merged += cv[t - 1].alpha * vertexSum;
+    }
+    //Density estimate over the radius disk, averaged over all light paths.
+    return result + Vector3f::Max(merged / counts.merge, 0.0f);
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <vector>
+#include "BDPT.hpp"
+#include "HashGrid.hpp"
+#include "Accumulation.hpp"
+
+class ThreadPool;
+
+#define VCM_RADIUS_ALPHA 0.75f      //Merge radius shrinks as iteration^((alpha - 1) / 2), so the bias goes away over iterations.
+#define VCM_DEFAULT_RADIUS 0.003f   //Initial merge radius relative to the scene's bounding box diagonal, when Scene::vcmRadius is 0.
+
+/*
+Vertex connection and merging(Georgiev et al. 2012, "Light Transport Simulation with Vertex Connection and Merging").
+
+BDPT plus photon mapping style merging, all weighted against each other by MIS. Renders in iterations, one per sample index:
+- Trace one light path per pixel of the job, splatting light tracing as BDPT does.
+- Build a HashGrid over the light vertices that can be merged at(BDPTPath::CanMerge, not the light point).
+- Trace camera paths. Each does every BDPT connection with the light path of its own pixel, and at each mergeable
+  camera vertex merges with every light vertex within the radius, from all light paths.
+Caustics(light -> specular -> diffuse -> camera) that BDPT only finds by hitting the light from the camera side
+or by light tracing get merging as a third, lower variance strategy.
+*/
+class VCMIntegrator {
+public:
+    /*Renders rows [yBegin, yEnd), one light path per pixel of those per iteration.*/
+    VCMIntegrator(const Scene* scene, ThreadPool& pool, int yBegin, int yEnd);
+
+    /*
+    Iteration for sample index ispp. Camera samples add to camera(one per pixel, row yBegin first),
+    light tracing splats to lightBuffers[threadIndex], full frame each. Returns the number of extension rays traced.
+    */
+    long long Iteration(int ispp, AccumPixel* camera, std::vector<AccumBuffer>& lightBuffers);
+
+    /*Merge radius used by iteration ispp.*/
+    float Radius(int ispp) const;
+
+private:
+    struct LightPath {
+        int thread;     //Whose vertices it lives in.
+        int first;
+        int count;      //Background vertices left out.
+    };
+    struct Photon {
+        int path;
+        int s;          //Light vertex s - 1 of the path.
+    };
+    struct ThreadData {
+        std::vector<BDPTPath::InternalPathVertex> vertices;
+        std::vector<Photon> photons;
+        std::vector<Vector3f> photonPositions;
+    };
+
+    Vector3f CameraSample(int pixel, int ispp, const MisCounts& counts, int& outBounces) const;
+
+    const Scene* scene;
+    ThreadPool& pool;
+    int yBegin, pathCount;
+    float initialRadius;
+    std::vector<ThreadData> threads;
+    std::vector<LightPath> paths;       //One per pixel of the job.
+    std::vector<Photon> photons;        //All threads' photons back to back, indexed as the grid's points.
+    std::vector<Vector3f> photonPositions;
+    HashGrid grid;
+};
@@ -7,56 +7,146 @@
 #include <cmath>
 #include <algorithm>
 
+/*
+Vector3f is 4 floats wide(w is padding) and does its arithmetic on SSE or NEON registers when the compiler targets them.
+Build with VECTOR_SCALAR defined(cmake -DVECTOR_SCALAR=ON) for the plain per component math, e.g. to compare results.
+w is not kept at any value: division and cross product may leave anything there, so every reduction ignores it.
+*/
+#if !defined(VECTOR_SCALAR) && (defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64))
+#define VECTOR_SSE
+#include <emmintrin.h>
+using Float4 = __m128;
+#elif !defined(VECTOR_SCALAR) && defined(__aarch64__) && defined(__ARM_NEON)
+#define VECTOR_NEON
+#include <arm_neon.h>
+using Float4 = float32x4_t;
+#else
+struct Float4 { float v[4]; };
+#endif
+
+#if defined(VECTOR_SSE)
+inline Float4 F4Set(float x, float y, float z) { return _mm_set_ps(0.0f, z, y, x); }
+inline Float4 F4Add(Float4 a, Float4 b) { return _mm_add_ps(a, b); }
+inline Float4 F4Sub(Float4 a, Float4 b) { return _mm_sub_ps(a, b); }
+inline Float4 F4Mul(Float4 a, Float4 b) { return _mm_mul_ps(a, b); }
+inline Float4 F4Div(Float4 a, Float4 b) { return _mm_div_ps(a, b); }
+inline Float4 F4Scale(Float4 a, float s) { return _mm_mul_ps(a, _mm_set1_ps(s)); }
+inline Float4 F4Neg(Float4 a) { return _mm_xor_ps(a, _mm_set1_ps(-0.0f)); }
+//Operand order makes these pick exactly what std::min(a, b) and std::max(a, b) would, NaN included.
+inline Float4 F4Min(Float4 a, Float4 b) { return _mm_min_ps(b, a); }
+inline Float4 F4Max(Float4 a, Float4 b) { return _mm_max_ps(b, a); }
+inline float F4Dot3(Float4 a, Float4 b) {
+    Float4 m = _mm_mul_ps(a, b);
+    //x + y + z, w left out.
+    Float4 yzx = _mm_shuffle_ps(m, m, _MM_SHUFFLE(3, 0, 2, 1));
+    Float4 zxy = _mm_shuffle_ps(m, m, _MM_SHUFFLE(3, 1, 0, 2));
+    return _mm_cvtss_f32(_mm_add_ss(_mm_add_ss(m, yzx), zxy));
+}
+inline Float4 F4Cross(Float4 a, Float4 b) {
+    Float4 aYzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+    Float4 bYzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+    Float4 c = _mm_sub_ps(_mm_mul_ps(a, bYzx), _mm_mul_ps(aYzx, b));
+    return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+}
+/*1 / sqrt(f): the ~12 bit estimate plus one Newton-Raphson step.*/
+inline float RsqrtRefined(float f) {
+    float y = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(f)));
+    return y * (1.5f - 0.5f * f * y * y);
+}
+#elif defined(VECTOR_NEON)
+inline Float4 F4Set(float x, float y, float z) { float v[4] = { x, y, z, 0.0f }; return vld1q_f32(v); }
+inline Float4 F4Add(Float4 a, Float4 b) { return vaddq_f32(a, b); }
+inline Float4 F4Sub(Float4 a, Float4 b) { return vsubq_f32(a, b); }
+inline Float4 F4Mul(Float4 a, Float4 b) { return vmulq_f32(a, b); }
+inline Float4 F4Div(Float4 a, Float4 b) { return vdivq_f32(a, b); }
+inline Float4 F4Scale(Float4 a, float s) { return vmulq_n_f32(a, s); }
+inline Float4 F4Neg(Float4 a) { return vnegq_f32(a); }
+//Selects instead of vminq/vmaxq, which return NaN for any NaN operand where std::min/std::max wouldn't.
+inline Float4 F4Min(Float4 a, Float4 b) { return vbslq_f32(vcltq_f32(b, a), b, a); }
+inline Float4 F4Max(Float4 a, Float4 b) { return vbslq_f32(vcltq_f32(a, b), b, a); }
+inline float F4Dot3(Float4 a, Float4 b) { return vaddvq_f32(vsetq_lane_f32(0.0f, vmulq_f32(a, b), 3)); }
+inline Float4 F4Cross(Float4 a, Float4 b) {
+    float ax = vgetq_lane_f32(a, 0), ay = vgetq_lane_f32(a, 1), az = vgetq_lane_f32(a, 2);
+    float bx = vgetq_lane_f32(b, 0), by = vgetq_lane_f32(b, 1), bz = vgetq_lane_f32(b, 2);
+    return F4Set(ay * bz - az * by, az * bx - ax * bz, ax * by - ay * bx);
+}
+inline float RsqrtRefined(float f) {
+    float32x2_t v = vdup_n_f32(f);
+    float32x2_t y = vrsqrte_f32(v);
+    //The NEON estimate is only ~8 bits, so two steps.
+    y = vmul_f32(y, vrsqrts_f32(vmul_f32(v, y), y));
+    y = vmul_f32(y, vrsqrts_f32(vmul_f32(v, y), y));
+    return vget_lane_f32(y, 0);
+}
+#else
+inline Float4 F4Set(float x, float y, float z) { return Float4{ { x, y, z, 0.0f } }; }
+inline Float4 F4Add(Float4 a, Float4 b) { return Float4{ { a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], 0.0f } }; }
+inline Float4 F4Sub(Float4 a, Float4 b) { return Float4{ { a.v[0] - b.v[0], a.v[1] - b.v[1], a.v[2] - b.v[2], 0.0f } }; }
+inline Float4 F4Mul(Float4 a, Float4 b) { return Float4{ { a.v[0] * b.v[0], a.v[1] * b.v[1], a.v[2] * b.v[2], 0.0f } }; }
+inline Float4 F4Div(Float4 a, Float4 b) { return Float4{ { a.v[0] / b.v[0], a.v[1] / b.v[1], a.v[2] / b.v[2], 0.0f } }; }
+inline Float4 F4Scale(Float4 a, float s) { return Float4{ { a.v[0] * s, a.v[1] * s, a.v[2] * s, 0.0f } }; }
+inline Float4 F4Neg(Float4 a) { return Float4{ { -a.v[0], -a.v[1], -a.v[2], 0.0f } }; }
+inline Float4 F4Min(Float4 a, Float4 b) { return Float4{ { std::min(a.v[0], b.v[0]), std::min(a.v[1], b.v[1]), std::min(a.v[2], b.v[2]), 0.0f } }; }
+inline Float4 F4Max(Float4 a, Float4 b) { return Float4{ { std::max(a.v[0], b.v[0]), std::max(a.v[1], b.v[1]), std::max(a.v[2], b.v[2]), 0.0f } }; }
+inline float F4Dot3(Float4 a, Float4 b) { return a.v[0] * b.v[0] + a.v[1] * b.v[1] + a.v[2] * b.v[2]; }
+inline Float4 F4Cross(Float4 a, Float4 b) {
+    return F4Set(a.v[1] * b.v[2] - a.v[2] * b.v[1], a.v[2] * b.v[0] - a.v[0] * b.v[2], a.v[0] * b.v[1] - a.v[1] * b.v[0]);
+}
+inline float RsqrtRefined(float f) { return 1.0f / std::sqrt(f); }
+#endif
+
 class alignas(16) Vector3f;
-inline double DotProduct(const Vector3f& a, const Vector3f& b);
+inline float DotProduct(const Vector3f& a, const Vector3f& b);
 
 class alignas(16) Vector3f {
 public:
-    float x, y, z;
-    Vector3f() : x(0), y(0), z(0) {}
-    Vector3f(float xx) : x(xx), y(xx), z(xx) {}
-    Vector3f(float xx, float yy, float zz) : x(xx), y(yy), z(zz) {
+    union {
+        struct { float x, y, z, w; };
+        Float4 v4;
+    };
+    Vector3f() : v4(F4Set(0.0f, 0.0f, 0.0f)) {}
+    Vector3f(float xx) : v4(F4Set(xx, xx, xx)) {}
+    Vector3f(float xx, float yy, float zz) : v4(F4Set(xx, yy, zz)) {
 #if _DEBUG
         if (isnan(xx) || isnan(yy) || isnan(zz))
             __debugbreak();
 #endif
     }
-    Vector3f operator * (const float &r) const { return Vector3f(x * r, y * r, z * r); }
-    Vector3f operator / (const float &r) const { return Vector3f(x / r, y / r, z / r); }
+    explicit Vector3f(Float4 v) : v4(v) {}
+    Vector3f(const Vector3f& v) : v4(v.v4) {}
+    Vector3f& operator = (const Vector3f& v) { v4 = v.v4; return *this; }
+
+    Vector3f operator * (const float &r) const { return Vector3f(F4Scale(v4, r)); }
+    Vector3f operator / (const float &r) const { return Vector3f(F4Div(v4, F4Set(r, r, r))); }
 
-    inline float SqrMagnitude() { return x * x + y * y + z * z; }
+    inline float SqrMagnitude() const { return F4Dot3(v4, v4); }
 
-    inline float Magnitude() {return std::sqrt(SqrMagnitude());}
+    inline float Magnitude() const { return std::sqrt(SqrMagnitude()); }
 
-    inline Vector3f Normalized() {
-        float n = std::sqrt(x * x + y * y + z * z);
-        return Vector3f(x / n, y / n, z / n);
+    inline Vector3f Normalized() const {
+        return *this * RsqrtRefined(SqrMagnitude());
     }
 
-    inline Vector3f NormlizeAndGetLengthSqr(float* lengthSqr) {
-        *lengthSqr = DotProduct(*this, *this);
-        return *this/ std::sqrt(*lengthSqr);
+    inline Vector3f NormlizeAndGetLengthSqr(float* lengthSqr) const {
+        *lengthSqr = SqrMagnitude();
+        return *this * RsqrtRefined(*lengthSqr);
     }
 
-    Vector3f operator * (const Vector3f& v) const { return Vector3f(x * v.x, y * v.y, z * v.z); }
-    Vector3f operator / (const Vector3f& v) const { return Vector3f(x / v.x, y / v.y, z / v.z); }
-    Vector3f operator - (const Vector3f &v) const { return Vector3f(x - v.x, y - v.y, z - v.z); }
-    Vector3f operator + (const Vector3f &v) const { return Vector3f(x + v.x, y + v.y, z + v.z); }
-    Vector3f operator - () const { return Vector3f(-x, -y, -z); }
-    Vector3f& operator += (const Vector3f &v) { x += v.x, y += v.y, z += v.z; return *this; }
+    Vector3f operator * (const Vector3f& v) const { return Vector3f(F4Mul(v4, v.v4)); }
+    Vector3f operator / (const Vector3f& v) const { return Vector3f(F4Div(v4, v.v4)); }
+    Vector3f operator - (const Vector3f &v) const { return Vector3f(F4Sub(v4, v.v4)); }
+    Vector3f operator + (const Vector3f &v) const { return Vector3f(F4Add(v4, v.v4)); }
+    Vector3f operator - () const { return Vector3f(F4Neg(v4)); }
+    Vector3f& operator += (const Vector3f &v) { v4 = F4Add(v4, v.v4); return *this; }
     friend Vector3f operator * (const float &r, const Vector3f &v)
-    { return Vector3f(v.x * r, v.y * r, v.z * r); }
+    { return v * r; }
     friend std::ostream & operator << (std::ostream &os, const Vector3f &v)
     { return os << v.x << ", " << v.y << ", " << v.z; }
     float       operator[](int index) const;
     float&      operator[](int index);
 
     static inline Vector3f Lerp(Vector3f a, Vector3f b, float t) {
-        return Vector3f(
-            (1-t) * a.x + t * b.x,
-            (1-t) * a.y + t * b.y,
-            (1-t) * a.z + t * b.z
-        );
+        return a * (1 - t) + b * t;
     }
 
     static inline Vector3f One(){
@@ -64,21 +154,15 @@ public:
     }
 
     static Vector3f Min(const Vector3f &p1, const Vector3f &p2) {
-        return Vector3f(std::min(p1.x, p2.x), std::min(p1.y, p2.y),
-                       std::min(p1.z, p2.z));
+        return Vector3f(F4Min(p1.v4, p2.v4));
     }
 
     static Vector3f Max(const Vector3f &p1, const Vector3f &p2) {
-        return Vector3f(std::max(p1.x, p2.x), std::max(p1.y, p2.y),
-                       std::max(p1.z, p2.z));
+        return Vector3f(F4Max(p1.v4, p2.v4));
     }
 
     Vector3f Cross(const Vector3f& v) const {
-        auto result = Vector3f();
-        result.x = y * v.z - z * v.y;
-        result.y = z * v.x - x * v.z;
-        result.z = x * v.y - y * v.x;
-        return result;
+        return Vector3f(F4Cross(v4, v.v4));
     }
 };
 inline float Vector3f::operator[](int index) const {
@@ -100,14 +184,10 @@ public:
 inline Vector3f Lerp(const Vector3f &a, const Vector3f& b, const float &t)
 { return a * (1 - t) + b * t; }
 
-inline double DotProduct(const Vector3f &a, const Vector3f &b)
-{ return (double)a.x * b.x + (double)a.y * b.y + (double)a.z * b.z; }
+inline float DotProduct(const Vector3f &a, const Vector3f &b)
+{ return F4Dot3(a.v4, b.v4); }
 
 inline Vector3f CrossProduct(const Vector3f &a, const Vector3f &b)
 {
-    return Vector3f(
-            a.y * b.z - a.z * b.y,
-            a.z * b.x - a.x * b.z,
-            a.x * b.y - a.y * b.x
-    );
+    return a.Cross(b);
 }
@@ -0,0 +1,293 @@
+#include "WavefrontPathTracer.hpp"
+#include "PathTracer.hpp"
+#include "SceneRenderingHelper.hpp"
+#include <algorithm>
+
+#define RussianRoulette 0.8f
+
+void WavefrontPathStates::Resize(size_t n) {
+    ray.resize(n, RayDifferential(Vector3f(), Vector3f(0.0f, 0.0f, 1.0f)));
+    alpha.resize(n);
+    radiance.resize(n);
+    flipCulling.resize(n);
+    pixel.resize(n);
+    depth.resize(n);
+    lastX.resize(n);
+    lastN.resize(n);
+    lastPdfBsdf.resize(n);
+    causticChain.resize(n);
+    rng.resize(n);
+    hit.resize(n);
+}
+
+/*Stage 1. Trace the extension ray of every active path, as one ray stream.*/
+static void ExtendStage(const Scene* scene, WavefrontPathStates& paths, const std::vector<int>& active) {
+    std::vector<Ray> rays;
+    std::vector<FaceCulling> culling;
+    std::vector<PTVertex> hits(active.size());
+    rays.reserve(active.size());
+    culling.reserve(active.size());
+    for (int p : active) {
+        rays.push_back(paths.ray[p]);
+        culling.push_back(paths.flipCulling[p] ? FaceCulling::CullFront : FaceCulling::CullBack);
+    }
+    //Textures after the stream, which takes plain rays, so the lookups get each path's differentials.
+    scene->IntersectStream(rays.data(), culling.data(), (int)rays.size(), hits.data(), RAY_PACKET_MAX, false);
+    for (size_t i = 0; i < active.size(); i++) {
+        int p = active[i];
+        paths.hit[p] = hits[i];
+        if (hits[i].obj && hits[i].obj->m->HasTextures())
+            scene->ApplyTextures(paths.ray[p], paths.hit[p], &paths.ray[p]);
+    }
+}
+
+/*
+Stage 2. Counting sort of active paths by the Material they hit. Paths that missed everything are dropped here.
+A scene has a handful of materials, so a linear search(from the last one found) beats hashing.
+*/
+static void SortStage(const WavefrontPathStates& paths, const std::vector<int>& active, WavefrontBins& bins) {
+    std::vector<Material*> found;
+    std::vector<int> counts;
+    bins.binOfActive.resize(active.size());
+    int last = -1;
+    for (size_t k = 0; k < active.size(); k++) {
+        const PTVertex& hit = paths.hit[active[k]];
+        if (hit.type == PTVertex::Type::Background) {
+            bins.binOfActive[k] = -1;
+            continue;
+        }
+        Material* m = hit.obj->m;
+        if (last < 0 || found[last] != m) {
+            last = (int)(std::find(found.begin(), found.end(), m) - found.begin());
+            if (last == (int)found.size()) {
+                found.push_back(m);
+                counts.push_back(0);
+            }
+        }
+        bins.binOfActive[k] = last;
+        counts[last]++;
+    }
+
+    //Bins of one type next to each other, so consecutive bins run the same code too.
+    std::vector<int> order(found.size()), rank(found.size());
+    for (size_t b = 0; b < found.size(); b++)
+        order[b] = (int)b;
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return found[a]->m_type < found[b]->m_type; });
+    bins.material.resize(found.size());
+    bins.start.assign(found.size() + 1, 0);
+    for (size_t b = 0; b < order.size(); b++) {
+        rank[order[b]] = (int)b;
+        bins.material[b] = found[order[b]];
+        bins.start[b + 1] = bins.start[b] + counts[order[b]];
+    }
+    bins.sorted.resize(bins.start.back());
+    std::vector<int> cursor(bins.start.begin(), bins.start.end() - 1);
+    for (size_t k = 0; k < active.size(); k++) {
+        if (bins.binOfActive[k] >= 0)
+            bins.sorted[cursor[rank[bins.binOfActive[k]]]++] = active[k];
+    }
+}
+
+/*
+Stage 3. Shade the count paths of bin, which all hit mat. Same math as PathTrace(), and each path draws its random numbers
+in the same order(bsdf sample, light sample, russian roulette), so the image doesn't change with the binning.
+Shadow rays aren't traced here, but queued along with the contribution they would add. Paths that go on are added to nextActive.
+*/
+static void ShadeBin(const Scene* scene, WavefrontPathStates& paths, Material* mat, const int* bin, int count, WavefrontShadeBatch& batch,
+    WavefrontShadowQueue& shadowQueue, const CausticPhotonMap* caustics, std::vector<int>& nextActive) {
+    //Emission and caustic photons, gathering the paths that go on.
+    batch.Clear();
+    bool textured = mat->HasTextures();
+    for (int k = 0; k < count; k++) {
+        int p = bin[k];
+        const PTVertex& intersection = paths.hit[p];
+        Vector3f alpha = paths.alpha[p];
+
+        CausticChain chain = paths.causticChain[p];
+        if (mat->hasEmission() && chain != CausticChain::Covered) {
+            if (paths.depth[p] == 0) {
+                paths.radiance[p] += alpha * mat->GetEmission();
+            }
+            else if (DotProduct(intersection.Ng, paths.ray[p].direction) < 0.0f) {
+                float pdf_light = LightPdf(scene, paths.lastX[p], paths.lastN[p], intersection);
+                float pdf_bsdf = paths.lastPdfBsdf[p];
+                paths.radiance[p] += alpha * mat->GetEmission() * (pdf_bsdf / (pdf_bsdf + pdf_light));
+            }
+        }
+        //Past the last vertex, the ray was only traced for emission.
+        if (paths.depth[p] == scene->maxDepth)
+            continue;
+
+        Vector3f w_o = -paths.ray[p].direction;
+        if (caustics) {
+            chain = NextCausticChain(chain, mat);
+            paths.causticChain[p] = chain;
+            if (chain == CausticChain::AfterRough)
+                paths.radiance[p] += alpha * caustics->Estimate(mat, intersection.x, w_o, intersection.N, intersection.Texels());
+        }
+        batch.path.push_back(p);
+        batch.wo.push_back(w_o);
+        batch.n.push_back(intersection.N);
+        batch.rng.push_back(paths.rng[p]);
+        if (textured)
+            batch.texels.push_back(intersection.Texels() ? intersection.texels : SurfaceTexels{ mat->Kd, mat->rough });
+    }
+    const SurfaceTexels* texels = textured ? batch.texels.data() : nullptr;
+    int live = (int)batch.path.size();
+    batch.wi.resize(live);
+    batch.pdf.resize(live);
+    batch.f.resize(live);
+    mat->SampleBatch(live, batch.wo.data(), batch.n.data(), texels, batch.rng.data(), batch.wi.data(), batch.pdf.data());
+
+    //Light points draw random numbers, so they are picked path by path, then the bsdf is evaluated for all of them at once.
+    for (int i = 0; i < live; i++) {
+        int p = batch.path[i];
+        LightPoint light;
+        s_RndState = batch.rng[i];
+        if (paths.causticChain[p] != CausticChain::Covered && SampleLightPoint(scene, paths.hit[p].x, batch.n[i], light)
+            && paths.hit[p].ScattersOnSurface(batch.wo[i], light.w_i)) {
+            batch.light.push_back(i);
+            batch.lightWo.push_back(batch.wo[i]);
+            batch.lightN.push_back(batch.n[i]);
+            batch.lightWi.push_back(light.w_i);
+            batch.lightPos.push_back(light.pos);
+            batch.lightEmission.push_back(light.emission);
+            batch.lightPdf.push_back(light.pdf);
+            if (textured)
+                batch.lightTexels.push_back(batch.texels[i]);
+        }
+        batch.rng[i] = s_RndState;
+    }
+    int lights = (int)batch.light.size();
+    batch.lightPdfBsdf.resize(lights);
+    batch.lightF.resize(lights);
+    const SurfaceTexels* lightTexels = textured ? batch.lightTexels.data() : nullptr;
+    mat->PdfBatch(lights, batch.lightWo.data(), batch.lightN.data(), batch.lightWi.data(), lightTexels, batch.lightPdfBsdf.data());
+    mat->EvalBatch(lights, batch.lightWo.data(), batch.lightWi.data(), batch.lightN.data(), lightTexels, batch.lightF.data());
+    for (int j = 0; j < lights; j++) {
+        int p = batch.path[batch.light[j]];
+        Vector3f contribution = batch.lightF[j] * batch.lightEmission[j] / (EPSILON + batch.lightPdf[j] + batch.lightPdfBsdf[j]);
+        shadowQueue.Push(paths.hit[p].x, batch.lightPos[j], paths.alpha[p] * contribution, p);
+    }
+
+    //Paths with pdf 0 get evaluated too, it's cheaper than compacting them out.
+    mat->EvalBatch(live, batch.wo.data(), batch.wi.data(), batch.n.data(), texels, batch.f.data());
+    for (int i = 0; i < live; i++) {
+        int p = batch.path[i];
+        float pdf_bsdf = batch.pdf[i];
+        if (pdf_bsdf <= 0.0f || !paths.hit[p].ScattersOnSurface(batch.wo[i], batch.wi[i])) {
+            paths.rng[p] = batch.rng[i];
+            continue;
+        }
+        Vector3f x = paths.hit[p].x, ng = paths.hit[p].Ng, w_i_bsdf = batch.wi[i];
+        Vector3f weight = batch.f[i] / (EPSILON + pdf_bsdf);
+        s_RndState = batch.rng[i];
+        bool doRussianRoulette = paths.depth[p] > 4;
+        if (!doRussianRoulette || GetRandomFloat() < RussianRoulette) {
+            paths.alpha[p] = paths.alpha[p] * weight / (doRussianRoulette ? RussianRoulette : 1.0f);
+            RayDifferential next(OffsetRayOrigin(x, ng, w_i_bsdf), w_i_bsdf);
+            if (paths.ray[p].hasDifferentials)
+                scene->SpawnDifferentials(paths.ray[p], paths.hit[p], next);
+            paths.ray[p] = next;
+            paths.flipCulling[p] = DotProduct(ng, w_i_bsdf) < 0.0f;
+            paths.lastX[p] = x;
+            paths.lastN[p] = batch.n[i];
+            paths.lastPdfBsdf[p] = pdf_bsdf;
+            paths.depth[p]++;
+            auto a = paths.alpha[p];
+            if (a.x != 0.0f || a.y != 0.0f || a.z != 0.0f)
+                nextActive.push_back(p);
+        }
+        else {
+            RENDER_COUNT(rouletteTerminated, 1);
+        }
+        paths.rng[p] = s_RndState;
+    }
+}
+
+/*Stage 4. Trace queued shadow rays, as one ray stream.*/
+static void ShadowStage(const Scene* scene, WavefrontPathStates& paths, const WavefrontShadowQueue& shadowQueue) {
+    std::vector<uint8_t> shadowed(shadowQueue.Size());
+    scene->ShadowCheckStream(shadowQueue.to.data(), shadowQueue.from.data(), (int)shadowQueue.Size(), shadowed.data());
+    for (size_t i = 0; i < shadowQueue.Size(); i++) {
+        if (!shadowed[i]) {
+            paths.radiance[shadowQueue.path[i]] += shadowQueue.contribution[i];
+        }
+    }
+}
+
+void WavefrontRenderTile(const Scene* scene, int yStart, int rowCount, int sppBegin, int sppEnd, AccumPixel* tile, int& outBounces, DepthRayStats* depthStats, const CausticPhotonMap* caustics) {
+    outBounces = 0;
+#ifndef RENDER_COUNTERS
+    (void)depthStats;
+#endif
+    int width = scene->width;
+    int tilePixelCount = width * rowCount;
+    int samplesPerPixel = sppEnd - sppBegin;
+    long long pathCount = (long long)tilePixelCount * samplesPerPixel;
+    float scale = CalculateScale(scene->fov);
+
+    WavefrontPathStates paths;
+    WavefrontShadowQueue shadowQueue;
+    std::vector<int> active, nextActive;
+    WavefrontBins bins;
+    WavefrontShadeBatch batch;
+    paths.Resize((size_t)std::min<long long>(pathCount, WAVEFRONT_BATCH_SIZE));
+    auto savedRndState = s_RndState;
+
+    for (long long batchStart = 0; batchStart < pathCount; batchStart += WAVEFRONT_BATCH_SIZE) {
+        int batchSize = (int)std::min<long long>(WAVEFRONT_BATCH_SIZE, pathCount - batchStart);
+
+        //Generate camera rays.
+        active.resize(batchSize);
+        for (int p = 0; p < batchSize; p++) {
+            long long pathIndex = batchStart + p;
+            int localPixel = (int)(pathIndex / samplesPerPixel);
+            int sample = sppBegin + (int)(pathIndex % samplesPerPixel);
+            int pixelIndex = yStart * width + localPixel;
+            paths.ray[p] = CameraRay(scene->eyePos, pixelIndex % width, pixelIndex / width, scene->width, scene->height, scale);
+            paths.alpha[p] = Vector3f::One();
+            paths.radiance[p] = Vector3f();
+            paths.flipCulling[p] = 0;
+            paths.pixel[p] = localPixel;
+            paths.depth[p] = 0;
+            paths.causticChain[p] = CausticChain::None;
+            paths.rng[p] = PixelSampleSeed(pixelIndex, sample);
+            active[p] = p;
+        }
+
+        for (int depth = 0; !active.empty(); depth++) {
+            ExtendStage(scene, paths, active);
+            outBounces += (int)active.size();
+#ifdef RENDER_COUNTERS
+            if (depthStats)
+                depthStats->AddExtension(depth, active.size());
+#endif
+
+            SortStage(paths, active, bins);
+
+            shadowQueue.Clear();
+            nextActive.clear();
+            for (size_t b = 0; b < bins.material.size(); b++) {
+                //In chunks, so the SoA arrays stay in cache between the passes over them.
+                for (int begin = bins.start[b]; begin < bins.start[b + 1]; begin += WAVEFRONT_SHADE_CHUNK) {
+                    int count = std::min(WAVEFRONT_SHADE_CHUNK, bins.start[b + 1] - begin);
+                    ShadeBin(scene, paths, bins.material[b], &bins.sorted[begin], count, batch, shadowQueue, caustics, nextActive);
+                }
+            }
+
+            ShadowStage(scene, paths, shadowQueue);
+#ifdef RENDER_COUNTERS
+            if (depthStats)
+                depthStats->AddShadow(depth, shadowQueue.Size());
+#endif
+            std::swap(active, nextActive);
+        }
+
+        //Accumulate.
+        for (int p = 0; p < batchSize; p++) {
+            tile[paths.pixel[p]].Add(paths.radiance[p]);
+        }
+    }
+    s_RndState = savedRndState;
+}
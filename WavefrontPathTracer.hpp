@@ -0,0 +1,94 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include "Vector.hpp"
+#include "Scene.hpp"
+#include "Accumulation.hpp"
+#include "RayStats.hpp"
+#include "PhotonMap.hpp"
+
+/*
+Wavefront(stream) path tracing.
+
+PathTrace() walks one path to completion before starting the next, mixing traversal, material code and light sampling in one loop.
+Here a large batch of paths is kept in SoA arrays instead, and pushed through separate stages, each over the whole batch:
+1. Extend: find the next hit of every active path, traced as one ray stream(Scene::IntersectStream).
+2. Sort: bin active paths by the Material of their hit(bins of one MaterialType next to each other).
+3. Shade: emission, light sampling(which queues shadow rays), bsdf sampling and russian roulette, generating the next ray.
+   Bin by bin: the bin's hits are gathered into SoA arrays and the material runs one type specialized loop over them
+   (Material::SampleBatch, PdfBatch, EvalBatch), instead of hopping between materials hit by hit.
+4. Shadow: trace all queued shadow rays as one stream, add the unoccluded contributions.
+5. Accumulate: when the batch is done, add the radiance of every path into the tile.
+
+The estimator is the same as PathTrace(), with up to Scene::maxDepth vertices. All paths of a batch are at the same depth in every round.
+Every path keeps its own random state(seeded by PixelSampleSeed), so the result doesn't depend on batching.
+*/
+
+#define WAVEFRONT_BATCH_SIZE (1 << 16)
+#define WAVEFRONT_SHADE_CHUNK 256     //Hits of one bin shaded at a time.
+
+struct WavefrontPathStates {
+    std::vector<RayDifferential> ray;   //Next extension ray, with its differentials.
+    std::vector<Vector3f> alpha;        //Throughput.
+    std::vector<Vector3f> radiance;
+    std::vector<uint8_t> flipCulling;   //Last bounce was a refraction, only back faces could be hit.
+    std::vector<int> pixel;             //Index into the tile.
+    std::vector<int> depth;
+    std::vector<Vector3f> lastX;        //Previous vertex and its bsdf pdf, for MIS of emission the extension ray hits.
+    std::vector<Vector3f> lastN;
+    std::vector<float> lastPdfBsdf;
+    std::vector<CausticChain> causticChain;     //Only used with a caustic photon map.
+    std::vector<uint32_t> rng;
+    std::vector<PTVertex> hit;
+
+    void Resize(size_t n);
+};
+
+struct WavefrontShadowQueue {
+    std::vector<Vector3f> from;
+    std::vector<Vector3f> to;
+    std::vector<Vector3f> contribution;     //Added to the path if from and to see each other.
+    std::vector<int> path;
+
+    inline void Clear() {
+        from.clear(); to.clear(); contribution.clear(); path.clear();
+    }
+
+    inline void Push(const Vector3f& f, const Vector3f& t, const Vector3f& c, int p) {
+        from.push_back(f); to.push_back(t); contribution.push_back(c); path.push_back(p);
+    }
+
+    inline size_t Size() const { return path.size(); }
+};
+
+/*Active paths grouped by the Material they hit: bin b is sorted[start[b], start[b + 1]), all hitting material[b].*/
+struct WavefrontBins {
+    std::vector<int> sorted;
+    std::vector<Material*> material;
+    std::vector<int> start;
+    std::vector<int> binOfActive;   //Scratch for the sort.
+};
+
+/*SoA arrays of one bin in the shade stage, reused from bin to bin.*/
+struct WavefrontShadeBatch {
+    //Paths that go on past this hit.
+    std::vector<int> path;
+    std::vector<Vector3f> wo, n, wi, f;
+    std::vector<float> pdf;
+    std::vector<uint32_t> rng;
+    //Only filled for textured materials.
+    std::vector<SurfaceTexels> texels;
+    //The ones of them that got a light sample, light[j] indexing the arrays above.
+    std::vector<int> light;
+    std::vector<Vector3f> lightWo, lightN, lightWi, lightF, lightPos, lightEmission;
+    std::vector<float> lightPdf, lightPdfBsdf;
+    std::vector<SurfaceTexels> lightTexels;
+
+    inline void Clear() {
+        path.clear(); wo.clear(); n.clear(); rng.clear(); texels.clear();
+        light.clear(); lightWo.clear(); lightN.clear(); lightWi.clear(); lightPos.clear(); lightEmission.clear(); lightPdf.clear(); lightTexels.clear();
+    }
+};
+
+/*Render samples [sppBegin, sppEnd) of rows [yStart, yStart + rowCount) into tile. outBounces is the number of extension rays traced.*/
+void WavefrontRenderTile(const Scene* scene, int yStart, int rowCount, int sppBegin, int sppEnd, AccumPixel* tile, int& outBounces, DepthRayStats* depthStats = nullptr, const CausticPhotonMap* caustics = nullptr);
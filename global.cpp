@@ -16,11 +16,27 @@ void ResetRandom(int seed = 1) {
 	s_RndState = seed;
 }
 
+uint32_t PixelSampleSeed(int pixelIndex, int sampleIndex) {
+	uint32_t h = (uint32_t)pixelIndex * 0x9E3779B1u ^ ((uint32_t)sampleIndex + 0x7F4A7C15u) * 0x85EBCA77u;
+	h ^= h >> 16; h *= 0x7FEB352Du;
+	h ^= h >> 15; h *= 0x846CA68Bu;
+	h ^= h >> 16;
+	return h == 0 ? 1 : h;     //XorShift gets stuck on 0.
+}
+
 float GetRandomFloat()
 {
+	if (s_SampleSource)
+		return s_SampleSource->Next();
 	return (double)(XorShift32()) / 0xffffffff;
 }
 
+void SetSampleDimension(int d)
+{
+	if (s_SampleSource)
+		s_SampleSource->SetDimension(d);
+}
+
 int GetRandom()
 {
 	return XorShift32();
@@ -14,10 +14,33 @@ const float kInfinity = std::numeric_limits<float>::max();
 
 thread_local extern uint32_t s_RndState;
 
+/*
+Where GetRandomFloat() takes its numbers from on this thread, in place of XorShift when set.
+Metropolis light transport feeds mutated sample vectors to the integrators through it(see MLT.hpp), and so do samplers(see Sampler.hpp).
+*/
+class SampleSource {
+public:
+    virtual ~SampleSource() = default;
+    virtual float Next() = 0;
+    /*Hand out dimension d next. Sources without dimensions ignore it.*/
+    virtual void SetDimension(int /*d*/) {}
+};
+
+thread_local extern SampleSource* s_SampleSource;
+
+/*Integrators call this where a decision starts, with a dimension from the layout in Sampler.hpp.*/
+void SetSampleDimension(int d);
+
 uint32_t XorShift32();
 
 void ResetRandom(int seed);
 
+/*
+Seed of a single sample. Every (pixel, sample) pair has its own seed, so any sample range of a pixel could be rendered alone,
+e.g. by another process, and still draw exactly the same random numbers.
+*/
+uint32_t PixelSampleSeed(int pixelIndex, int sampleIndex);
+
 float GetRandomFloat();
 
 int GetRandom();
@@ -10,6 +10,10 @@
 #include "SceneRenderingHelper.hpp"
 #include "SampleHelperFunctions.hpp"
 #include "BDPT.hpp"
+#include "Distributed.hpp"
+#include "Benchmark.hpp"
+#include "CpuDispatch.hpp"
+#include "Texture.hpp"
 
 template<typename T> 
 T tryParseArg(int argc, char** argv, const char* argName, const T& defaultValue){
@@ -26,8 +30,39 @@ T tryParseArg(int argc, char** argv, const char* argName, const T& defaultValue)
 }
 
 
-void SaveFloatImageToJpg(std::vector<Vector3f> framebuffer, int width, int height, std::string path);
-
+/*
+Replaces the ceiling light with count small one sided triangles in a grid over the whole ceiling, for many-light tests.
+Brightness varies per light, total power stays about the same as the single light's.
+*/
+static void AddLightGrid(Scene& scene, int count, const Vector3f& emission, std::vector<Triangle>& storage) {
+    const float y = 548.7f, x0 = 20.0f, x1 = 536.0f, z0 = 20.0f, z1 = 539.0f;
+    const int levels = 8;
+    int quads = (count + 1) / 2;
+    int columns = (int)std::ceil(std::sqrt((float)quads));
+    int rows = (quads + columns - 1) / columns;
+    float cellX = (x1 - x0) / columns, cellZ = (z1 - z0) / rows;
+    float size = 0.5f * std::min(cellX, cellZ);
+    //Main light is 130x105, mean level is (levels+1)/(2*levels).
+    float scale = 130.0f * 105.0f / (quads * size * size) * 2.0f * levels / (levels + 1);
+    std::vector<Material*> materials;
+    for (int i = 0; i < levels; i++) {
+        Material* m = new Material(Dieletric, emission * (scale * (i + 1) / levels));
+        m->Kd = Vector3f(0.65f);
+        materials.push_back(m);
+    }
+    storage.reserve(count);
+    for (int i = 0; i < count; i++) {
+        int q = i / 2;
+        float xa = x0 + (q % columns + 0.25f) * cellX, za = z0 + (q / columns + 0.25f) * cellZ;
+        Material* m = materials[(q * 5 + q / columns) % levels];
+        //Wound to face down, like light.obj.
+        if (i % 2 == 0)
+            storage.emplace_back(Vector3f(xa + size, y, za), Vector3f(xa + size, y, za + size), Vector3f(xa, y, za + size), m);
+        else
+            storage.emplace_back(Vector3f(xa + size, y, za), Vector3f(xa, y, za + size), Vector3f(xa, y, za), m);
+        scene.Add(&storage.back());
+    }
+}
 
 // In the main function of the program, we create the scene (create objects and
 // lights) as well as set the options for the render (image width and height,
@@ -35,7 +70,35 @@ void SaveFloatImageToJpg(std::vector<Vector3f> framebuffer, int width, int heigh
 // function().
 int main(int argc, char** argv)
 {
+    //-isa generic|sse42|avx2|avx512 caps the kernels used, by default the best the CPU has.
+    CpuIsa isa = DetectCpuIsa();
+    std::string isaName = tryParseArg(argc, argv, "-isa", std::string());
+    if (!isaName.empty() && !ParseCpuIsa(isaName, isa)) {
+        std::cout << "Unknown instruction set " << isaName << ", use generic, sse42, avx2 or avx512\n";
+        return 1;
+    }
+    SelectKernels(isa);
+    //-materiallut 1 takes fresnel and GGX half vectors from per material tables, -energycomp 1 brightens rough metals by what multiple scattering would add.
+    s_MaterialLUT = tryParseArg(argc, argv, "-materiallut", 0);
+    s_EnergyCompensation = tryParseArg(argc, argv, "-energycomp", 0);
+    //-vndf 1 samples GGX lobes from the visible normals, so fewer samples end up below the surface.
+    s_VisibleNormalSampling = tryParseArg(argc, argv, "-vndf", 0);
     std::string outputFileName = tryParseArg(argc, argv, "-o", std::string("output.jpg"));
+    bool writePasses = tryParseArg(argc, argv, "-passes", 0);
+    //-aov 1 writes albedo, normal and depth of the first hits, -denoise 1 denoises before saving, -reference prints the error against an image.
+    bool writeAovs = tryParseArg(argc, argv, "-aov", 0);
+    bool denoise = tryParseArg(argc, argv, "-denoise", 0);
+    std::string referencePath = tryParseArg(argc, argv, "-reference", std::string());
+    //-stats file.json writes time per phase and, built with RENDER_COUNTERS, ray and traversal counts.
+    std::string statsPath = tryParseArg(argc, argv, "-stats", std::string());
+    DistributedOptions distributed;
+    distributed.directory = tryParseArg(argc, argv, "-dist", std::string());
+    distributed.jobCount = tryParseArg(argc, argv, "-jobs", 1);
+    distributed.jobIndex = tryParseArg(argc, argv, "-job", -1);
+    distributed.splitTiles = tryParseArg(argc, argv, "-split", std::string("samples")) == "tiles";
+    distributed.mergeOnly = tryParseArg(argc, argv, "-merge", 0);
+    distributed.claimTimeout = tryParseArg(argc, argv, "-claimtimeout", DIST_CLAIM_TIMEOUT);
+    distributed.mergeTimeout = tryParseArg(argc, argv, "-mergetimeout", DIST_MERGE_TIMEOUT);
 #ifdef _DEBUG
     int spp = tryParseArg(argc, argv, "-spp", 1);
     int thread = tryParseArg(argc, argv, "-j", 1);
@@ -45,6 +108,13 @@ int main(int argc, char** argv)
     int thread = tryParseArg(argc, argv, "-j", 8);
     bool usebdpt = tryParseArg(argc, argv, "-bdpt", 1);
 #endif
+    //-integrator pt|bdpt|wavefront|lvc|vcm|mlt, -bdpt is kept for old command lines.
+    IntegratorType integrator = usebdpt ? IntegratorType::BDPT : IntegratorType::PathTracing;
+    std::string integratorName = tryParseArg(argc, argv, "-integrator", std::string());
+    if (!integratorName.empty() && !ParseIntegratorType(integratorName, integrator)) {
+        std::cout << "Unknown integrator " << integratorName << ", use pt, bdpt, wavefront, lvc, vcm or mlt\n";
+        return 1;
+    }
     // Change the definition here to change resolution
     Scene scene(784, 784);
     scene.eyePos = Vector3f(278, 278, -800);
@@ -63,29 +133,50 @@ int main(int argc, char** argv)
     Material* smoothmetal = new Material(Metal);
     smoothmetal->SetSmoothness(0.7f);
     Material* steel = new Material(Metal);
-    steel->ior_m = Vector3f(2.8653, 2.8889, 2.4006);
-    steel->ior_m_k = Vector3f(3.1820, 2.9164, 2.6773);
+    steel->SetMetalIOR(Vector3f(2.8653, 2.8889, 2.4006), Vector3f(3.1820, 2.9164, 2.6773));
 
     Material* silver = new Material(Metal);
-    silver->ior_m = Vector3f(0.041000f, 0.53285f, 0.049317f);
-    silver->ior_m_k = Vector3f(4.8025f, 3.4101f, 2.8545f);
+    silver->SetMetalIOR(Vector3f(0.041000f, 0.53285f, 0.049317f), Vector3f(4.8025f, 3.4101f, 2.8545f));
     silver->SetSmoothness(1.f);
 
     Material* copper = new Material(Metal);
-    copper->ior_m = Vector3f(0.211f, 1.2174f, 1.2493);
-    copper->ior_m_k = Vector3f(4.1592f, 2.5978f, 2.4771);
+    copper->SetMetalIOR(Vector3f(0.211f, 1.2174f, 1.2493), Vector3f(4.1592f, 2.5978f, 2.4771));
     copper->SetSmoothness(0.7f);
 
     Material* mglassBall = new Material(Transparent);
-    mglassBall->ior_d = 1.5f;
+    mglassBall->SetIOR(1.5f);
     mglassBall->SetSmoothness(.9f);
 
-    MeshTriangle floor("../models/cornellbox/floor.obj", silver);
+    //Meshes build their own BVHs while loading, so those count as load. BuildBVH is the scene's over them.
+    auto loadStart = std::chrono::steady_clock::now();
+    //-albedomap, -roughnessmap and -normalmap put a textured plastic on the floor, ceiling and back wall. -texturecache MB caps the memory they use.
+    s_TextureCache.SetBudget((size_t)tryParseArg(argc, argv, "-texturecache", 256) << 20);
+    s_TextureCacheDir = tryParseArg(argc, argv, "-texturedir", std::string());
+    std::unique_ptr<Texture> albedoMap, roughnessMap, normalMap;
+    std::string albedoPath = tryParseArg(argc, argv, "-albedomap", std::string());
+    std::string roughnessPath = tryParseArg(argc, argv, "-roughnessmap", std::string());
+    std::string normalPath = tryParseArg(argc, argv, "-normalmap", std::string());
+    if ((!albedoPath.empty() && !(albedoMap = Texture::Load(albedoPath, true)))
+        || (!roughnessPath.empty() && !(roughnessMap = Texture::Load(roughnessPath, false)))
+        || (!normalPath.empty() && !(normalMap = Texture::Load(normalPath, false))))
+        return 1;
+    Material* textured = new Material(Dieletric);
+    textured->Kd = Vector3f(0.725f, 0.71f, 0.68f);
+    textured->SetSmoothness(0.5f);
+    textured->albedoMap = albedoMap.get();
+    textured->roughnessMap = roughnessMap.get();
+    textured->normalMap = normalMap.get();
+
+    MeshTriangle floor("../models/cornellbox/floor.obj", textured->HasTextures() ? textured : silver);
     MeshTriangle shortbox("../models/cornellbox/shortbox.obj", silver);
     MeshTriangle tallbox("../models/cornellbox/tallbox.obj", silver);
     MeshTriangle left("../models/cornellbox/left.obj", red);
     MeshTriangle right("../models/cornellbox/right.obj", green);
     MeshTriangle light_("../models/cornellbox/light.obj", light);
+    //-extralight 1 adds a dimmer second light next to the main one.
+    Material* light2 = new Material(Dieletric, light->m_emission * 0.25f);
+    light2->Kd = Vector3f(0.65f);
+    MeshTriangle light2_("../models/cornellbox/light2.obj", light2);
     MeshTriangle lightOcculuder("../models/cornellbox/lightocculuder.obj", white);
     
     Sphere glassBall(
@@ -97,10 +188,47 @@ int main(int argc, char** argv)
     scene.Add(&tallbox);
     scene.Add(&left);
     scene.Add(&right);
-    scene.Add(&light_);
-    //scene.Add(&glassBall);
+    //-lights N swaps the ceiling light for a grid of N small ones.
+    int lightGridCount = tryParseArg(argc, argv, "-lights", 0);
+    std::vector<Triangle> lightGrid;
+    if (lightGridCount > 0)
+        AddLightGrid(scene, lightGridCount, light->m_emission, lightGrid);
+    else
+        scene.Add(&light_);
+    if (tryParseArg(argc, argv, "-extralight", 0))
+        scene.Add(&light2_);
+    if (tryParseArg(argc, argv, "-glassball", 0))
+        scene.Add(&glassBall);
     //scene.Add(&lightOcculuder);
+    scene.maxDepth = tryParseArg(argc, argv, "-depth", scene.maxDepth);
+    scene.lightCacheConnections = tryParseArg(argc, argv, "-connections", scene.lightCacheConnections);
+    scene.vcmRadius = tryParseArg(argc, argv, "-radius", scene.vcmRadius);
+    scene.causticPhotons = tryParseArg(argc, argv, "-photons", scene.causticPhotons);
+    scene.photonRadius = tryParseArg(argc, argv, "-photonradius", scene.photonRadius);
+    std::string lightSamplerName = tryParseArg(argc, argv, "-lightsampler", std::string());
+    if (!lightSamplerName.empty() && !ParseLightSamplerType(lightSamplerName, scene.lightSamplerType)) {
+        std::cout << "Unknown light sampler " << lightSamplerName << ", use uniform, power or bvh\n";
+        return 1;
+    }
+    std::string samplerName = tryParseArg(argc, argv, "-sampler", std::string());
+    if (!samplerName.empty() && !ParseSamplerType(samplerName, scene.samplerType)) {
+        std::cout << "Unknown sampler " << samplerName << ", use random, stratified, sobol or bluenoise\n";
+        return 1;
+    }
+    //The other integrators and the photon pass draw from XorShift on their own, they would ignore it.
+    if (scene.samplerType != SamplerType::Random
+        && ((integrator != IntegratorType::PathTracing && integrator != IntegratorType::BDPT) || scene.causticPhotons > 0)) {
+        std::cout << "-sampler " << samplerName << " only works with -integrator pt or bdpt, without -photons\n";
+        return 1;
+    }
+    auto bvhStart = std::chrono::steady_clock::now();
     scene.BuildBVH();
+    double loadSeconds = std::chrono::duration<double>(bvhStart - loadStart).count();
+    double bvhSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - bvhStart).count();
+
+    std::string benchmark = tryParseArg(argc, argv, "-benchmark", std::string());
+    if (!benchmark.empty())
+        return RunBenchmark(benchmark, scene) ? 0 : 1;
 #if _DEBUG
     auto test = Refract(Vector3f(-1.0f, 1.0f, 0.0f), Vector3f(0.0f, 1.0f, 0.0f), 1.5f);
     auto test2 = Refract(Vector3f(-1.0f, -1.0f, 0.0f), Vector3f(0.0f, 1.0f, 0.0f), 1.5f);
@@ -117,9 +245,12 @@ int main(int argc, char** argv)
     float scale = CalculateScale(scene.fov);
     auto debugRay = PixelPosToRay(debugPixel.x, debugPixel.y, scene.width, scene.height, scale);
     ResetRandom(434 + 510 * scene.height + 1);
-    std::vector<Vector3f> tb(scene.width * scene.height);
+    AccumBuffer tb(scene.width * scene.height);
     BDPT(&scene, Ray(scene.eyePos, debugRay), t, &tb[0]);
-    SaveFloatImageToJpg(tb, scene.width, scene.height, "t.jpg");
+    std::vector<Vector3f> tbResolved;
+    for (auto& p : tb)
+        tbResolved.push_back(p.Resolve(1));
+    SaveFloatImageToJpg(tbResolved, scene.width, scene.height, "t.jpg");
     /*{
         BDPTPath lightpath(&scene);
         Intersection l;
@@ -139,13 +270,43 @@ int main(int argc, char** argv)
         lightpath.Append(sphereOut, true);
 
         BDPTPath camPath(&scene);
-        camPath.GenerateCameraPath(Ray(scene.eyePos, Vector3f(0.0f, 0.0f, 1.0f)));
+        camPath.GenerateCameraPath(RayDifferential(scene.eyePos, Vector3f(0.0f, 0.0f, 1.0f)));
 
         BDPTPath::PathWeight(lightpath, camPath.Sub(1));
     }*/
 #endif
-    Renderer r;
-    r.Render(outputFileName, scene, spp, thread, usebdpt);
+    if (!distributed.directory.empty()) {
+        RunDistributedRender(scene, spp, thread, integrator, distributed, outputFileName, writePasses);
+        return 0;
+    }
+    //-frames N renders N frames in one session, moving the camera by -camstep along x each frame. Files get a .frame<i> suffix.
+    int frameCount = tryParseArg(argc, argv, "-frames", 1);
+    float cameraStep = tryParseArg(argc, argv, "-camstep", 0.0f);
+    //-pin 1 pins each worker to a core of the process' affinity mask.
+    RenderSession session(scene, thread, tryParseArg(argc, argv, "-pin", 0));
+    for (int i = 0; i < frameCount; i++) {
+        FrameRequest frame;
+        frame.outputFileName = frameCount > 1 ? PassFileName(outputFileName, "frame" + std::to_string(i)) : outputFileName;
+        frame.spp = spp;
+        frame.integrator = integrator;
+        frame.writePasses = writePasses;
+        frame.writeAovs = writeAovs;
+        frame.denoise = denoise;
+        frame.reference = referencePath;
+        frame.eyePos = scene.eyePos + Vector3f(cameraStep * i, 0.0f, 0.0f);
+        session.Render(frame);
+    }
+    if (frameCount > 1) {
+        auto& stats = session.Stats();
+        std::cout << "Session: " << stats.frames << " frames, " << stats.vertices << " path vertices, " << stats.phases.render << " seconds rendering\n";
+    }
+    if (!statsPath.empty()) {
+        RenderStats stats = session.Stats();
+        stats.phases.load = loadSeconds;
+        stats.phases.bvhBuild = bvhSeconds;
+        if (!SaveStatsJson(stats, session.ThreadCount(), statsPath))
+            return 1;
+    }
 
 
     return 0;